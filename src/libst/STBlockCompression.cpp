@@ -0,0 +1,637 @@
+// STBlockCompression.cpp
+#include "STBlockCompression.h"
+
+#include "STThreadPool.h"
+#include "STUtil.h"
+#include "stparallel.h"
+
+#include <assert.h>
+#include <limits>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+// Images with fewer blocks than this are compressed on the
+// calling thread only. Encoding a block costs much more than
+// resampling its pixels, so this is fewer than kMinParallelPixels.
+static const int kMinParallelBlocks = 1024;
+
+//
+// Copy the 4x4 block of pixels at block column bx and block row by,
+// repeating the edge pixels of images whose sides are not multiples
+// of 4.
+//
+static void
+LoadBlock(const STColor4ub* pixels, int width, int height, int bx, int by,
+          STColor4ub block[16])
+{
+    for (int y = 0; y < 4; ++y) {
+        const STColor4ub* row = pixels + STMin(by*4 + y, height-1) * width;
+        for (int x = 0; x < 4; ++x)
+            block[y*4 + x] = row[STMin(bx*4 + x, width-1)];
+    }
+}
+
+//
+// Store a decoded block, dropping pixels outside the image.
+//
+static void
+StoreBlock(const STColor4ub block[16], int bx, int by, int width, int height,
+           STColor4ub* pixels)
+{
+    for (int y = 0; y < 4 && by*4 + y < height; ++y) {
+        STColor4ub* row = pixels + (by*4 + y) * width;
+        for (int x = 0; x < 4 && bx*4 + x < width; ++x)
+            row[bx*4 + x] = block[y*4 + x];
+    }
+}
+
+//------------------------------------------------------------------------
+// Single-channel blocks (BC4, BC5 and the alpha of BC3)
+//------------------------------------------------------------------------
+
+//
+// Encode 16 values into an 8-byte BC4 block, using the mode with
+// six values interpolated between the block's minimum and maximum.
+//
+static void
+EncodeChannelBlock(const unsigned char values[16], unsigned char* out)
+{
+    int lo, hi;
+    int t[16];
+#ifdef ST_SSE2
+    __m128i v = _mm_loadu_si128((const __m128i*) values);
+    __m128i vmin = _mm_min_epu8(v, _mm_srli_si128(v, 8));
+    __m128i vmax = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+    vmin = _mm_min_epu8(vmin, _mm_srli_si128(vmin, 4));
+    vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 4));
+    vmin = _mm_min_epu8(vmin, _mm_srli_si128(vmin, 2));
+    vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 2));
+    vmin = _mm_min_epu8(vmin, _mm_srli_si128(vmin, 1));
+    vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 1));
+    lo = _mm_cvtsi128_si32(vmin) & 0xff;
+    hi = _mm_cvtsi128_si32(vmax) & 0xff;
+#else
+    lo = hi = values[0];
+    for (int i = 1; i < 16; ++i) {
+        lo = STMin(lo, (int) values[i]);
+        hi = STMax(hi, (int) values[i]);
+    }
+#endif
+
+    out[0] = (unsigned char) hi;
+    out[1] = (unsigned char) lo;
+    if (hi == lo) {
+        memset(out + 2, 0, 6);
+        return;
+    }
+
+    // Position of each value between lo (0) and hi (7), rounded to
+    // the nearest of the eight palette entries.
+#ifdef ST_SSE2
+    __m128 scale = _mm_set1_ps(7.0f / (hi - lo));
+    __m128i zero = _mm_setzero_si128();
+    __m128i offset = _mm_set1_epi16((short) lo);
+    __m128i v16[2] = { _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), offset),
+                       _mm_sub_epi16(_mm_unpackhi_epi8(v, zero), offset) };
+    for (int i = 0; i < 2; ++i) {
+        __m128 a = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v16[i], zero));
+        __m128 b = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v16[i], zero));
+        _mm_storeu_si128((__m128i*) (t + 8*i), _mm_cvtps_epi32(_mm_mul_ps(a, scale)));
+        _mm_storeu_si128((__m128i*) (t + 8*i + 4), _mm_cvtps_epi32(_mm_mul_ps(b, scale)));
+    }
+#else
+    for (int i = 0; i < 16; ++i)
+        t[i] = ((values[i] - lo) * 14 + (hi - lo)) / (2 * (hi - lo));
+#endif
+
+    // Palette entry 0 is hi, 1 is lo, and 2..7 run from hi to lo.
+    unsigned long long bits = 0;
+    for (int i = 0; i < 16; ++i) {
+        int index = (t[i] >= 7) ? 0 : (t[i] <= 0) ? 1 : 8 - t[i];
+        bits |= (unsigned long long) index << (3*i);
+    }
+    for (int i = 0; i < 6; ++i)
+        out[2 + i] = (unsigned char) (bits >> (8*i));
+}
+
+//
+// Decode an 8-byte BC4 block into 16 values.
+//
+static void
+DecodeChannelBlock(const unsigned char* in, unsigned char values[16])
+{
+    int palette[8];
+    palette[0] = in[0];
+    palette[1] = in[1];
+    if (palette[0] > palette[1]) {
+        for (int i = 2; i < 8; ++i)
+            palette[i] = ((8-i) * palette[0] + (i-1) * palette[1]) / 7;
+    }
+    else {
+        for (int i = 2; i < 6; ++i)
+            palette[i] = ((6-i) * palette[0] + (i-1) * palette[1]) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    unsigned long long bits = 0;
+    for (int i = 0; i < 6; ++i)
+        bits |= (unsigned long long) in[2 + i] << (8*i);
+    for (int i = 0; i < 16; ++i)
+        values[i] = (unsigned char) palette[(bits >> (3*i)) & 7];
+}
+
+//
+// Gather one channel (0 = red ... 3 = alpha) of a block of pixels.
+//
+static void
+GetChannel(const STColor4ub block[16], int channel, unsigned char values[16])
+{
+    for (int i = 0; i < 16; ++i)
+        values[i] = (&block[i].r)[channel];
+}
+
+//------------------------------------------------------------------------
+// Color blocks (BC1 and the color of BC3)
+//------------------------------------------------------------------------
+
+//
+// Quantize an RGB color to 5:6:5 bits.
+//
+static inline int
+To565(float r, float g, float b)
+{
+    int r5 = (int) (STMin(STMax(r, 0.0f), 255.0f) * (31.0f / 255.0f) + 0.5f);
+    int g6 = (int) (STMin(STMax(g, 0.0f), 255.0f) * (63.0f / 255.0f) + 0.5f);
+    int b5 = (int) (STMin(STMax(b, 0.0f), 255.0f) * (31.0f / 255.0f) + 0.5f);
+    return (r5 << 11) | (g6 << 5) | b5;
+}
+
+//
+// Expand a 5:6:5 color to 8 bits per channel.
+//
+static inline void
+From565(int c, int rgb[3])
+{
+    int r5 = (c >> 11) & 31;
+    int g6 = (c >> 5) & 63;
+    int b5 = c & 31;
+    rgb[0] = (r5 << 3) | (r5 >> 2);
+    rgb[1] = (g6 << 2) | (g6 >> 4);
+    rgb[2] = (b5 << 3) | (b5 >> 2);
+}
+
+//
+// Build the four-color palette of a color block.
+//
+static void
+ColorPalette(int c0, int c1, bool allowTransparent, int palette[4][4])
+{
+    From565(c0, palette[0]);
+    From565(c1, palette[1]);
+    palette[0][3] = palette[1][3] = 255;
+
+    if (c0 > c1 || !allowTransparent) {
+        for (int c = 0; c < 3; ++c) {
+            palette[2][c] = (2*palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2*palette[1][c]) / 3;
+        }
+        palette[2][3] = palette[3][3] = 255;
+    }
+    else {
+        for (int c = 0; c < 3; ++c) {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+        palette[2][3] = 255;
+        palette[3][3] = 0;
+    }
+}
+
+//
+// Choose the nearest palette entry for each pixel of a block.
+// Returns the total squared error.
+//
+static float
+ChooseColorIndices(const float r[16], const float g[16], const float b[16],
+                   const int palette[4][4], int indices[16])
+{
+#ifdef ST_SSE2
+    __m128 total = _mm_setzero_ps();
+    for (int i = 0; i < 16; i += 4) {
+        __m128 pr = _mm_loadu_ps(r + i);
+        __m128 pg = _mm_loadu_ps(g + i);
+        __m128 pb = _mm_loadu_ps(b + i);
+
+        __m128 best = _mm_set1_ps(std::numeric_limits<float>::max());
+        __m128i bestIndex = _mm_setzero_si128();
+        for (int k = 0; k < 4; ++k) {
+            __m128 dr = _mm_sub_ps(pr, _mm_set1_ps((float) palette[k][0]));
+            __m128 dg = _mm_sub_ps(pg, _mm_set1_ps((float) palette[k][1]));
+            __m128 db = _mm_sub_ps(pb, _mm_set1_ps((float) palette[k][2]));
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)),
+                                  _mm_mul_ps(db, db));
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+            best = _mm_min_ps(d, best);
+            bestIndex = _mm_or_si128(_mm_andnot_si128(closer, bestIndex),
+                                     _mm_and_si128(closer, _mm_set1_epi32(k)));
+        }
+        _mm_storeu_si128((__m128i*) (indices + i), bestIndex);
+        total = _mm_add_ps(total, best);
+    }
+    float sums[4];
+    _mm_storeu_ps(sums, total);
+    return sums[0] + sums[1] + sums[2] + sums[3];
+#else
+    float total = 0.0f;
+    for (int i = 0; i < 16; ++i) {
+        float best = std::numeric_limits<float>::max();
+        for (int k = 0; k < 4; ++k) {
+            float dr = r[i] - palette[k][0];
+            float dg = g[i] - palette[k][1];
+            float db = b[i] - palette[k][2];
+            float d = dr*dr + dg*dg + db*db;
+            if (d < best) {
+                best = d;
+                indices[i] = k;
+            }
+        }
+        total += best;
+    }
+    return total;
+#endif
+}
+
+//
+// Order a pair of endpoints for four-color mode and choose the pixel
+// indices for them. Returns the total squared error.
+//
+static float
+FitColorEndpoints(const float r[16], const float g[16], const float b[16],
+                  int& c0, int& c1, int indices[16])
+{
+    if (c0 < c1) {
+        int swap = c0;
+        c0 = c1;
+        c1 = swap;
+    }
+
+    int palette[4][4];
+    ColorPalette(c0, c1, false, palette);
+    return ChooseColorIndices(r, g, b, palette, indices);
+}
+
+//
+// Encode 16 pixels into an 8-byte color block.
+//
+static void
+EncodeColorBlock(const STColor4ub block[16], unsigned char* out)
+{
+    float r[16], g[16], b[16];
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; ++i) {
+        r[i] = block[i].r;
+        g[i] = block[i].g;
+        b[i] = block[i].b;
+        mean[0] += r[i];
+        mean[1] += g[i];
+        mean[2] += b[i];
+    }
+    for (int c = 0; c < 3; ++c)
+        mean[c] /= 16.0f;
+
+    // Find the principal axis of the colors by power iteration
+    // on their covariance matrix.
+    float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; ++i) {
+        float dr = r[i] - mean[0], dg = g[i] - mean[1], db = b[i] - mean[2];
+        cov[0] += dr*dr; cov[1] += dr*dg; cov[2] += dr*db;
+        cov[3] += dg*dg; cov[4] += dg*db; cov[5] += db*db;
+    }
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iter = 0; iter < 4; ++iter) {
+        float x = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+        float y = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+        float z = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+        float length = STMax(STMax(fabsf(x), fabsf(y)), fabsf(z));
+        if (length < 1e-6f)
+            break;
+        axis[0] = x / length;
+        axis[1] = y / length;
+        axis[2] = z / length;
+    }
+
+    // Start from the pixels furthest along the axis in each direction.
+    int lo = 0, hi = 0;
+    float loDot = std::numeric_limits<float>::max();
+    float hiDot = -loDot;
+    for (int i = 0; i < 16; ++i) {
+        float dot = r[i]*axis[0] + g[i]*axis[1] + b[i]*axis[2];
+        if (dot < loDot) { loDot = dot; lo = i; }
+        if (dot > hiDot) { hiDot = dot; hi = i; }
+    }
+    int c0 = To565(r[hi], g[hi], b[hi]);
+    int c1 = To565(r[lo], g[lo], b[lo]);
+    int indices[16];
+    float error = FitColorEndpoints(r, g, b, c0, c1, indices);
+
+    // Refine the endpoints by least squares, given the chosen indices,
+    // and keep the result if it is better.
+    if (c0 != c1) {
+        static const float kWeight[4] = { 1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f };
+        float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+        float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; ++i) {
+            float wa = kWeight[indices[i]];
+            float wb = 1.0f - wa;
+            aa += wa*wa; bb += wb*wb; ab += wa*wb;
+            ax[0] += wa*r[i]; ax[1] += wa*g[i]; ax[2] += wa*b[i];
+            bx[0] += wb*r[i]; bx[1] += wb*g[i]; bx[2] += wb*b[i];
+        }
+        float det = aa*bb - ab*ab;
+        if (fabsf(det) > 1e-6f) {
+            float ea[3], eb[3];
+            for (int c = 0; c < 3; ++c) {
+                ea[c] = (ax[c]*bb - bx[c]*ab) / det;
+                eb[c] = (bx[c]*aa - ax[c]*ab) / det;
+            }
+            int refined0 = To565(ea[0], ea[1], ea[2]);
+            int refined1 = To565(eb[0], eb[1], eb[2]);
+            int refinedIndices[16];
+            float refinedError = FitColorEndpoints(r, g, b, refined0, refined1,
+                                                   refinedIndices);
+            if (refinedError < error) {
+                c0 = refined0;
+                c1 = refined1;
+                memcpy(indices, refinedIndices, sizeof(indices));
+            }
+        }
+    }
+
+    unsigned int bits = 0;
+    if (c0 != c1) {
+        for (int i = 0; i < 16; ++i)
+            bits |= (unsigned int) indices[i] << (2*i);
+    }
+    out[0] = (unsigned char) c0;
+    out[1] = (unsigned char) (c0 >> 8);
+    out[2] = (unsigned char) c1;
+    out[3] = (unsigned char) (c1 >> 8);
+    for (int i = 0; i < 4; ++i)
+        out[4 + i] = (unsigned char) (bits >> (8*i));
+}
+
+//
+// Decode an 8-byte color block into 16 pixels.
+//
+static void
+DecodeColorBlock(const unsigned char* in, bool allowTransparent,
+                 STColor4ub block[16])
+{
+    int c0 = in[0] | (in[1] << 8);
+    int c1 = in[2] | (in[3] << 8);
+    int palette[4][4];
+    ColorPalette(c0, c1, allowTransparent, palette);
+
+    unsigned int bits = in[4] | (in[5] << 8) | (in[6] << 16) | ((unsigned int) in[7] << 24);
+    for (int i = 0; i < 16; ++i) {
+        const int* p = palette[(bits >> (2*i)) & 3];
+        block[i] = STColor4ub((unsigned char) p[0], (unsigned char) p[1],
+                              (unsigned char) p[2], (unsigned char) p[3]);
+    }
+}
+
+//------------------------------------------------------------------------
+// Whole images
+//------------------------------------------------------------------------
+
+//
+// Get the number of bytes in each block of a format.
+//
+int STBlockCompression::GetBlockSize(Format format)
+{
+    switch (format) {
+        case kBC1: return 8;
+        case kBC3: return 16;
+        case kBC4: return 8;
+        case kBC5: return 16;
+        default:   return (int) sizeof(STColor4ub);
+    }
+}
+
+//
+// Get the number of bytes needed to store an image in a format.
+//
+size_t STBlockCompression::GetCompressedSize(Format format, int width, int height)
+{
+    if (format == kUncompressed)
+        return (size_t) width * height * sizeof(STColor4ub);
+    return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * GetBlockSize(format);
+}
+
+//
+// Encode a 4x4 block of pixels in a compressed format.
+//
+static void
+EncodeBlock(STBlockCompression::Format format, const STColor4ub block[16],
+            unsigned char* out)
+{
+    unsigned char values[16];
+    switch (format) {
+        case STBlockCompression::kBC1:
+            EncodeColorBlock(block, out);
+            break;
+        case STBlockCompression::kBC3:
+            GetChannel(block, 3, values);
+            EncodeChannelBlock(values, out);
+            EncodeColorBlock(block, out + 8);
+            break;
+        case STBlockCompression::kBC4:
+            GetChannel(block, 0, values);
+            EncodeChannelBlock(values, out);
+            break;
+        case STBlockCompression::kBC5:
+            GetChannel(block, 0, values);
+            EncodeChannelBlock(values, out);
+            GetChannel(block, 1, values);
+            EncodeChannelBlock(values, out + 8);
+            break;
+        default:
+            assert(false);
+    }
+}
+
+//
+// Compress an image into blocks of a compressed format other than
+// kUncompressed.
+//
+static void
+CompressBlocks(STBlockCompression::Format format,
+               const STColor4ub* pixels, int width, int height,
+               unsigned char* blocks, STThreadPool* pool)
+{
+    int blocksWide = (width + 3) / 4;
+    int blocksHigh = (height + 3) / 4;
+    int blockSize = STBlockCompression::GetBlockSize(format);
+
+    // Each band is one row of blocks.
+    STForEachBand(pool, blocksHigh, blocksWide * 16, [&](int by0, int by1) {
+        STColor4ub block[16];
+        for (int by = by0; by < by1; ++by) {
+            unsigned char* out = blocks + (size_t) by * blocksWide * blockSize;
+            for (int bx = 0; bx < blocksWide; ++bx, out += blockSize) {
+                LoadBlock(pixels, width, height, bx, by, block);
+                EncodeBlock(format, block, out);
+            }
+        }
+    }, 1, kMinParallelBlocks * 16);
+}
+
+#ifndef NDEBUG
+// Least PSNR, in decibels, of the sample image of CheckRoundTrip().
+// Every format keeps its gradients to 32 dB or better, while a block
+// that is lost or misplaced brings it under 10 dB.
+static const double kMinSamplePSNR = 28.0;
+
+//
+// Compress a small sample image in each format and decompress it
+// again, asserting that it comes back close to the original.
+//
+static bool
+CheckRoundTrip()
+{
+    // Sides that are not multiples of 4 check the padding too.
+    const int width = 30;
+    const int height = 18;
+    std::vector<STColor4ub> pixels(width * height);
+    std::vector<STColor4ub> decoded(width * height);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            pixels[y * width + x] = STColor4ub(x * 8, y * 14, 255 - (x + y) * 4,
+                                               255 - x * 6);
+        }
+    }
+
+    const STBlockCompression::Format formats[] = {
+        STBlockCompression::kBC1, STBlockCompression::kBC3,
+        STBlockCompression::kBC4, STBlockCompression::kBC5,
+    };
+    for (int i = 0; i < 4; ++i) {
+        STBlockCompression::Format format = formats[i];
+        std::vector<unsigned char> blocks(
+            STBlockCompression::GetCompressedSize(format, width, height));
+        CompressBlocks(format, &pixels[0], width, height, &blocks[0], NULL);
+        STBlockCompression::Decompress(format, &blocks[0], width, height, &decoded[0]);
+        double psnr = STBlockCompression::ComputePSNR(format, &pixels[0], &decoded[0],
+                                                      width, height);
+        assert(psnr >= kMinSamplePSNR);
+        (void) psnr;
+    }
+    return true;
+}
+#endif
+
+//
+// Compress an image into blocks of a compressed format.
+//
+void STBlockCompression::Compress(Format format,
+                                  const STColor4ub* pixels, int width, int height,
+                                  unsigned char* blocks,
+                                  STThreadPool* pool)
+{
+#ifndef NDEBUG
+    // Check the encoder the first time it is used.
+    static const bool checked = CheckRoundTrip();
+    (void) checked;
+#endif
+
+    if (format == kUncompressed) {
+        memcpy(blocks, pixels, GetCompressedSize(format, width, height));
+        return;
+    }
+
+    CompressBlocks(format, pixels, width, height, blocks, pool);
+}
+
+//
+// Decompress blocks of a compressed format back into pixels.
+//
+void STBlockCompression::Decompress(Format format,
+                                    const unsigned char* blocks, int width, int height,
+                                    STColor4ub* pixels)
+{
+    if (format == kUncompressed) {
+        memcpy((void*) pixels, blocks, GetCompressedSize(format, width, height));
+        return;
+    }
+
+    int blocksWide = (width + 3) / 4;
+    int blocksHigh = (height + 3) / 4;
+    int blockSize = GetBlockSize(format);
+
+    const unsigned char* in = blocks;
+    STColor4ub block[16];
+    unsigned char red[16], green[16], alpha[16];
+    for (int by = 0; by < blocksHigh; ++by) {
+        for (int bx = 0; bx < blocksWide; ++bx, in += blockSize) {
+            switch (format) {
+                case kBC1:
+                    DecodeColorBlock(in, true, block);
+                    break;
+                case kBC3:
+                    DecodeChannelBlock(in, alpha);
+                    DecodeColorBlock(in + 8, false, block);
+                    for (int i = 0; i < 16; ++i)
+                        block[i].a = alpha[i];
+                    break;
+                case kBC4:
+                    DecodeChannelBlock(in, red);
+                    for (int i = 0; i < 16; ++i)
+                        block[i] = STColor4ub(red[i], 0, 0, 255);
+                    break;
+                case kBC5:
+                    DecodeChannelBlock(in, red);
+                    DecodeChannelBlock(in + 8, green);
+                    for (int i = 0; i < 16; ++i)
+                        block[i] = STColor4ub(red[i], green[i], 0, 255);
+                    break;
+                default:
+                    assert(false);
+            }
+            StoreBlock(block, bx, by, width, height, pixels);
+        }
+    }
+}
+
+//
+// Compute the peak signal-to-noise ratio between an image and its
+// compressed version.
+//
+double STBlockCompression::ComputePSNR(Format format,
+                                       const STColor4ub* original,
+                                       const STColor4ub* decoded,
+                                       int width, int height)
+{
+    int numChannels;
+    switch (format) {
+        case kBC1: numChannels = 3; break;
+        case kBC4: numChannels = 1; break;
+        case kBC5: numChannels = 2; break;
+        default:   numChannels = 4; break;
+    }
+
+    double sum = 0.0;
+    int numPixels = width * height;
+    for (int i = 0; i < numPixels; ++i) {
+        for (int c = 0; c < numChannels; ++c) {
+            double d = (double) (&original[i].r)[c] - (double) (&decoded[i].r)[c];
+            sum += d * d;
+        }
+    }
+    if (sum == 0.0)
+        return std::numeric_limits<double>::infinity();
+
+    double mse = sum / ((double) numPixels * numChannels);
+    return 10.0 * log10(255.0 * 255.0 / mse);
+}
@@ -0,0 +1,383 @@
+// STCoreRenderer.cpp
+
+/* Include-order dependency!
+*
+* GLEW must be included before the standard GL.h header.
+* In this case, it means we must violate the usual design
+* principle of always including Foo.h first in Foo.cpp.
+*/
+#ifdef __APPLE__
+#define GLEW_VERSION_2_0 1
+#include <OpenGL/gl.h>
+#else
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GL/gl.h"
+#endif
+
+#include "STCoreRenderer.h"
+
+#include "STGLState.h"
+#include "STShaderProgram.h"
+#include "STTexture.h"
+#include "STTriangleMesh.h"
+#include "stglproc.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// Vertex array objects and uniform buffers (OpenGL 3.0 and 3.1) are
+// newer than the GLEW in ext/, so their entry points are looked up here.
+#ifndef GL_UNIFORM_BUFFER
+#define GL_UNIFORM_BUFFER 0x8A11
+#endif
+
+typedef void (STAPIENTRY *STGenVertexArraysProc)(GLsizei n, GLuint* arrays);
+typedef void (STAPIENTRY *STBindVertexArrayProc)(GLuint array);
+typedef void (STAPIENTRY *STDeleteVertexArraysProc)(GLsizei n, const GLuint* arrays);
+typedef void (STAPIENTRY *STBindBufferBaseProc)(GLenum target, GLuint index, GLuint buffer);
+
+static STGenVertexArraysProc sGenVertexArrays = NULL;
+static STBindVertexArrayProc sBindVertexArray = NULL;
+static STDeleteVertexArraysProc sDeleteVertexArrays = NULL;
+static STBindBufferBaseProc sBindBufferBase = NULL;
+
+// The uniform block binding points the renderer uses.
+static const GLuint kFrameBinding = 0;
+static const GLuint kMaterialBinding = 1;
+
+// The texture unit the color map is bound to.
+static const int kColorUnit = 0;
+
+// The generic vertex attributes core.vert reads.
+enum {
+    kPositionAttrib = 0,
+    kNormalAttrib = 1,
+    kTexPosAttrib = 2,
+};
+
+//
+// Write a matrix a column at a time, as OpenGL reads it.
+//
+static void
+GetColumns(const STMatrix4& m, float* columns)
+{
+    for (int column = 0; column < 4; column++) {
+        for (int row = 0; row < 4; row++)
+            columns[column * 4 + row] = m.table[row][column];
+    }
+}
+
+//
+// Get the matrix that transforms normals as the given matrix
+// transforms positions: the inverse transpose of its upper 3x3,
+// which is its matrix of cofactors over its determinant.
+//
+static STMatrix4
+GetNormalMatrix(const STMatrix4& m)
+{
+    const float (*a)[4] = m.table;
+    STMatrix4 result;
+    result.table[0][0] = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+    result.table[0][1] = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+    result.table[0][2] = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+    result.table[1][0] = a[0][2] * a[2][1] - a[0][1] * a[2][2];
+    result.table[1][1] = a[0][0] * a[2][2] - a[0][2] * a[2][0];
+    result.table[1][2] = a[0][1] * a[2][0] - a[0][0] * a[2][1];
+    result.table[2][0] = a[0][1] * a[1][2] - a[0][2] * a[1][1];
+    result.table[2][1] = a[0][2] * a[1][0] - a[0][0] * a[1][2];
+    result.table[2][2] = a[0][0] * a[1][1] - a[0][1] * a[1][0];
+
+    float det = a[0][0] * result.table[0][0] +
+                a[0][1] * result.table[0][1] +
+                a[0][2] * result.table[0][2];
+    if (det != 0.f) {
+        for (int row = 0; row < 3; row++) {
+            for (int column = 0; column < 3; column++)
+                result.table[row][column] /= det;
+        }
+    }
+    return result;
+}
+
+//
+// Record in the bound vertex array object where the attributes are
+// read from the bound buffer.
+//
+static void
+SetVertexAttribs(bool smooth)
+{
+    GLsizei stride = sizeof(STBufferVertex);
+    size_t normal = smooth ? offsetof(STBufferVertex, normal) : offsetof(STBufferVertex, faceNormal);
+    glEnableVertexAttribArray(kPositionAttrib);
+    glVertexAttribPointer(kPositionAttrib, 3, GL_FLOAT, GL_FALSE, stride,
+                          (const GLvoid*) offsetof(STBufferVertex, position));
+    glEnableVertexAttribArray(kNormalAttrib);
+    glVertexAttribPointer(kNormalAttrib, 3, GL_FLOAT, GL_FALSE, stride,
+                          (const GLvoid*) normal);
+    glEnableVertexAttribArray(kTexPosAttrib);
+    glVertexAttribPointer(kTexPosAttrib, 2, GL_FLOAT, GL_FALSE, stride,
+                          (const GLvoid*) offsetof(STBufferVertex, texPos));
+}
+
+STCoreRenderer::STCoreRenderer(STShaderProgram* program)
+    : mProgram(program),
+      mFrameChanged(true),
+      mFrameBuffer(0),
+      mBoundMaterial(0),
+      mBoundArray(0)
+{
+    mProjection.EncodeI();
+    mView.EncodeI();
+
+    // A white light above the camera, until one is set.
+    const float position[4] = { 0.f, 0.f, 1.f, 0.f };
+    const float ambient[4] = { 0.f, 0.f, 0.f, 1.f };
+    const float white[4] = { 1.f, 1.f, 1.f, 1.f };
+    memcpy(mLightPosition, position, sizeof(mLightPosition));
+    memcpy(mLightAmbient, ambient, sizeof(mLightAmbient));
+    memcpy(mLightDiffuse, white, sizeof(mLightDiffuse));
+    memcpy(mLightSpecular, white, sizeof(mLightSpecular));
+
+    mProgram->SetUniformBlock("STFrame", kFrameBinding);
+    mProgram->SetUniformBlock("STMaterial", kMaterialBinding);
+    mProgram->SetTexture("colorTex", kColorUnit);
+}
+
+STCoreRenderer::~STCoreRenderer()
+{
+    ForgetAll();
+
+    std::map<STMaterialKey, GLuint>::iterator it;
+    for (it = mMaterials.begin(); it != mMaterials.end(); ++it)
+        glDeleteBuffers(1, &it->second);
+    if (mFrameBuffer)
+        glDeleteBuffers(1, &mFrameBuffer);
+}
+
+//
+// Check the version of OpenGL, and look up the entry points the
+// renderer needs.
+//
+bool STCoreRenderer::IsSupported()
+{
+#ifdef __APPLE__
+    return false;
+#else
+    int major = 0, minor = 0;
+    const char* version = (const char*) glGetString(GL_VERSION);
+    if (!version || sscanf(version, "%d.%d", &major, &minor) != 2 ||
+        major * 10 + minor < 33)
+        return false;
+
+    sGenVertexArrays = (STGenVertexArraysProc) STGetProcAddress("glGenVertexArrays");
+    sBindVertexArray = (STBindVertexArrayProc) STGetProcAddress("glBindVertexArray");
+    sDeleteVertexArrays = (STDeleteVertexArraysProc) STGetProcAddress("glDeleteVertexArrays");
+    sBindBufferBase = (STBindBufferBaseProc) STGetProcAddress("glBindBufferBase");
+    return sGenVertexArrays && sBindVertexArray && sDeleteVertexArrays &&
+           sBindBufferBase;
+#endif
+}
+
+void STCoreRenderer::SetProjection(const STMatrix4& projection)
+{
+    mProjection = projection;
+    mFrameChanged = true;
+}
+
+void STCoreRenderer::SetView(const STMatrix4& view)
+{
+    if (memcmp(mView.table, view.table, sizeof(mView.table)) != 0) {
+        mView = view;
+        mFrameChanged = true;
+    }
+}
+
+void STCoreRenderer::SetLight(const float* position, const float* ambient,
+                              const float* diffuse, const float* specular)
+{
+    memcpy(mLightPosition, position, sizeof(mLightPosition));
+    memcpy(mLightAmbient, ambient, sizeof(mLightAmbient));
+    memcpy(mLightDiffuse, diffuse, sizeof(mLightDiffuse));
+    memcpy(mLightSpecular, specular, sizeof(mLightSpecular));
+    mFrameChanged = true;
+}
+
+//
+// Bind the program, and upload the frame's uniforms, laid out as
+// the std140 STFrame block.
+//
+void STCoreRenderer::BeginFrame()
+{
+    mProgram->Bind();
+
+    if (!mFrameBuffer) {
+        glGenBuffers(1, &mFrameBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, mFrameBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, 32 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+        mFrameChanged = true;
+    }
+    else {
+        glBindBuffer(GL_UNIFORM_BUFFER, mFrameBuffer);
+    }
+
+    if (mFrameChanged) {
+        float frame[32];
+        GetColumns(mProjection, frame);
+
+        // Light the scene in eye space, as glLightfv does.
+        for (int row = 0; row < 4; row++) {
+            frame[16 + row] = 0.f;
+            for (int k = 0; k < 4; k++)
+                frame[16 + row] += mView.table[row][k] * mLightPosition[k];
+        }
+        memcpy(frame + 20, mLightAmbient, sizeof(mLightAmbient));
+        memcpy(frame + 24, mLightDiffuse, sizeof(mLightDiffuse));
+        memcpy(frame + 28, mLightSpecular, sizeof(mLightSpecular));
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame), frame);
+        mFrameChanged = false;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    sBindBufferBase(GL_UNIFORM_BUFFER, kFrameBinding, mFrameBuffer);
+
+    mBoundMaterial = 0;
+    mBoundArray = 0;
+}
+
+//
+// Get the buffers of a mesh, copying it in the first time.
+//
+const STCoreRenderer::MeshArrays& STCoreRenderer::GetMeshArrays(const STTriangleMesh* mesh)
+{
+    std::map<const STTriangleMesh*, MeshArrays>::iterator it = mMeshes.find(mesh);
+    if (it != mMeshes.end())
+        return it->second;
+
+    std::vector<STBufferVertex> vertices;
+    std::vector<unsigned int> indices;
+    mesh->AppendBuffers(&vertices, &indices);
+
+    MeshArrays arrays;
+    arrays.numIndices = (GLsizei) indices.size();
+    glGenBuffers(1, &arrays.vertexBuffer);
+    glGenBuffers(1, &arrays.indexBuffer);
+    sGenVertexArrays(1, &arrays.smoothArray);
+    sGenVertexArrays(1, &arrays.flatArray);
+
+    glBindBuffer(GL_ARRAY_BUFFER, arrays.vertexBuffer);
+    if (!vertices.empty()) {
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(STBufferVertex),
+                     &vertices[0], GL_STATIC_DRAW);
+    }
+
+    // The index buffer binding is part of each vertex array object.
+    for (int smooth = 0; smooth < 2; smooth++) {
+        sBindVertexArray(smooth ? arrays.smoothArray : arrays.flatArray);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arrays.indexBuffer);
+        if (!smooth && !indices.empty()) {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
+                         &indices[0], GL_STATIC_DRAW);
+        }
+        SetVertexAttribs(smooth != 0);
+    }
+    sBindVertexArray(0);
+    mBoundArray = 0;
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    return mMeshes.insert(std::make_pair(mesh, arrays)).first->second;
+}
+
+//
+// Get the uniform buffer of a mesh's material, laid out as the
+// std140 STMaterial block, uploading it the first time.
+//
+GLuint STCoreRenderer::GetMaterialBuffer(const STTriangleMesh* mesh)
+{
+    STMaterialKey state = mesh->GetMaterialKey();
+    std::map<STMaterialKey, GLuint>::iterator it = mMaterials.find(state);
+    if (it != mMaterials.end())
+        return it->second;
+
+    float material[16];
+    memset(material, 0, sizeof(material));
+    memcpy(material, mesh->mMaterialAmbient, sizeof(mesh->mMaterialAmbient));
+    memcpy(material + 4, mesh->mMaterialDiffuse, sizeof(mesh->mMaterialDiffuse));
+    memcpy(material + 8, mesh->mMaterialSpecular, sizeof(mesh->mMaterialSpecular));
+    material[12] = mesh->mShininess;
+
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(material), material, GL_STATIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    mMaterials[state] = buffer;
+    return buffer;
+}
+
+//
+// Draw a mesh, binding only the state that differs from the mesh
+// drawn before it.
+//
+void STCoreRenderer::Draw(const STTriangleMesh* mesh, const STMatrix4& model, bool smooth)
+{
+    const MeshArrays& arrays = GetMeshArrays(mesh);
+    if (arrays.numIndices == 0)
+        return;
+
+    GLuint material = GetMaterialBuffer(mesh);
+    if (material != mBoundMaterial) {
+        sBindBufferBase(GL_UNIFORM_BUFFER, kMaterialBinding, material);
+        mBoundMaterial = material;
+    }
+
+    STGLState::ActiveTexture(kColorUnit);
+    STGLState::BindTexture(GL_TEXTURE_2D, mesh->mSurfaceColorTex->GetId());
+
+    STMatrix4 modelView = mView * model;
+    mProgram->SetUniform("modelViewMatrix", modelView);
+    mProgram->SetUniform("normalMatrix", GetNormalMatrix(modelView));
+
+    GLuint array = smooth ? arrays.smoothArray : arrays.flatArray;
+    if (array != mBoundArray) {
+        sBindVertexArray(array);
+        mBoundArray = array;
+    }
+    glDrawElements(GL_TRIANGLES, arrays.numIndices, GL_UNSIGNED_INT, 0);
+}
+
+void STCoreRenderer::EndFrame()
+{
+    sBindVertexArray(0);
+    mBoundArray = 0;
+    mBoundMaterial = 0;
+    mProgram->UnBind();
+}
+
+//
+// Free the buffers of a mesh.
+//
+void STCoreRenderer::Forget(const STTriangleMesh* mesh)
+{
+    std::map<const STTriangleMesh*, MeshArrays>::iterator it = mMeshes.find(mesh);
+    if (it == mMeshes.end())
+        return;
+
+    MeshArrays& arrays = it->second;
+    if (mBoundArray == arrays.smoothArray || mBoundArray == arrays.flatArray) {
+        sBindVertexArray(0);
+        mBoundArray = 0;
+    }
+    sDeleteVertexArrays(1, &arrays.smoothArray);
+    sDeleteVertexArrays(1, &arrays.flatArray);
+    glDeleteBuffers(1, &arrays.vertexBuffer);
+    glDeleteBuffers(1, &arrays.indexBuffer);
+    mMeshes.erase(it);
+}
+
+void STCoreRenderer::ForgetAll()
+{
+    while (!mMeshes.empty())
+        Forget(mMeshes.begin()->first);
+}
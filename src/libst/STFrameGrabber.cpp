@@ -0,0 +1,242 @@
+// STFrameGrabber.cpp
+
+/* Include-order dependency!
+*
+* GLEW must be included before the standard GL.h header.
+* In this case, it means we must violate the usual design
+* principle of always including Foo.h first in Foo.cpp.
+*/
+#ifdef __APPLE__
+#define GLEW_VERSION_2_1 1
+#else
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GL/gl.h"
+#endif
+
+#include "STFrameGrabber.h"
+
+#include "STImage.h"
+
+#include <stdio.h>
+
+//
+// Create a grabber whose encoding queue holds at most
+// maxQueued images, encoded by numWorkers threads.
+//
+STFrameGrabber::STFrameGrabber(int maxQueued, int numWorkers)
+    : mNumWriting(0)
+    , mMaxQueued(maxQueued > 0 ? maxQueued : 1)
+    , mStopping(false)
+    , mNumDropped(0)
+{
+#ifdef __APPLE__
+    mUseBuffers = true;
+#else
+    mUseBuffers = GLEW_VERSION_2_1 ||
+        (GLEW_VERSION_1_5 && GLEW_ARB_pixel_buffer_object);
+#endif
+
+    if (numWorkers <= 0)
+        numWorkers = (int) std::thread::hardware_concurrency() - 1;
+    if (numWorkers <= 0)
+        numWorkers = 1;
+
+    for (int i = 0; i < numWorkers; ++i)
+        mWorkers.push_back(std::thread(&STFrameGrabber::WorkerLoop, this));
+}
+
+//
+// Write out all captures in flight and stop the workers.
+//
+STFrameGrabber::~STFrameGrabber()
+{
+    Finish();
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mJobAvailable.notify_all();
+
+    for (size_t i = 0; i < mWorkers.size(); ++i)
+        mWorkers[i].join();
+
+    ReleaseBuffers();
+    if (!mFreeBuffers.empty())
+        glDeleteBuffers((GLsizei) mFreeBuffers.size(), &mFreeBuffers[0]);
+}
+
+//
+// Start capturing a region of the framebuffer into a file.
+//
+bool STFrameGrabber::Capture(const std::string& filename,
+                             int x, int y, int width, int height,
+                             FullQueuePolicy policy)
+{
+    if (width <= 0 || height <= 0)
+        return false;
+
+    // Captures being read back will join the queue in the
+    // next Update(), so they count towards its size.
+    if (policy == kDrop) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mJobs.size() + mReadbacks.size() >= mMaxQueued) {
+            mNumDropped++;
+            return false;
+        }
+    }
+
+    if (!mUseBuffers) {
+        STImage* image = new STImage(width, height);
+        image->Read(x, y);
+        Enqueue(image, filename, 0);
+        return true;
+    }
+
+    Readback readback;
+    if (!mFreeBuffers.empty()) {
+        readback.buffer = mFreeBuffers.back();
+        mFreeBuffers.pop_back();
+    }
+    else {
+        glGenBuffers(1, &readback.buffer);
+    }
+    readback.filename = filename;
+    readback.width = width;
+    readback.height = height;
+
+    // glReadPixels returns as soon as the copy is queued, as the
+    // pixels go to a buffer object rather than to client memory.
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, width * height * sizeof(STColor4ub),
+                 NULL, GL_STREAM_READ);
+    glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    mReadbacks.push_back(readback);
+    return true;
+}
+
+//
+// Hand the captures started in earlier frames to the workers.
+//
+void STFrameGrabber::Update()
+{
+    ReleaseBuffers();
+
+    for (size_t i = 0; i < mReadbacks.size(); ++i) {
+        const Readback& readback = mReadbacks[i];
+
+        // A frame later the copy has normally finished, so mapping
+        // the buffer does not wait for the GPU. The buffer stays
+        // mapped while a worker encodes the pixels in place.
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        void* pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        if (pixels) {
+            STImage* image = new STImage(readback.width, readback.height,
+                                         STImage::kRGBA8, pixels);
+            Enqueue(image, readback.filename, readback.buffer);
+        }
+        else {
+            fprintf(stderr, "STFrameGrabber::Update() - Could not read "
+                    "the pixels for '%s'.\n", readback.filename.c_str());
+            mFreeBuffers.push_back(readback.buffer);
+        }
+    }
+    mReadbacks.clear();
+}
+
+//
+// Unmap the buffer objects whose files have been written.
+//
+void STFrameGrabber::ReleaseBuffers()
+{
+    std::vector<GLuint> written;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        written.swap(mWrittenBuffers);
+    }
+
+    for (size_t i = 0; i < written.size(); ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, written[i]);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        mFreeBuffers.push_back(written[i]);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+//
+// Wait until every capture has been written to its file.
+//
+void STFrameGrabber::Finish()
+{
+    Update();
+
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (!mJobs.empty() || mNumWriting > 0)
+            mJobDone.wait(lock);
+    }
+    ReleaseBuffers();
+}
+
+//
+// Are there no captures in flight?
+//
+bool STFrameGrabber::IsIdle() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mReadbacks.empty() && mJobs.empty() && mNumWriting == 0;
+}
+
+//
+// Queue an image for the workers, waiting while the queue is full.
+//
+void STFrameGrabber::Enqueue(STImage* image, const std::string& filename,
+                             GLuint buffer)
+{
+    Job job;
+    job.image = image;
+    job.filename = filename;
+    job.buffer = buffer;
+
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (mJobs.size() >= mMaxQueued)
+            mJobDone.wait(lock);
+        mJobs.push_back(job);
+    }
+    mJobAvailable.notify_one();
+}
+
+//
+// Encode and write queued images until stopped.
+//
+void STFrameGrabber::WorkerLoop()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (;;) {
+        while (mJobs.empty() && !mStopping)
+            mJobAvailable.wait(lock);
+        if (mJobs.empty())
+            return;
+
+        Job job = mJobs.front();
+        mJobs.pop_front();
+        mNumWriting++;
+        lock.unlock();
+
+        // Save() reports its own errors.
+        job.image->Save(job.filename);
+        delete job.image;
+
+        lock.lock();
+        if (job.buffer != 0)
+            mWrittenBuffers.push_back(job.buffer);
+        mNumWriting--;
+        mJobDone.notify_all();
+    }
+}
@@ -0,0 +1,67 @@
+// STFrameRecorder.cpp
+#include "STFrameRecorder.h"
+
+#include "STFrameGrabber.h"
+
+#include <stdio.h>
+
+// Older versions of Visual C++ only have _snprintf.
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define snprintf _snprintf
+#endif
+
+//
+// Create a recorder that captures frames with the given grabber.
+//
+STFrameRecorder::STFrameRecorder(STFrameGrabber* grabber)
+    : mGrabber(grabber)
+    , mEveryNthFrame(1)
+    , mFrame(0)
+    , mRecording(false)
+    , mNumRecorded(0)
+    , mNumDropped(0)
+{
+}
+
+//
+// Start recording every Nth frame to files named by the pattern.
+//
+void STFrameRecorder::Start(const std::string& pattern, int everyNthFrame)
+{
+    mPattern = pattern;
+    mEveryNthFrame = (everyNthFrame > 0) ? everyNthFrame : 1;
+    mFrame = 0;
+    mRecording = true;
+    mNumRecorded = 0;
+    mNumDropped = 0;
+}
+
+//
+// Stop recording.
+//
+void STFrameRecorder::Stop()
+{
+    mRecording = false;
+}
+
+//
+// Record the region of the framebuffer if this frame is due.
+//
+void STFrameRecorder::RecordFrame(int x, int y, int width, int height)
+{
+    if (!mRecording)
+        return;
+
+    if (mFrame++ % mEveryNthFrame != 0)
+        return;
+
+    char filename[1024];
+    snprintf(filename, sizeof(filename), mPattern.c_str(), mNumRecorded);
+    filename[sizeof(filename) - 1] = '\0';
+
+    if (mGrabber->Capture(filename, x, y, width, height,
+                          STFrameGrabber::kDrop))
+        mNumRecorded++;
+    else
+        mNumDropped++;
+}
@@ -0,0 +1,75 @@
+// STFrameScheduler.cpp
+#include "STFrameScheduler.h"
+
+STFrameScheduler::STFrameScheduler(float targetFrameRate)
+    : mTargetFrameRate(0.0f),
+      mDirty(true),
+      mAnimating(false),
+      mFrameStarted(false),
+      mNextFrameDelay(0.0f),
+      mNumFrames(0),
+      mBusyMillis(0.0f)
+{
+    SetTargetFrameRate(targetFrameRate);
+    mFrameTimer.Reset();
+    mStatisticsTimer.Reset();
+}
+
+void STFrameScheduler::SetTargetFrameRate(float targetFrameRate)
+{
+    mTargetFrameRate = (targetFrameRate > 0.0f) ? targetFrameRate : 0.0f;
+    mNextFrameDelay = (mTargetFrameRate > 0.0f) ? 1000.0f / mTargetFrameRate : 0.0f;
+}
+
+//
+// The next frame is due a frame period after the last one began,
+// less however late that one was.
+//
+int STFrameScheduler::GetMillisUntilNextFrame()
+{
+    if (!IsDirty())
+        return -1;
+    if (!mFrameStarted || mTargetFrameRate <= 0.0f)
+        return 0;
+
+    float wait = mNextFrameDelay - mFrameTimer.GetElapsedMillis();
+    return (wait > 0.0f) ? (int) (wait + 0.5f) : 0;
+}
+
+void STFrameScheduler::BeginFrame()
+{
+    float sinceLastFrame = mFrameTimer.GetElapsedMillis();
+    mFrameTimer.Reset();
+
+    // Pace frames to the target rate on average: a frame that began
+    // late brings the next one forward. A frame drawn after the
+    // program sat idle for over a period starts the pacing again.
+    if (mTargetFrameRate > 0.0f) {
+        float period = 1000.0f / mTargetFrameRate;
+        float late = mFrameStarted ? sinceLastFrame - mNextFrameDelay : 0.0f;
+        if (late < 0.0f || late >= period)
+            late = 0.0f;
+        mNextFrameDelay = period - late;
+    }
+
+    mFrameStarted = true;
+    mDirty = false;
+}
+
+void STFrameScheduler::EndFrame()
+{
+    mBusyMillis += mFrameTimer.GetElapsedMillis();
+    mNumFrames++;
+}
+
+float STFrameScheduler::GetElapsedMillis()
+{
+    return mStatisticsTimer.GetElapsedMillis();
+}
+
+void STFrameScheduler::ResetStatistics()
+{
+    mStatisticsTimer.Reset();
+    mNumFrames = 0;
+    mBusyMillis = 0.0f;
+}
@@ -0,0 +1,271 @@
+// STGLState.cpp
+
+/* Include-order dependency!
+*
+* GLEW must be included before the standard GL.h header.
+* In this case, it means we must violate the usual design
+* principle of always including Foo.h first in Foo.cpp.
+*/
+#ifdef __APPLE__
+#define GLEW_VERSION_2_0 1
+#include <OpenGL/gl.h>
+#else
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GL/gl.h"
+#endif
+
+#include "STGLState.h"
+
+#include <map>
+#include <string.h>
+
+// Number of texture units whose bindings are tracked.
+static const int kMaxTextureUnits = 32;
+
+// Value of state that has not been set through STGLState.
+static const GLuint kUnknown = ~0u;
+
+// The active texture unit, or -1 if unknown.
+static int sActiveUnit = -1;
+
+// The 2D texture bound to each unit.
+static GLuint sTextures[kMaxTextureUnits];
+
+// Whether each capability is enabled. Texture targets are
+// kept for each unit, in the high half of the key.
+static std::map<unsigned long long, bool> sCapabilities;
+
+// The current program.
+static GLuint sProgram = kUnknown;
+
+// The front material parameters, and which are known.
+static float sAmbient[4], sDiffuse[4], sSpecular[4], sEmission[4];
+static float sShininess;
+static bool sAmbientKnown, sDiffuseKnown, sSpecularKnown;
+static bool sEmissionKnown, sShininessKnown;
+
+// Calls made and skipped in this frame and the last.
+static int sIssued = 0;
+static int sSkipped = 0;
+static int sLastIssued = 0;
+static int sLastSkipped = 0;
+
+static bool sInitialized = false;
+
+static void
+Initialize()
+{
+    if (!sInitialized) {
+        STGLState::Invalidate();
+        sInitialized = true;
+    }
+}
+
+//
+// Count a call that would not change anything. Returns true
+// if the state is already set, so the call can be skipped.
+//
+static bool
+Skip(bool alreadySet)
+{
+    if (alreadySet)
+        sSkipped++;
+    else
+        sIssued++;
+    return alreadySet;
+}
+
+//
+// Get the key of a capability. Enabling a texture target only
+// affects the active texture unit.
+//
+static bool
+GetCapabilityKey(GLenum cap, unsigned long long* key)
+{
+    switch (cap) {
+        case GL_TEXTURE_1D:
+        case GL_TEXTURE_2D:
+        case GL_TEXTURE_3D:
+        case GL_TEXTURE_CUBE_MAP:
+        case GL_TEXTURE_GEN_S:
+        case GL_TEXTURE_GEN_T:
+        case GL_TEXTURE_GEN_R:
+        case GL_TEXTURE_GEN_Q:
+            if (sActiveUnit < 0)
+                return false;
+            *key = ((unsigned long long) sActiveUnit << 32) | cap;
+            return true;
+        default:
+            *key = cap;
+            return true;
+    }
+}
+
+//
+// Set a capability on or off.
+//
+static void
+SetCapability(GLenum cap, bool enabled)
+{
+    Initialize();
+
+    unsigned long long key;
+    bool tracked = GetCapabilityKey(cap, &key);
+    if (tracked) {
+        std::map<unsigned long long, bool>::iterator it = sCapabilities.find(key);
+        if (Skip(it != sCapabilities.end() && it->second == enabled))
+            return;
+        sCapabilities[key] = enabled;
+    }
+    else {
+        sIssued++;
+    }
+
+    if (enabled)
+        glEnable(cap);
+    else
+        glDisable(cap);
+}
+
+//
+// Make a texture unit (0 for GL_TEXTURE0, and so on) active.
+//
+void STGLState::ActiveTexture(int unit)
+{
+    Initialize();
+    if (Skip(unit == sActiveUnit))
+        return;
+    sActiveUnit = (unit < kMaxTextureUnits) ? unit : -1;
+    glActiveTexture(GL_TEXTURE0 + unit);
+}
+
+//
+// Bind a texture to the active unit.
+//
+void STGLState::BindTexture(GLenum target, GLuint texture)
+{
+    Initialize();
+    if (target != GL_TEXTURE_2D || sActiveUnit < 0) {
+        sIssued++;
+        glBindTexture(target, texture);
+        return;
+    }
+
+    if (Skip(sTextures[sActiveUnit] == texture))
+        return;
+    sTextures[sActiveUnit] = texture;
+    glBindTexture(target, texture);
+}
+
+//
+// Delete a texture. OpenGL binds 0 in place of a deleted
+// texture, and its name may then be given to a new one.
+//
+void STGLState::DeleteTexture(GLuint texture)
+{
+    Initialize();
+    for (int i = 0; i < kMaxTextureUnits; ++i) {
+        if (sTextures[i] == texture)
+            sTextures[i] = 0;
+    }
+    glDeleteTextures(1, &texture);
+}
+
+//
+// Enable or disable a capability.
+//
+void STGLState::Enable(GLenum cap)
+{
+    SetCapability(cap, true);
+}
+
+void STGLState::Disable(GLenum cap)
+{
+    SetCapability(cap, false);
+}
+
+//
+// Use a GLSL program, or 0 for fixed-function drawing.
+//
+void STGLState::UseProgram(GLuint program)
+{
+    Initialize();
+    if (Skip(program == sProgram))
+        return;
+    sProgram = program;
+
+    if (GLEW_VERSION_2_0)
+        glUseProgram(program);
+#ifndef __APPLE__
+    else
+        glUseProgramObjectARB(program);
+#endif
+}
+
+//
+// Set a front-face material parameter.
+//
+void STGLState::Material(GLenum pname, const float* params)
+{
+    Initialize();
+
+    float* value = NULL;
+    bool* known = NULL;
+    int count = 4;
+    switch (pname) {
+        case GL_AMBIENT:   value = sAmbient;   known = &sAmbientKnown;   break;
+        case GL_DIFFUSE:   value = sDiffuse;   known = &sDiffuseKnown;   break;
+        case GL_SPECULAR:  value = sSpecular;  known = &sSpecularKnown;  break;
+        case GL_EMISSION:  value = sEmission;  known = &sEmissionKnown;  break;
+        case GL_SHININESS: value = &sShininess; known = &sShininessKnown; count = 1; break;
+        default:
+            sIssued++;
+            glMaterialfv(GL_FRONT, pname, params);
+            return;
+    }
+
+    if (Skip(*known && memcmp(value, params, count * sizeof(float)) == 0))
+        return;
+    memcpy(value, params, count * sizeof(float));
+    *known = true;
+    glMaterialfv(GL_FRONT, pname, params);
+}
+
+//
+// Forget all of the tracked state.
+//
+void STGLState::Invalidate()
+{
+    sActiveUnit = -1;
+    for (int i = 0; i < kMaxTextureUnits; ++i)
+        sTextures[i] = kUnknown;
+    sCapabilities.clear();
+    sProgram = kUnknown;
+    sAmbientKnown = sDiffuseKnown = sSpecularKnown = false;
+    sEmissionKnown = sShininessKnown = false;
+}
+
+//
+// Finish counting calls for a frame.
+//
+void STGLState::EndFrame()
+{
+    sLastIssued = sIssued;
+    sLastSkipped = sSkipped;
+    sIssued = 0;
+    sSkipped = 0;
+}
+
+//
+// Get the number of calls passed on and skipped in the last frame.
+//
+int STGLState::GetNumIssued()
+{
+    return sLastIssued;
+}
+
+int STGLState::GetNumSkipped()
+{
+    return sLastSkipped;
+}
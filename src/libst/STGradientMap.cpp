@@ -0,0 +1,178 @@
+// STGradientMap.cpp
+#include "STGradientMap.h"
+
+#include "STThreadPool.h"
+#include "STUtil.h"
+#include "stparallel.h"
+
+#include <math.h>
+#include <vector>
+
+//
+// A linearly filtered sample at a fixed offset, in pixels, from each
+// pixel: it blends pixels index and index+1 with the given weight.
+//
+struct STSampleOffset {
+    int index;
+    float weight;
+
+    STSampleOffset(float offset)
+    {
+        index = (int) floorf(offset);
+        weight = offset - (float) index;
+    }
+};
+
+//
+// Convert row y of a height map (clamped to the image) to heights
+// from 0 to 1. The row is padded with pad copies of its edge pixels
+// on either side, as clamped texture coordinates would sample them.
+//
+static void
+LoadRow(const STImage* heightMap, int y, int pad, float* row)
+{
+    int width = heightMap->GetWidth();
+    y = STMin(STMax(y, 0), heightMap->GetHeight() - 1);
+
+    STImage::Format format = heightMap->GetFormat();
+    int bytesPerPixel = STImage::GetBytesPerPixel(format);
+    const unsigned char* data = heightMap->GetRow(y);
+
+    float* heights = row + pad;
+    if (format == STImage::kR16) {
+        const unsigned short* data16 = (const unsigned short*) data;
+        for (int x = 0; x < width; ++x)
+            heights[x] = data16[x] * (1.0f / 65535.0f);
+    }
+    else {
+        // The first byte of every other format is its red channel.
+        for (int x = 0; x < width; ++x)
+            heights[x] = data[x * bytesPerPixel] * (1.0f / 255.0f);
+    }
+
+    for (int i = 0; i < pad; ++i) {
+        row[i] = heights[0];
+        heights[width + i] = heights[width - 1];
+    }
+}
+
+//
+// Compute the difference of two linearly filtered samples for n
+// pixels: lerp(a0, a1, ta) - lerp(b0, b1, tb).
+//
+static void
+Difference(const float* a0, const float* a1, float ta,
+           const float* b0, const float* b1, float tb,
+           float* out, int n)
+{
+    int x = 0;
+#ifdef ST_SSE2
+    __m128 vta = _mm_set1_ps(ta);
+    __m128 vtb = _mm_set1_ps(tb);
+    for (; x + 4 <= n; x += 4) {
+        __m128 a = _mm_loadu_ps(a0 + x);
+        __m128 b = _mm_loadu_ps(b0 + x);
+        a = _mm_add_ps(a, _mm_mul_ps(vta, _mm_sub_ps(_mm_loadu_ps(a1 + x), a)));
+        b = _mm_add_ps(b, _mm_mul_ps(vtb, _mm_sub_ps(_mm_loadu_ps(b1 + x), b)));
+        _mm_storeu_ps(out + x, _mm_sub_ps(a, b));
+    }
+#endif
+    for (; x < n; ++x) {
+        float a = a0[x] + ta * (a1[x] - a0[x]);
+        float b = b0[x] + tb * (b1[x] - b0[x]);
+        out[x] = a - b;
+    }
+}
+
+//
+// Pack the heights and differences of n pixels into kRGBA16 pixels.
+//
+static void
+EncodeRow(const float* heights, const float* du, const float* dv,
+          unsigned short* out, int n)
+{
+    int x = 0;
+#ifdef ST_SSE2
+    // Heights are in [0, 1] and differences in [-1, 1], so the
+    // biased values are all positive and truncation rounds them.
+    // Each 32-bit lane holds a pair of channels, red and green or
+    // blue and alpha, which are then interleaved into pixels.
+    __m128 k65535 = _mm_set1_ps(65535.0f);
+    __m128 k32767 = _mm_set1_ps(32767.0f);
+    __m128 kHalf = _mm_set1_ps(0.5f);
+    __m128 kBias = _mm_set1_ps(32768.5f);
+    __m128i kAlpha = _mm_set1_epi32((int) 0xFFFF0000);
+    for (; x + 4 <= n; x += 4) {
+        __m128i r = _mm_cvttps_epi32(
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(heights + x), k65535), kHalf));
+        __m128i g = _mm_cvttps_epi32(
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(du + x), k32767), kBias));
+        __m128i b = _mm_cvttps_epi32(
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(dv + x), k32767), kBias));
+        __m128i rg = _mm_or_si128(r, _mm_slli_epi32(g, 16));
+        __m128i ba = _mm_or_si128(b, kAlpha);
+        _mm_storeu_si128((__m128i*) (out + 4 * x), _mm_unpacklo_epi32(rg, ba));
+        _mm_storeu_si128((__m128i*) (out + 4 * x + 8), _mm_unpackhi_epi32(rg, ba));
+    }
+#endif
+    for (; x < n; ++x) {
+        out[4 * x] = (unsigned short) (heights[x] * 65535.0f + 0.5f);
+        out[4 * x + 1] = (unsigned short) (du[x] * 32767.0f + 32768.5f);
+        out[4 * x + 2] = (unsigned short) (dv[x] * 32767.0f + 32768.5f);
+        out[4 * x + 3] = 65535;
+    }
+}
+
+//
+// Bake the height and central differences of a height map into
+// a new image, which the caller must delete.
+//
+STImage*
+STGradientMap::Bake(const STImage* heightMap, float delta,
+                    STThreadPool* pool)
+{
+    int width = heightMap->GetWidth();
+    int height = heightMap->GetHeight();
+    STImage* result = new STImage(width, height, STImage::kRGBA16);
+
+    // Texel centers are at (x + 0.5) / width, so a sample delta away
+    // in u is delta * width pixels away. Offsets beyond the edge of
+    // the image all sample the edge.
+    float offsetU = STMin(delta * width, (float) width);
+    float offsetV = STMin(delta * height, (float) height);
+    STSampleOffset plusU(offsetU), minusU(-offsetU);
+    STSampleOffset plusV(offsetV), minusV(-offsetV);
+    int pad = (int) ceilf(offsetU) + 2;
+
+    STForEachBand(pool, height, width, [&](int y0, int y1) {
+        int paddedWidth = width + 2 * pad;
+        std::vector<float> rows(5 * paddedWidth);
+        std::vector<float> differences(2 * width);
+        float* center = &rows[0];
+        float* vRows[4] = {
+            &rows[paddedWidth], &rows[2 * paddedWidth],
+            &rows[3 * paddedWidth], &rows[4 * paddedWidth],
+        };
+        float* du = &differences[0];
+        float* dv = &differences[width];
+
+        for (int y = y0; y < y1; ++y) {
+            LoadRow(heightMap, y, pad, center);
+            LoadRow(heightMap, y + plusV.index, 0, vRows[0]);
+            LoadRow(heightMap, y + plusV.index + 1, 0, vRows[1]);
+            LoadRow(heightMap, y + minusV.index, 0, vRows[2]);
+            LoadRow(heightMap, y + minusV.index + 1, 0, vRows[3]);
+
+            const float* heights = center + pad;
+            Difference(heights + plusU.index, heights + plusU.index + 1, plusU.weight,
+                       heights + minusU.index, heights + minusU.index + 1, minusU.weight,
+                       du, width);
+            Difference(vRows[0], vRows[1], plusV.weight,
+                       vRows[2], vRows[3], minusV.weight,
+                       dv, width);
+            EncodeRow(heights, du, dv, (unsigned short*) result->GetRow(y), width);
+        }
+    });
+
+    return result;
+}
@@ -1,36 +1,58 @@
 // STImage.cpp
 #include "STImage.h"
 
+#include "STMappedFile.h"
 #include "stgl.h"
 #include "st.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 #include <string>
 
 //
-// Load a new image from an image file (PPM, JPEG
+// Get the size in bytes of the pixels of an image, throwing if
+// a row is too long for an int stride or the whole is too large
+// to address.
+//
+static size_t
+GetDataSize(int width, int height, int bytesPerPixel)
+{
+    if (width > INT_MAX / bytesPerPixel ||
+        (size_t) height > (size_t) -1 / ((size_t) width * bytesPerPixel))
+        throw std::runtime_error("STImage is too large");
+    return (size_t) width * bytesPerPixel * height;
+}
+
+//
+// Load a new image from an image file (PPM, PAM, JPEG
 // and PNG formats are supported).
 // Returns NULL on failure.
 //
-STImage::STImage(const std::string& filename)
+STImage::STImage(const std::string& filename, const LoadOptions& options)
     : mWidth(-1)
     , mHeight(-1)
-    , mPixels(NULL)
+    , mData(NULL)
+    , mFormat(kRGBA8)
+    , mStride(0)
+    , mRowOrder(kBottomUp)
+    , mOwnsData(true)
+    , mMappedFile(NULL)
 {
 
     // Determine the right routine based on the file's extension.
     // The format-specific subroutines are each implemented in
     // a different file.
     std::string ext = STGetExtension( filename );
-    if (ext.compare("PPM") == 0) {
-        LoadPPM(filename);
+    if (ext.compare("PPM") == 0 || ext.compare("PAM") == 0) {
+        LoadPPM(filename, options);
     }
     else if (ext.compare("PNG") == 0) {
-        LoadPNG(filename);
+        LoadPNG(filename, options);
     }
     else if (ext.compare("JPG") == 0 || ext.compare("JPEG") == 0) {
-        LoadJPG(filename);
+        LoadJPG(filename, options);
     }
     else {
         fprintf(stderr,
@@ -38,6 +60,16 @@ STImage::STImage(const std::string& filename)
                 filename.c_str());
         throw new std::runtime_error("Error creating STImage");
     } 
+
+    // Only the JPEG loader can decode at reduced size,
+    // the other formats are reduced after loading.
+    if (options.maxDimension > 0)
+        ReduceToFit(options.maxDimension);
+
+    // The PNG loader can decode greyscale images straight
+    // into compact formats; everything else is converted.
+    if (mFormat != options.format)
+        ConvertTo(options.format);
 }
 
 //
@@ -48,25 +80,345 @@ STImage::STImage(int width, int height, Pixel color)
 {
     Initialize(width, height);
 
-    int numPixels = mWidth * mHeight;
-    for (int ii = 0; ii < numPixels; ++ii) {
-        mPixels[ii] = color;
+    Pixel* pixels = GetPixels();
+    size_t numPixels = (size_t) mWidth * mHeight;
+    for (size_t ii = 0; ii < numPixels; ++ii) {
+        pixels[ii] = color;
     }
 }
 
+//
+// Construct a new image of the specified width, height
+// and pixel format, with all channels set to zero.
+//
+STImage::STImage(int width, int height, Format format)
+{
+    Initialize(width, height, format);
+    memset(mData, 0, (size_t) mWidth * mHeight * GetBytesPerPixel(mFormat));
+}
+
+//
+// Construct a view of existing pixel data in the given format,
+// without copying it.
+//
+STImage::STImage(int width, int height, Format format, void* data,
+                 int stride, RowOrder rowOrder)
+    : mHeight(height)
+    , mWidth(width)
+    , mData((unsigned char*) data)
+    , mFormat(format)
+    , mStride(stride > 0 ? stride : width * GetBytesPerPixel(format))
+    , mRowOrder(rowOrder)
+    , mOwnsData(false)
+    , mMappedFile(NULL)
+{
+    if (width <= 0)
+        throw std::runtime_error("STImage width must be positive");
+    if (height <= 0)
+        throw std::runtime_error("STImage height must be positive");
+}
+
 // Common initialization logic shared by all construcotrs.
-void STImage::Initialize(int width, int height)
+void STImage::Initialize(int width, int height, Format format,
+                         RowOrder rowOrder)
 {
     if (width <= 0)
         throw std::runtime_error("STImage width must be positive");
     if (height <= 0)
         throw std::runtime_error("STImage height must be positive");
 
+    size_t size = GetDataSize(width, height, GetBytesPerPixel(format));
+
     mWidth = width;
     mHeight = height;
+    mFormat = format;
+    mStride = mWidth * GetBytesPerPixel(mFormat);
+    mRowOrder = rowOrder;
+    mOwnsData = true;
+    mMappedFile = NULL;
+
+    mData = new unsigned char[size];
+}
+
+//
+// Replace the data with a tightly packed copy, if the rows
+// have padding or the image is a view.
+//
+void STImage::Pack()
+{
+    int rowBytes = mWidth * GetBytesPerPixel(mFormat);
+    if (!IsView() && mStride == rowBytes)
+        return;
+
+    unsigned char* data = new unsigned char[(size_t) rowBytes * mHeight];
+    for (int i = 0; i < mHeight; ++i)
+        memcpy(data + (size_t) i * rowBytes, mData + (size_t) i * mStride, rowBytes);
+
+    FreeData();
+    mData = data;
+    mStride = rowBytes;
+    mOwnsData = true;
+}
+
+//
+// Free the data, or close the file mapping, that the image owns.
+//
+void STImage::FreeData()
+{
+    if (mOwnsData)
+        delete [] mData;
+    delete mMappedFile;
+
+    mData = NULL;
+    mMappedFile = NULL;
+}
+
+//
+// Halve the resolution of the image until it fits
+// within maxDimension pixels in both directions.
+//
+void STImage::ReduceToFit(int maxDimension)
+{
+    // Halving is the same whichever order the rows are in.
+    Pack();
+
+    int bytesPerPixel = GetBytesPerPixel(mFormat);
+    while ((mWidth > maxDimension || mHeight > maxDimension) &&
+           (mWidth > 1 || mHeight > 1)) {
+        int width = STMax(mWidth / 2, 1);
+        int height = STMax(mHeight / 2, 1);
+
+        unsigned char* data = new unsigned char[(size_t) width * height * bytesPerPixel];
+        if (mFormat == kRGBA8) {
+            Downsample((const Pixel*) mData, mWidth, mHeight, (Pixel*) data);
+        }
+        else {
+            int bytesPerChannel = GetBytesPerChannel(mFormat);
+            STResample::DownsampleChannels(mData, mWidth, mHeight,
+                                           bytesPerPixel / bytesPerChannel,
+                                           bytesPerChannel, data);
+        }
+
+        FreeData();
+        mData = data;
+        mOwnsData = true;
+        mWidth = width;
+        mHeight = height;
+        mStride = width * bytesPerPixel;
+    }
+}
+
+//
+// Fill in a half-resolution copy of an array of pixels
+// by averaging 2x2 blocks.
+//
+void STImage::Downsample(const Pixel* src, int width, int height,
+                         Pixel* dst)
+{
+    STResample::Downsample(src, width, height, dst);
+}
+
+//
+// Resample the image to a new width and height.
+//
+void STImage::Resize(int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        throw std::runtime_error("STImage width and height must be positive");
+
+    Format format = mFormat;
+    if (format != kRGBA8)
+        ConvertTo(kRGBA8);
+    else
+        Pack();
+
+    Pixel* pixels = (Pixel*) new unsigned char[GetDataSize(width, height, sizeof(Pixel))];
+    STResample::Resize((const Pixel*) mData, mWidth, mHeight, pixels, width, height);
+
+    FreeData();
+    mData = (unsigned char*) pixels;
+    mOwnsData = true;
+    mWidth = width;
+    mHeight = height;
+    mStride = width * sizeof(Pixel);
+
+    if (format != kRGBA8)
+        ConvertTo(format);
+}
+
+//
+// Get the size in bytes of one pixel of a format.
+//
+int STImage::GetBytesPerPixel(Format format)
+{
+    switch (format) {
+        case kR8:   return 1;
+        case kRG8:  return 2;
+        case kR16:  return 2;
+        case kRGBA16: return 8;
+        default:    return 4;
+    }
+}
+
+//
+// Get the size in bytes of one channel of a format.
+//
+int STImage::GetBytesPerChannel(Format format)
+{
+    return (format == kR16 || format == kRGBA16) ? 2 : 1;
+}
+
+//
+// Convert an array of pixels from one format to another.
+//
+void STImage::ConvertPixels(Format srcFormat, const void* src,
+                            Format dstFormat, void* dst,
+                            int numPixels)
+{
+    if (srcFormat == dstFormat) {
+        memcpy(dst, src, (size_t) numPixels * GetBytesPerPixel(srcFormat));
+        return;
+    }
+
+    const unsigned char* in8 = (const unsigned char*) src;
+    const unsigned short* in16 = (const unsigned short*) src;
+    unsigned char* out8 = (unsigned char*) dst;
+    unsigned short* out16 = (unsigned short*) dst;
+
+    // Keep the full precision between the two single-channel formats.
+    if (srcFormat == kR16 && dstFormat == kR8) {
+        for (int i = 0; i < numPixels; ++i)
+            out8[i] = (unsigned char) ((in16[i] + 128) / 257);
+        return;
+    }
+    if (srcFormat == kR8 && dstFormat == kR16) {
+        for (int i = 0; i < numPixels; ++i)
+            out16[i] = (unsigned short) (in8[i] * 257);
+        return;
+    }
+
+    // Otherwise go through RGBA.
+    for (int i = 0; i < numPixels; ++i) {
+        Pixel p;
+        switch (srcFormat) {
+            case kR8:   p = Pixel(in8[i], in8[i], in8[i], 255); break;
+            case kRG8:  p = Pixel(in8[2*i], in8[2*i+1], 0, 255); break;
+            case kR16: {
+                unsigned char v = (unsigned char) ((in16[i] + 128) / 257);
+                p = Pixel(v, v, v, 255);
+                break;
+            }
+            case kRGBA16:
+                p = Pixel((unsigned char) ((in16[4*i] + 128) / 257),
+                          (unsigned char) ((in16[4*i+1] + 128) / 257),
+                          (unsigned char) ((in16[4*i+2] + 128) / 257),
+                          (unsigned char) ((in16[4*i+3] + 128) / 257));
+                break;
+            default:    p = ((const Pixel*) src)[i]; break;
+        }
+
+        switch (dstFormat) {
+            case kR8:   out8[i] = p.r; break;
+            case kRG8:  out8[2*i] = p.r; out8[2*i+1] = p.g; break;
+            case kR16:  out16[i] = (unsigned short) (p.r * 257); break;
+            case kRGBA16:
+                out16[4*i] = (unsigned short) (p.r * 257);
+                out16[4*i+1] = (unsigned short) (p.g * 257);
+                out16[4*i+2] = (unsigned short) (p.b * 257);
+                out16[4*i+3] = (unsigned short) (p.a * 257);
+                break;
+            default:    ((Pixel*) dst)[i] = p; break;
+        }
+    }
+}
 
-    int numPixels = mWidth * mHeight;
-    mPixels = new Pixel[numPixels];
+//
+// Convert the pixels to another format.
+//
+void STImage::ConvertTo(Format format)
+{
+    if (format == mFormat)
+        return;
+
+    // The rows stay in the same order.
+    unsigned char* data = new unsigned char[GetDataSize(mWidth, mHeight, GetBytesPerPixel(format))];
+    int rowBytes = mWidth * GetBytesPerPixel(format);
+    for (int i = 0; i < mHeight; ++i) {
+        ConvertPixels(mFormat, mData + (size_t) i * mStride,
+                      format, data + (size_t) i * rowBytes, mWidth);
+    }
+
+    FreeData();
+    mData = data;
+    mFormat = format;
+    mStride = rowBytes;
+    mOwnsData = true;
+}
+
+//
+// Reverse the order of the rows in memory, in place.
+//
+void STImage::SetRowOrder(RowOrder rowOrder)
+{
+    if (rowOrder == mRowOrder)
+        return;
+
+    int rowBytes = mWidth * GetBytesPerPixel(mFormat);
+    unsigned char* temp = new unsigned char[rowBytes];
+    for (int i = 0; i < mHeight / 2; ++i) {
+        unsigned char* a = mData + (size_t) i * mStride;
+        unsigned char* b = mData + (size_t) (mHeight - 1 - i) * mStride;
+        memcpy(temp, a, rowBytes);
+        memcpy(a, b, rowBytes);
+        memcpy(b, temp, rowBytes);
+    }
+    delete [] temp;
+
+    mRowOrder = rowOrder;
+}
+
+//
+// Get row y of the image, counting from the bottom row.
+//
+const unsigned char* STImage::GetRow(int y) const
+{
+    assert(y >= 0 && y < mHeight);
+    int row = (mRowOrder == kBottomUp) ? y : mHeight - 1 - y;
+    return mData + (size_t) row * mStride;
+}
+
+unsigned char* STImage::GetRow(int y)
+{
+    assert(y >= 0 && y < mHeight);
+    int row = (mRowOrder == kBottomUp) ? y : mHeight - 1 - y;
+    return mData + (size_t) row * mStride;
+}
+
+//
+// Copy the pixels of another image of the same size into
+// this one, converting their format, stride and row order.
+//
+void STImage::CopyPixels(const STImage& image)
+{
+    assert(image.mWidth == mWidth && image.mHeight == mHeight);
+
+    for (int y = 0; y < mHeight; ++y)
+        ConvertPixels(image.mFormat, image.GetRow(y), mFormat, GetRow(y), mWidth);
+}
+
+//
+// Get access to the "raw" array of RGBA pixels.
+//
+const STImage::Pixel* STImage::GetPixels() const
+{
+    assert(mFormat == kRGBA8);
+    return (const Pixel*) mData;
+}
+
+STImage::Pixel* STImage::GetPixels()
+{
+    assert(mFormat == kRGBA8);
+    return (Pixel*) mData;
 }
 
 //
@@ -74,13 +426,11 @@ void STImage::Initialize(int width, int height)
 //
 STImage::~STImage()
 {
-    if (mPixels != NULL) {
-        delete [] mPixels;
-    }
+    FreeData();
 }
 
 //
-// Save the image to a file (PPM, JPEG and PNG
+// Save the image to a file (PPM, PAM, JPEG and PNG
 // formats are supported).
 // Returns a non-zero value on error.
 //
@@ -91,9 +441,20 @@ STStatus STImage::Save(const std::string& filename) const
     // a different file.
     std::string ext = STGetExtension( filename );
 
+    // The image file savers all work with RGBA pixels,
+    // but in either row order.
+    if (mFormat != kRGBA8) {
+        STImage rgba(mWidth, mHeight, kRGBA8);
+        rgba.CopyPixels(*this);
+        return rgba.Save(filename);
+    }
+
     if (ext.compare("PPM") == 0 ) {
         return SavePPM(filename);
     }
+    else if (ext.compare("PAM") == 0) {
+        return SavePAM(filename);
+    }
     else if (ext.compare("PNG") == 0) {
         return SavePNG(filename);
     }
@@ -116,10 +477,36 @@ STStatus STImage::Save(const std::string& filename) const
 //
 void STImage::Draw() const
 {
+    // OpenGL draws tightly packed rows, bottom row first.
+    if (mRowOrder != kBottomUp || mFormat == kRG8 ||
+        mStride != mWidth * GetBytesPerPixel(mFormat)) {
+        STImage copy(mWidth, mHeight, (mFormat == kRG8) ? kRGBA8 : mFormat);
+        copy.CopyPixels(*this);
+        copy.Draw();
+        return;
+    }
+
     glRasterPos2f(0.0f, 0.0f);
-    glDrawPixels(mWidth, mHeight,
-                 GL_RGBA, GL_UNSIGNED_BYTE,
-                 (GLvoid*) mPixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    switch (mFormat) {
+        case kR8:
+            glDrawPixels(mWidth, mHeight, GL_LUMINANCE, GL_UNSIGNED_BYTE,
+                         (GLvoid*) mData);
+            break;
+        case kR16:
+            glDrawPixels(mWidth, mHeight, GL_LUMINANCE, GL_UNSIGNED_SHORT,
+                         (GLvoid*) mData);
+            break;
+        case kRGBA16:
+            glDrawPixels(mWidth, mHeight, GL_RGBA, GL_UNSIGNED_SHORT,
+                         (GLvoid*) mData);
+            break;
+        default:
+            glDrawPixels(mWidth, mHeight, GL_RGBA, GL_UNSIGNED_BYTE,
+                         (GLvoid*) mData);
+            break;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
 //
@@ -131,9 +518,35 @@ void STImage::Draw() const
 //
 void STImage::Read(int x, int y)
 {
-    glReadPixels(x, y, mWidth, mHeight,
-                 GL_RGBA, GL_UNSIGNED_BYTE,
-                 (GLvoid*) mPixels);
+    // OpenGL reads tightly packed rows, bottom row first.
+    if (mRowOrder != kBottomUp || mFormat == kRG8 ||
+        mStride != mWidth * GetBytesPerPixel(mFormat)) {
+        STImage copy(mWidth, mHeight, (mFormat == kRG8) ? kRGBA8 : mFormat);
+        copy.Read(x, y);
+        CopyPixels(copy);
+        return;
+    }
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    switch (mFormat) {
+        case kR8:
+            glReadPixels(x, y, mWidth, mHeight, GL_RED, GL_UNSIGNED_BYTE,
+                         (GLvoid*) mData);
+            break;
+        case kR16:
+            glReadPixels(x, y, mWidth, mHeight, GL_RED, GL_UNSIGNED_SHORT,
+                         (GLvoid*) mData);
+            break;
+        case kRGBA16:
+            glReadPixels(x, y, mWidth, mHeight, GL_RGBA, GL_UNSIGNED_SHORT,
+                         (GLvoid*) mData);
+            break;
+        default:
+            glReadPixels(x, y, mWidth, mHeight, GL_RGBA, GL_UNSIGNED_BYTE,
+                         (GLvoid*) mData);
+            break;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
 }
 
 //
@@ -145,7 +558,10 @@ STImage::Pixel STImage::GetPixel(int x, int y) const
     assert(x >= 0 && x < mWidth);
     assert(y >= 0 && y < mHeight);
 
-    return mPixels[y*mWidth + x];
+    Pixel value;
+    ConvertPixels(mFormat, GetRow(y) + x * GetBytesPerPixel(mFormat),
+                  kRGBA8, &value, 1);
+    return value;
 }
 
 //
@@ -157,5 +573,6 @@ void STImage::SetPixel(int x, int y, Pixel value)
     assert(x >= 0 && x < mWidth);
     assert(y >= 0 && y < mHeight);
 
-    mPixels[y*mWidth + x] = value;
+    ConvertPixels(kRGBA8, &value,
+                  mFormat, GetRow(y) + x * GetBytesPerPixel(mFormat), 1);
 }
@@ -0,0 +1,421 @@
+// STImageCache.cpp
+#include "STImageCache.h"
+
+#include "st.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Identifies a file as an STImageCache file. The version must be
+// bumped whenever the layout of the file changes.
+static const char kCacheMagic[4] = { 'S', 'T', 'I', 'C' };
+static const unsigned int kCacheVersion = 3;
+
+// Flags recording the remaining load options.
+static const unsigned int kCacheFlagSRGB = 0x1;
+
+// Level data is aligned so it can be handed to OpenGL (or SIMD code)
+// directly from the mapped file.
+static const size_t kCacheAlignment = 16;
+
+// The cache file begins with this header...
+struct STImageCacheHeader
+{
+    char magic[4];
+    unsigned int version;
+    unsigned int format;        // An STBlockCompression::Format
+    unsigned int pixelFormat;   // An STImage::Format
+    unsigned int numLevels;
+    // The STImage::LoadOptions used to decode the source.
+    int maxDimension;
+    unsigned int flags;
+    // Size, modification time and hash of the
+    // source image the cache was built from.
+    unsigned long long sourceSize;
+    long long sourceMtime;
+    unsigned long long sourceHash;
+};
+
+// ...followed by one of these for each mipmap level.
+struct STImageCacheLevel
+{
+    unsigned int width;
+    unsigned int height;
+    unsigned long long offset;
+    unsigned long long size;
+};
+
+std::string STImageCache::sCacheDirectory;
+
+//
+// Round a size up to the next multiple of kCacheAlignment.
+//
+static size_t
+AlignCacheOffset(size_t offset)
+{
+    return (offset + kCacheAlignment - 1) & ~(kCacheAlignment - 1);
+}
+
+//
+// Get the size in bytes of a mipmap level stored in a format.
+//
+static size_t
+GetLevelSize(STBlockCompression::Format format, STImage::Format pixelFormat,
+             int width, int height)
+{
+    if (format != STBlockCompression::kUncompressed)
+        return STBlockCompression::GetCompressedSize(format, width, height);
+    return (size_t) width * height * STImage::GetBytesPerPixel(pixelFormat);
+}
+
+//
+// Look up the size and modification time of a file.
+// Returns false if the file does not exist.
+//
+static bool
+StatSourceFile(const std::string& filename,
+               unsigned long long* size, long long* mtime)
+{
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+        return false;
+    *size = (unsigned long long) info.st_size;
+    *mtime = (long long) info.st_mtime;
+    return true;
+}
+
+//
+// Hash the contents of a file. Returns false if
+// the file could not be read.
+//
+static bool
+HashSourceFile(const std::string& filename, unsigned long long* hash)
+{
+    STMappedFile file;
+    if (file.Open(filename) != ST_OK)
+        return false;
+    *hash = STHashBytes(file.GetData(), file.GetSize());
+    return true;
+}
+
+//
+// Open the cache for an image file, decoding the image and
+// writing a new cache file if there is no valid one.
+//
+STImageCache::STImageCache(const std::string& filename,
+                           const STImage::LoadOptions& options,
+                           STBlockCompression::Format format)
+    : mFormat(format)
+    , mPixelFormat(format == STBlockCompression::kUncompressed ?
+                   options.format : STImage::kRGBA8)
+    , mData(NULL)
+    , mCacheHit(false)
+{
+    std::string cachePath = GetCachePath(filename, options, format);
+
+    if (OpenCacheFile(filename, options, cachePath)) {
+        mCacheHit = true;
+    }
+    else {
+        BuildCacheFile(filename, options, cachePath);
+    }
+}
+
+//
+// Release the cached pixel data.
+//
+STImageCache::~STImageCache()
+{
+}
+
+//
+// Get read-only access to the pixels of a mipmap level.
+//
+const STImageCache::Pixel* STImageCache::GetPixels(int level) const
+{
+    assert(level >= 0 && level < GetNumLevels());
+    assert(mFormat == STBlockCompression::kUncompressed);
+    assert(mPixelFormat == STImage::kRGBA8);
+    return (const Pixel*) (mData + mLevels[level].offset);
+}
+
+//
+// Try to use an existing cache file.
+//
+bool STImageCache::OpenCacheFile(const std::string& filename,
+                                 const STImage::LoadOptions& options,
+                                 const std::string& cachePath)
+{
+    unsigned long long sourceSize;
+    long long sourceMtime;
+    if (!StatSourceFile(filename, &sourceSize, &sourceMtime))
+        return false;
+
+    if (mFile.Open(cachePath) != ST_OK)
+        return false;
+
+    const unsigned char* data = mFile.GetData();
+    size_t fileSize = mFile.GetSize();
+
+    // Check that this is a cache file we know how to read.
+    const STImageCacheHeader* header = (const STImageCacheHeader*) data;
+    if (fileSize < sizeof(STImageCacheHeader) ||
+        memcmp(header->magic, kCacheMagic, sizeof(kCacheMagic)) != 0 ||
+        header->version != kCacheVersion ||
+        header->format != (unsigned int) mFormat ||
+        header->pixelFormat != (unsigned int) mPixelFormat ||
+        header->maxDimension != options.maxDimension ||
+        header->flags != (options.sRGB ? kCacheFlagSRGB : 0) ||
+        header->numLevels == 0 || header->numLevels > 32 ||
+        sizeof(STImageCacheHeader) +
+            header->numLevels * sizeof(STImageCacheLevel) > fileSize) {
+        mFile.Close();
+        return false;
+    }
+
+    // Check that the cache was built from the current source image.
+    // A changed modification time alone (e.g. from a fresh checkout)
+    // does not invalidate the cache if the contents are unchanged.
+    if (header->sourceSize != sourceSize) {
+        mFile.Close();
+        return false;
+    }
+    if (header->sourceMtime != sourceMtime) {
+        unsigned long long sourceHash;
+        if (!HashSourceFile(filename, &sourceHash) ||
+            sourceHash != header->sourceHash) {
+            mFile.Close();
+            return false;
+        }
+
+        // Remember the new modification time, so the next run
+        // does not need to hash the source again.
+        FILE* cacheFile = fopen(cachePath.c_str(), "r+b");
+        if (cacheFile) {
+            fseek(cacheFile, offsetof(STImageCacheHeader, sourceMtime), SEEK_SET);
+            fwrite(&sourceMtime, sizeof(sourceMtime), 1, cacheFile);
+            fclose(cacheFile);
+        }
+    }
+
+    // Read the level table, checking that every level
+    // lies within the file.
+    const STImageCacheLevel* levels =
+        (const STImageCacheLevel*) (data + sizeof(STImageCacheHeader));
+    mLevels.clear();
+    for (unsigned int i = 0; i < header->numLevels; ++i) {
+        unsigned long long expectedSize = GetLevelSize(
+            mFormat, mPixelFormat, (int) levels[i].width, (int) levels[i].height);
+        if (levels[i].width == 0 || levels[i].height == 0 ||
+            levels[i].size != expectedSize ||
+            levels[i].offset + levels[i].size > fileSize) {
+            mLevels.clear();
+            mFile.Close();
+            return false;
+        }
+
+        Level level;
+        level.width = (int) levels[i].width;
+        level.height = (int) levels[i].height;
+        level.offset = (size_t) levels[i].offset;
+        level.size = (size_t) levels[i].size;
+        mLevels.push_back(level);
+    }
+
+    mData = data;
+    return true;
+}
+
+//
+// Decode the source image, build its mipmaps and
+// write them to a new cache file.
+//
+void STImageCache::BuildCacheFile(const std::string& filename,
+                                  const STImage::LoadOptions& options,
+                                  const std::string& cachePath)
+{
+    // Throws if the image cannot be loaded. Cache files always hold
+    // pixels bottom row first, or blocks encoded from RGBA pixels.
+    STImage::LoadOptions decodeOptions = options;
+    decodeOptions.format = mPixelFormat;
+    decodeOptions.rowOrder = STImage::kBottomUp;
+    STImage image(filename, decodeOptions);
+
+    STImageCacheHeader header;
+    memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+    header.version = kCacheVersion;
+    header.format = (unsigned int) mFormat;
+    header.pixelFormat = (unsigned int) mPixelFormat;
+    header.maxDimension = options.maxDimension;
+    header.flags = options.sRGB ? kCacheFlagSRGB : 0;
+    header.sourceSize = 0;
+    header.sourceMtime = 0;
+    header.sourceHash = 0;
+    StatSourceFile(filename, &header.sourceSize, &header.sourceMtime);
+    HashSourceFile(filename, &header.sourceHash);
+
+    // Lay out the full mipmap chain.
+    std::vector<STImageCacheLevel> levels;
+    int width = image.GetWidth();
+    int height = image.GetHeight();
+    while (true) {
+        STImageCacheLevel level;
+        level.width = width;
+        level.height = height;
+        level.offset = 0;
+        level.size = GetLevelSize(mFormat, mPixelFormat, width, height);
+        levels.push_back(level);
+
+        if (width == 1 && height == 1)
+            break;
+        width = STMax(width / 2, 1);
+        height = STMax(height / 2, 1);
+    }
+    header.numLevels = (unsigned int) levels.size();
+
+    size_t offset = AlignCacheOffset(sizeof(STImageCacheHeader) +
+                                     levels.size() * sizeof(STImageCacheLevel));
+    mLevels.clear();
+    for (size_t i = 0; i < levels.size(); ++i) {
+        levels[i].offset = offset;
+        offset = AlignCacheOffset(offset + (size_t) levels[i].size);
+
+        Level level;
+        level.width = (int) levels[i].width;
+        level.height = (int) levels[i].height;
+        level.offset = (size_t) levels[i].offset;
+        level.size = (size_t) levels[i].size;
+        mLevels.push_back(level);
+    }
+
+    // Fill in the cache data: header, level table and pixels.
+    mBuffer.assign(offset, 0);
+    unsigned char* data = &mBuffer[0];
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), &levels[0],
+           levels.size() * sizeof(STImageCacheLevel));
+
+    // Each level is downsampled from the one before, then compressed
+    // if needed. Uncompressed levels are built in place.
+    bool compressed = (mFormat != STBlockCompression::kUncompressed);
+    STResample::ColorSpace space = options.sRGB ?
+        STResample::kSRGB : STResample::kLinear;
+    int bytesPerPixel = STImage::GetBytesPerPixel(mPixelFormat);
+    int bytesPerChannel = STImage::GetBytesPerChannel(mPixelFormat);
+    const unsigned char* pixels = image.GetData();
+    std::vector<unsigned char> scratch[2];
+    for (size_t i = 0; i < mLevels.size(); ++i) {
+        unsigned char* levelData = data + mLevels[i].offset;
+        if (i > 0) {
+            unsigned char* levelPixels = levelData;
+            if (compressed) {
+                scratch[i % 2].resize(mLevels[i].width * mLevels[i].height * bytesPerPixel);
+                levelPixels = &scratch[i % 2][0];
+            }
+            if (mPixelFormat == STImage::kRGBA8) {
+                STResample::Downsample((const Pixel*) pixels,
+                                       mLevels[i-1].width, mLevels[i-1].height,
+                                       (Pixel*) levelPixels, space);
+            }
+            else {
+                STResample::DownsampleChannels(pixels, mLevels[i-1].width, mLevels[i-1].height,
+                                               bytesPerPixel / bytesPerChannel,
+                                               bytesPerChannel, levelPixels);
+            }
+            pixels = levelPixels;
+        }
+
+        if (compressed) {
+            STBlockCompression::Compress(mFormat, (const Pixel*) pixels,
+                                         mLevels[i].width, mLevels[i].height,
+                                         levelData);
+        }
+        else if (i == 0) {
+            memcpy(levelData, pixels, mLevels[i].size);
+        }
+    }
+    mData = data;
+
+    // Write the cache file. Write to a temporary file first so that
+    // a partially written cache can never be mistaken for a valid one.
+    // The temporary name is unique to this object, in case the same
+    // image is being cached on another thread at the same time.
+    char tempSuffix[32];
+    sprintf(tempSuffix, ".%p.tmp", (void*) this);
+    std::string tempPath = cachePath + tempSuffix;
+    FILE* cacheFile = fopen(tempPath.c_str(), "wb");
+    if (!cacheFile) {
+        fprintf(stderr, "STImageCache::STImageCache() - Could not write "
+                "cache file '%s'.\n", cachePath.c_str());
+        return;
+    }
+    size_t written = fwrite(data, 1, mBuffer.size(), cacheFile);
+    fclose(cacheFile);
+
+    remove(cachePath.c_str());
+    if (written != mBuffer.size() ||
+        rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        fprintf(stderr, "STImageCache::STImageCache() - Could not write "
+                "cache file '%s'.\n", cachePath.c_str());
+        remove(tempPath.c_str());
+    }
+}
+
+//
+// Store all cache files in the given directory instead
+// of next to their source images.
+//
+void STImageCache::SetCacheDirectory(const std::string& directory)
+{
+    sCacheDirectory = directory;
+}
+
+//
+// Get the path of the cache file used for an image file.
+//
+std::string STImageCache::GetCachePath(const std::string& filename,
+                                       const STImage::LoadOptions& options,
+                                       STBlockCompression::Format format)
+{
+    // Images loaded with different options get separate cache files.
+    std::string suffix = ".stcache";
+    if (options.maxDimension > 0) {
+        char size[32];
+        sprintf(size, ".max%d", options.maxDimension);
+        suffix = size + suffix;
+    }
+    if (options.sRGB)
+        suffix = ".srgb" + suffix;
+    if (format != STBlockCompression::kUncompressed) {
+        static const char* kFormatNames[] = { "", ".bc1", ".bc3", ".bc4", ".bc5" };
+        suffix = kFormatNames[format] + suffix;
+    }
+    else if (options.format != STImage::kRGBA8) {
+        static const char* kPixelFormatNames[] = { "", ".r8", ".rg8", ".r16", ".rgba16" };
+        suffix = kPixelFormatNames[options.format] + suffix;
+    }
+
+    if (sCacheDirectory.empty())
+        return filename + suffix;
+
+    // Files from different directories may share a name, so
+    // the cache file name includes a hash of the full path.
+    size_t slash = filename.find_last_of("/\\");
+    std::string base = (slash == std::string::npos) ?
+        filename : filename.substr(slash + 1);
+
+    char hash[17];
+    sprintf(hash, "%016llx",
+            STHashBytes(filename.data(), filename.size()));
+
+    std::string directory = sCacheDirectory;
+    char last = directory[directory.size() - 1];
+    if (last != '/' && last != '\\')
+        directory += "/";
+
+    return directory + base + "." + hash + suffix;
+}
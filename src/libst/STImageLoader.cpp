@@ -0,0 +1,98 @@
+// STImageLoader.cpp
+#include "STImageLoader.h"
+
+#include "STThreadPool.h"
+
+#include <stdio.h>
+#include <stdexcept>
+
+//
+// Create a loader that decodes images on the given thread pool.
+//
+STImageLoader::STImageLoader(STThreadPool* pool)
+    : mPool(pool ? pool : STThreadPool::GetShared())
+    , mNumPending(0)
+{
+}
+
+//
+// Wait for any images still being decoded, and delete
+// the images that were never handed to a callback.
+//
+STImageLoader::~STImageLoader()
+{
+    for (size_t i = 0; i < mJobs.size(); ++i) {
+        if (!mJobs[i].delivered)
+            delete Collect(mJobs[i]);
+    }
+}
+
+//
+// Start decoding an image file.
+//
+int STImageLoader::Add(const std::string& filename,
+                       const STImage::LoadOptions& options)
+{
+    Job job;
+    job.filename = filename;
+    job.result = mPool->Submit([filename, options]() {
+        return new STImage(filename, options);
+    }).share();
+    job.delivered = false;
+
+    mJobs.push_back(job);
+    mNumPending++;
+    return (int) mJobs.size() - 1;
+}
+
+//
+// Hand every image that has finished decoding
+// to the callback, without waiting for the others.
+//
+int STImageLoader::Poll(const Callback& callback)
+{
+    for (size_t i = 0; i < mJobs.size(); ++i) {
+        Job& job = mJobs[i];
+        if (!job.delivered &&
+            job.result.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            callback((int) i, Collect(job));
+        }
+    }
+    return mNumPending;
+}
+
+//
+// Wait for all images to finish decoding,
+// handing each one to the callback.
+//
+void STImageLoader::Finish(const Callback& callback)
+{
+    for (size_t i = 0; i < mJobs.size(); ++i) {
+        if (!mJobs[i].delivered)
+            callback((int) i, Collect(mJobs[i]));
+    }
+}
+
+//
+// Take a finished image out of a job, waiting for it if needed.
+// Load errors are reported here and turned into a NULL image.
+//
+STImage* STImageLoader::Collect(Job& job)
+{
+    job.delivered = true;
+    mNumPending--;
+
+    try {
+        return job.result.get();
+    }
+    catch (const std::exception& e) {
+        fprintf(stderr, "STImageLoader - Could not load '%s': %s\n",
+                job.filename.c_str(), e.what());
+    }
+    catch (const std::exception* e) {
+        fprintf(stderr, "STImageLoader - Could not load '%s': %s\n",
+                job.filename.c_str(), e->what());
+        delete e;
+    }
+    return NULL;
+}
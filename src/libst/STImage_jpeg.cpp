@@ -34,7 +34,7 @@ STJpegErrorExit(j_common_ptr cinfo)
 //
 // Create an STImage from the contents of a JPG file via the libjpeg API
 //
-void STImage::LoadJPG(const std::string& filename)
+void STImage::LoadJPG(const std::string& filename, const LoadOptions& options)
 {
     // Open image file.
     FILE* imgFile = fopen(filename.c_str(), "rb");
@@ -52,6 +52,8 @@ void STImage::LoadJPG(const std::string& filename)
     if (setjmp(jerr.setjmpBuf)) {
         jpeg_destroy_decompress(&cinfo);
         fclose(imgFile);
+        // The rows may have been allocated, and partly decoded.
+        FreeData();
         throw std::runtime_error("Error in LoadJPG");
     }
 
@@ -59,6 +61,34 @@ void STImage::LoadJPG(const std::string& filename)
     jpeg_create_decompress(&cinfo);
     jpeg_stdio_src(&cinfo, imgFile);
     jpeg_read_header(&cinfo, TRUE);
+
+    // If the caller asked for a reduced size, let libjpeg do the
+    // reduction as part of the inverse DCT. It supports scaling by
+    // 1/2, 1/4 and 1/8, which skips most of the decoding work.
+    // Any further reduction happens after loading.
+    if (options.maxDimension > 0) {
+        unsigned int denom = 1;
+        while (denom < 8 &&
+               ((cinfo.image_width + denom - 1) / denom > (unsigned int) options.maxDimension ||
+                (cinfo.image_height + denom - 1) / denom > (unsigned int) options.maxDimension)) {
+            denom *= 2;
+        }
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = denom;
+    }
+
+#ifdef JCS_EXTENSIONS
+    // libjpeg-turbo can produce RGBA pixels directly, so
+    // rows can be decoded straight into the pixel array.
+    bool decodeRGBA = cinfo.jpeg_color_space == JCS_YCbCr ||
+                      cinfo.jpeg_color_space == JCS_RGB ||
+                      cinfo.jpeg_color_space == JCS_GRAYSCALE;
+    if (decodeRGBA)
+        cinfo.out_color_space = JCS_EXT_RGBA;
+#else
+    bool decodeRGBA = false;
+#endif
+
     jpeg_start_decompress(&cinfo);
 
     int rowStride = cinfo.output_width * cinfo.output_components;
@@ -67,38 +97,53 @@ void STImage::LoadJPG(const std::string& filename)
     int width = cinfo.output_width;
     int height = cinfo.output_height;
 
-    Initialize(width, height);
-    STColor4ub* pixels = mPixels;
-
-    // temporary buffer to hold the decompressed data from the JPEG
-    // file before it is stuck into the mPixels array
-    JSAMPARRAY rowBuffer = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo,
-                                                      JPOOL_IMAGE,
-                                                      rowStride, 1);
-
-    // Load all rows of pixels.
-    while (cinfo.output_scanline < cinfo.output_height) {
-
-        STColor4ub* curPixel = &pixels[ width * (height-cinfo.output_scanline-1) ];
-
-        jpeg_read_scanlines(&cinfo, rowBuffer, 1);
-
-        unsigned char* buf = rowBuffer[0];
-        if (cinfo.output_components == 3) {
-            // RGB data
-            for (int ii = 0; ii < width; ++ii) {
-                curPixel->r = *buf++;
-                curPixel->g = *buf++;
-                curPixel->b = *buf++;
-                curPixel->a = 255;
-                curPixel++;
+    Initialize(width, height, kRGBA8, options.rowOrder);
+
+    if (decodeRGBA) {
+        // Load all rows of pixels, several at a time when libjpeg
+        // can provide them. JPEG rows are stored top to bottom,
+        // so each row is pointed at its location in the image.
+        JSAMPROW rows[16];
+        while (cinfo.output_scanline < cinfo.output_height) {
+            int numRows = STMin((int) (cinfo.output_height - cinfo.output_scanline), 16);
+            for (int ii = 0; ii < numRows; ++ii) {
+                int row = height - (int) cinfo.output_scanline - ii - 1;
+                rows[ii] = (JSAMPROW) GetRow(row);
             }
-        } else {
-            // Greyscale data
-            for (int ii = 0; ii < width; ++ii) {
-                curPixel->r = curPixel->g = curPixel->b = *buf++;
-                curPixel->a = 255;
-                curPixel++;
+            jpeg_read_scanlines(&cinfo, rows, numRows);
+        }
+    }
+    else {
+        // temporary buffer to hold the decompressed data from the JPEG
+        // file before it is stuck into the pixel array
+        JSAMPARRAY rowBuffer = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo,
+                                                          JPOOL_IMAGE,
+                                                          rowStride, 1);
+
+        // Load all rows of pixels.
+        while (cinfo.output_scanline < cinfo.output_height) {
+
+            STColor4ub* curPixel = (STColor4ub*) GetRow(height-cinfo.output_scanline-1);
+
+            jpeg_read_scanlines(&cinfo, rowBuffer, 1);
+
+            unsigned char* buf = rowBuffer[0];
+            if (cinfo.output_components == 3) {
+                // RGB data
+                for (int ii = 0; ii < width; ++ii) {
+                    curPixel->r = *buf++;
+                    curPixel->g = *buf++;
+                    curPixel->b = *buf++;
+                    curPixel->a = 255;
+                    curPixel++;
+                }
+            } else {
+                // Greyscale data
+                for (int ii = 0; ii < width; ++ii) {
+                    curPixel->r = curPixel->g = curPixel->b = *buf++;
+                    curPixel->a = 255;
+                    curPixel++;
+                }
             }
         }
     }
@@ -160,7 +205,7 @@ STImage::SaveJPG(const std::string& filename) const
     // Walk through the rows of the image and write each in turn.
     while (cinfo.next_scanline < cinfo.image_height) {
         
-        STColor4ub* curPixel = &mPixels[ mWidth * (mHeight-cinfo.next_scanline-1) ];
+        const STColor4ub* curPixel = (const STColor4ub*) GetRow(mHeight-cinfo.next_scanline-1);
 
         JSAMPLE* buf = buffer[0];
         for (int i=0; i<mWidth; i++) {
@@ -12,7 +12,7 @@
 //
 // Create an STImage from the contents of a PNG file via the libpng API
 //
-void STImage::LoadPNG(const std::string& filename)
+void STImage::LoadPNG(const std::string& filename, const LoadOptions& options)
 {
     FILE* imgFile = fopen(filename.c_str(), "rb");
     if (!imgFile) {
@@ -68,97 +68,103 @@ void STImage::LoadPNG(const std::string& filename)
                 filename.c_str());
         png_destroy_read_struct(&pngPtr, &infoPtr, (png_infopp)NULL);
         fclose(imgFile);
+        // The rows may have been allocated, and partly decoded.
+        FreeData();
         throw std::runtime_error("Error in LoadPNG");
     }
 
     png_init_io(pngPtr, imgFile);
     png_set_sig_bytes(pngPtr, 8);
 
-    // The following code used the libpng high level interface
-    // to read data from the file into the array of STColor4ub structs
-    // representing an image in this class.  Format conversion into 8-bit
-    // RGBA as currently required by this class, requires an additional
-    // buffer copy.  Using the libpng **low-level interface** this buffer
-    // copy and the associated buffer double allocation could be avoided.
-    // The code would be complicated slightly with additional libpng
-    // transform calls, so I will leave this for later if performance or
-    // memory footprint becomes an issue.
-
-    // These transforms get us very close to 8 bit per channel RGBA, but
-    // not quite (won't extend from 1 or 3 components to 4.  Must use low
-    // level interface to do this.
-    int transforms =            
-            PNG_TRANSFORM_PACKING |
-            PNG_TRANSFORM_PACKSWAP |
-            PNG_TRANSFORM_EXPAND |
-            PNG_TRANSFORM_SHIFT;
-
-    
-    // Tell libpng to load the image into memory
-    png_read_png(pngPtr, infoPtr, transforms, NULL);
-
-    
-    // libpng exposes the data as an array of arrays of bytes
-    png_bytepp pngRowPointers = png_get_rows(pngPtr, infoPtr);
+    // The following code uses the libpng low-level interface, so that
+    // libpng decodes each row directly into the array of STColor4ub
+    // structs representing an image in this class, with no intermediate
+    // buffer. libpng transforms take care of the format conversion into
+    // 8-bit RGBA, or into a compact format for greyscale images.
+    png_read_info(pngPtr, infoPtr);
 
     int width = png_get_image_width(pngPtr, infoPtr);
     int height = png_get_image_height(pngPtr, infoPtr);
-    Initialize(width, height);
-    STColor4ub* pixels = mPixels;
-
-    int numChannels = png_get_channels(pngPtr, infoPtr);
-
-    // Now copy the data read by libpng into the STImage class'
-    // contiguous allocation of pixel data.  In doing so, explode
-    // single channel images or images without an alpha channle
-    // into full RGBA pixels.  
-    //
-    // We also need to flip the order of the rows of data.  Data in
-    // the png file begins with the topmost row of the image.  The
-    // STImage class stores data bottom row first to be consistent
-    // with OpenGL pixel formats
-    for (int i = 0; i < height; ++i) {
-
-        png_bytep srcPtr = pngRowPointers[height-i-1]; 
-        STColor4ub* curPixel = &pixels[ i*width ];
-
-        for (int j = 0; j < width; ++j) {
-
-            switch (numChannels) {
-
-            // monochrome, no alpha
-            case 1:
-                curPixel->r = curPixel->g = curPixel->b = *srcPtr++;
-                curPixel->a = 255;
-                break;
-
-            // monochrome, with alpha
-            case 2:
-                curPixel->r = curPixel->g = curPixel->b = *srcPtr++;
-                curPixel->a = *srcPtr++;
-                break;
-
-            // RGB, no alpha
-            case 3:
-                curPixel->r = *srcPtr++;
-                curPixel->g = *srcPtr++;
-                curPixel->b = *srcPtr++;
-                curPixel->a = 255;
-                break;
-                
-            // RGBA
-            case 4:
-                curPixel->r = *srcPtr++;
-                curPixel->g = *srcPtr++;
-                curPixel->b = *srcPtr++;
-                curPixel->a = *srcPtr++;
-                break;
-            }
-
-            curPixel++;
+    int bitDepth = png_get_bit_depth(pngPtr, infoPtr);
+    int colorType = png_get_color_type(pngPtr, infoPtr);
+
+    // Greyscale images that are wanted in a single-channel format are
+    // decoded straight into it, keeping all 16 bits of 16-bit images.
+    Format format = kRGBA8;
+    if (colorType == PNG_COLOR_TYPE_GRAY &&
+        !png_get_valid(pngPtr, infoPtr, PNG_INFO_tRNS)) {
+        if (options.format == kR16 && bitDepth == 16)
+            format = kR16;
+        else if (options.format == kR8 || options.format == kR16)
+            format = kR8;
+    }
+
+    // Expand palette images to RGB, low bit-depth greyscale images
+    // to 8 bits, and transparent colors to a full alpha channel.
+    if (colorType == PNG_COLOR_TYPE_PALETTE)
+        png_set_palette_to_rgb(pngPtr);
+    if (colorType == PNG_COLOR_TYPE_GRAY && bitDepth < 8)
+        png_set_expand_gray_1_2_4_to_8(pngPtr);
+    bool hasAlpha = (colorType & PNG_COLOR_MASK_ALPHA) != 0;
+    if (png_get_valid(pngPtr, infoPtr, PNG_INFO_tRNS)) {
+        png_set_tRNS_to_alpha(pngPtr);
+        hasAlpha = true;
+    }
+
+    // Reduce 16-bit channels to 8 bits (or put them in the host's
+    // byte order), and unpack pixels that are smaller than a byte.
+    png_color_8p significantBits;
+    if (png_get_sBIT(pngPtr, infoPtr, &significantBits))
+        png_set_shift(pngPtr, significantBits);
+    if (bitDepth == 16) {
+        if (format == kR16) {
+            unsigned short one = 1;
+            if (*(unsigned char*) &one == 1)
+                png_set_swap(pngPtr);
+        }
+        else {
+            png_set_strip_16(pngPtr);
+        }
+    }
+    if (bitDepth < 8)
+        png_set_packing(pngPtr);
+
+    // Explode single channel images or images without an
+    // alpha channel into full RGBA pixels.
+    if (format == kRGBA8) {
+        if (colorType == PNG_COLOR_TYPE_GRAY ||
+            colorType == PNG_COLOR_TYPE_GRAY_ALPHA)
+            png_set_gray_to_rgb(pngPtr);
+        if (!hasAlpha)
+            png_set_filler(pngPtr, 255, PNG_FILLER_AFTER);
+    }
+
+    // Interlaced images are delivered in several passes over the rows.
+    int numPasses = png_set_interlace_handling(pngPtr);
+    png_read_update_info(pngPtr, infoPtr);
+
+    int bytesPerPixel = GetBytesPerPixel(format);
+    if (png_get_rowbytes(pngPtr, infoPtr) != (png_size_t) width * bytesPerPixel) {
+        fprintf(stderr, "STImage::LoadPNG() - Unsupported pixel format in '%s'.\n",
+                filename.c_str());
+        png_destroy_read_struct(&pngPtr, &infoPtr, (png_infopp)NULL);
+        fclose(imgFile);
+        throw std::runtime_error("Error in LoadPNG");
+    }
+
+    Initialize(width, height, format, options.rowOrder);
+
+    // Data in the png file begins with the topmost row of the image.
+    // The STImage class stores data bottom row first by default, to be
+    // consistent with OpenGL pixel formats, so each row is decoded
+    // straight into its location in either row order.
+    for (int pass = 0; pass < numPasses; ++pass) {
+        for (int i = 0; i < height; ++i) {
+            png_read_row(pngPtr, (png_bytep) GetRow(height-i-1), NULL);
         }
     }
 
+    png_read_end(pngPtr, NULL);
 
     // Clean up libpng.
     png_destroy_read_struct(&pngPtr, &infoPtr, (png_infopp)NULL);
@@ -216,19 +222,12 @@ STImage::SavePNG(const std::string& filename) const
         PNG_COMPRESSION_TYPE_DEFAULT,
         PNG_FILTER_TYPE_DEFAULT);
 
-    // allocate a set of row pointers that points directly into the existing
-    // array of STPixels
-    png_bytepp rowPointers = (png_bytepp)png_malloc( pngPtr, sizeof(png_bytep) * mHeight );
+    png_write_info(pngPtr, infoPtr);
 
+    // Stream the rows straight out of the existing array of STPixels,
+    // topmost row first as the png format requires.
     for (int i=0; i<mHeight; i++)
-        rowPointers[i] = (png_bytep)(mPixels + (mHeight-i-1)*mWidth);
-
-    png_set_rows(pngPtr, infoPtr, rowPointers);
-
-    // write the image data to the specified file
-    png_write_png(pngPtr, infoPtr, PNG_TRANSFORM_IDENTITY, NULL);
-
-    png_free( pngPtr, rowPointers ) ;
+        png_write_row(pngPtr, (png_bytep) GetRow(mHeight-i-1));
 
     // cleanup
     png_write_end(pngPtr, NULL);
@@ -1,10 +1,21 @@
 // STImage_ppm.cpp
 #include "STImage.h"
 
+#include "STMappedFile.h"
 #include "st.h"
 
 #include <string.h>
 #include <stdio.h>
+#include <vector>
+
+// Expand pixels with byte shuffles on processors with SSSE3, which
+// GCC and Clang can compile for without targeting it throughout.
+// Otherwise a 32-bit word at a time is quick enough to keep up with
+// the file system.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ST_PPM_SSSE3
+#include <tmmintrin.h>
+#endif
 
 // The PPM format guarantees no line in the file is longer
 // than 70 characters. We are a little conservative here.
@@ -28,9 +39,368 @@ PPMNextLine(FILE* ppmFile, char* line)
 }
 
 //
-// Creates an STImage from the contents of a PPM file
+// Returns the next whitespace-separated token of a line and advances
+// the cursor past it, or returns NULL at the end of the line. Unlike
+// strtok() this keeps no hidden state, so several images can be
+// loaded at once on different threads.
+//
+static char*
+PPMNextToken(char** cursor)
+{
+    char* tok = *cursor + strspn(*cursor, " \t\r\n");
+    if (*tok == '\0')
+        return NULL;
+
+    char* end = tok + strcspn(tok, " \t\r\n");
+    *cursor = (*end != '\0') ? end + 1 : end;
+    *end = '\0';
+    return tok;
+}
+
+//
+// Is the host little-endian, so that four bytes in memory
+// read as a word with the first byte lowest?
+//
+static bool
+IsLittleEndian()
+{
+    unsigned int one = 1;
+    return *(unsigned char*) &one == 1;
+}
+
+#ifdef ST_PPM_SSSE3
+//
+// Does the processor run SSSE3 instructions?
 //
-void STImage::LoadPPM(const std::string& filename)
+static bool
+HasSSSE3()
+{
+    static const bool hasSSSE3 = __builtin_cpu_supports("ssse3") != 0;
+    return hasSSSE3;
+}
+
+//
+// Expand as many RGB pixels to RGBA as the SSSE3 loop can, sixteen
+// at a time, returning how many that was.
+//
+__attribute__((target("ssse3"))) static int
+ExpandRGBToRGBASSSE3(const unsigned char* src, STColor4ub* dst, int numPixels)
+{
+    // Four pixels per shuffle. The last load starts four bytes
+    // early so that it stays within the row.
+    const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                         6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i spreadLast = _mm_setr_epi8(4, 5, 6, -1, 7, 8, 9, -1,
+                                             10, 11, 12, -1, 13, 14, 15, -1);
+    const __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+    int i = 0;
+    for (; i + 16 <= numPixels; i += 16, src += 48) {
+        __m128i a = _mm_loadu_si128((const __m128i*) src);
+        __m128i b = _mm_loadu_si128((const __m128i*) (src + 12));
+        __m128i c = _mm_loadu_si128((const __m128i*) (src + 24));
+        __m128i d = _mm_loadu_si128((const __m128i*) (src + 32));
+        __m128i* out = (__m128i*) (dst + i);
+        _mm_storeu_si128(out, _mm_or_si128(_mm_shuffle_epi8(a, spread), alpha));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(b, spread), alpha));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(c, spread), alpha));
+        _mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(d, spreadLast), alpha));
+    }
+    return i;
+}
+
+//
+// Pack as many RGBA pixels to RGB as the SSSE3 loop can, four at
+// a time, returning how many that was.
+//
+__attribute__((target("ssse3"))) static int
+PackRGBAToRGBSSSE3(const STColor4ub* src, unsigned char* dst, int numPixels)
+{
+    const __m128i gather = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+                                         10, 12, 13, 14, -1, -1, -1, -1);
+    // Each store writes four bytes beyond its twelve, which the next
+    // store overwrites. Those sixteen bytes fit only while at least six
+    // pixels (eighteen bytes) remain; the rest are left to the caller.
+    int i = 0;
+    for (; i + 6 <= numPixels; i += 4, dst += 12) {
+        __m128i p = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm_storeu_si128((__m128i*) dst, _mm_shuffle_epi8(p, gather));
+    }
+    return i;
+}
+#endif
+
+//
+// Expand packed 8-bit RGB pixels to RGBA, with an opaque alpha.
+//
+static void
+ExpandRGBToRGBA(const unsigned char* src, STColor4ub* dst, int numPixels)
+{
+    int i = 0;
+#ifdef ST_PPM_SSSE3
+    if (HasSSSE3()) {
+        i = ExpandRGBToRGBASSSE3(src, dst, numPixels);
+        src += 3 * i;
+    }
+#endif
+    if (IsLittleEndian()) {
+        // Three words hold four pixels: r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3.
+        const unsigned int alpha = 0xFF000000;
+        for (; i + 4 <= numPixels; i += 4, src += 12) {
+            unsigned int w[3];
+            memcpy(w, src, sizeof(w));
+            unsigned int p[4] = {
+                w[0] | alpha,
+                (w[0] >> 24) | (w[1] << 8) | alpha,
+                (w[1] >> 16) | (w[2] << 16) | alpha,
+                (w[2] >> 8) | alpha,
+            };
+            memcpy((void*) (dst + i), p, sizeof(p));
+        }
+    }
+    for (; i < numPixels; ++i, src += 3)
+        dst[i] = STColor4ub(src[0], src[1], src[2], 255);
+}
+
+//
+// Pack RGBA pixels into 8-bit RGB, dropping the alpha channel.
+//
+static void
+PackRGBAToRGB(const STColor4ub* src, unsigned char* dst, int numPixels)
+{
+    int i = 0;
+#ifdef ST_PPM_SSSE3
+    if (HasSSSE3()) {
+        i = PackRGBAToRGBSSSE3(src, dst, numPixels);
+        dst += 3 * i;
+    }
+#endif
+    if (IsLittleEndian()) {
+        for (; i + 4 <= numPixels; i += 4, dst += 12) {
+            unsigned int p[4];
+            memcpy(p, src + i, sizeof(p));
+            unsigned int w[3] = {
+                (p[0] & 0x00FFFFFF) | (p[1] << 24),
+                ((p[1] >> 8) & 0x0000FFFF) | (p[2] << 16),
+                ((p[2] >> 16) & 0x000000FF) | (p[3] << 8),
+            };
+            memcpy(dst, w, sizeof(w));
+        }
+    }
+    for (; i < numPixels; ++i, dst += 3) {
+        dst[0] = src[i].r;
+        dst[1] = src[i].g;
+        dst[2] = src[i].b;
+    }
+}
+
+//
+// Skip whitespace and comments in the header of a binary PPM file.
+//
+static const unsigned char*
+PNMSkipSpace(const unsigned char* cursor, const unsigned char* end)
+{
+    while (cursor < end) {
+        if (*cursor == '#') {
+            while (cursor < end && *cursor != '\n')
+                ++cursor;
+        }
+        else if (*cursor == ' ' || *cursor == '\t' ||
+                 *cursor == '\r' || *cursor == '\n') {
+            ++cursor;
+        }
+        else {
+            break;
+        }
+    }
+    return cursor;
+}
+
+//
+// Parse a decimal integer in the header of a binary PPM file and
+// advance the cursor past it. Returns false if there is none.
+//
+static bool
+PNMReadInt(const unsigned char** cursor, const unsigned char* end, int* value)
+{
+    const unsigned char* p = *cursor;
+    int result = 0;
+    while (p < end && *p >= '0' && *p <= '9' && result < 1000000)
+        result = result * 10 + (*p++ - '0');
+
+    if (p == *cursor)
+        return false;
+    *cursor = p;
+    *value = result;
+    return true;
+}
+
+//
+// Parse a whitespace-separated word in the header of a PAM file
+// and advance the cursor past it.
+//
+static std::string
+PAMReadWord(const unsigned char** cursor, const unsigned char* end)
+{
+    const unsigned char* p = *cursor;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+        ++p;
+
+    std::string word((const char*) *cursor, p - *cursor);
+    *cursor = p;
+    return word;
+}
+
+//
+// Creates an STImage from the contents of a PPM or PAM file. Binary
+// files are mapped into memory and decoded a row at a time straight
+// from the mapping; plain PPM files are parsed as text.
+//
+void STImage::LoadPPM(const std::string& filename, const LoadOptions& options)
+{
+    STMappedFile* file = new STMappedFile();
+    if (file->Open(filename, true) != ST_OK) {
+        delete file;
+        fprintf(stderr, "STImage::LoadPPM() - Could not open '%s'.\n",
+                filename.c_str());
+        throw std::runtime_error("Error in LoadPPM");
+    }
+
+    const unsigned char* cursor = file->GetData();
+    const unsigned char* end = cursor + file->GetSize();
+
+    if (end - cursor >= 2 && cursor[0] == 'P' && cursor[1] == '3') {
+        delete file;
+        LoadPPMText(filename, options);
+        return;
+    }
+
+    // P6 files are RGB. P7 (PAM) files name their number of
+    // channels, which may be 1 to 4 (grey, grey-alpha, RGB, RGBA).
+    int width = 0;
+    int height = 0;
+    int depth = 3;
+    int maxVal = 0;
+    bool valid = (end - cursor >= 2 && cursor[0] == 'P');
+
+    if (valid && cursor[1] == '6') {
+        cursor += 2;
+        cursor = PNMSkipSpace(cursor, end);
+        valid = PNMReadInt(&cursor, end, &width);
+        cursor = PNMSkipSpace(cursor, end);
+        valid = valid && PNMReadInt(&cursor, end, &height);
+        cursor = PNMSkipSpace(cursor, end);
+        valid = valid && PNMReadInt(&cursor, end, &maxVal);
+
+        // A single whitespace character ends the header.
+        valid = valid && cursor < end;
+        ++cursor;
+    }
+    else if (valid && cursor[1] == '7') {
+        cursor += 2;
+        depth = 0;
+        for (;;) {
+            cursor = PNMSkipSpace(cursor, end);
+            std::string key = PAMReadWord(&cursor, end);
+            if (key.empty() || key == "ENDHDR")
+                break;
+
+            cursor = PNMSkipSpace(cursor, end);
+            if (key == "WIDTH")
+                valid = valid && PNMReadInt(&cursor, end, &width);
+            else if (key == "HEIGHT")
+                valid = valid && PNMReadInt(&cursor, end, &height);
+            else if (key == "DEPTH")
+                valid = valid && PNMReadInt(&cursor, end, &depth);
+            else if (key == "MAXVAL")
+                valid = valid && PNMReadInt(&cursor, end, &maxVal);
+            else
+                PAMReadWord(&cursor, end); // TUPLTYPE is implied by DEPTH.
+        }
+
+        // The line holding ENDHDR ends the header.
+        while (cursor < end && *cursor != '\n')
+            ++cursor;
+        ++cursor;
+    }
+    else {
+        valid = false;
+    }
+
+    int bytesPerSample = (maxVal > 255) ? 2 : 1;
+    valid = valid && width > 0 && height > 0 && depth >= 1 && depth <= 4 &&
+        maxVal > 0 && maxVal <= 65535 &&
+        cursor <= end &&
+        (size_t) (end - cursor) / ((size_t) width * depth * bytesPerSample)
+            >= (size_t) height;
+    if (!valid) {
+        delete file;
+        fprintf(stderr, "STImage::LoadPPM() - Invalid PPM file '%s'.\n",
+                filename.c_str());
+        throw std::runtime_error("Error in LoadPPM");
+    }
+
+    const unsigned char* pixels = cursor;
+    int fileStride = width * depth * bytesPerSample;
+    bool fullRange = (maxVal == 255);
+
+    // Rows of 8-bit RGBA in file order are already what STImage
+    // stores, so keep the mapping and use them in place. The mapping
+    // is copy-on-write, so writing the pixels leaves the file alone.
+    if (depth == 4 && fullRange && options.rowOrder == kTopDown) {
+        mWidth = width;
+        mHeight = height;
+        mFormat = kRGBA8;
+        mStride = fileStride;
+        mRowOrder = kTopDown;
+        mOwnsData = false;
+        mMappedFile = file;
+        mData = file->GetPrivateData() + (pixels - file->GetData());
+        return;
+    }
+
+    Initialize(width, height, kRGBA8, options.rowOrder);
+
+    // The file begins with the topmost row of the image.
+    for (int i = 0; i < height; ++i) {
+        const unsigned char* src = pixels + (size_t) i * fileStride;
+        STColor4ub* dst = (STColor4ub*) GetRow(height - 1 - i);
+
+        if (depth == 3 && fullRange) {
+            ExpandRGBToRGBA(src, dst, width);
+        }
+        else if (depth == 4 && fullRange) {
+            memcpy((void*) dst, src, width * sizeof(STColor4ub));
+        }
+        else {
+            // Other depths and ranges, including 16-bit samples
+            // (which are big-endian), a sample at a time.
+            unsigned char samples[4];
+            for (int x = 0; x < width; ++x) {
+                for (int c = 0; c < depth; ++c) {
+                    int value = (bytesPerSample == 2) ?
+                        ((src[0] << 8) | src[1]) : src[0];
+                    src += bytesPerSample;
+                    samples[c] = (unsigned char)
+                        ((STMin(value, maxVal) * 255 + maxVal / 2) / maxVal);
+                }
+
+                switch (depth) {
+                    case 1:  dst[x] = STColor4ub(samples[0], samples[0], samples[0], 255); break;
+                    case 2:  dst[x] = STColor4ub(samples[0], samples[0], samples[0], samples[1]); break;
+                    case 3:  dst[x] = STColor4ub(samples[0], samples[1], samples[2], 255); break;
+                    default: dst[x] = STColor4ub(samples[0], samples[1], samples[2], samples[3]); break;
+                }
+            }
+        }
+    }
+
+    delete file;
+}
+
+//
+// Creates an STImage from the contents of a plain (ASCII) PPM file
+//
+void STImage::LoadPPMText(const std::string& filename, const LoadOptions& options)
 {
     FILE* imgFile = fopen(filename.c_str(), "r");
     if (!imgFile) {
@@ -55,12 +425,13 @@ void STImage::LoadPPM(const std::string& filename)
     int pos = 0;
     int header[3];
     while (pos < 3 && PPMNextLine(imgFile, line)) {
-        char* tok = strtok(line, " \t\n");
+        char* cursor = line;
+        char* tok = PPMNextToken(&cursor);
         while (tok) {
             int val = 0;
             sscanf(tok, "%d", &val);
             header[pos++] = val;
-            tok = strtok(NULL, " \t\n");
+            tok = PPMNextToken(&cursor);
         } 
     }
 
@@ -71,8 +442,7 @@ void STImage::LoadPPM(const std::string& filename)
     int numPixels = width * height;
     int curComponent = 0;
 
-    Initialize(width, height);
-    STColor4ub* pixels = mPixels;
+    Initialize(width, height, kRGBA8, options.rowOrder);
 
     int pixelValues[3];
 
@@ -80,7 +450,8 @@ void STImage::LoadPPM(const std::string& filename)
 
     while ( pos < numPixels && PPMNextLine(imgFile, line)) {
 
-        char* tok = strtok(line, " \t\n");
+        char* cursor = line;
+        char* tok = PPMNextToken(&cursor);
 
         while (tok) {
             int val = 0;
@@ -89,11 +460,14 @@ void STImage::LoadPPM(const std::string& filename)
             pixelValues[curComponent] = val;
             
             if (curComponent == 2) {
-                // done with this pixel, store the pixel and move to next
-                pixels[pos].r = pixelValues[0] * 255 / maxVal;
-                pixels[pos].g = pixelValues[1] * 255 / maxVal;
-                pixels[pos].b = pixelValues[2] * 255 / maxVal;
-                pixels[pos].a = 255;
+                // done with this pixel, store the pixel and move to next.
+                // The file begins with the topmost row of the image.
+                int row = height - 1 - pos / width;
+                STColor4ub* pixel = (STColor4ub*) GetRow(row) + pos % width;
+                pixel->r = pixelValues[0] * 255 / maxVal;
+                pixel->g = pixelValues[1] * 255 / maxVal;
+                pixel->b = pixelValues[2] * 255 / maxVal;
+                pixel->a = 255;
 
                 curComponent = 0;
                 pos++;
@@ -102,7 +476,7 @@ void STImage::LoadPPM(const std::string& filename)
                 curComponent++;
             }
 
-            tok = strtok(NULL, " \t\n");
+            tok = PPMNextToken(&cursor);
         } 
     }
     
@@ -110,28 +484,72 @@ void STImage::LoadPPM(const std::string& filename)
 }
 
 //
-// Create a PPM file from the pixel contents of the STImage
+// Write a whole image file with a single call, so that the file
+// system sees one large write rather than a stream of small ones.
 //
-STStatus
-STImage::SavePPM(const std::string& filename) const
+static STStatus
+PNMWriteFile(const std::string& filename, const char* caller,
+             const std::vector<unsigned char>& contents)
 {
-    FILE* imgFile = fopen(filename.c_str(), "w");
+    FILE* imgFile = fopen(filename.c_str(), "wb");
     if (!imgFile) {
-        fprintf(stderr, "STImage::SavePPM() - Could not open '%s'.\n",
-                filename.c_str());
+        fprintf(stderr, "STImage::%s() - Could not open '%s'.\n",
+                caller, filename.c_str());
         return ST_ERROR;
     }
 
-    fprintf(imgFile, "P3\n");
-    fprintf(imgFile, "%d %d\n", mWidth, mHeight);
-    fprintf(imgFile, "255\n");
-
-    int numPixels = mWidth * mHeight;
-    for (int ii = 0; ii < numPixels; ++ii) {
-        STColor4ub pixel = mPixels[ii];
-        fprintf(imgFile,"%d %d %d\n", pixel.r, pixel.g, pixel.b);
+    size_t written = fwrite(&contents[0], 1, contents.size(), imgFile);
+    if (fclose(imgFile) != 0 || written != contents.size()) {
+        fprintf(stderr, "STImage::%s() - Could not write '%s'.\n",
+                caller, filename.c_str());
+        return ST_ERROR;
     }
-    fclose(imgFile);
 
     return ST_OK;
 }
+
+//
+// Create a binary (P6) PPM file from the pixel contents of the
+// STImage. The alpha channel is dropped.
+//
+STStatus
+STImage::SavePPM(const std::string& filename) const
+{
+    char header[64];
+    int headerSize = sprintf(header, "P6\n%d %d\n255\n", mWidth, mHeight);
+
+    int rowBytes = mWidth * 3;
+    std::vector<unsigned char> contents(headerSize + (size_t) rowBytes * mHeight);
+    memcpy(&contents[0], header, headerSize);
+
+    // Write the topmost row first, as the PPM format requires.
+    unsigned char* out = &contents[headerSize];
+    for (int y = mHeight - 1; y >= 0; --y, out += rowBytes)
+        PackRGBAToRGB((const STColor4ub*) GetRow(y), out, mWidth);
+
+    return PNMWriteFile(filename, "SavePPM", contents);
+}
+
+//
+// Create an 8-bit RGBA PAM (P7) file from the pixel contents
+// of the STImage.
+//
+STStatus
+STImage::SavePAM(const std::string& filename) const
+{
+    char header[128];
+    int headerSize = sprintf(header,
+                             "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\n"
+                             "TUPLTYPE RGB_ALPHA\nENDHDR\n", mWidth, mHeight);
+
+    int rowBytes = mWidth * (int) sizeof(STColor4ub);
+    std::vector<unsigned char> contents(headerSize + (size_t) rowBytes * mHeight);
+    memcpy(&contents[0], header, headerSize);
+
+    // Write the topmost row first, as the PAM format requires.
+    unsigned char* out = &contents[headerSize];
+    for (int y = mHeight - 1; y >= 0; --y, out += rowBytes)
+        memcpy(out, GetRow(y), rowBytes);
+
+    return PNMWriteFile(filename, "SavePAM", contents);
+}
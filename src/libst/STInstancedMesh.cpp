@@ -0,0 +1,359 @@
+// STInstancedMesh.cpp
+
+/* Include-order dependency!
+*
+* GLEW must be included before the standard GL.h header.
+* In this case, it means we must violate the usual design
+* principle of always including Foo.h first in Foo.cpp.
+*/
+#ifdef __APPLE__
+#define GLEW_VERSION_2_0 1
+#include <OpenGL/gl.h>
+#else
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GL/gl.h"
+#endif
+
+#include "STInstancedMesh.h"
+
+#include "STColor4f.h"
+#include "STGLState.h"
+#include "STMatrix4.h"
+#include "STShaderProgram.h"
+#include "STTriangleMesh.h"
+#include "STUtil.h"
+#include "stglproc.h"
+
+#include <map>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// Instanced drawing (OpenGL 3.3, or ARB_instanced_arrays with
+// ARB_draw_instanced) is newer than the GLEW in ext/, so its entry
+// points are looked up here.
+
+typedef void (STAPIENTRY *STDrawElementsInstancedProc)(GLenum mode, GLsizei count,
+                                                       GLenum type, const void* indices,
+                                                       GLsizei instanceCount);
+typedef void (STAPIENTRY *STVertexAttribDivisorProc)(GLuint index, GLuint divisor);
+
+static STDrawElementsInstancedProc sDrawElementsInstanced = NULL;
+static STVertexAttribDivisorProc sVertexAttribDivisor = NULL;
+
+//
+// Can instances be drawn by the GPU with a single call? Checked once.
+//
+bool STInstancedMesh::HasInstancing()
+{
+    static int sSupported = -1;
+    if (sSupported >= 0)
+        return sSupported != 0;
+    sSupported = 0;
+
+#ifndef __APPLE__
+    if (!GLEW_VERSION_2_0)
+        return false;
+
+    int major = 0, minor = 0;
+    const char* version = (const char*) glGetString(GL_VERSION);
+    if (version)
+        sscanf(version, "%d.%d", &major, &minor);
+    if (major * 10 + minor >= 33) {
+        sDrawElementsInstanced = (STDrawElementsInstancedProc) STGetProcAddress("glDrawElementsInstanced");
+        sVertexAttribDivisor = (STVertexAttribDivisorProc) STGetProcAddress("glVertexAttribDivisor");
+    }
+    else {
+        // Older contexts list their extensions in one string.
+        const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+        if (extensions && strstr(extensions, "GL_ARB_instanced_arrays") &&
+            strstr(extensions, "GL_ARB_draw_instanced")) {
+            sDrawElementsInstanced = (STDrawElementsInstancedProc) STGetProcAddress("glDrawElementsInstancedARB");
+            sVertexAttribDivisor = (STVertexAttribDivisorProc) STGetProcAddress("glVertexAttribDivisorARB");
+        }
+    }
+
+    if (sDrawElementsInstanced && sVertexAttribDivisor)
+        sSupported = 1;
+#endif
+    return sSupported != 0;
+}
+
+STInstancedMesh::STInstancedMesh(const STTriangleMesh* mesh)
+    : mMesh(mesh),
+      mVertexBuffer(0),
+      mIndexBuffer(0),
+      mInstanceBuffer(0),
+      mInstancesChanged(true),
+      mTransformedVertexBuffer(0),
+      mTransformedIndexBuffer(0),
+      mTransformedChanged(true)
+{
+    mesh->AppendBuffers(&mVertices, &mIndices);
+}
+
+STInstancedMesh::~STInstancedMesh()
+{
+    GLuint buffers[] = { mVertexBuffer, mIndexBuffer, mInstanceBuffer,
+                         mTransformedVertexBuffer, mTransformedIndexBuffer };
+    for (int i = 0; i < 5; ++i) {
+        if (buffers[i])
+            glDeleteBuffers(1, &buffers[i]);
+    }
+}
+
+//
+// Add an instance, returning its index.
+//
+int STInstancedMesh::AddInstance(const STMatrix4& transform)
+{
+    const float* diffuse = mMesh->mMaterialDiffuse;
+    return AddInstance(transform, STColor4f(diffuse[0], diffuse[1], diffuse[2], diffuse[3]));
+}
+
+int STInstancedMesh::AddInstance(const STMatrix4& transform, const STColor4f& diffuse)
+{
+    mInstances.push_back(Instance());
+    SetInstance((int) mInstances.size() - 1, transform, diffuse);
+    return (int) mInstances.size() - 1;
+}
+
+//
+// Change an instance that was added.
+//
+void STInstancedMesh::SetInstance(int instance, const STMatrix4& transform,
+                                  const STColor4f& diffuse)
+{
+    Instance& data = mInstances[instance];
+    for (int column = 0; column < 4; ++column) {
+        for (int row = 0; row < 4; ++row)
+            data.transform[column * 4 + row] = transform.table[row][column];
+    }
+    data.diffuse[0] = diffuse.r;
+    data.diffuse[1] = diffuse.g;
+    data.diffuse[2] = diffuse.b;
+    data.diffuse[3] = diffuse.a;
+
+    mInstancesChanged = true;
+    mTransformedChanged = true;
+}
+
+//
+// Remove all the instances.
+//
+void STInstancedMesh::ClearInstances()
+{
+    mInstances.clear();
+    mInstancesChanged = true;
+    mTransformedChanged = true;
+}
+
+//
+// Upload the mesh, if it has not been yet, and the instances, if
+// they changed.
+//
+void STInstancedMesh::UploadInstances()
+{
+    if (!mVertexBuffer) {
+        glGenBuffers(1, &mVertexBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, mVertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, mVertices.size() * sizeof(STBufferVertex),
+                     &mVertices[0], GL_STATIC_DRAW);
+
+        glGenBuffers(1, &mIndexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mIndices.size() * sizeof(unsigned int),
+                     &mIndices[0], GL_STATIC_DRAW);
+    }
+
+    if (mInstancesChanged) {
+        if (!mInstanceBuffer)
+            glGenBuffers(1, &mInstanceBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, mInstances.size() * sizeof(Instance),
+                     &mInstances[0], GL_DYNAMIC_DRAW);
+        mInstancesChanged = false;
+    }
+}
+
+//
+// Pack a color to 8 bits per channel, the precision it is drawn with,
+// so that instances whose colors look the same are drawn together.
+//
+static unsigned int
+PackColor(const float* color)
+{
+    unsigned int packed = 0;
+    for (int i = 0; i < 4; ++i) {
+        float c = STMin(STMax(color[i], 0.0f), 1.0f);
+        packed = (packed << 8) | (unsigned int) (c * 255.0f + 0.5f);
+    }
+    return packed;
+}
+
+//
+// Transform every instance on the CPU, if they changed, and upload
+// them with the instances of each diffuse color next to each other.
+//
+void STInstancedMesh::UploadTransformed()
+{
+    if (!mTransformedChanged)
+        return;
+    mTransformedChanged = false;
+
+    // List the instances of each color, in the order the colors
+    // are first seen.
+    std::map<unsigned int, int> colorIds;
+    std::vector<std::vector<int> > colorInstances;
+    for (size_t i = 0; i < mInstances.size(); ++i) {
+        unsigned int color = PackColor(mInstances[i].diffuse);
+        std::map<unsigned int, int>::iterator it = colorIds.find(color);
+        if (it == colorIds.end()) {
+            it = colorIds.insert(std::make_pair(color, (int) colorInstances.size())).first;
+            colorInstances.push_back(std::vector<int>());
+        }
+        colorInstances[it->second].push_back((int) i);
+    }
+
+    std::vector<STBufferVertex> vertices;
+    std::vector<unsigned int> indices;
+    vertices.reserve(mVertices.size() * mInstances.size());
+    indices.reserve(mIndices.size() * mInstances.size());
+    mRunCounts.clear();
+    mRunOffsets.clear();
+    mRunInstances.clear();
+    for (size_t c = 0; c < colorInstances.size(); ++c) {
+        mRunCounts.push_back((GLsizei) (mIndices.size() * colorInstances[c].size()));
+        mRunOffsets.push_back((const GLvoid*) (indices.size() * sizeof(unsigned int)));
+        mRunInstances.push_back(colorInstances[c][0]);
+
+        for (size_t k = 0; k < colorInstances[c].size(); ++k) {
+            const float* m = mInstances[colorInstances[c][k]].transform;
+            unsigned int base = (unsigned int) vertices.size();
+            for (size_t v = 0; v < mVertices.size(); ++v) {
+                STBufferVertex vertex = mVertices[v];
+                const float* p = mVertices[v].position;
+                for (int row = 0; row < 3; ++row)
+                    vertex.position[row] = m[row] * p[0] + m[4 + row] * p[1] + m[8 + row] * p[2] + m[12 + row];
+
+                // Scaling changes the length of the normals, so
+                // they are normalized again.
+                const float* normals[2] = { mVertices[v].normal, mVertices[v].faceNormal };
+                float* transformed[2] = { vertex.normal, vertex.faceNormal };
+                for (int n = 0; n < 2; ++n) {
+                    const float* in = normals[n];
+                    float* out = transformed[n];
+                    for (int row = 0; row < 3; ++row)
+                        out[row] = m[row] * in[0] + m[4 + row] * in[1] + m[8 + row] * in[2];
+                    float length = sqrtf(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+                    if (length > 0) {
+                        for (int row = 0; row < 3; ++row)
+                            out[row] /= length;
+                    }
+                }
+                vertices.push_back(vertex);
+            }
+            for (size_t i = 0; i < mIndices.size(); ++i)
+                indices.push_back(base + mIndices[i]);
+        }
+    }
+
+    if (!mTransformedVertexBuffer) {
+        glGenBuffers(1, &mTransformedVertexBuffer);
+        glGenBuffers(1, &mTransformedIndexBuffer);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, mTransformedVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(STBufferVertex),
+                 vertices.empty() ? NULL : &vertices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mTransformedIndexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
+                 indices.empty() ? NULL : &indices[0], GL_STATIC_DRAW);
+}
+
+//
+// Set the vertex arrays to read from a buffer of vertices.
+//
+void STInstancedMesh::SetVertexArrays(GLuint buffer, bool smooth)
+{
+    GLsizei stride = sizeof(STBufferVertex);
+    size_t normal = smooth ? offsetof(STBufferVertex, normal) : offsetof(STBufferVertex, faceNormal);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, stride, (const GLvoid*) offsetof(STBufferVertex, position));
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glNormalPointer(GL_FLOAT, stride, (const GLvoid*) normal);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, stride, (const GLvoid*) offsetof(STBufferVertex, texPos));
+}
+
+//
+// Draw all the instances.
+//
+void STInstancedMesh::Draw(bool smooth, STShaderProgram* program)
+{
+    if (mInstances.empty() || mIndices.empty())
+        return;
+
+    int transform = -1;
+    int diffuse = -1;
+    if (program && HasInstancing()) {
+        transform = program->GetAttribLocation("instanceTransform");
+        diffuse = program->GetAttribLocation("instanceDiffuse");
+    }
+
+    mMesh->BindMaterial();
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+
+    if (transform >= 0) {
+        UploadInstances();
+        SetVertexArrays(mVertexBuffer, smooth);
+
+        // A mat4 attribute takes one location for each column.
+        std::vector<int> attributes;
+        std::vector<size_t> offsets;
+        for (int column = 0; column < 4; ++column) {
+            attributes.push_back(transform + column);
+            offsets.push_back(offsetof(Instance, transform) + column * 4 * sizeof(float));
+        }
+        if (diffuse >= 0) {
+            attributes.push_back(diffuse);
+            offsets.push_back(offsetof(Instance, diffuse));
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+        for (size_t i = 0; i < attributes.size(); ++i) {
+            glEnableVertexAttribArray(attributes[i]);
+            glVertexAttribPointer(attributes[i], 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                                  (const GLvoid*) offsets[i]);
+            sVertexAttribDivisor(attributes[i], 1);
+        }
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexBuffer);
+        sDrawElementsInstanced(GL_TRIANGLES, (GLsizei) mIndices.size(), GL_UNSIGNED_INT,
+                               NULL, (GLsizei) mInstances.size());
+
+        // Put the attributes back as other drawing expects them.
+        for (size_t i = 0; i < attributes.size(); ++i) {
+            sVertexAttribDivisor(attributes[i], 0);
+            glDisableVertexAttribArray(attributes[i]);
+        }
+    }
+    else {
+        UploadTransformed();
+        SetVertexArrays(mTransformedVertexBuffer, smooth);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mTransformedIndexBuffer);
+        for (size_t i = 0; i < mRunCounts.size(); ++i) {
+            STGLState::Material(GL_DIFFUSE, mInstances[mRunInstances[i]].diffuse);
+            glDrawElements(GL_TRIANGLES, mRunCounts[i], GL_UNSIGNED_INT, mRunOffsets[i]);
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glPopClientAttrib();
+    mMesh->UnBindMaterial();
+}
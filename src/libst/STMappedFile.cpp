@@ -0,0 +1,144 @@
+// STMappedFile.cpp
+#include "STMappedFile.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+STMappedFile::STMappedFile()
+    : mData(NULL)
+    , mSize(0)
+    , mCopyOnWrite(false)
+#ifdef _WIN32
+    , mFileHandle(INVALID_HANDLE_VALUE)
+    , mMappingHandle(NULL)
+#endif
+{
+}
+
+STMappedFile::~STMappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+//
+// Map the entire contents of a file into memory, optionally
+// copy-on-write. Returns a non-zero value on error.
+//
+STStatus STMappedFile::Open(const std::string& filename, bool copyOnWrite)
+{
+    Close();
+
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ,
+                              FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return ST_ERROR;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return ST_ERROR;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL,
+                                        copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY,
+                                        0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        return ST_ERROR;
+    }
+
+    void* data = MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ,
+                               0, 0, 0);
+    if (data == NULL) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return ST_ERROR;
+    }
+
+    mFileHandle = file;
+    mMappingHandle = mapping;
+    mData = (const unsigned char*) data;
+    mSize = (size_t) size.QuadPart;
+    mCopyOnWrite = copyOnWrite;
+    return ST_OK;
+}
+
+//
+// Unmap the file.
+//
+void STMappedFile::Close()
+{
+    if (mData != NULL)
+        UnmapViewOfFile(mData);
+    if (mMappingHandle != NULL)
+        CloseHandle(mMappingHandle);
+    if (mFileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(mFileHandle);
+
+    mData = NULL;
+    mSize = 0;
+    mCopyOnWrite = false;
+    mMappingHandle = NULL;
+    mFileHandle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+//
+// Map the entire contents of a file into memory, optionally
+// copy-on-write. Returns a non-zero value on error.
+//
+STStatus STMappedFile::Open(const std::string& filename, bool copyOnWrite)
+{
+    Close();
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return ST_ERROR;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return ST_ERROR;
+    }
+
+    int protection = copyOnWrite ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void* data = mmap(NULL, (size_t) info.st_size, protection, MAP_PRIVATE, fd, 0);
+
+    // The mapping keeps its own reference to the file.
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return ST_ERROR;
+
+    mData = (const unsigned char*) data;
+    mSize = (size_t) info.st_size;
+    mCopyOnWrite = copyOnWrite;
+    return ST_OK;
+}
+
+//
+// Unmap the file.
+//
+void STMappedFile::Close()
+{
+    if (mData != NULL)
+        munmap((void*) mData, mSize);
+
+    mData = NULL;
+    mSize = 0;
+    mCopyOnWrite = false;
+}
+
+#endif
@@ -0,0 +1,214 @@
+// STMeshBatch.cpp
+
+/* Include-order dependency!
+*
+* GLEW must be included before the standard GL.h header.
+* In this case, it means we must violate the usual design
+* principle of always including Foo.h first in Foo.cpp.
+*/
+#ifdef __APPLE__
+#define GLEW_VERSION_2_0 1
+#include <OpenGL/gl.h>
+#else
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GL/gl.h"
+#endif
+
+#include "STMeshBatch.h"
+
+#include "STTriangleMesh.h"
+
+#include <map>
+#include <stddef.h>
+#include <utility>
+
+// What tells meshes with different color maps or materials apart.
+typedef std::pair<const STTexture*, STMaterialKey> STMaterialState;
+
+STMeshBatch::STMeshBatch()
+    : mRunsChanged(false),
+      mVertexBuffer(0),
+      mIndexBuffer(0),
+      mNumDrawCalls(0)
+{
+}
+
+STMeshBatch::~STMeshBatch()
+{
+    Clear();
+}
+
+//
+// Copy the meshes into the batch.
+//
+void STMeshBatch::Build(const std::vector<STTriangleMesh*>& meshes)
+{
+    Clear();
+
+    // Number the groups in the order they are first seen, and
+    // list the meshes in each.
+    std::map<STMaterialState, int> groupIds;
+    std::vector<std::vector<int> > groupMeshes;
+    mRanges.resize(meshes.size());
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        STMaterialState state(meshes[i]->mSurfaceColorTex, meshes[i]->GetMaterialKey());
+        std::map<STMaterialState, int>::iterator it = groupIds.find(state);
+        if (it == groupIds.end()) {
+            it = groupIds.insert(std::make_pair(state, (int) mGroups.size())).first;
+            Group group;
+            group.material = meshes[i];
+            mGroups.push_back(group);
+            groupMeshes.push_back(std::vector<int>());
+        }
+        groupMeshes[it->second].push_back((int) i);
+        mMeshes.push_back(meshes[i]);
+    }
+
+    // Lay out the meshes of each group one after another.
+    std::vector<STBufferVertex> vertices;
+    std::vector<unsigned int> indices;
+    for (size_t g = 0; g < groupMeshes.size(); ++g) {
+        for (size_t k = 0; k < groupMeshes[g].size(); ++k) {
+            Range& range = mRanges[groupMeshes[g][k]];
+            range.group = (int) g;
+            range.firstIndex = (int) indices.size();
+            mMeshes[groupMeshes[g][k]]->AppendBuffers(&vertices, &indices);
+            range.numIndices = (int) indices.size() - range.firstIndex;
+            range.visible = true;
+        }
+    }
+    mRunsChanged = true;
+
+    if (indices.empty())
+        return;
+
+    glGenBuffers(1, &mVertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, mVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(STBufferVertex),
+                 &vertices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenBuffers(1, &mIndexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
+                 &indices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+//
+// Remove all the meshes and free the buffers.
+//
+void STMeshBatch::Clear()
+{
+    if (mVertexBuffer)
+        glDeleteBuffers(1, &mVertexBuffer);
+    if (mIndexBuffer)
+        glDeleteBuffers(1, &mIndexBuffer);
+    mVertexBuffer = 0;
+    mIndexBuffer = 0;
+
+    mMeshes.clear();
+    mRanges.clear();
+    mGroups.clear();
+    mRunsChanged = false;
+}
+
+//
+// Show or hide a mesh.
+//
+void STMeshBatch::SetVisible(int mesh, bool visible)
+{
+    if (mRanges[mesh].visible != visible) {
+        mRanges[mesh].visible = visible;
+        mRunsChanged = true;
+    }
+}
+
+bool STMeshBatch::IsVisible(int mesh) const
+{
+    return mRanges[mesh].visible;
+}
+
+//
+// Find the runs of indices to draw for each group. Visible meshes
+// next to each other in the index buffer are drawn as one run.
+//
+void STMeshBatch::UpdateRuns()
+{
+    for (size_t g = 0; g < mGroups.size(); ++g) {
+        mGroups[g].counts.clear();
+        mGroups[g].offsets.clear();
+    }
+
+    // The ranges of a group are in index buffer order, but the
+    // groups are interleaved, so each one tracks where its last
+    // run ends.
+    std::vector<int> groupEnd(mGroups.size(), -1);
+    for (size_t i = 0; i < mRanges.size(); ++i) {
+        const Range& range = mRanges[i];
+        if (!range.visible || range.numIndices == 0)
+            continue;
+
+        Group& group = mGroups[range.group];
+        if (!group.counts.empty() && range.firstIndex == groupEnd[range.group]) {
+            group.counts.back() += range.numIndices;
+        }
+        else {
+            group.counts.push_back(range.numIndices);
+            group.offsets.push_back((const GLvoid*) (range.firstIndex * sizeof(unsigned int)));
+        }
+        groupEnd[range.group] = range.firstIndex + range.numIndices;
+    }
+    mRunsChanged = false;
+}
+
+//
+// Draw the visible meshes.
+//
+void STMeshBatch::Draw(bool smooth)
+{
+    mNumDrawCalls = 0;
+    if (mRunsChanged)
+        UpdateRuns();
+
+    for (size_t i = 0; i < mMeshes.size(); ++i) {
+        if (mRanges[i].visible && mMeshes[i]->mDrawAxis)
+            mMeshes[i]->DrawAxis();
+    }
+
+    if (!mVertexBuffer)
+        return;
+
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    glBindBuffer(GL_ARRAY_BUFFER, mVertexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexBuffer);
+
+    GLsizei stride = sizeof(STBufferVertex);
+    size_t normal = smooth ? offsetof(STBufferVertex, normal) : offsetof(STBufferVertex, faceNormal);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, stride, (const GLvoid*) offsetof(STBufferVertex, position));
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glNormalPointer(GL_FLOAT, stride, (const GLvoid*) normal);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, stride, (const GLvoid*) offsetof(STBufferVertex, texPos));
+
+    const STTriangleMesh* bound = NULL;
+    for (size_t g = 0; g < mGroups.size(); ++g) {
+        Group& group = mGroups[g];
+        if (group.counts.empty())
+            continue;
+
+        group.material->BindMaterial();
+        bound = group.material;
+        glMultiDrawElements(GL_TRIANGLES, &group.counts[0], GL_UNSIGNED_INT,
+                            &group.offsets[0], (GLsizei) group.counts.size());
+        mNumDrawCalls++;
+    }
+    if (bound)
+        bound->UnBindMaterial();
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glPopClientAttrib();
+}
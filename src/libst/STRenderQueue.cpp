@@ -0,0 +1,185 @@
+// STRenderQueue.cpp
+#include "STRenderQueue.h"
+
+#include "STShaderProgram.h"
+#include "STTriangleMesh.h"
+
+#include <algorithm>
+#include <string.h>
+
+// Bits of the sort key, most significant first: the program, then
+// the color map, then the material.
+static const int kMaterialBits = 24;
+static const int kTextureBits = 24;
+static const int kProgramBits = 16;
+
+static const unsigned long long kMaterialMask = (1ULL << kMaterialBits) - 1;
+static const unsigned long long kTextureMask = (1ULL << kTextureBits) - 1;
+static const unsigned long long kProgramMask = (1ULL << kProgramBits) - 1;
+
+// The color map and material part of a key.
+static const unsigned long long kStateMask =
+    (1ULL << (kMaterialBits + kTextureBits)) - 1;
+
+//
+// A key to sort, and the item it belongs to.
+//
+struct STSortEntry {
+    unsigned long long key;
+    int index;
+};
+
+//
+// Sort entries by key, keeping equal keys in order, with a least
+// significant digit radix sort on 8 bits at a time. Digits that are
+// the same in every key, such as the unused high bits, are skipped.
+//
+static void
+RadixSort(std::vector<STSortEntry>* entries)
+{
+    size_t n = entries->size();
+    std::vector<STSortEntry> scratch(n);
+    STSortEntry* src = &(*entries)[0];
+    STSortEntry* dst = &scratch[0];
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t counts[256];
+        memset(counts, 0, sizeof(counts));
+        for (size_t i = 0; i < n; ++i)
+            counts[(src[i].key >> shift) & 0xff]++;
+        if (counts[(src[0].key >> shift) & 0xff] == n)
+            continue;
+
+        size_t offsets[256];
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; ++digit) {
+            offsets[digit] = offset;
+            offset += counts[digit];
+        }
+        for (size_t i = 0; i < n; ++i)
+            dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+        std::swap(src, dst);
+    }
+
+    if (src != &(*entries)[0])
+        memcpy((void*) &(*entries)[0], src, n * sizeof(STSortEntry));
+}
+
+STRenderQueue::STRenderQueue()
+    : mNumStateChanges(0)
+{
+}
+
+//
+// Remove the meshes submitted for the last frame.
+//
+void STRenderQueue::Clear()
+{
+    mItems.clear();
+    mProgramIds.clear();
+    mTextureIds.clear();
+    mMaterialIds.clear();
+}
+
+//
+// Get a small number standing for a piece of state.
+//
+template <class Key>
+unsigned int STRenderQueue::GetId(std::map<Key, unsigned int>* ids,
+                                  const Key& state)
+{
+    typename std::map<Key, unsigned int>::iterator it = ids->find(state);
+    if (it != ids->end())
+        return it->second;
+    unsigned int id = (unsigned int) ids->size();
+    (*ids)[state] = id;
+    return id;
+}
+
+//
+// Add a mesh to draw.
+//
+void STRenderQueue::Submit(const STTriangleMesh* mesh, STShaderProgram* program)
+{
+    unsigned long long programId =
+        GetId(&mProgramIds, (const void*) program);
+    unsigned long long textureId =
+        GetId(&mTextureIds, (const void*) mesh->mSurfaceColorTex);
+    unsigned long long materialId = GetId(&mMaterialIds, mesh->GetMaterialKey());
+
+    Item item;
+    item.key = ((programId & kProgramMask) << (kTextureBits + kMaterialBits)) |
+               ((textureId & kTextureMask) << kMaterialBits) |
+               (materialId & kMaterialMask);
+    item.mesh = mesh;
+    item.program = program;
+    mItems.push_back(item);
+}
+
+//
+// Sort the meshes submitted by their state.
+//
+void STRenderQueue::Sort()
+{
+    // Most frames draw the same scene as the one before.
+    bool unchanged = mItems.size() == mSortedItems.size();
+    for (size_t i = 0; unchanged && i < mItems.size(); ++i) {
+        unchanged = mItems[i].key == mSortedItems[i].key &&
+                    mItems[i].mesh == mSortedItems[i].mesh &&
+                    mItems[i].program == mSortedItems[i].program;
+    }
+    if (unchanged)
+        return;
+
+    std::vector<STSortEntry> entries(mItems.size());
+    for (size_t i = 0; i < mItems.size(); ++i) {
+        entries[i].key = mItems[i].key;
+        entries[i].index = (int) i;
+    }
+    if (!entries.empty())
+        RadixSort(&entries);
+
+    mOrder.resize(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i)
+        mOrder[i] = entries[i].index;
+    mSortedItems = mItems;
+}
+
+//
+// Draw the meshes in sorted order.
+//
+void STRenderQueue::Execute(bool smooth)
+{
+    mNumStateChanges = 0;
+    Sort();
+
+    STShaderProgram* program = NULL;
+    const STTriangleMesh* bound = NULL;
+    unsigned long long state = 0;
+    for (size_t i = 0; i < mOrder.size(); ++i) {
+        const Item& item = mItems[mOrder[i]];
+
+        if (item.program && item.program != program) {
+            item.program->Bind();
+            program = item.program;
+            mNumStateChanges++;
+        }
+
+        // The axes use their own color map and material.
+        if (item.mesh->mDrawAxis) {
+            item.mesh->DrawAxis();
+            bound = NULL;
+        }
+
+        if (!bound || (item.key & kStateMask) != state) {
+            item.mesh->BindMaterial();
+            bound = item.mesh;
+            state = item.key & kStateMask;
+            mNumStateChanges++;
+        }
+        item.mesh->DrawGeometry(smooth);
+    }
+
+    if (bound)
+        bound->UnBindMaterial();
+}
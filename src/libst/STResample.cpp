@@ -0,0 +1,468 @@
+// STResample.cpp
+#include "STResample.h"
+
+#include "STThreadPool.h"
+#include "STUtil.h"
+#include "stparallel.h"
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+// Resolution of the table used to encode linear values to sRGB.
+static const int kSRGBTableSize = 4096;
+
+//
+// Lookup tables for converting between 8-bit channels and floats.
+//
+struct STResampleTables {
+    // Linear value in [0, 1] of each 8-bit channel, for each color space.
+    float toLinear[2][256];
+
+    // 8-bit sRGB encoding of linear values from 0 to 1.
+    unsigned char toSRGB[kSRGBTableSize];
+
+    STResampleTables()
+    {
+        for (int i = 0; i < 256; ++i) {
+            float c = i / 255.0f;
+            toLinear[STResample::kLinear][i] = c;
+            toLinear[STResample::kSRGB][i] = (c <= 0.04045f) ?
+                c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i < kSRGBTableSize; ++i) {
+            float c = i / (float) (kSRGBTableSize - 1);
+            float s = (c <= 0.0031308f) ?
+                c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+            toSRGB[i] = (unsigned char) (s * 255.0f + 0.5f);
+        }
+    }
+};
+
+static const STResampleTables&
+GetTables()
+{
+    static const STResampleTables tables;
+    return tables;
+}
+
+//
+// Convert a linear value to an 8-bit channel.
+//
+static inline unsigned char
+EncodeLinear(float value)
+{
+    int i = (int) (value * 255.0f + 0.5f);
+    return (unsigned char) STMin(STMax(i, 0), 255);
+}
+
+//
+// Convert a linear value to an 8-bit sRGB-encoded channel.
+//
+static inline unsigned char
+EncodeSRGB(const STResampleTables& tables, float value)
+{
+    int i = (int) (value * (kSRGBTableSize - 1) + 0.5f);
+    return tables.toSRGB[STMin(STMax(i, 0), kSRGBTableSize - 1)];
+}
+
+//------------------------------------------------------------------------
+// Downsampling by 2x2 boxes
+//------------------------------------------------------------------------
+
+//
+// Downsample rows y0 to y1-1 of the destination, averaging
+// 8-bit channels directly.
+//
+static void
+DownsampleRowsLinear(const STColor4ub* src, int width, int height,
+                     STColor4ub* dst, int dstWidth, int y0, int y1)
+{
+    for (int y = y0; y < y1; ++y) {
+        const STColor4ub* row0 = src + (2*y) * width;
+        const STColor4ub* row1 = src + STMin(2*y+1, height-1) * width;
+        STColor4ub* out = dst + y * dstWidth;
+
+        int x = 0;
+#ifdef ST_SSE2
+        // Two destination pixels from four source pixels in each row.
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i two = _mm_set1_epi16(2);
+        for (; x + 1 < dstWidth && 2*x + 3 < width; x += 2) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (row0 + 2*x));
+            __m128i b = _mm_loadu_si128((const __m128i*) (row1 + 2*x));
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                       _mm_unpacklo_epi8(b, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                       _mm_unpackhi_epi8(b, zero));
+            lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+            hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+            __m128i sum = _mm_unpacklo_epi64(lo, hi);
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+            _mm_storel_epi64((__m128i*) (out + x), _mm_packus_epi16(sum, sum));
+        }
+#endif
+        for (; x < dstWidth; ++x) {
+            int x0 = 2*x;
+            int x1 = STMin(2*x+1, width-1);
+
+            const STColor4ub& a = row0[x0];
+            const STColor4ub& b = row0[x1];
+            const STColor4ub& c = row1[x0];
+            const STColor4ub& d = row1[x1];
+
+            out[x].r = (unsigned char) ((a.r + b.r + c.r + d.r + 2) >> 2);
+            out[x].g = (unsigned char) ((a.g + b.g + c.g + d.g + 2) >> 2);
+            out[x].b = (unsigned char) ((a.b + b.b + c.b + d.b + 2) >> 2);
+            out[x].a = (unsigned char) ((a.a + b.a + c.a + d.a + 2) >> 2);
+        }
+    }
+}
+
+//
+// Downsample rows y0 to y1-1 of the destination, averaging
+// the color channels in linear light.
+//
+static void
+DownsampleRowsSRGB(const STColor4ub* src, int width, int height,
+                   STColor4ub* dst, int dstWidth, int y0, int y1)
+{
+    const STResampleTables& tables = GetTables();
+    const float* linear = tables.toLinear[STResample::kSRGB];
+
+    for (int y = y0; y < y1; ++y) {
+        const STColor4ub* row0 = src + (2*y) * width;
+        const STColor4ub* row1 = src + STMin(2*y+1, height-1) * width;
+        STColor4ub* out = dst + y * dstWidth;
+
+        for (int x = 0; x < dstWidth; ++x) {
+            int x0 = 2*x;
+            int x1 = STMin(2*x+1, width-1);
+
+            const STColor4ub& a = row0[x0];
+            const STColor4ub& b = row0[x1];
+            const STColor4ub& c = row1[x0];
+            const STColor4ub& d = row1[x1];
+
+            out[x].r = EncodeSRGB(tables, 0.25f * (linear[a.r] + linear[b.r] +
+                                                   linear[c.r] + linear[d.r]));
+            out[x].g = EncodeSRGB(tables, 0.25f * (linear[a.g] + linear[b.g] +
+                                                   linear[c.g] + linear[d.g]));
+            out[x].b = EncodeSRGB(tables, 0.25f * (linear[a.b] + linear[b.b] +
+                                                   linear[c.b] + linear[d.b]));
+            out[x].a = (unsigned char) ((a.a + b.a + c.a + d.a + 2) >> 2);
+        }
+    }
+}
+
+//
+// Fill in a half-resolution copy of an image by averaging 2x2 blocks.
+//
+void STResample::Downsample(const STColor4ub* src, int width, int height,
+                            STColor4ub* dst, ColorSpace space,
+                            STThreadPool* pool)
+{
+    int dstWidth = STMax(width / 2, 1);
+    int dstHeight = STMax(height / 2, 1);
+
+    STForEachBand(pool, dstHeight, dstWidth, [&](int y0, int y1) {
+        if (space == kSRGB)
+            DownsampleRowsSRGB(src, width, height, dst, dstWidth, y0, y1);
+        else
+            DownsampleRowsLinear(src, width, height, dst, dstWidth, y0, y1);
+    });
+}
+
+//
+// Downsample rows y0 to y1-1 of an image with any number of
+// channels of type T.
+//
+template<typename T>
+static void
+DownsampleRowsChannels(const T* src, int width, int height, int numChannels,
+                       T* dst, int dstWidth, int y0, int y1)
+{
+    for (int y = y0; y < y1; ++y) {
+        const T* row0 = src + (2*y) * width * numChannels;
+        const T* row1 = src + STMin(2*y+1, height-1) * width * numChannels;
+        T* out = dst + y * dstWidth * numChannels;
+
+        for (int x = 0; x < dstWidth; ++x) {
+            int x0 = 2*x * numChannels;
+            int x1 = STMin(2*x+1, width-1) * numChannels;
+            for (int c = 0; c < numChannels; ++c) {
+                *out++ = (T) ((row0[x0+c] + row0[x1+c] +
+                               row1[x0+c] + row1[x1+c] + 2) >> 2);
+            }
+        }
+    }
+}
+
+//
+// Fill in a half-resolution copy of an image
+// with 8-bit or 16-bit channels.
+//
+void STResample::DownsampleChannels(const void* src, int width, int height,
+                                    int numChannels, int bytesPerChannel,
+                                    void* dst, STThreadPool* pool)
+{
+    int dstWidth = STMax(width / 2, 1);
+    int dstHeight = STMax(height / 2, 1);
+
+    STForEachBand(pool, dstHeight, dstWidth, [&](int y0, int y1) {
+        if (bytesPerChannel == 2) {
+            DownsampleRowsChannels((const unsigned short*) src, width, height,
+                                   numChannels, (unsigned short*) dst,
+                                   dstWidth, y0, y1);
+        }
+        else {
+            DownsampleRowsChannels((const unsigned char*) src, width, height,
+                                   numChannels, (unsigned char*) dst,
+                                   dstWidth, y0, y1);
+        }
+    });
+}
+
+//
+// Get the number of levels in a full mipmap chain.
+//
+int STResample::GetNumMipLevels(int width, int height)
+{
+    int numLevels = 1;
+    while (width > 1 || height > 1) {
+        width = STMax(width / 2, 1);
+        height = STMax(height / 2, 1);
+        numLevels++;
+    }
+    return numLevels;
+}
+
+//------------------------------------------------------------------------
+// Resampling with separable filters
+//------------------------------------------------------------------------
+
+//
+// The source pixels, and their weights, that contribute to each
+// destination pixel along one axis of a resize.
+//
+struct STResampleAxis {
+    std::vector<int> first;     // First source pixel of each destination pixel
+    std::vector<int> count;     // Number of source pixels of each destination pixel
+    std::vector<int> offset;    // Start of each destination pixel's weights
+    std::vector<float> weights;
+};
+
+//
+// Evaluate a resampling filter at a distance x (in pixels).
+//
+static float
+EvaluateFilter(STResample::Filter filter, float x)
+{
+    if (filter == STResample::kBox)
+        return (x >= -0.5f && x < 0.5f) ? 1.0f : 0.0f;
+
+    // Lanczos with three lobes: sinc(x) * sinc(x/3).
+    x = fabsf(x);
+    if (x < 1e-6f)
+        return 1.0f;
+    if (x >= 3.0f)
+        return 0.0f;
+    float px = (float) M_PI * x;
+    return 3.0f * sinf(px) * sinf(px / 3.0f) / (px * px);
+}
+
+//
+// Compute the filter weights for resizing one axis of an image.
+//
+static void
+ComputeAxis(STResample::Filter filter, int srcSize, int dstSize,
+            STResampleAxis& axis)
+{
+    // When shrinking, the filter is stretched to cover all the
+    // source pixels that fall inside each destination pixel.
+    float scale = srcSize / (float) dstSize;
+    float filterScale = STMax(scale, 1.0f);
+    float support = ((filter == STResample::kBox) ? 0.5f : 3.0f) * filterScale;
+
+    axis.first.resize(dstSize);
+    axis.count.resize(dstSize);
+    axis.offset.resize(dstSize);
+    axis.weights.clear();
+
+    for (int i = 0; i < dstSize; ++i) {
+        float center = (i + 0.5f) * scale;
+        int first = STMax((int) floorf(center - support), 0);
+        int last = STMin((int) ceilf(center + support), srcSize - 1);
+
+        size_t offset = axis.weights.size();
+        float total = 0.0f;
+        for (int j = first; j <= last; ++j) {
+            float weight = EvaluateFilter(filter, (j + 0.5f - center) / filterScale);
+            axis.weights.push_back(weight);
+            total += weight;
+        }
+
+        // Normalize so that flat areas keep their value. A box
+        // narrower than a pixel can miss every source pixel, in
+        // which case the nearest one is used.
+        if (total == 0.0f) {
+            int nearest = STMin(STMax((int) center, first), last);
+            for (int j = first; j <= last; ++j)
+                axis.weights[offset + (j - first)] = (j == nearest) ? 1.0f : 0.0f;
+        }
+        else {
+            for (size_t j = offset; j < axis.weights.size(); ++j)
+                axis.weights[j] /= total;
+        }
+
+        axis.first[i] = first;
+        axis.count[i] = last - first + 1;
+        axis.offset[i] = (int) offset;
+    }
+}
+
+//
+// Convert a row of pixels to linear floats, four per pixel.
+//
+static void
+DecodeRow(const STColor4ub* src, int width, STResample::ColorSpace space,
+          float* out)
+{
+    const STResampleTables& tables = GetTables();
+    const float* color = tables.toLinear[space];
+    const float* alpha = tables.toLinear[STResample::kLinear];
+
+    for (int x = 0; x < width; ++x) {
+        out[4*x + 0] = color[src[x].r];
+        out[4*x + 1] = color[src[x].g];
+        out[4*x + 2] = color[src[x].b];
+        out[4*x + 3] = alpha[src[x].a];
+    }
+}
+
+//
+// Convert a row of linear floats, four per pixel, back to pixels.
+//
+static void
+EncodeRow(const float* src, int width, STResample::ColorSpace space,
+          STColor4ub* out)
+{
+    if (space == STResample::kSRGB) {
+        const STResampleTables& tables = GetTables();
+        for (int x = 0; x < width; ++x) {
+            out[x].r = EncodeSRGB(tables, src[4*x + 0]);
+            out[x].g = EncodeSRGB(tables, src[4*x + 1]);
+            out[x].b = EncodeSRGB(tables, src[4*x + 2]);
+            out[x].a = EncodeLinear(src[4*x + 3]);
+        }
+        return;
+    }
+
+    int x = 0;
+#ifdef ST_SSE2
+    // The packing instructions saturate, which clamps to [0, 255].
+    const __m128 scale = _mm_set1_ps(255.0f);
+    for (; x + 1 < width; x += 2) {
+        __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + 4*x), scale));
+        __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + 4*x + 4), scale));
+        __m128i packed = _mm_packs_epi32(a, b);
+        _mm_storel_epi64((__m128i*) (out + x), _mm_packus_epi16(packed, packed));
+    }
+#endif
+    for (; x < width; ++x) {
+        out[x].r = EncodeLinear(src[4*x + 0]);
+        out[x].g = EncodeLinear(src[4*x + 1]);
+        out[x].b = EncodeLinear(src[4*x + 2]);
+        out[x].a = EncodeLinear(src[4*x + 3]);
+    }
+}
+
+//
+// Filter a row of linear pixels horizontally.
+//
+static void
+FilterRow(const float* src, const STResampleAxis& axis, int dstWidth,
+          float* out)
+{
+    for (int x = 0; x < dstWidth; ++x) {
+        const float* pixel = src + 4 * axis.first[x];
+        const float* weight = &axis.weights[axis.offset[x]];
+        int count = axis.count[x];
+#ifdef ST_SSE2
+        __m128 sum = _mm_setzero_ps();
+        for (int i = 0; i < count; ++i) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(pixel + 4*i),
+                                             _mm_set1_ps(weight[i])));
+        }
+        _mm_storeu_ps(out + 4*x, sum);
+#else
+        float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < count; ++i) {
+            for (int c = 0; c < 4; ++c)
+                sum[c] += pixel[4*i + c] * weight[i];
+        }
+        for (int c = 0; c < 4; ++c)
+            out[4*x + c] = sum[c];
+#endif
+    }
+}
+
+//
+// Add a weighted row of floats to another.
+//
+static void
+AccumulateRow(const float* src, float weight, int count, float* sum)
+{
+    int i = 0;
+#ifdef ST_SSE2
+    __m128 w = _mm_set1_ps(weight);
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i),
+                                          _mm_mul_ps(_mm_loadu_ps(src + i), w)));
+    }
+#endif
+    for (; i < count; ++i)
+        sum[i] += src[i] * weight;
+}
+
+//
+// Resample an image to a new size.
+//
+void STResample::Resize(const STColor4ub* src, int srcWidth, int srcHeight,
+                        STColor4ub* dst, int dstWidth, int dstHeight,
+                        Filter filter, ColorSpace space,
+                        STThreadPool* pool)
+{
+    STResampleAxis horizontal, vertical;
+    ComputeAxis(filter, srcWidth, dstWidth, horizontal);
+    ComputeAxis(filter, srcHeight, dstHeight, vertical);
+
+    // Each band filters horizontally just the source rows it needs,
+    // then filters those vertically into its destination rows.
+    STForEachBand(pool, dstHeight, dstWidth, [&](int y0, int y1) {
+        int firstRow = vertical.first[y0];
+        int endRow = firstRow;
+        for (int y = y0; y < y1; ++y)
+            endRow = STMax(endRow, vertical.first[y] + vertical.count[y]);
+
+        int rowFloats = 4 * dstWidth;
+        std::vector<float> decoded(4 * srcWidth);
+        std::vector<float> rows((endRow - firstRow) * rowFloats);
+        for (int r = firstRow; r < endRow; ++r) {
+            DecodeRow(src + r * srcWidth, srcWidth, space, &decoded[0]);
+            FilterRow(&decoded[0], horizontal, dstWidth,
+                      &rows[(r - firstRow) * rowFloats]);
+        }
+
+        std::vector<float> sum(rowFloats);
+        for (int y = y0; y < y1; ++y) {
+            std::fill(sum.begin(), sum.end(), 0.0f);
+            const float* weight = &vertical.weights[vertical.offset[y]];
+            for (int i = 0; i < vertical.count[y]; ++i) {
+                int r = vertical.first[y] + i - firstRow;
+                AccumulateRow(&rows[r * rowFloats], weight[i], rowFloats, &sum[0]);
+            }
+            EncodeRow(&sum[0], dstWidth, space, dst + y * dstWidth);
+        }
+    });
+}
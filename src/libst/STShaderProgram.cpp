@@ -18,16 +18,130 @@
 
 #include "STShaderProgram.h"
 
+#include "STGLState.h"
 #include "st.h"
+#include "stglproc.h"
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <fstream>
 #include <sstream>
 
+// Program binaries (OpenGL 4.1 and ARB_get_program_binary) and
+// uniform blocks (OpenGL 3.1) are newer than the GLEW in ext/, so
+// their entry points are looked up here.
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_INVALID_INDEX
+#define GL_INVALID_INDEX 0xFFFFFFFFu
+#endif
+#ifndef GL_NUM_EXTENSIONS
+#define GL_NUM_EXTENSIONS 0x821D
+#endif
+
+typedef void (STAPIENTRY *STGetProgramBinaryProc)(GLuint program, GLsizei bufSize,
+                                                GLsizei* length, GLenum* format,
+                                                void* binary);
+typedef void (STAPIENTRY *STProgramBinaryProc)(GLuint program, GLenum format,
+                                             const void* binary, GLsizei length);
+typedef void (STAPIENTRY *STProgramParameteriProc)(GLuint program, GLenum pname,
+                                                 GLint value);
+typedef GLuint (STAPIENTRY *STGetUniformBlockIndexProc)(GLuint program, const char* name);
+typedef void (STAPIENTRY *STUniformBlockBindingProc)(GLuint program, GLuint index,
+                                                   GLuint binding);
+typedef const GLubyte* (STAPIENTRY *STGetStringiProc)(GLenum name, GLuint index);
+
+static STGetProgramBinaryProc sGetProgramBinary = NULL;
+static STProgramBinaryProc sProgramBinary = NULL;
+static STProgramParameteriProc sProgramParameteri = NULL;
+static STGetUniformBlockIndexProc sGetUniformBlockIndex = NULL;
+static STUniformBlockBindingProc sUniformBlockBinding = NULL;
+
+#ifndef __APPLE__
+//
+// Does the driver have an extension? Core profile contexts only
+// list them one at a time, with glGetStringi (OpenGL 3.0).
+//
+static bool
+HasExtension(int major, const char* name)
+{
+    if (major < 3) {
+        const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+        return extensions && strstr(extensions, name);
+    }
+
+    STGetStringiProc getStringi = (STGetStringiProc) STGetProcAddress("glGetStringi");
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; getStringi && i < numExtensions; i++) {
+        const char* extension = (const char*) getStringi(GL_EXTENSIONS, i);
+        if (extension && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+#endif
+
+//
+// Can linked programs be saved and loaded? Checked once, on the
+// first program linked.
+//
+static bool
+HasProgramBinary()
+{
+    static int sSupported = -1;
+    if (sSupported >= 0)
+        return sSupported != 0;
+    sSupported = 0;
+
+#ifndef __APPLE__
+    if (!GLEW_VERSION_2_0)
+        return false;
+
+    int major = 0, minor = 0;
+    const char* version = (const char*) glGetString(GL_VERSION);
+    if (version)
+        sscanf(version, "%d.%d", &major, &minor);
+    if (major * 10 + minor < 41 && !HasExtension(major, "GL_ARB_get_program_binary"))
+        return false;
+
+    sGetProgramBinary = (STGetProgramBinaryProc) STGetProcAddress("glGetProgramBinary");
+    sProgramBinary = (STProgramBinaryProc) STGetProcAddress("glProgramBinary");
+    sProgramParameteri = (STProgramParameteriProc) STGetProcAddress("glProgramParameteri");
+
+    // Drivers may support the extension with no formats to save in.
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    if (sGetProgramBinary && sProgramBinary && sProgramParameteri && numFormats > 0)
+        sSupported = 1;
+#endif
+    return sSupported != 0;
+}
+
+//
+// Header of a program cache file, followed by the program binary.
 //
+struct STProgramCacheHeader {
+    char magic[4];              // "STPB"
+    unsigned int version;
+    unsigned long long key;     // Hash of the sources and the driver.
+    unsigned int format;        // Format of the binary.
+    unsigned int length;        // Size of the binary, in bytes.
+};
+
+static const char kProgramCacheMagic[4] = { 'S', 'T', 'P', 'B' };
+static const unsigned int kProgramCacheVersion = 1;
+
+std::string STShaderProgram::sCacheDirectory;
 
 STShaderProgram::STShaderProgram()
+    : linked(false)
 {
     if(GLEW_VERSION_2_0)
         programid = glCreateProgram();
@@ -39,6 +153,10 @@ STShaderProgram::STShaderProgram()
 
 STShaderProgram::~STShaderProgram()
 {
+    std::map<unsigned int, STShaderProgram*>::iterator it;
+    for (it = variants.begin(); it != variants.end(); ++it)
+        delete it->second;
+
     if(GLEW_VERSION_2_0)
         glDeleteProgram(programid);
 #ifndef __APPLE__
@@ -48,6 +166,85 @@ STShaderProgram::~STShaderProgram()
 }
 
 void STShaderProgram::LoadVertexShader(const std::string& filename)
+{
+    LoadShader(GL_VERTEX_SHADER, filename);
+}
+
+void STShaderProgram::LoadFragmentShader(const std::string& filename)
+{
+    LoadShader(GL_FRAGMENT_SHADER, filename);
+}
+
+// Declare a feature that variants of the program can define.
+unsigned int STShaderProgram::AddFeature(const std::string& define)
+{
+    assert(features.size() < 32);
+    features.push_back(define);
+    return 1u << (features.size() - 1);
+}
+
+//
+// Add preprocessor definitions to the start of a shader. Only comments
+// may come before a #version line, so they go after it if there is one.
+// A #line directive keeps the line numbers in error messages right.
+//
+static std::string
+InsertDefines(const std::string& text, const std::string& defines)
+{
+    size_t insert = 0;
+    int line = 1;
+    int version = 110;
+    size_t found = text.find("#version");
+    if (found != std::string::npos &&
+        (found == 0 || text[found - 1] == '\n')) {
+        version = atoi(text.c_str() + found + 8);
+        insert = text.find('\n', found);
+        insert = (insert == std::string::npos) ? text.size() : insert + 1;
+        for (size_t i = 0; i < insert; i++) {
+            if (text[i] == '\n')
+                line++;
+        }
+    }
+
+    // Before GLSL 3.30, #line names the number of the line before
+    // the next one.
+    char directive[32];
+    sprintf(directive, "#line %d\n", version < 330 ? line - 1 : line);
+
+    std::string result = text.substr(0, insert);
+    if (insert > 0 && text[insert - 1] != '\n')
+        result += "\n";
+    return result + defines + directive + text.substr(insert);
+}
+
+// Get the variant of the program with the features in the mask defined.
+STShaderProgram* STShaderProgram::GetVariant(unsigned int features)
+{
+    if (features == 0)
+        return this;
+
+    std::map<unsigned int, STShaderProgram*>::iterator it = variants.find(features);
+    if (it != variants.end())
+        return it->second;
+
+    STShaderProgram* variant = new STShaderProgram();
+    for (size_t i = 0; i < this->features.size(); i++) {
+        if (features & (1u << i))
+            variant->defines += "#define " + this->features[i] + "\n";
+    }
+    for (size_t i = 0; i < sources.size(); i++) {
+        Source source = sources[i];
+        source.text = InsertDefines(source.text, variant->defines);
+        variant->sources.push_back(source);
+    }
+    variant->textureUnits = textureUnits;
+    variant->blockBindings = blockBindings;
+    variants[features] = variant;
+    return variant;
+}
+
+// Read a shader file. It is compiled when the program is linked.
+void STShaderProgram::LoadShader(GLenum type, const std::string& filename)
 {
     std::ifstream in(filename.c_str());
     if(!in) {
@@ -57,9 +254,19 @@ void STShaderProgram::LoadVertexShader(const std::string& filename)
     }
     std::stringstream ss;
     ss << in.rdbuf();
-    
-    std::string str = ss.str();
-    const char* ptr = str.c_str();
+
+    Source source;
+    source.type = type;
+    source.filename = filename;
+    source.text = ss.str();
+    sources.push_back(source);
+    linked = false;
+}
+
+// Compile a shader and attach it to the program.
+bool STShaderProgram::CompileShader(const Source& source)
+{
+    const char* ptr = source.text.c_str();
 
     // Buffer for error messages
     static const int kBufferSize = 1024;
@@ -67,7 +274,7 @@ void STShaderProgram::LoadVertexShader(const std::string& filename)
 
     if(GLEW_VERSION_2_0) 
     {
-        GLuint shader = glCreateShader(GL_VERTEX_SHADER);
+        GLuint shader = glCreateShader(source.type);
         glShaderSource(shader, 1, &ptr, NULL);
         glCompileShader(shader);
         GLint result = 0;
@@ -76,16 +283,19 @@ void STShaderProgram::LoadVertexShader(const std::string& filename)
             GLsizei length = 0;
             glGetShaderInfoLog(shader, kBufferSize-1,
                 &length, buffer);
-            fprintf(stderr, "%s: GLSL error\n%s\n", filename.c_str(), buffer);
+            fprintf(stderr, "%s: GLSL error\n%s\n", source.filename.c_str(), buffer);
             assert(false);
         }
         glAttachShader(programid, shader);
-        glLinkProgram(programid);
+
+        // The program keeps the shader until it is detached.
+        glDeleteShader(shader);
+        return result == GL_TRUE;
     }
 #ifndef __APPLE__
     else
     {
-        GLuint shader = glCreateShaderObjectARB(GL_VERTEX_SHADER);
+        GLuint shader = glCreateShaderObjectARB(source.type);
         glShaderSourceARB(shader, 1, &ptr, NULL);
         glCompileShaderARB(shader);
         GLint result = 0;
@@ -94,111 +304,274 @@ void STShaderProgram::LoadVertexShader(const std::string& filename)
             GLsizei length = 0;
             glGetInfoLogARB(shader, kBufferSize-1,
                 &length, buffer);
-            fprintf(stderr, "%s: GLSL error\n%s\n", filename.c_str(), buffer);
+            fprintf(stderr, "%s: GLSL error\n%s\n", source.filename.c_str(), buffer);
             assert(false);
         }
         glAttachObjectARB(programid, shader);
-        glLinkProgramARB(programid);
+        glDeleteObjectARB(shader);
+        return result == GL_TRUE;
     }
 #endif
 }
 
-void STShaderProgram::LoadFragmentShader(const std::string& filename)
+// Compile and link the shaders, or load them from the cache.
+void STShaderProgram::Link()
 {
-    std::ifstream in(filename.c_str());
-    if(!in) {
-      fprintf(stderr, "Failed to open shader file '%s'\n", filename.c_str());
-        assert(false);
+    if (linked || sources.empty())
         return;
+    linked = true;
+
+    // The cache is only good for the same sources on the same driver.
+    std::string cachePath;
+    unsigned long long key = 0;
+    bool useCache = HasProgramBinary();
+    if (useCache) {
+        const GLenum kDriverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        for (int i = 0; i < 3; i++) {
+            const char* driver = (const char*) glGetString(kDriverStrings[i]);
+            if (driver)
+                key = STHashBytes(driver, strlen(driver), key);
+        }
+        for (size_t i = 0; i < sources.size(); i++) {
+            key = STHashBytes(&sources[i].type, sizeof(sources[i].type), key);
+            key = STHashBytes(sources[i].text.data(), sources[i].text.size(), key);
+        }
+
+        cachePath = GetCachePath();
+        if (LoadProgramBinary(cachePath, key)) {
+            ReflectUniforms();
+            return;
+        }
     }
-    std::stringstream ss;
-    ss << in.rdbuf();
-    
-    std::string str = ss.str();
-    const char* ptr = str.c_str();
+
+    // Shaders attached by an earlier link are still in the program.
+    if (GLEW_VERSION_2_0) {
+        GLint numAttached = 0;
+        glGetProgramiv(programid, GL_ATTACHED_SHADERS, &numAttached);
+        if (numAttached > 0) {
+            std::vector<GLuint> attached(numAttached);
+            glGetAttachedShaders(programid, numAttached, NULL, &attached[0]);
+            for (GLint i = 0; i < numAttached; i++)
+                glDetachShader(programid, attached[i]);
+        }
+    }
+#ifndef __APPLE__
+    else {
+        GLint numAttached = 0;
+        glGetObjectParameterivARB(programid, GL_OBJECT_ATTACHED_OBJECTS_ARB, &numAttached);
+        if (numAttached > 0) {
+            std::vector<GLhandleARB> attached(numAttached);
+            glGetAttachedObjectsARB(programid, numAttached, NULL, &attached[0]);
+            for (GLint i = 0; i < numAttached; i++)
+                glDetachObjectARB(programid, attached[i]);
+        }
+    }
+#endif
+
+    bool compiled = true;
+    for (size_t i = 0; i < sources.size(); i++)
+        compiled = CompileShader(sources[i]) && compiled;
 
     // Buffer for error messages
     static const int kBufferSize = 1024;
     char buffer[1024];
 
-    if(GLEW_VERSION_2_0)
-    {
-        GLuint shader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(shader, 1, &ptr, NULL);
-        glCompileShader(shader);
-        GLint result = 0;
-        glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
-        if(result != GL_TRUE) {
+    GLint result = 0;
+    if(GLEW_VERSION_2_0) {
+        if (useCache)
+            sProgramParameteri(programid, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(programid);
+        glGetProgramiv(programid, GL_LINK_STATUS, &result);
+        if(result != GL_TRUE && compiled) {
             GLsizei length = 0;
-            glGetShaderInfoLog(shader, kBufferSize-1,
-                &length, buffer);
-            fprintf(stderr, "%s: GLSL error\n%s\n", filename.c_str(), buffer);
+            glGetProgramInfoLog(programid, kBufferSize-1, &length, buffer);
+            fprintf(stderr, "%s: GLSL link error\n%s\n",
+                    sources[0].filename.c_str(), buffer);
             assert(false);
         }
-        glAttachShader(programid, shader);
-        glLinkProgram(programid);
     }
 #ifndef __APPLE__
-    else
-    {
-        GLuint shader = glCreateShaderObjectARB(GL_FRAGMENT_SHADER);
-        glShaderSourceARB(shader, 1, &ptr, NULL);
-        glCompileShaderARB(shader);
-        GLint result = 0;
-        glGetObjectParameterivARB(shader, GL_OBJECT_COMPILE_STATUS_ARB, &result);
-        if(result != GL_TRUE) {
+    else {
+        glLinkProgramARB(programid);
+        glGetObjectParameterivARB(programid, GL_OBJECT_LINK_STATUS_ARB, &result);
+        if(result != GL_TRUE && compiled) {
             GLsizei length = 0;
-            glGetInfoLogARB(shader, kBufferSize-1,
-                &length, buffer);
-            fprintf(stderr, "%s: GLSL error\n%s\n", filename.c_str(), buffer);
+            glGetInfoLogARB(programid, kBufferSize-1, &length, buffer);
+            fprintf(stderr, "%s: GLSL link error\n%s\n",
+                    sources[0].filename.c_str(), buffer);
             assert(false);
         }
-        glAttachObjectARB(programid, shader);
-        glLinkProgramARB(programid);
     }
 #endif
+
+    if (useCache && result == GL_TRUE)
+        SaveProgramBinary(cachePath, key);
+    ReflectUniforms();
+}
+
+//
+// Store all program cache files in the given directory
+// instead of next to their shaders.
+//
+void STShaderProgram::SetCacheDirectory(const std::string& directory)
+{
+    sCacheDirectory = directory;
+}
+
+// Get the path of the cache file for the program.
+std::string STShaderProgram::GetCachePath() const
+{
+    // Programs may share their first shader, so the cache file
+    // name includes a hash of the names of all of them, and of the
+    // features defined in a variant.
+    unsigned long long hash = STHashBytes(defines.data(), defines.size());
+    for (size_t i = 0; i < sources.size(); i++) {
+        const std::string& filename = sources[i].filename;
+        hash = STHashBytes(filename.c_str(), filename.size() + 1, hash);
+    }
+    char suffix[40];
+    sprintf(suffix, ".%016llx.stprogram", hash);
+
+    const std::string& filename = sources[0].filename;
+    if (sCacheDirectory.empty())
+        return filename + suffix;
+
+    size_t slash = filename.find_last_of("/\\");
+    std::string base = (slash == std::string::npos) ?
+        filename : filename.substr(slash + 1);
+
+    std::string directory = sCacheDirectory;
+    char last = directory[directory.size() - 1];
+    if (last != '/' && last != '\\')
+        directory += "/";
+
+    return directory + base + suffix;
+}
+
+// Load the linked program from its cache file. Returns false if
+// there is no cache file, or it is out of date.
+bool STShaderProgram::LoadProgramBinary(const std::string& cachePath,
+                                        unsigned long long key)
+{
+    STMappedFile file;
+    if (file.Open(cachePath) != ST_OK ||
+        file.GetSize() < sizeof(STProgramCacheHeader))
+        return false;
+
+    const STProgramCacheHeader* header =
+        (const STProgramCacheHeader*) file.GetData();
+    if (memcmp(header->magic, kProgramCacheMagic, 4) != 0 ||
+        header->version != kProgramCacheVersion ||
+        header->key != key ||
+        file.GetSize() != sizeof(STProgramCacheHeader) + header->length)
+        return false;
+
+    // The driver may still refuse the binary, for example after
+    // an update that kept the same version string.
+    sProgramBinary(programid, header->format, header + 1, header->length);
+    GLint result = 0;
+    glGetProgramiv(programid, GL_LINK_STATUS, &result);
+    return result == GL_TRUE;
 }
 
+// Save the linked program to its cache file.
+void STShaderProgram::SaveProgramBinary(const std::string& cachePath,
+                                        unsigned long long key)
+{
+    GLint length = 0;
+    glGetProgramiv(programid, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<unsigned char> data(sizeof(STProgramCacheHeader) + length);
+    STProgramCacheHeader* header = (STProgramCacheHeader*) &data[0];
+    memcpy(header->magic, kProgramCacheMagic, 4);
+    header->version = kProgramCacheVersion;
+    header->key = key;
+    GLenum format = 0;
+    GLsizei written = 0;
+    sGetProgramBinary(programid, length, &written, &format, header + 1);
+    if (written <= 0)
+        return;
+    header->format = format;
+    header->length = written;
+    data.resize(sizeof(STProgramCacheHeader) + written);
+
+    // Write to a temporary file first so that a partially written
+    // cache can never be mistaken for a valid one.
+    char tempSuffix[32];
+    sprintf(tempSuffix, ".%p.tmp", (void*) this);
+    std::string tempPath = cachePath + tempSuffix;
+    FILE* cacheFile = fopen(tempPath.c_str(), "wb");
+    if (!cacheFile) {
+        fprintf(stderr, "STShaderProgram::Link() - Could not write "
+                "cache file '%s'.\n", cachePath.c_str());
+        return;
+    }
+    size_t saved = fwrite(&data[0], 1, data.size(), cacheFile);
+    fclose(cacheFile);
+
+    remove(cachePath.c_str());
+    if (saved != data.size() ||
+        rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        fprintf(stderr, "STShaderProgram::Link() - Could not write "
+                "cache file '%s'.\n", cachePath.c_str());
+        remove(tempPath.c_str());
+    }
+}
 
 /* Bind the program as the current program. */
 void STShaderProgram::Bind() {
-    if(GLEW_VERSION_2_0)
-        glUseProgram(programid);    
-#ifndef __APPLE__
-    else
-        glUseProgramObjectARB(programid);
-#endif
+    if (!linked)
+        Link();
+
+    STGLState::UseProgram(programid);
 
-    for (unsigned int i = 0; i < textures.size(); i++) {
+    // Upload the sampler units that changed since the last Bind().
+    for (unsigned int i = 0; i < samplers.size(); i++) {
+        Uniform* uniform = samplers[i];
+        if (!uniform->tex_pending)
+            continue;
+        uniform->tex_pending = false;
         if (GLEW_VERSION_2_0)
-            glUniform1i(textures[i].location, textures[i].tex_id);
+            glUniform1i(uniform->location, uniform->tex_id);
 #ifndef __APPLE__
         else
-            glUniform1iARB(textures[i].location, textures[i].tex_id);
+            glUniform1iARB(uniform->location, uniform->tex_id);
 #endif
     }
 }
 
 /* Un-bind the program. */
 void STShaderProgram::UnBind() {
-    if(GLEW_VERSION_2_0)
-        glUseProgram(0);
-    else
-        glUseProgramObjectARB(0);
+    STGLState::UseProgram(0);
 }
 
 void STShaderProgram::SetTexture(const std::string& name, int tex_index) {
-    GLint location = glGetUniformLocation(programid, name.c_str());
-    UnboundTexture tex;
-    tex.location = location;
-    tex.tex_id   = tex_index;
-    textures.push_back(tex);
+    std::map<unsigned int, STShaderProgram*>::iterator it;
+    for (it = variants.begin(); it != variants.end(); ++it)
+        it->second->SetTexture(name, tex_index);
+
+    textureUnits[name] = tex_index;
+    if (!linked)
+        return;
+
+    Uniform* uniform = FindUniform(name);
+    if (!uniform || uniform->tex_id == tex_index)
+        return;
+    if (uniform->tex_id < 0)
+        samplers.push_back(uniform);
+    uniform->tex_id = tex_index;
+    uniform->tex_pending = true;
 }
 
 // Set a uniform global parameter of the program by name.
 void STShaderProgram::SetUniform(const std::string& name, float value)
 {
-    GLint location = GetUniformLocation(name);
+    Uniform* uniform = FindUniform(name);
+    if (!uniform || !uniform->Change(1, value, 0.0f, 0.0f, 0.0f))
+        return;
+    GLint location = uniform->location;
     if(GLEW_VERSION_2_0) {
         glUniform1f(location, value);
     }
@@ -210,7 +583,10 @@ void STShaderProgram::SetUniform(const std::string& name, float value)
 // Set a uniform global parameter of the program by name.
 void STShaderProgram::SetUniform(const std::string& name, float v0, float v1)
 {
-    GLint location = GetUniformLocation(name);
+    Uniform* uniform = FindUniform(name);
+    if (!uniform || !uniform->Change(2, v0, v1, 0.0f, 0.0f))
+        return;
+    GLint location = uniform->location;
     if(GLEW_VERSION_2_0) {
         glUniform2f(location, v0, v1);
     }
@@ -223,7 +599,10 @@ void STShaderProgram::SetUniform(const std::string& name, float v0, float v1)
 void STShaderProgram::SetUniform(const std::string& name,
                                  float v0, float v1, float v2)
 {
-    GLint location = GetUniformLocation(name);
+    Uniform* uniform = FindUniform(name);
+    if (!uniform || !uniform->Change(3, v0, v1, v2, 0.0f))
+        return;
+    GLint location = uniform->location;
     if(GLEW_VERSION_2_0) {
         glUniform3f(location, v0, v1, v2);
     }
@@ -236,7 +615,10 @@ void STShaderProgram::SetUniform(const std::string& name,
 void STShaderProgram::SetUniform(const std::string& name,
                                  float v0, float v1, float v2, float v3)
 {
-    GLint location = GetUniformLocation(name);
+    Uniform* uniform = FindUniform(name);
+    if (!uniform || !uniform->Change(4, v0, v1, v2, v3))
+        return;
+    GLint location = uniform->location;
     if(GLEW_VERSION_2_0) {
         glUniform4f(location, v0, v1, v2, v3);
     }
@@ -269,15 +651,167 @@ void STShaderProgram::SetUniform(const std::string& name, const STColor4f& value
     SetUniform(name, value.r, value.g, value.b, value.a);
 }
 
-// Helper routine - get the location for a uniform shader parameter.
-GLint STShaderProgram::GetUniformLocation(const std::string& name)
+// Set a matrix uniform of the program by name.
+void STShaderProgram::SetUniform(const std::string& name, const STMatrix4& value)
+{
+    // OpenGL reads matrices a column at a time.
+    float columns[16];
+    for (int column = 0; column < 4; column++) {
+        for (int row = 0; row < 4; row++)
+            columns[column * 4 + row] = value.table[row][column];
+    }
+
+    Uniform* uniform = FindUniform(name);
+    if (!uniform || !uniform->Change(16, columns))
+        return;
+    GLint location = uniform->location;
+    if(GLEW_VERSION_2_0) {
+        glUniformMatrix4fv(location, 1, GL_FALSE, columns);
+    }
+    else {
+        glUniformMatrix4fvARB(location, 1, GL_FALSE, columns);
+    }
+}
+
+// Set the binding point a uniform block reads its buffer from.
+void STShaderProgram::SetUniformBlock(const std::string& name, int binding)
+{
+    std::map<unsigned int, STShaderProgram*>::iterator it;
+    for (it = variants.begin(); it != variants.end(); ++it)
+        it->second->SetUniformBlock(name, binding);
+
+    blockBindings[name] = binding;
+    if (!linked)
+        return;
+
+#ifndef __APPLE__
+    if (!sGetUniformBlockIndex) {
+        sGetUniformBlockIndex = (STGetUniformBlockIndexProc) STGetProcAddress("glGetUniformBlockIndex");
+        sUniformBlockBinding = (STUniformBlockBindingProc) STGetProcAddress("glUniformBlockBinding");
+    }
+    if (!sGetUniformBlockIndex || !sUniformBlockBinding)
+        return;
+
+    GLuint index = sGetUniformBlockIndex(programid, name.c_str());
+    if (index != GL_INVALID_INDEX)
+        sUniformBlockBinding(programid, index, binding);
+#endif
+}
+
+// Get the location of a vertex attribute.
+int STShaderProgram::GetAttribLocation(const std::string& name)
+{
+    if (!linked)
+        Link();
+
+    std::map<std::string, int>::iterator it = attributes.find(name);
+    if (it == attributes.end()) {
+        int location = -1;
+        if(GLEW_VERSION_2_0) {
+            location = glGetAttribLocation(programid, name.c_str());
+        }
+#ifndef __APPLE__
+        else {
+            location = glGetAttribLocationARB(programid, name.c_str());
+        }
+#endif
+        it = attributes.insert(std::make_pair(name, location)).first;
+    }
+    return it->second;
+}
+
+// Record a new value, returning false if it is the value already uploaded.
+bool STShaderProgram::Uniform::Change(int n, float v0, float v1, float v2, float v3)
 {
+    float values[4] = { v0, v1, v2, v3 };
+    return Change(n, values);
+}
+
+bool STShaderProgram::Uniform::Change(int n, const float* values)
+{
+    if (count == n && memcmp(value, values, n * sizeof(float)) == 0)
+        return false;
+    count = n;
+    memcpy(value, values, n * sizeof(float));
+    return true;
+}
+
+// Helper routine - find the active uniforms after linking.
+void STShaderProgram::ReflectUniforms()
+{
+    // Linking resets every uniform, and may move them, so start over.
+    uniforms.clear();
+    samplers.clear();
+    attributes.clear();
+
+    GLint numUniforms = 0;
+    GLint maxLength = 0;
     if(GLEW_VERSION_2_0) {
-        return glGetUniformLocation(programid, name.c_str());
+        glGetProgramiv(programid, GL_ACTIVE_UNIFORMS, &numUniforms);
+        glGetProgramiv(programid, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
     }
 #ifndef __APPLE__
     else {
-        return glGetUniformLocationARB(programid, name.c_str());
+        glGetObjectParameterivARB(programid, GL_OBJECT_ACTIVE_UNIFORMS_ARB, &numUniforms);
+        glGetObjectParameterivARB(programid, GL_OBJECT_ACTIVE_UNIFORM_MAX_LENGTH_ARB, &maxLength);
+    }
+#endif
+
+    std::vector<char> buffer(maxLength + 1);
+    for (GLint i = 0; i < numUniforms; i++) {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        if(GLEW_VERSION_2_0)
+            glGetActiveUniform(programid, i, maxLength + 1, &length, &size, &type, &buffer[0]);
+#ifndef __APPLE__
+        else
+            glGetActiveUniformARB(programid, i, maxLength + 1, &length, &size, &type, &buffer[0]);
+#endif
+        std::string name(&buffer[0], length);
+
+        // Arrays are listed by their first element.
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            name.resize(name.size() - 3);
+        FindUniform(name);
     }
+
+    // Set the texture units again.
+    std::map<std::string, int> units;
+    units.swap(textureUnits);
+    std::map<std::string, int>::iterator unit;
+    for (unit = units.begin(); unit != units.end(); ++unit)
+        SetTexture(unit->first, unit->second);
+
+    // And the uniform block bindings.
+    std::map<std::string, int> bindings;
+    bindings.swap(blockBindings);
+    std::map<std::string, int>::iterator binding;
+    for (binding = bindings.begin(); binding != bindings.end(); ++binding)
+        SetUniformBlock(binding->first, binding->second);
+}
+
+// Helper routine - get the active uniform with a name, or NULL if
+// the program does not use it.
+STShaderProgram::Uniform* STShaderProgram::FindUniform(const std::string& name)
+{
+    std::map<std::string, Uniform>::iterator it = uniforms.find(name);
+    if (it == uniforms.end()) {
+        // Built-in uniforms and elements of arrays after the first
+        // are not listed, so look up anything else once.
+        Uniform uniform;
+        if(GLEW_VERSION_2_0) {
+            uniform.location = glGetUniformLocation(programid, name.c_str());
+        }
+#ifndef __APPLE__
+        else {
+            uniform.location = glGetUniformLocationARB(programid, name.c_str());
+        }
 #endif
+        uniform.count = 0;
+        uniform.tex_id = -1;
+        uniform.tex_pending = false;
+        it = uniforms.insert(std::make_pair(name, uniform)).first;
+    }
+    return it->second.location >= 0 ? &it->second : NULL;
 }
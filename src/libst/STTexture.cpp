@@ -1,9 +1,128 @@
 // STTexture.cpp
+
+/* Include-order dependency!
+*
+* GLEW must be included before the standard GL.h header.
+* In this case, it means we must violate the usual design
+* principle of always including Foo.h first in Foo.cpp.
+*/
+#ifdef __APPLE__
+#define GLEW_EXT_texture_compression_s3tc 1
+#define GLEW_EXT_texture_compression_rgtc 1
+#else
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GL/gl.h"
+#endif
+
 #include "STTexture.h"
 
+#include "STGLState.h"
 #include "st.h"
 #include "stgl.h"
 
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// Not defined in the OpenGL 1.1 headers shipped on Windows.
+#ifndef GL_TEXTURE_MAX_LEVEL
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
+
+// Compressed formats, not defined in the OpenGL headers on Mac OS X.
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RED_RGTC1_EXT
+#define GL_COMPRESSED_RED_RGTC1_EXT      0x8DBB
+#define GL_COMPRESSED_RED_GREEN_RGTC2_EXT 0x8DBD
+#endif
+
+// One and two channel formats from OpenGL 3.0 and ARB_texture_rg,
+// not defined in the GLEW headers shipped with libst.
+#ifndef GL_RG
+#define GL_RG                            0x8227
+#endif
+#ifndef GL_R8
+#define GL_R8                            0x8229
+#define GL_R16                           0x822A
+#define GL_RG8                           0x822B
+#endif
+
+// Does the driver support the GL_RED and GL_RG texture formats?
+static bool SupportsTextureRG()
+{
+    static int supported = -1;
+    if (supported < 0) {
+        int major = 0, minor = 0;
+        const char* version = (const char*) glGetString(GL_VERSION);
+        if (version != NULL)
+            sscanf(version, "%d.%d", &major, &minor);
+
+        // Core profile contexts have no GL_EXTENSIONS string, but
+        // OpenGL 3.0 has the formats anyway.
+        const char* extensions = NULL;
+        if (major < 3)
+            extensions = (const char*) glGetString(GL_EXTENSIONS);
+        supported = (major >= 3 ||
+                     (extensions != NULL &&
+                      strstr(extensions, "GL_ARB_texture_rg") != NULL)) ? 1 : 0;
+    }
+    return supported != 0;
+}
+
+// Upload one level of a texture from pixels in an STImage format,
+// using the matching one, two or 16-bit four channel internal format. Without
+// GL_RED and GL_RG, single channel textures fall back to luminance
+// (which shaders also read as .x) and two channel ones to RGBA.
+static void UploadLevel(int level, STImage::Format format,
+                        int width, int height, const void* data)
+{
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    bool rg = SupportsTextureRG();
+    switch (format) {
+        case STImage::kR8:
+            glTexImage2D(GL_TEXTURE_2D, level, rg ? GL_R8 : GL_LUMINANCE8,
+                         width, height, 0,
+                         rg ? GL_RED : GL_LUMINANCE, GL_UNSIGNED_BYTE, data);
+            break;
+        case STImage::kR16:
+            glTexImage2D(GL_TEXTURE_2D, level, rg ? GL_R16 : GL_LUMINANCE16,
+                         width, height, 0,
+                         rg ? GL_RED : GL_LUMINANCE, GL_UNSIGNED_SHORT, data);
+            break;
+        case STImage::kRGBA16:
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA16,
+                         width, height, 0,
+                         GL_RGBA, GL_UNSIGNED_SHORT, data);
+            break;
+        case STImage::kRG8:
+            if (rg) {
+                glTexImage2D(GL_TEXTURE_2D, level, GL_RG8,
+                             width, height, 0,
+                             GL_RG, GL_UNSIGNED_BYTE, data);
+            }
+            else {
+                std::vector<STColor4ub> pixels(width * height);
+                STImage::ConvertPixels(format, data,
+                                       STImage::kRGBA8, &pixels[0],
+                                       width * height);
+                glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA,
+                             width, height, 0,
+                             GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+            }
+            break;
+        default:
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA,
+                         width, height, 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, data);
+            break;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
 //
 
 // Create an "empty" STTexture with no image data. You will need
@@ -29,6 +148,18 @@ STTexture::STTexture(
     LoadImageData(image, options);
 }
 
+// Create a new STTexture using the pixel data and precomputed
+// mipmaps from the given image cache.
+STTexture::STTexture(
+    const STImageCache* cache,
+    ImageOptions options)
+    : mWidth(-1)
+    , mHeight(-1)
+{
+    Initialize();
+    LoadImageData(cache, options);
+}
+
 // Common initialization code, used by all constructors.
 void STTexture::Initialize()
 {
@@ -36,15 +167,17 @@ void STTexture::Initialize()
     glGenTextures(1, &mTexId);
 
     // Default filtering and addressing options:
+    mMagFilter = mMinFilter = 0;
+    mWrapS = mWrapT = 0;
     SetFilter(GL_LINEAR, GL_LINEAR);
-    SetWrap(GL_CLAMP, GL_CLAMP);
+    SetWrap(GL_REPEAT, GL_REPEAT);
 }
 
 
 // Delete an existing STTexture.
 STTexture::~STTexture()
 {
-    glDeleteTextures(1, &mTexId);
+    STGLState::DeleteTexture(mTexId);
 }
 
 // Load image data into the STTexture. The texture will be
@@ -53,59 +186,198 @@ STTexture::~STTexture()
 void STTexture::LoadImageData(const STImage* image,
                               ImageOptions options)
 {
-    Bind();
+    // Bind without Bind(), since loading does not need texturing
+    // enabled (and core profile contexts cannot enable it).
+    STGLState::BindTexture(GL_TEXTURE_2D, mTexId);
 
     int width = image->GetWidth();
     int height = image->GetHeight();
     mWidth = width;
     mHeight = height;
-    const STColor4ub* pixels = image->GetPixels();
+    STImage::Format format = image->GetFormat();
+
+    // Textures are uploaded from tightly packed rows, bottom row
+    // first, so other images (such as views) are copied first.
+    STImage* packed = NULL;
+    if (image->GetRowOrder() != STImage::kBottomUp ||
+        image->GetStride() != width * STImage::GetBytesPerPixel(format)) {
+        packed = new STImage(width, height, format);
+        packed->CopyPixels(*image);
+        image = packed;
+    }
+    const unsigned char* data = image->GetData();
+
+    UploadLevel(0, format, width, height, data);
 
+    // Build the mipmaps ourselves rather than with gluBuild2DMipmaps,
+    // which runs on one core and first rescales images whose sides are
+    // not powers of two. Each level is downsampled from the previous
+    // one on the thread pool, then uploaded.
+    int numLevels = 1;
     if (options & kGenerateMipmaps) {
-        gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGBA,
-                          width, height,
-                          GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        STResample::ColorSpace space = (options & kSRGB) ?
+            STResample::kSRGB : STResample::kLinear;
+        numLevels = STResample::GetNumMipLevels(width, height);
+
+        int bytesPerPixel = STImage::GetBytesPerPixel(format);
+        int bytesPerChannel = STImage::GetBytesPerChannel(format);
+
+        std::vector<unsigned char> levels[2];
+        for (int level = 1; level < numLevels; ++level) {
+            int levelWidth = STMax(width / 2, 1);
+            int levelHeight = STMax(height / 2, 1);
+
+            std::vector<unsigned char>& levelData = levels[level % 2];
+            levelData.resize(levelWidth * levelHeight * bytesPerPixel);
+            if (format == STImage::kRGBA8) {
+                STResample::Downsample((const STColor4ub*) data, width, height,
+                                       (STColor4ub*) &levelData[0], space);
+            }
+            else {
+                STResample::DownsampleChannels(data, width, height,
+                                               bytesPerPixel / bytesPerChannel,
+                                               bytesPerChannel, &levelData[0]);
+            }
+            UploadLevel(level, format, levelWidth, levelHeight, &levelData[0]);
+
+            data = &levelData[0];
+            width = levelWidth;
+            height = levelHeight;
+        }
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+    STGLState::BindTexture(GL_TEXTURE_2D, 0);
+
+    delete packed;
+}
+
+// Load image data into the STTexture from an image cache,
+// uploading each cached mipmap level directly.
+void STTexture::LoadImageData(const STImageCache* cache,
+                              ImageOptions options)
+{
+    STGLState::BindTexture(GL_TEXTURE_2D, mTexId);
+
+    mWidth = cache->GetWidth();
+    mHeight = cache->GetHeight();
+
+    STBlockCompression::Format format = cache->GetFormat();
+    bool uploadCompressed = (format != STBlockCompression::kUncompressed &&
+                             SupportsFormat(format));
+
+    GLenum internalFormat = GL_RGBA;
+    switch (format) {
+        case STBlockCompression::kBC1: internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT; break;
+        case STBlockCompression::kBC3: internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+        case STBlockCompression::kBC4: internalFormat = GL_COMPRESSED_RED_RGTC1_EXT; break;
+        case STBlockCompression::kBC5: internalFormat = GL_COMPRESSED_RED_GREEN_RGTC2_EXT; break;
+        default: break;
+    }
+
+    // Without driver support, BC4 and BC5 levels are decompressed into
+    // the one and two channel formats they hold, rather than to RGBA.
+    STImage::Format decodedFormat = STImage::kRGBA8;
+    if (format == STBlockCompression::kBC4)
+        decodedFormat = STImage::kR8;
+    else if (format == STBlockCompression::kBC5)
+        decodedFormat = STImage::kRG8;
+
+    int numLevels = (options & kGenerateMipmaps) ? cache->GetNumLevels() : 1;
+    std::vector<STColor4ub> decoded;
+    std::vector<unsigned char> channels;
+    for (int level = 0; level < numLevels; ++level) {
+        int width = cache->GetWidth(level);
+        int height = cache->GetHeight(level);
+
+        if (uploadCompressed) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat,
+                                   width, height, 0,
+                                   (GLsizei) cache->GetDataSize(level),
+                                   cache->GetData(level));
+        }
+        else if (format != STBlockCompression::kUncompressed) {
+            // The driver cannot sample this format, so decompress it.
+            decoded.resize(width * height);
+            STBlockCompression::Decompress(format, cache->GetData(level),
+                                           width, height, &decoded[0]);
+            if (decodedFormat != STImage::kRGBA8) {
+                channels.resize(width * height *
+                                STImage::GetBytesPerPixel(decodedFormat));
+                STImage::ConvertPixels(STImage::kRGBA8, &decoded[0],
+                                       decodedFormat, &channels[0],
+                                       width * height);
+                UploadLevel(level, decodedFormat, width, height, &channels[0]);
+            }
+            else {
+                UploadLevel(level, STImage::kRGBA8, width, height, &decoded[0]);
+            }
+        }
+        else {
+            UploadLevel(level, cache->GetPixelFormat(), width, height,
+                        cache->GetData(level));
+        }
     }
-    else {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-                     width, height, 0,
-                     GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+    STGLState::BindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Can the OpenGL driver use textures stored in a block compressed
+// format directly?
+bool STTexture::SupportsFormat(STBlockCompression::Format format)
+{
+    switch (format) {
+        case STBlockCompression::kUncompressed:
+            return true;
+        case STBlockCompression::kBC1:
+        case STBlockCompression::kBC3:
+            return GLEW_EXT_texture_compression_s3tc != 0;
+        case STBlockCompression::kBC4:
+        case STBlockCompression::kBC5:
+            return GLEW_EXT_texture_compression_rgtc != 0;
     }
-    UnBind();
+    return false;
 }
 
 // Bind this texture for use in subsequent OpenGL drawing.
 void STTexture::Bind()
 {
-    glEnable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, mTexId);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    STGLState::Enable(GL_TEXTURE_2D);
+    STGLState::BindTexture(GL_TEXTURE_2D, mTexId);
 }
 
 // Un-bind this texture and return to untextured drawing.
 void STTexture::UnBind()
 {
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glDisable(GL_TEXTURE_2D);
+    STGLState::BindTexture(GL_TEXTURE_2D, 0);
+    STGLState::Disable(GL_TEXTURE_2D);
 }
 
 // Set the OpenGL texture-filtering mode to use for texture
 // magnification and minification respectively.
 void STTexture::SetFilter(GLint magFilter, GLint minFilter)
 {
-    Bind();
+    if (magFilter == mMagFilter && minFilter == mMinFilter)
+        return;
+    mMagFilter = magFilter;
+    mMinFilter = minFilter;
+
+    STGLState::BindTexture(GL_TEXTURE_2D, mTexId);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
-    UnBind();
+    STGLState::BindTexture(GL_TEXTURE_2D, 0);
 }
 
 // Set the OpenGL mode to use for texture addressing in
 // the S and T dimensions respectively.
 void STTexture::SetWrap(GLint wrapS, GLint wrapT)
 {
-    Bind();
+    if (wrapS == mWrapS && wrapT == mWrapT)
+        return;
+    mWrapS = wrapS;
+    mWrapT = wrapT;
+
+    STGLState::BindTexture(GL_TEXTURE_2D, mTexId);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
-    UnBind();
+    STGLState::BindTexture(GL_TEXTURE_2D, 0);
 }
@@ -0,0 +1,364 @@
+// STTextureAtlas.cpp
+
+/* Include-order dependency!
+*
+* GLEW must be included before the standard GL.h header.
+* In this case, it means we must violate the usual design
+* principle of always including Foo.h first in Foo.cpp.
+*/
+#ifdef __APPLE__
+#include <OpenGL/gl.h>
+#else
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GL/gl.h"
+#endif
+
+#include "STTextureAtlas.h"
+
+#include "STImageCache.h"
+#include "STTexture.h"
+#include "STTextureCache.h"
+#include "STTriangleMesh.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdio.h>
+
+// Texture coordinates this far outside [0, 1] still count as inside,
+// to allow for rounding in exported models.
+static const float kTexCoordTolerance = 1.0e-3f;
+
+// Number of atlases built so far, to name them in the texture cache.
+static int sNumAtlases = 0;
+
+//
+// Packs rectangles into a fixed-size area bottom-left first, keeping
+// track of the outline of the top of the rectangles placed so far.
+//
+class STSkyline
+{
+public:
+    STSkyline(int width, int height)
+        : mWidth(width)
+        , mHeight(height)
+        , mUsedWidth(0)
+        , mUsedHeight(0)
+    {
+        Segment segment = { 0, 0, width };
+        mSegments.push_back(segment);
+    }
+
+    //
+    // Find the lowest place for a rectangle and claim it.
+    // Returns false if the rectangle does not fit.
+    //
+    bool Insert(int width, int height, int* x, int* y)
+    {
+        int best = -1;
+        int bestY = mHeight;
+        for (int i = 0; i < (int) mSegments.size(); ++i) {
+            int top = Fit(i, width, height);
+            if (top >= 0 && top < bestY) {
+                best = i;
+                bestY = top;
+            }
+        }
+        if (best < 0)
+            return false;
+
+        Segment segment = { mSegments[best].x, bestY + height, width };
+        mSegments.insert(mSegments.begin() + best, segment);
+
+        // Trim the segments that the new one now covers.
+        for (size_t i = best + 1; i < mSegments.size(); ) {
+            const Segment& previous = mSegments[i - 1];
+            int overlap = previous.x + previous.width - mSegments[i].x;
+            if (overlap <= 0)
+                break;
+            mSegments[i].x += overlap;
+            mSegments[i].width -= overlap;
+            if (mSegments[i].width > 0)
+                break;
+            mSegments.erase(mSegments.begin() + i);
+        }
+
+        // Merge neighbors at the same height.
+        for (size_t i = 1; i < mSegments.size(); ) {
+            if (mSegments[i].y == mSegments[i - 1].y) {
+                mSegments[i - 1].width += mSegments[i].width;
+                mSegments.erase(mSegments.begin() + i);
+            }
+            else {
+                ++i;
+            }
+        }
+
+        *x = segment.x;
+        *y = bestY;
+        mUsedWidth = std::max(mUsedWidth, segment.x + width);
+        mUsedHeight = std::max(mUsedHeight, bestY + height);
+        return true;
+    }
+
+    int GetUsedWidth() const { return mUsedWidth; }
+    int GetUsedHeight() const { return mUsedHeight; }
+
+private:
+    struct Segment {
+        int x;
+        int y;
+        int width;
+    };
+
+    //
+    // Get the height at which a rectangle starting at segment i
+    // would rest, or -1 if it would not fit.
+    //
+    int Fit(int i, int width, int height) const
+    {
+        if (mSegments[i].x + width > mWidth)
+            return -1;
+
+        int y = 0;
+        int remaining = width;
+        for (int j = i; remaining > 0; ++j) {
+            y = std::max(y, mSegments[j].y);
+            if (y + height > mHeight)
+                return -1;
+            remaining -= mSegments[j].width;
+        }
+        return y;
+    }
+
+    int mWidth;
+    int mHeight;
+    int mUsedWidth;
+    int mUsedHeight;
+
+    // The outline, left to right, covering the whole width.
+    std::vector<Segment> mSegments;
+};
+
+//
+// A color map to pack, and the meshes that use it.
+//
+struct STAtlasEntry {
+    STTexture* texture;
+    const STImageCache* image;
+    std::vector<STTriangleMesh*> meshes;
+
+    // Where the map (without its padding) was placed.
+    int page;
+    int x;
+    int y;
+};
+
+//
+// Order maps tallest first, which packs a skyline most tightly.
+//
+static bool
+IsTaller(const STAtlasEntry* a, const STAtlasEntry* b)
+{
+    if (a->image->GetHeight() != b->image->GetHeight())
+        return a->image->GetHeight() > b->image->GetHeight();
+    return a->image->GetWidth() > b->image->GetWidth();
+}
+
+//
+// Round a size up to a multiple of the alignment.
+//
+static int
+AlignUp(int size, int alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+//
+// Collect the texture coordinates used by the faces of a mesh,
+// each only once. Returns false if any lies outside [0, 1].
+//
+static bool
+GetTexCoords(const STTriangleMesh* mesh, std::set<STPoint2*>* texCoords)
+{
+    for (size_t i = 0; i < mesh->mFaces.size(); ++i) {
+        for (int j = 0; j < 3; ++j) {
+            STPoint2* texPos = mesh->mFaces[i]->texPos[j];
+            if (texPos->x < -kTexCoordTolerance || texPos->x > 1.0f + kTexCoordTolerance ||
+                texPos->y < -kTexCoordTolerance || texPos->y > 1.0f + kTexCoordTolerance)
+                return false;
+            texCoords->insert(texPos);
+        }
+    }
+    return true;
+}
+
+//
+// Copy a map into an atlas at (x, y), surrounded by padding pixels
+// that repeat its edges.
+//
+static void
+CopyPadded(const STImageCache* image, STImage* atlas, int x, int y, int padding)
+{
+    int width = image->GetWidth();
+    int height = image->GetHeight();
+    const STImage::Pixel* pixels = image->GetPixels();
+
+    for (int row = -padding; row < height + padding; ++row) {
+        const STImage::Pixel* src =
+            pixels + (size_t) std::min(std::max(row, 0), height - 1) * width;
+        STImage::Pixel* dst = (STImage::Pixel*) atlas->GetRow(y + row) + x;
+
+        for (int i = -padding; i < 0; ++i)
+            dst[i] = src[0];
+        std::copy(src, src + width, dst);
+        for (int i = width; i < width + padding; ++i)
+            dst[i] = src[width - 1];
+    }
+}
+
+//
+// Pack the color maps of the meshes into atlas textures.
+//
+int STTextureAtlas::Build(const std::vector<STTriangleMesh*>& meshes,
+                          int maxSize, int padding)
+{
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    if (maxTextureSize > 0)
+        maxSize = std::min(maxSize, (int) maxTextureSize);
+    padding = std::max(padding, 0);
+
+    // Placing maps at multiples of a power of two keeps them apart
+    // in that many mipmap levels, if mipmaps are made of an atlas.
+    int alignment = 1;
+    while (alignment * 2 <= padding)
+        alignment *= 2;
+
+    // Group the meshes that can share an atlas by their color map.
+    std::map<STTexture*, STAtlasEntry> entries;
+    std::map<STTriangleMesh*, std::set<STPoint2*> > texCoords;
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        STTriangleMesh* mesh = meshes[i];
+        STTexture* texture = mesh->mSurfaceColorTex;
+        if (texture == STTriangleMesh::whiteTex)
+            continue;
+
+        const STImageCache* image = STTextureCache::GetImage(texture);
+        if (!image || image->GetFormat() != STBlockCompression::kUncompressed ||
+            image->GetPixelFormat() != STImage::kRGBA8 ||
+            image->GetWidth() + 2 * padding > maxSize ||
+            image->GetHeight() + 2 * padding > maxSize)
+            continue;
+
+        std::set<STPoint2*> meshTexCoords;
+        if (!GetTexCoords(mesh, &meshTexCoords))
+            continue;
+        texCoords[mesh].swap(meshTexCoords);
+
+        STAtlasEntry& entry = entries[texture];
+        entry.texture = texture;
+        entry.image = image;
+        entry.meshes.push_back(mesh);
+    }
+
+    // Packing a single map would only add padding.
+    if (entries.size() < 2)
+        return 0;
+
+    std::vector<STAtlasEntry*> sorted;
+    std::map<STTexture*, STAtlasEntry>::iterator it;
+    for (it = entries.begin(); it != entries.end(); ++it)
+        sorted.push_back(&it->second);
+    std::stable_sort(sorted.begin(), sorted.end(), IsTaller);
+
+    std::vector<STSkyline> pages;
+    std::vector<int> pageEntries;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        STAtlasEntry* entry = sorted[i];
+        int width = AlignUp(entry->image->GetWidth() + 2 * padding, alignment);
+        int height = AlignUp(entry->image->GetHeight() + 2 * padding, alignment);
+
+        int x = 0, y = 0;
+        size_t page = 0;
+        while (page < pages.size() && !pages[page].Insert(width, height, &x, &y))
+            ++page;
+        if (page == pages.size()) {
+            pages.push_back(STSkyline(maxSize, maxSize));
+            pageEntries.push_back(0);
+            pages[page].Insert(width, height, &x, &y);
+        }
+
+        entry->page = (int) page;
+        entry->x = x + padding;
+        entry->y = y + padding;
+        pageEntries[page]++;
+    }
+
+    // Copy the maps into the atlases, and add them to the cache.
+    std::vector<STTexture*> atlases;
+    for (size_t page = 0; page < pages.size(); ++page) {
+        if (pageEntries[page] < 2) {
+            // A map alone in its atlas stays where it is.
+            atlases.push_back(NULL);
+            continue;
+        }
+
+        STImage atlas(pages[page].GetUsedWidth(), pages[page].GetUsedHeight(),
+                      STImage::kRGBA8);
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            if (sorted[i]->page == (int) page)
+                CopyPadded(sorted[i]->image, &atlas, sorted[i]->x, sorted[i]->y, padding);
+        }
+
+        // Without mipmaps, as LoadObj() loads the maps themselves.
+        STTexture* texture = new STTexture(&atlas, STTexture::kNone);
+        char name[64];
+        sprintf(name, "<atlas %d>", sNumAtlases++);
+        STTextureCache::Insert(name, texture);
+        atlases.push_back(texture);
+    }
+
+    // Move the meshes over to the atlases. Releasing a mesh's own
+    // map may delete it, so this comes after all the copying.
+    int numAtlases = 0;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        const STAtlasEntry* entry = sorted[i];
+        STTexture* atlas = atlases[entry->page];
+        if (!atlas)
+            continue;
+
+        float atlasWidth = (float) atlas->GetWidth();
+        float atlasHeight = (float) atlas->GetHeight();
+        float width = (float) entry->image->GetWidth();
+        float height = (float) entry->image->GetHeight();
+
+        for (size_t m = 0; m < entry->meshes.size(); ++m) {
+            STTriangleMesh* mesh = entry->meshes[m];
+            std::set<STPoint2*>& meshTexCoords = texCoords[mesh];
+            std::set<STPoint2*>::iterator t;
+            for (t = meshTexCoords.begin(); t != meshTexCoords.end(); ++t) {
+                STPoint2* texPos = *t;
+                float u = std::min(std::max(texPos->x, 0.0f), 1.0f);
+                float v = std::min(std::max(texPos->y, 0.0f), 1.0f);
+                texPos->x = (entry->x + u * width) / atlasWidth;
+                texPos->y = (entry->y + v * height) / atlasHeight;
+            }
+
+            STTextureCache::AddRef(atlas);
+            STTextureCache::Release(mesh->mSurfaceColorTex);
+            mesh->mSurfaceColorTex = atlas;
+        }
+    }
+
+    // Drop the references held since Insert().
+    for (size_t page = 0; page < atlases.size(); ++page) {
+        if (atlases[page]) {
+            STTextureCache::Release(atlases[page]);
+            numAtlases++;
+        }
+    }
+
+    return numAtlases;
+}
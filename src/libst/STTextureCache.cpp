@@ -0,0 +1,185 @@
+// STTextureCache.cpp
+#include "STTextureCache.h"
+
+#include "STImageCache.h"
+#include "STThreadPool.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+std::map<std::string, STTextureCache::Entry> STTextureCache::sEntries;
+std::map<std::string, std::shared_future<STImageCache*> > STTextureCache::sPending;
+
+//
+// Resolve a file name to an absolute path with no "." or ".."
+// components, so that different spellings of the same file share
+// a cache entry. Returns the name unchanged if it cannot be resolved.
+//
+static std::string
+CanonicalPath(const std::string& filename)
+{
+#ifdef _WIN32
+    char path[_MAX_PATH];
+    if (_fullpath(path, filename.c_str(), _MAX_PATH) != NULL)
+        return std::string(path);
+#else
+    char path[PATH_MAX];
+    if (realpath(filename.c_str(), path) != NULL)
+        return std::string(path);
+#endif
+    return filename;
+}
+
+//
+// Get the options for decoding an image into a texture. Mipmaps for
+// sRGB textures must be built in linear light by the image cache.
+//
+static STImage::LoadOptions
+GetImageOptions(const STImage::LoadOptions& options,
+                STTexture::ImageOptions textureOptions)
+{
+    STImage::LoadOptions imageOptions = options;
+    if (textureOptions & STTexture::kSRGB)
+        imageOptions.sRGB = true;
+    return imageOptions;
+}
+
+//
+// Build the key identifying an image file loaded with given options.
+//
+std::string STTextureCache::MakeKey(const std::string& filename,
+                                    const STImage::LoadOptions& options,
+                                    STTexture::ImageOptions textureOptions,
+                                    STBlockCompression::Format format)
+{
+    // Compressed images are encoded from RGBA pixels, whatever
+    // format the options ask for.
+    STImage::Format pixelFormat = (format == STBlockCompression::kUncompressed) ?
+        options.format : STImage::kRGBA8;
+
+    char suffix[80];
+    sprintf(suffix, "|max=%d|srgb=%d|pix=%d|tex=%d|fmt=%d", options.maxDimension,
+            (int) options.sRGB, (int) pixelFormat, (int) textureOptions, (int) format);
+    return CanonicalPath(filename) + suffix;
+}
+
+//
+// Start decoding an image file on a worker thread.
+//
+void STTextureCache::Request(const std::string& filename,
+                             const STImage::LoadOptions& requestOptions,
+                             STTexture::ImageOptions textureOptions,
+                             STBlockCompression::Format format)
+{
+    STImage::LoadOptions options = GetImageOptions(requestOptions, textureOptions);
+    std::string key = MakeKey(filename, options, textureOptions, format);
+    if (sEntries.count(key) || sPending.count(key))
+        return;
+
+    sPending[key] = STThreadPool::GetShared()->Submit([filename, options, format]() {
+        return new STImageCache(filename, options, format);
+    }).share();
+}
+
+//
+// Get the texture for an image file, loading
+// it if needed, and add a reference to it.
+//
+STTexture* STTextureCache::Acquire(const std::string& filename,
+                                   const STImage::LoadOptions& requestOptions,
+                                   STTexture::ImageOptions textureOptions,
+                                   STBlockCompression::Format format)
+{
+    STImage::LoadOptions options = GetImageOptions(requestOptions, textureOptions);
+    std::string key = MakeKey(filename, options, textureOptions, format);
+
+    std::map<std::string, Entry>::iterator found = sEntries.find(key);
+    if (found != sEntries.end()) {
+        found->second.refCount++;
+        return found->second.texture;
+    }
+
+    // Use the decoded image from an earlier Request(), or decode it
+    // now. Either way, load errors are thrown to the caller.
+    STImageCache* image = NULL;
+    std::map<std::string, std::shared_future<STImageCache*> >::iterator
+        pending = sPending.find(key);
+    if (pending != sPending.end()) {
+        std::shared_future<STImageCache*> result = pending->second;
+        sPending.erase(pending);
+        image = result.get();
+    }
+    else {
+        image = new STImageCache(filename, options, format);
+    }
+
+    Entry entry;
+    entry.image = image;
+    entry.texture = new STTexture(image, textureOptions);
+    entry.refCount = 1;
+    sEntries[key] = entry;
+    return entry.texture;
+}
+
+//
+// Add a texture made by the program to the cache.
+//
+void STTextureCache::Insert(const std::string& name, STTexture* texture)
+{
+    assert(sEntries.count(name) == 0 && "STTextureCache::Insert() - name is in use");
+
+    Entry entry;
+    entry.image = NULL;
+    entry.texture = texture;
+    entry.refCount = 1;
+    sEntries[name] = entry;
+}
+
+//
+// Add a reference to a texture that came from the cache.
+//
+void STTextureCache::AddRef(STTexture* texture)
+{
+    std::map<std::string, Entry>::iterator it;
+    for (it = sEntries.begin(); it != sEntries.end(); ++it) {
+        if (it->second.texture == texture) {
+            it->second.refCount++;
+            return;
+        }
+    }
+    assert(false && "STTextureCache::AddRef() - texture is not cached");
+}
+
+//
+// Drop a reference to a texture from Acquire().
+//
+void STTextureCache::Release(STTexture* texture)
+{
+    std::map<std::string, Entry>::iterator it;
+    for (it = sEntries.begin(); it != sEntries.end(); ++it) {
+        if (it->second.texture == texture) {
+            if (--it->second.refCount == 0) {
+                delete it->second.texture;
+                delete it->second.image;
+                sEntries.erase(it);
+            }
+            return;
+        }
+    }
+    assert(false && "STTextureCache::Release() - texture is not cached");
+}
+
+//
+// Get the decoded pixels of a cached texture.
+//
+const STImageCache* STTextureCache::GetImage(const STTexture* texture)
+{
+    std::map<std::string, Entry>::const_iterator it;
+    for (it = sEntries.begin(); it != sEntries.end(); ++it) {
+        if (it->second.texture == texture)
+            return it->second.image;
+    }
+    return NULL;
+}
@@ -0,0 +1,146 @@
+// STThreadPool.cpp
+#include "STThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+
+//
+// Work shared by the threads taking part in one ParallelFor() call.
+// Helper jobs may start after the call has returned, so the state is
+// reference counted and late helpers simply find no work left.
+//
+struct STParallelForState {
+    std::function<void(int)> body;
+    int count;
+    std::atomic<int> next;
+    int numDone;
+    std::mutex mutex;
+    std::condition_variable allDone;
+};
+
+//
+// Run iterations of a ParallelFor() until none are left.
+//
+static void
+RunParallelFor(STParallelForState& state)
+{
+    int numRun = 0;
+    int index;
+    while ((index = state.next++) < state.count) {
+        state.body(index);
+        numRun++;
+    }
+
+    if (numRun > 0) {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.numDone += numRun;
+        if (state.numDone == state.count)
+            state.allDone.notify_all();
+    }
+}
+
+//
+// Start a pool with the given number of worker threads.
+//
+STThreadPool::STThreadPool(int numThreads)
+    : mStopping(false)
+{
+    if (numThreads <= 0)
+        numThreads = (int) std::thread::hardware_concurrency();
+    if (numThreads <= 0)
+        numThreads = 2;
+
+    for (int i = 0; i < numThreads; ++i)
+        mThreads.push_back(std::thread(&STThreadPool::WorkerLoop, this));
+}
+
+//
+// Finish all queued jobs and stop the worker threads.
+//
+STThreadPool::~STThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mJobAvailable.notify_all();
+
+    for (size_t i = 0; i < mThreads.size(); ++i)
+        mThreads[i].join();
+}
+
+//
+// Add a job to the queue and wake a worker.
+//
+void STThreadPool::Enqueue(const std::function<void()>& job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJobs.push_back(job);
+    }
+    mJobAvailable.notify_one();
+}
+
+//
+// Main loop of each worker thread: run jobs until the
+// pool is stopped and the queue is empty.
+//
+void STThreadPool::WorkerLoop()
+{
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while (!mStopping && mJobs.empty())
+                mJobAvailable.wait(lock);
+            if (mJobs.empty())
+                return;
+
+            job = mJobs.front();
+            mJobs.pop_front();
+        }
+        job();
+    }
+}
+
+//
+// Call body(i) for every i in [0, count) on the worker
+// threads and the calling thread.
+//
+void STThreadPool::ParallelFor(int count, const std::function<void(int)>& body)
+{
+    if (count <= 0)
+        return;
+
+    std::shared_ptr<STParallelForState> state(new STParallelForState);
+    state->body = body;
+    state->count = count;
+    state->next = 0;
+    state->numDone = 0;
+
+    int numHelpers = std::min(count - 1, GetNumThreads());
+    for (int i = 0; i < numHelpers; ++i)
+        Enqueue([state]() { RunParallelFor(*state); });
+
+    // Work alongside the helpers rather than just waiting for them,
+    // so that this never deadlocks when called from a busy pool.
+    RunParallelFor(*state);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (state->numDone < count)
+        state->allDone.wait(lock);
+}
+
+//
+// Get the pool shared by all of libst, creating it on first use.
+//
+STThreadPool* STThreadPool::GetShared()
+{
+    static std::once_flag sCreated;
+    static STThreadPool* sShared = NULL;
+
+    // The shared pool is never deleted, so that jobs still running
+    // at exit do not race with static destructors.
+    std::call_once(sCreated, []() { sShared = new STThreadPool(); });
+    return sShared;
+}
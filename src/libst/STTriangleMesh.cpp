@@ -16,11 +16,14 @@
 #include "GL/gl.h"
 #endif
 
+#include "STGLState.h"
 #include "STTexture.h"
+#include "STTextureCache.h"
 #include <iostream>
 #include <fstream>
 #include <map>
 #include <math.h>
+#include <stdio.h>
 #include <string.h>
 #include <algorithm>
 #define PI 3.14159265
@@ -36,6 +39,7 @@ const float STTriangleMesh::white[]={1.0f,1.0f,1.0f,1.0f};
 int STTriangleMesh::instance_count=0;
 STImage STTriangleMesh::whiteImg=STImage(256, 256, STImage::Pixel(255,255,255,255));
 STTexture* STTriangleMesh::whiteTex = 0;
+unsigned int STTriangleMesh::axisList = 0;
 //
 // Initialization
 //
@@ -54,7 +58,6 @@ STTriangleMesh::STTriangleMesh()
 
     mDrawAxis = true;
 
-    mSurfaceColorImg=&whiteImg;
     if(instance_count==0){
         whiteTex = new STTexture(&whiteImg);
     }
@@ -78,12 +81,14 @@ STTriangleMesh::~STTriangleMesh()
     for(unsigned int i=0;i<mTexPos.size();i++)delete mTexPos[i];
     for(unsigned int i=0;i<mNormals.size();i++)delete mNormals[i];
     for(unsigned int i=0;i<mFaces.size();i++)delete mFaces[i];
-	if(mSurfaceColorTex!=whiteTex)delete mSurfaceColorTex;
-	if(mSurfaceColorImg!=&whiteImg)delete mSurfaceColorImg;
+	if(mSurfaceColorTex!=whiteTex)STTextureCache::Release(mSurfaceColorTex);
 
     instance_count--;
     if(instance_count==0){
         delete whiteTex;
+        if(axisList)
+            glDeleteLists(axisList, 1);
+        axisList = 0;
     }
 }
 
@@ -92,55 +97,123 @@ STTriangleMesh::~STTriangleMesh()
 //
 void STTriangleMesh::Draw(bool smooth) const
 {
-    if(mDrawAxis){
-        glPushAttrib(GL_LIGHTING_BIT);
-        glActiveTexture(GL_TEXTURE2);
-        whiteTex->Bind();
-
-        glEnable(GL_LIGHTING);
-        glLightfv(GL_LIGHT0, GL_AMBIENT,     white);
-        glMaterialfv(GL_FRONT, GL_DIFFUSE,   black);
-        glMaterialfv(GL_FRONT, GL_SPECULAR,  black);
-
-        glPushMatrix();
-        STVector3 size_vector=mBoundingBoxMax-mBoundingBoxMin;
-        float maxSize=(std::max)((std::max)(size_vector.x,size_vector.y),size_vector.z);
-        glScalef(maxSize/200.0f,maxSize/200.0f,maxSize/200.0f);
-
-        GLUquadricObj* cylinder = gluNewQuadric();
-
-        glMaterialfv(GL_FRONT, GL_AMBIENT,   red);
-        glPushMatrix();
-        glRotatef(90.0f,0,1,0);
-        gluCylinder(cylinder, 1.0, 1.0, 200, 10, 1);
-        glPopMatrix();
-
-        glMaterialfv(GL_FRONT, GL_AMBIENT,   green);
-        glPushMatrix();
-        glRotatef(-90.0f,1,0,0);
-        gluCylinder(cylinder, 1.0, 1.0, 200, 10, 1);
-        glPopMatrix();
-
-        glMaterialfv(GL_FRONT, GL_AMBIENT,   blue);
-        glPushMatrix();
-        gluCylinder(cylinder, 1.0, 1.0, 200, 10, 1);
-        glPopMatrix();
-
-        glPopMatrix();
-
-        glActiveTexture(GL_TEXTURE2);
-        whiteTex->UnBind();
-        glPopAttrib();
-    }
+    if(mDrawAxis)
+        DrawAxis();
+
+    BindMaterial();
+    DrawGeometry(smooth);
+    UnBindMaterial();
+}
 
-    glActiveTexture(GL_TEXTURE2);
+//
+// Record the coordinate axes, shared by all meshes, in a display
+// list: the lighting, and a cylinder of the axis' color along each
+// axis, 200 units long.
+//
+static unsigned int
+BuildAxisList()
+{
+    GLuint list = glGenLists(1);
+    glNewList(list, GL_COMPILE);
+
+    // The lighting is set directly, since popping it
+    // restores what STGLState expects.
+    glEnable(GL_LIGHTING);
+    glLightfv(GL_LIGHT0, GL_AMBIENT,     STTriangleMesh::white);
+    glMaterialfv(GL_FRONT, GL_DIFFUSE,   STTriangleMesh::black);
+    glMaterialfv(GL_FRONT, GL_SPECULAR,  STTriangleMesh::black);
+
+    GLUquadricObj* cylinder = gluNewQuadric();
+
+    glMaterialfv(GL_FRONT, GL_AMBIENT,   STTriangleMesh::red);
+    glPushMatrix();
+    glRotatef(90.0f,0,1,0);
+    gluCylinder(cylinder, 1.0, 1.0, 200, 10, 1);
+    glPopMatrix();
+
+    glMaterialfv(GL_FRONT, GL_AMBIENT,   STTriangleMesh::green);
+    glPushMatrix();
+    glRotatef(-90.0f,1,0,0);
+    gluCylinder(cylinder, 1.0, 1.0, 200, 10, 1);
+    glPopMatrix();
+
+    glMaterialfv(GL_FRONT, GL_AMBIENT,   STTriangleMesh::blue);
+    glPushMatrix();
+    gluCylinder(cylinder, 1.0, 1.0, 200, 10, 1);
+    glPopMatrix();
+
+    gluDeleteQuadric(cylinder);
+    glEndList();
+    return list;
+}
+
+//
+// Draw the coordinate axes at the origin of the mesh.
+//
+void STTriangleMesh::DrawAxis() const
+{
+    // The axes are tessellated once, the first time any mesh
+    // draws them.
+    if(!axisList)
+        axisList = BuildAxisList();
+
+    glPushAttrib(GL_LIGHTING_BIT);
+    STGLState::ActiveTexture(2);
+    whiteTex->Bind();
+
+    glPushMatrix();
+    STVector3 size_vector=mBoundingBoxMax-mBoundingBoxMin;
+    float maxSize=(std::max)((std::max)(size_vector.x,size_vector.y),size_vector.z);
+    glScalef(maxSize/200.0f,maxSize/200.0f,maxSize/200.0f);
+    glCallList(axisList);
+    glPopMatrix();
+
+    STGLState::ActiveTexture(2);
+    whiteTex->UnBind();
+    glPopAttrib();
+}
+
+//
+// Bind the color map, on texture unit 2, and set the material.
+//
+void STTriangleMesh::BindMaterial() const
+{
+    STGLState::ActiveTexture(2);
     mSurfaceColorTex->Bind();
 
-    glMaterialfv(GL_FRONT, GL_AMBIENT,   mMaterialAmbient);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE,   mMaterialDiffuse);
-    glMaterialfv(GL_FRONT, GL_SPECULAR,  mMaterialSpecular);
-    glMaterialfv(GL_FRONT, GL_SHININESS, &mShininess);
-    
+    STGLState::Material(GL_AMBIENT,   mMaterialAmbient);
+    STGLState::Material(GL_DIFFUSE,   mMaterialDiffuse);
+    STGLState::Material(GL_SPECULAR,  mMaterialSpecular);
+    STGLState::Material(GL_SHININESS, &mShininess);
+}
+
+//
+// Get the values of the material.
+//
+STMaterialKey STTriangleMesh::GetMaterialKey() const
+{
+    STMaterialKey key;
+    memcpy(key.ambient, mMaterialAmbient, sizeof(key.ambient));
+    memcpy(key.diffuse, mMaterialDiffuse, sizeof(key.diffuse));
+    memcpy(key.specular, mMaterialSpecular, sizeof(key.specular));
+    key.shininess = mShininess;
+    return key;
+}
+
+//
+// Un-bind the color map.
+//
+void STTriangleMesh::UnBindMaterial() const
+{
+    STGLState::ActiveTexture(2);
+    mSurfaceColorTex->UnBind();
+}
+
+//
+// Draw the triangles, without changing any state.
+//
+void STTriangleMesh::DrawGeometry(bool smooth) const
+{
     glBegin(GL_TRIANGLES);
     for (unsigned int i = 0; i < mFaces.size(); i++) {
         STFace* f=mFaces[i];
@@ -158,9 +231,53 @@ void STTriangleMesh::Draw(bool smooth) const
         }
     }
     glEnd();
+}
 
-    glActiveTexture(GL_TEXTURE2);
-    mSurfaceColorTex->UnBind();
+//
+// Order the corners of triangles bytewise, to find those that are
+// the same in every way, including their face normal.
+//
+struct STBufferVertexLess {
+    bool operator()(const STBufferVertex& a, const STBufferVertex& b) const
+    {
+        return memcmp(&a, &b, sizeof(STBufferVertex)) < 0;
+    }
+};
+
+//
+// Append the corners and triangles to vertex and index buffers.
+//
+void STTriangleMesh::AppendBuffers(std::vector<STBufferVertex>* vertices,
+                                   std::vector<unsigned int>* indices) const
+{
+    std::map<STBufferVertex, unsigned int, STBufferVertexLess> corners;
+    for (unsigned int i = 0; i < mFaces.size(); i++) {
+        const STFace* f = mFaces[i];
+        for (unsigned int j = 0; j < 3; j++) {
+            const STVector3& normal = mSimpleMesh ? f->v[j]->normal : *f->normals[j];
+
+            STBufferVertex vertex;
+            vertex.position[0] = f->v[j]->pt.x;
+            vertex.position[1] = f->v[j]->pt.y;
+            vertex.position[2] = f->v[j]->pt.z;
+            vertex.normal[0] = normal.x;
+            vertex.normal[1] = normal.y;
+            vertex.normal[2] = normal.z;
+            vertex.faceNormal[0] = f->normal.x;
+            vertex.faceNormal[1] = f->normal.y;
+            vertex.faceNormal[2] = f->normal.z;
+            vertex.texPos[0] = f->texPos[j]->x;
+            vertex.texPos[1] = f->texPos[j]->y;
+
+            std::map<STBufferVertex, unsigned int, STBufferVertexLess>::iterator
+                it = corners.find(vertex);
+            if (it == corners.end()) {
+                it = corners.insert(std::make_pair(vertex, (unsigned int) vertices->size())).first;
+                vertices->push_back(vertex);
+            }
+            indices->push_back(it->second);
+        }
+    }
 }
 
 //
@@ -345,8 +462,39 @@ bool STTriangleMesh::UpdateGeometry()
     return true;
 }
 
+//
+// Get a reference to the texture of a color map, loaded as LoadObj()
+// loads them. Throws on failure to load the image.
+//
+static STTexture*
+AcquireColorMap(const std::string& filename)
+{
+    return STTextureCache::Acquire(filename, STImage::LoadOptions(), STTexture::kNone);
+}
+
 bool STTriangleMesh::CalculateTextureCoordinatesViaSphericalProxy()
 {
+    // The new coordinates wrap around the seam of the sphere and do
+    // not address the mesh's place in a texture atlas (see
+    // STTextureAtlas), so the mesh goes back to its own color map.
+    // Without an atlas, this is the texture the mesh already has.
+    if(!mColorMapFile.empty()){
+        try {
+            STTexture* colorMap = AcquireColorMap(mColorMapFile);
+            STTextureCache::Release(mSurfaceColorTex);
+            mSurfaceColorTex = colorMap;
+        }
+        catch (const std::exception& e) {
+            fprintf(stderr, "STTriangleMesh::CalculateTextureCoordinatesViaSphericalProxy() - Could not load '%s': %s\n",
+                    mColorMapFile.c_str(), e.what());
+        }
+        catch (const std::exception* e) {
+            fprintf(stderr, "STTriangleMesh::CalculateTextureCoordinatesViaSphericalProxy() - Could not load '%s': %s\n",
+                    mColorMapFile.c_str(), e->what());
+            delete e;
+        }
+    }
+
 	for(unsigned int i=0;i<mFaces.size();i++){
 		STFace* face=mFaces[i];		
 		for(int v=0;v<3;v++){
@@ -546,6 +694,20 @@ std::string STTriangleMesh::LoadObj(std::vector<STTriangleMesh*>& output_meshes,
     
     std::cout<<"#shapes="<<shapes.size()<<" #materials="<<materials.size()<<std::endl;
     
+    // Start decoding all texture maps in the background while
+    // the meshes are built. Maps shared by several shapes are
+    // only decoded and uploaded once.
+    std::vector<std::string> colorMaps(shapes.size());
+    for(unsigned int mesh_id=0; mesh_id<shapes.size(); mesh_id++){
+        const std::vector<int>& material_ids=shapes[mesh_id].mesh.material_ids;
+        if(material_ids.size()>0&&material_ids[0]>=0){
+            std::string colorMap = materials[material_ids[0]].diffuse_texname;
+            if (colorMap != "") {
+                colorMaps[mesh_id] = base+colorMap;
+                STTextureCache::Request(colorMaps[mesh_id], STImage::LoadOptions(), STTexture::kNone);
+            }
+        }
+    }
 
     for(unsigned int mesh_id=0; mesh_id<shapes.size(); mesh_id++)
     {
@@ -589,18 +751,33 @@ std::string STTriangleMesh::LoadObj(std::vector<STTriangleMesh*>& output_meshes,
                 stmesh->mMaterialDiffuse[i]=material.diffuse[i];
                 stmesh->mMaterialSpecular[i]=material.specular[i];
             }
-			std::string colorMap = material.diffuse_texname;
-			if (colorMap != "") {
-				stmesh->mSurfaceColorImg = new STImage(base+colorMap);
-		        stmesh->mSurfaceColorTex = new STTexture(stmesh->mSurfaceColorImg,STTexture::kNone);
-			}
-  		
             stmesh->mShininess = 8.;  // # between 1 and 128.
         }
 
         output_meshes.push_back(stmesh);
     }
 
+    // Upload the decoded texture maps here, on the OpenGL thread.
+    size_t first_mesh = output_meshes.size()-shapes.size();
+    for(unsigned int mesh_id=0; mesh_id<shapes.size(); mesh_id++){
+        if(colorMaps[mesh_id] == "")
+            continue;
+        try {
+            output_meshes[first_mesh+mesh_id]->mSurfaceColorTex =
+                AcquireColorMap(colorMaps[mesh_id]);
+            output_meshes[first_mesh+mesh_id]->mColorMapFile = colorMaps[mesh_id];
+        }
+        catch (const std::exception& e) {
+            fprintf(stderr, "STTriangleMesh::LoadObj() - Could not load '%s': %s\n",
+                    colorMaps[mesh_id].c_str(), e.what());
+        }
+        catch (const std::exception* e) {
+            fprintf(stderr, "STTriangleMesh::LoadObj() - Could not load '%s': %s\n",
+                    colorMaps[mesh_id].c_str(), e->what());
+            delete e;
+        }
+    }
+
     return err;
 }
 
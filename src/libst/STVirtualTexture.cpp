@@ -0,0 +1,813 @@
+// STVirtualTexture.cpp
+
+/* Include-order dependency!
+*
+* GLEW must be included before the standard GL.h header.
+* In this case, it means we must violate the usual design
+* principle of always including Foo.h first in Foo.cpp.
+*/
+#ifdef __APPLE__
+#define GLEW_VERSION_2_1 1
+#define GLEW_EXT_framebuffer_object 1
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+#else
+#define GLEW_STATIC
+#include "GL/glew.h"
+#include "GL/gl.h"
+#endif
+
+#include "STVirtualTexture.h"
+
+#include "STGLState.h"
+#include "STImage.h"
+#include "STImageCache.h"
+#include "STShaderProgram.h"
+#include "STThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits.h>
+#include <math.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Identifies a file as an STVirtualTexture tile cache. The version
+// must be bumped whenever the layout of the file changes.
+static const char kTileCacheMagic[4] = { 'S', 'T', 'V', 'T' };
+static const unsigned int kTileCacheVersion = 1;
+
+// Tiles are stored kTileSize pixels square, including a border of
+// kTileBorder pixels copied from their neighbors so that they can be
+// filtered. Each tile covers kTilePayload pixels of its level.
+static const int kTileSize = 128;
+static const int kTileBorder = 1;
+static const int kTilePayload = kTileSize - 2 * kTileBorder;
+static const size_t kTileBytes = kTileSize * kTileSize * 4;
+
+// The feedback encodes tile coordinates in 12 bits, which limits
+// the page table to 4096 tiles (about 500,000 pixels) on a side.
+static const int kMaxLevels = 13;
+
+// Tile data starts at a multiple of this, for uploading from the
+// mapped file.
+static const size_t kTileCacheAlignment = 16;
+
+// The feedback buffer is this many times smaller than the window.
+static const int kFeedbackScale = 8;
+
+// Limits on the work done for loading tiles each frame.
+static const int kMaxUploadsPerFrame = 8;
+static const size_t kMaxLoadsInFlight = 16;
+
+// Marks an empty slot in the pool.
+static const unsigned long long kNoTile = ~0ULL;
+
+// The cache file begins with this header...
+struct STTileCacheHeader
+{
+    char magic[4];
+    unsigned int version;
+    unsigned int tileSize;
+    unsigned int tileBorder;
+    unsigned int width;
+    unsigned int height;
+    unsigned int numLevels;
+    unsigned int reserved;
+    // Size and modification time of the source image.
+    unsigned long long sourceSize;
+    long long sourceMtime;
+};
+
+// ...followed by one of these for each mipmap level, and then the
+// tiles of every level, bottom row of tiles first.
+struct STTileCacheLevel
+{
+    unsigned int width;
+    unsigned int height;
+    unsigned int tilesX;
+    unsigned int tilesY;
+    unsigned long long firstTile;
+};
+
+//
+// Tiles are identified by their level and their position in it.
+//
+static unsigned long long
+MakeTile(int level, int x, int y)
+{
+    return ((unsigned long long) level << 48) |
+        ((unsigned long long) y << 24) | (unsigned long long) x;
+}
+
+static int GetTileLevel(unsigned long long tile) { return (int) (tile >> 48); }
+static int GetTileY(unsigned long long tile) { return (int) ((tile >> 24) & 0xFFFFFF); }
+static int GetTileX(unsigned long long tile) { return (int) (tile & 0xFFFFFF); }
+
+//
+// Get the tile covering a tile at the next coarser level.
+//
+static unsigned long long
+GetParentTile(unsigned long long tile)
+{
+    return MakeTile(GetTileLevel(tile) + 1, GetTileX(tile) / 2, GetTileY(tile) / 2);
+}
+
+//
+// Look up the size and modification time of a file.
+// Returns false if the file does not exist.
+//
+static bool
+StatSourceFile(const std::string& filename,
+               unsigned long long* size, long long* mtime)
+{
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+        return false;
+    *size = (unsigned long long) info.st_size;
+    *mtime = (long long) info.st_mtime;
+    return true;
+}
+
+//
+// Halve an image, rounding odd sizes up, by averaging 2x2 blocks
+// (which repeat the last row or column at odd edges).
+//
+static void
+DownsampleLevel(const STColor4ub* src, int width, int height,
+                std::vector<STColor4ub>* dst)
+{
+    int dstWidth = (width + 1) / 2;
+    int dstHeight = (height + 1) / 2;
+    dst->resize((size_t) dstWidth * dstHeight);
+
+    for (int y = 0; y < dstHeight; ++y) {
+        const STColor4ub* row0 = src + (size_t) (2 * y) * width;
+        const STColor4ub* row1 = src + (size_t) std::min(2 * y + 1, height - 1) * width;
+        STColor4ub* out = &(*dst)[(size_t) y * dstWidth];
+        for (int x = 0; x < dstWidth; ++x) {
+            int x0 = 2 * x;
+            int x1 = std::min(2 * x + 1, width - 1);
+            out[x] = STColor4ub(
+                (unsigned char) ((row0[x0].r + row0[x1].r + row1[x0].r + row1[x1].r + 2) / 4),
+                (unsigned char) ((row0[x0].g + row0[x1].g + row1[x0].g + row1[x1].g + 2) / 4),
+                (unsigned char) ((row0[x0].b + row0[x1].b + row1[x0].b + row1[x1].b + 2) / 4),
+                (unsigned char) ((row0[x0].a + row0[x1].a + row1[x0].a + row1[x1].a + 2) / 4));
+        }
+    }
+}
+
+//
+// Open the tile cache of an image file, building it if needed.
+//
+STVirtualTexture::STVirtualTexture(const std::string& filename, int poolTiles)
+    : mWidth(0)
+    , mHeight(0)
+    , mTileOffset(0)
+    , mPageTableSize(1)
+    , mPoolTiles(std::min(std::max(poolTiles, 2), 256))
+    , mFrame(0)
+    , mPoolTexture(0)
+    , mPageTableTexture(0)
+    , mFeedbackFramebuffer(0)
+    , mFeedbackColor(0)
+    , mFeedbackDepth(0)
+    , mFeedbackWidth(0)
+    , mFeedbackHeight(0)
+{
+    // Store the tiles next to the image cache files.
+    std::string cachePath = STImageCache::GetCachePath(filename);
+    cachePath.insert(cachePath.rfind(".stcache"), ".tiles");
+
+    if (!OpenCacheFile(filename, cachePath)) {
+        BuildCacheFile(filename, cachePath);
+        if (!OpenCacheFile(filename, cachePath)) {
+            fprintf(stderr, "STVirtualTexture::STVirtualTexture() - Could not "
+                    "open tile cache '%s'.\n", cachePath.c_str());
+            throw std::runtime_error("Error creating STVirtualTexture");
+        }
+    }
+
+    mPageTableSize = 1 << (GetNumLevels() - 1);
+
+    // Pool slots map to pool positions (and page table entries)
+    // in 8 bits each way.
+    Slot empty = { kNoTile, 0 };
+    mSlots.assign(mPoolTiles * mPoolTiles, empty);
+
+#ifdef __APPLE__
+    mUseFeedback = true;
+    mUseBuffers = true;
+#else
+    mUseFeedback = GLEW_EXT_framebuffer_object != 0;
+    mUseBuffers = GLEW_VERSION_2_1 ||
+        (GLEW_VERSION_1_5 && GLEW_ARB_pixel_buffer_object);
+#endif
+    mFeedbackBuffers[0] = mFeedbackBuffers[1] = 0;
+    mFeedbackPixels[0] = mFeedbackPixels[1] = 0;
+    if (mUseBuffers)
+        glGenBuffers(2, mFeedbackBuffers);
+
+    CreateTextures();
+
+    // The coarsest tile covers the whole image, and stays loaded
+    // so that there is always something to draw.
+    unsigned long long top = MakeTile(GetNumLevels() - 1, 0, 0);
+    UploadTile(top, 0, GetTileData(top));
+    mSlots[0].lastUsed = INT_MAX;
+}
+
+//
+// Delete the textures, after waiting for loads in flight.
+//
+STVirtualTexture::~STVirtualTexture()
+{
+    // The loads read from the mapped cache file.
+    std::map<unsigned long long, std::future<std::vector<unsigned char> > >::iterator it;
+    for (it = mLoading.begin(); it != mLoading.end(); ++it)
+        it->second.wait();
+
+    STGLState::DeleteTexture(mPoolTexture);
+    STGLState::DeleteTexture(mPageTableTexture);
+
+    if (mFeedbackFramebuffer) {
+        glDeleteFramebuffersEXT(1, &mFeedbackFramebuffer);
+        glDeleteRenderbuffersEXT(1, &mFeedbackColor);
+        glDeleteRenderbuffersEXT(1, &mFeedbackDepth);
+    }
+    if (mUseBuffers)
+        glDeleteBuffers(2, mFeedbackBuffers);
+}
+
+//
+// Try to use an existing cache file.
+//
+bool STVirtualTexture::OpenCacheFile(const std::string& filename,
+                                     const std::string& cachePath)
+{
+    unsigned long long sourceSize;
+    long long sourceMtime;
+    if (!StatSourceFile(filename, &sourceSize, &sourceMtime))
+        return false;
+
+    if (mFile.Open(cachePath) != ST_OK)
+        return false;
+
+    const unsigned char* data = mFile.GetData();
+    size_t fileSize = mFile.GetSize();
+
+    const STTileCacheHeader* header = (const STTileCacheHeader*) data;
+    if (fileSize < sizeof(STTileCacheHeader) ||
+        memcmp(header->magic, kTileCacheMagic, sizeof(kTileCacheMagic)) != 0 ||
+        header->version != kTileCacheVersion ||
+        header->tileSize != (unsigned int) kTileSize ||
+        header->tileBorder != (unsigned int) kTileBorder ||
+        header->numLevels == 0 || header->numLevels > (unsigned int) kMaxLevels ||
+        header->sourceSize != sourceSize ||
+        header->sourceMtime != sourceMtime) {
+        mFile.Close();
+        return false;
+    }
+
+    size_t tableSize = sizeof(STTileCacheHeader) +
+        header->numLevels * sizeof(STTileCacheLevel);
+    size_t tileOffset = (tableSize + kTileCacheAlignment - 1) &
+        ~(kTileCacheAlignment - 1);
+    if (tileOffset > fileSize) {
+        mFile.Close();
+        return false;
+    }
+
+    // Check that every level's tiles lie within the file.
+    const STTileCacheLevel* levels =
+        (const STTileCacheLevel*) (data + sizeof(STTileCacheHeader));
+    mLevels.clear();
+    for (unsigned int i = 0; i < header->numLevels; ++i) {
+        unsigned long long numTiles =
+            (unsigned long long) levels[i].tilesX * levels[i].tilesY;
+        if (levels[i].tilesX == 0 || levels[i].tilesY == 0 ||
+            (levels[i].firstTile + numTiles) * kTileBytes > fileSize - tileOffset) {
+            mLevels.clear();
+            mFile.Close();
+            return false;
+        }
+
+        Level level;
+        level.width = (int) levels[i].width;
+        level.height = (int) levels[i].height;
+        level.tilesX = (int) levels[i].tilesX;
+        level.tilesY = (int) levels[i].tilesY;
+        level.firstTile = (size_t) levels[i].firstTile;
+        mLevels.push_back(level);
+    }
+
+    mWidth = (int) header->width;
+    mHeight = (int) header->height;
+    mTileOffset = tileOffset;
+    return true;
+}
+
+//
+// Load the source image, split every level into tiles
+// and write them to a new cache file.
+//
+void STVirtualTexture::BuildCacheFile(const std::string& filename,
+                                      const std::string& cachePath)
+{
+    // Throws if the image cannot be loaded.
+    STImage::LoadOptions options;
+    options.format = STImage::kRGBA8;
+    options.rowOrder = STImage::kBottomUp;
+    STImage image(filename, options);
+
+    // The page table is square, with a power of two tiles on a side,
+    // so that each level of it is a mipmap level of the texture.
+    int width = image.GetWidth();
+    int height = image.GetHeight();
+    int maxTiles = (std::max(width, height) + kTilePayload - 1) / kTilePayload;
+    int numLevels = 1;
+    while ((1 << (numLevels - 1)) < maxTiles)
+        numLevels++;
+    if (numLevels > kMaxLevels) {
+        fprintf(stderr, "STVirtualTexture::STVirtualTexture() - '%s' is "
+                "too large.\n", filename.c_str());
+        throw std::runtime_error("Error creating STVirtualTexture");
+    }
+
+    STTileCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kTileCacheMagic, sizeof(kTileCacheMagic));
+    header.version = kTileCacheVersion;
+    header.tileSize = kTileSize;
+    header.tileBorder = kTileBorder;
+    header.width = width;
+    header.height = height;
+    header.numLevels = numLevels;
+    StatSourceFile(filename, &header.sourceSize, &header.sourceMtime);
+
+    std::vector<STTileCacheLevel> levels(numLevels);
+    unsigned long long numTiles = 0;
+    for (int i = 0; i < numLevels; ++i) {
+        levels[i].width = width;
+        levels[i].height = height;
+        levels[i].tilesX = (width + kTilePayload - 1) / kTilePayload;
+        levels[i].tilesY = (height + kTilePayload - 1) / kTilePayload;
+        levels[i].firstTile = numTiles;
+        numTiles += (unsigned long long) levels[i].tilesX * levels[i].tilesY;
+
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+
+    // Write to a temporary file first so that a partially written
+    // cache can never be mistaken for a valid one.
+    char tempSuffix[32];
+    sprintf(tempSuffix, ".%p.tmp", (void*) this);
+    std::string tempPath = cachePath + tempSuffix;
+    FILE* cacheFile = fopen(tempPath.c_str(), "wb");
+    if (!cacheFile) {
+        fprintf(stderr, "STVirtualTexture::STVirtualTexture() - Could not "
+                "write tile cache '%s'.\n", cachePath.c_str());
+        return;
+    }
+
+    size_t tableSize = sizeof(header) + levels.size() * sizeof(STTileCacheLevel);
+    std::vector<unsigned char> table((tableSize + kTileCacheAlignment - 1) &
+                                     ~(kTileCacheAlignment - 1), 0);
+    memcpy(&table[0], &header, sizeof(header));
+    memcpy(&table[sizeof(header)], &levels[0], levels.size() * sizeof(STTileCacheLevel));
+    bool ok = fwrite(&table[0], 1, table.size(), cacheFile) == table.size();
+
+    // Cut each level into tiles, then halve it for the next level.
+    std::vector<STColor4ub> tile(kTileSize * kTileSize);
+    std::vector<STColor4ub> scratch[2];
+    const STColor4ub* pixels = image.GetPixels();
+    for (int i = 0; i < numLevels && ok; ++i) {
+        const STTileCacheLevel& level = levels[i];
+        int levelWidth = (int) level.width;
+        int levelHeight = (int) level.height;
+
+        for (unsigned int ty = 0; ty < level.tilesY && ok; ++ty) {
+            for (unsigned int tx = 0; tx < level.tilesX && ok; ++tx) {
+                for (int row = 0; row < kTileSize; ++row) {
+                    int y = (int) ty * kTilePayload - kTileBorder + row;
+                    y = std::min(std::max(y, 0), levelHeight - 1);
+                    const STColor4ub* src = pixels + (size_t) y * levelWidth;
+                    STColor4ub* dst = &tile[row * kTileSize];
+                    for (int col = 0; col < kTileSize; ++col) {
+                        int x = (int) tx * kTilePayload - kTileBorder + col;
+                        dst[col] = src[std::min(std::max(x, 0), levelWidth - 1)];
+                    }
+                }
+                ok = fwrite(&tile[0], 1, kTileBytes, cacheFile) == kTileBytes;
+            }
+        }
+
+        if (i + 1 < numLevels) {
+            DownsampleLevel(pixels, levelWidth, levelHeight, &scratch[i % 2]);
+            pixels = &scratch[i % 2][0];
+        }
+    }
+    ok = (fclose(cacheFile) == 0) && ok;
+
+    remove(cachePath.c_str());
+    if (!ok || rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        fprintf(stderr, "STVirtualTexture::STVirtualTexture() - Could not "
+                "write tile cache '%s'.\n", cachePath.c_str());
+        remove(tempPath.c_str());
+    }
+}
+
+//
+// Create the pool and page table textures.
+//
+void STVirtualTexture::CreateTextures()
+{
+    int poolSize = mPoolTiles * kTileSize;
+    glGenTextures(1, &mPoolTexture);
+    STGLState::BindTexture(GL_TEXTURE_2D, mPoolTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, poolSize, poolSize, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    // Sampling the page table picks its level as if it were the
+    // image, once biased by the size of a tile (see the shader).
+    glGenTextures(1, &mPageTableTexture);
+    STGLState::BindTexture(GL_TEXTURE_2D, mPageTableTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GetNumLevels() - 1);
+
+    mPageTable.resize(GetNumLevels());
+    for (int level = 0; level < GetNumLevels(); ++level) {
+        int size = mPageTableSize >> level;
+        mPageTable[level].assign(size * size, STColor4ub(0, 0, 0, 0));
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, size, size, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, &mPageTable[level][0]);
+    }
+    STGLState::BindTexture(GL_TEXTURE_2D, 0);
+}
+
+//
+// Get the data of a tile in the cache file.
+//
+const unsigned char* STVirtualTexture::GetTileData(unsigned long long tile) const
+{
+    const Level& level = mLevels[GetTileLevel(tile)];
+    size_t index = level.firstTile +
+        (size_t) GetTileY(tile) * level.tilesX + GetTileX(tile);
+    return mFile.GetData() + mTileOffset + index * kTileBytes;
+}
+
+//
+// Start drawing the feedback pass.
+//
+void STVirtualTexture::BeginFeedback(int windowWidth, int windowHeight)
+{
+    if (!mUseFeedback)
+        return;
+
+    int width = std::max(windowWidth / kFeedbackScale, 1);
+    int height = std::max(windowHeight / kFeedbackScale, 1);
+    if (!mFeedbackFramebuffer) {
+        glGenFramebuffersEXT(1, &mFeedbackFramebuffer);
+        glGenRenderbuffersEXT(1, &mFeedbackColor);
+        glGenRenderbuffersEXT(1, &mFeedbackDepth);
+    }
+
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, mFeedbackFramebuffer);
+    if (width != mFeedbackWidth || height != mFeedbackHeight) {
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, mFeedbackColor);
+        glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA8, width, height);
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, mFeedbackDepth);
+        glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
+        glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+                                     GL_RENDERBUFFER_EXT, mFeedbackColor);
+        glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+                                     GL_RENDERBUFFER_EXT, mFeedbackDepth);
+
+        if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) !=
+            GL_FRAMEBUFFER_COMPLETE_EXT) {
+            fprintf(stderr, "STVirtualTexture::BeginFeedback() - Could not "
+                    "create the feedback buffer.\n");
+            glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+            mUseFeedback = false;
+            return;
+        }
+
+        mFeedbackWidth = width;
+        mFeedbackHeight = height;
+        mFeedbackPixels[0] = mFeedbackPixels[1] = 0;
+    }
+
+    // Pixels left clear ask for no tiles.
+    glPushAttrib(GL_VIEWPORT_BIT | GL_COLOR_BUFFER_BIT);
+    glViewport(0, 0, width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+//
+// Finish the feedback pass, and find the tiles it asked for.
+//
+void STVirtualTexture::EndFeedback()
+{
+    if (!mUseFeedback)
+        return;
+
+    int numPixels = mFeedbackWidth * mFeedbackHeight;
+    if (mUseBuffers) {
+        // Read this frame's feedback into one buffer while
+        // looking at last frame's in the other.
+        int current = mFrame % 2;
+        int previous = 1 - current;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, mFeedbackBuffers[current]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, numPixels * 4, NULL, GL_STREAM_READ);
+        glReadPixels(0, 0, mFeedbackWidth, mFeedbackHeight,
+                     GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        mFeedbackPixels[current] = numPixels;
+
+        if (mFeedbackPixels[previous] > 0) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, mFeedbackBuffers[previous]);
+            const unsigned char* pixels = (const unsigned char*)
+                glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+            if (pixels) {
+                ReadFeedback(pixels, mFeedbackPixels[previous]);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    else {
+        std::vector<unsigned char> pixels(numPixels * 4);
+        glReadPixels(0, 0, mFeedbackWidth, mFeedbackHeight,
+                     GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+        ReadFeedback(&pixels[0], numPixels);
+    }
+
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    glPopAttrib();
+}
+
+//
+// Collect the tiles asked for by a feedback buffer. Each pixel holds
+// the low 8 bits of the tile's x and y in red and green, the high 4
+// bits of each in blue, and its level plus one in alpha.
+//
+void STVirtualTexture::ReadFeedback(const unsigned char* pixels, int numPixels)
+{
+    std::map<unsigned long long, int> counts;
+    unsigned long long last = kNoTile;
+    int lastCount = 0;
+    for (int i = 0; i < numPixels; ++i, pixels += 4) {
+        if (pixels[3] == 0 || pixels[3] > GetNumLevels())
+            continue;
+
+        int level = pixels[3] - 1;
+        int x = pixels[0] + (pixels[2] & 0xF) * 256;
+        int y = pixels[1] + (pixels[2] >> 4) * 256;
+        if (x >= mLevels[level].tilesX || y >= mLevels[level].tilesY)
+            continue;
+
+        // Neighboring pixels usually ask for the same tile.
+        unsigned long long tile = MakeTile(level, x, y);
+        if (tile != last) {
+            if (last != kNoTile)
+                counts[last] += lastCount;
+            last = tile;
+            lastCount = 0;
+        }
+        lastCount++;
+    }
+    if (last != kNoTile)
+        counts[last] += lastCount;
+
+    // Tiles and their ancestors are both needed: the ancestors
+    // are drawn until the tiles load. Coarse tiles load first,
+    // then the tiles covering the most pixels.
+    std::map<unsigned long long, int> needed;
+    std::map<unsigned long long, int>::const_iterator it;
+    for (it = counts.begin(); it != counts.end(); ++it) {
+        for (unsigned long long tile = it->first; ;
+             tile = GetParentTile(tile)) {
+            std::map<unsigned long long, int>::iterator resident = mResident.find(tile);
+            if (resident != mResident.end())
+                mSlots[resident->second].lastUsed = std::max(mSlots[resident->second].lastUsed, mFrame);
+            else
+                needed[tile] += it->second;
+
+            if (GetTileLevel(tile) == GetNumLevels() - 1)
+                break;
+        }
+    }
+
+    std::vector<std::pair<std::pair<int, int>, unsigned long long> > order;
+    for (it = needed.begin(); it != needed.end(); ++it) {
+        order.push_back(std::make_pair(
+            std::make_pair(GetTileLevel(it->first), it->second), it->first));
+    }
+    std::sort(order.rbegin(), order.rend());
+
+    mRequests.clear();
+    for (size_t i = 0; i < order.size(); ++i)
+        mRequests.push_back(order[i].second);
+}
+
+//
+// Start loading requested tiles, and upload loaded ones.
+//
+void STVirtualTexture::Update()
+{
+    // Upload the tiles that have finished loading. A tile that finds
+    // no room in the pool is dropped, and asked for again later.
+    int numUploads = 0;
+    std::map<unsigned long long, std::future<std::vector<unsigned char> > >::iterator it;
+    for (it = mLoading.begin(); it != mLoading.end() &&
+         numUploads < kMaxUploadsPerFrame; ) {
+        if (it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            ++it;
+            continue;
+        }
+
+        unsigned long long tile = it->first;
+        std::vector<unsigned char> data = it->second.get();
+        mLoading.erase(it++);
+
+        int slot = AllocateSlot();
+        if (slot >= 0) {
+            UploadTile(tile, slot, &data[0]);
+            numUploads++;
+        }
+    }
+
+    // Reading a tile from the mapped file may have to wait for the
+    // disk, so copy it out on a worker thread.
+    for (size_t i = 0; i < mRequests.size() &&
+         mLoading.size() < kMaxLoadsInFlight; ++i) {
+        unsigned long long tile = mRequests[i];
+        if (mResident.count(tile) || mLoading.count(tile))
+            continue;
+
+        const unsigned char* data = GetTileData(tile);
+        mLoading[tile] = STThreadPool::GetShared()->Submit([data]() {
+            return std::vector<unsigned char>(data, data + kTileBytes);
+        });
+    }
+    mRequests.clear();
+
+    mFrame++;
+}
+
+//
+// Find a slot for a new tile, evicting if needed.
+//
+int STVirtualTexture::AllocateSlot()
+{
+    int oldest = -1;
+    for (size_t i = 0; i < mSlots.size(); ++i) {
+        if (mSlots[i].tile == kNoTile)
+            return (int) i;
+
+        // Tiles needed this frame stay.
+        if (mSlots[i].lastUsed < mFrame &&
+            (oldest < 0 || mSlots[i].lastUsed < mSlots[oldest].lastUsed))
+            oldest = (int) i;
+    }
+    if (oldest < 0)
+        return -1;
+
+    unsigned long long evicted = mSlots[oldest].tile;
+    mResident.erase(evicted);
+    mSlots[oldest].tile = kNoTile;
+    UpdatePageTable(evicted);
+    return oldest;
+}
+
+//
+// Copy a tile into a slot of the pool.
+//
+void STVirtualTexture::UploadTile(unsigned long long tile, int slot,
+                                  const unsigned char* data)
+{
+    STGLState::BindTexture(GL_TEXTURE_2D, mPoolTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0,
+                    (slot % mPoolTiles) * kTileSize, (slot / mPoolTiles) * kTileSize,
+                    kTileSize, kTileSize, GL_RGBA, GL_UNSIGNED_BYTE, data);
+    STGLState::BindTexture(GL_TEXTURE_2D, 0);
+
+    mSlots[slot].tile = tile;
+    mSlots[slot].lastUsed = mFrame;
+    mResident[tile] = slot;
+    UpdatePageTable(tile);
+}
+
+//
+// Update the page table under a tile after it was loaded or
+// evicted. Every entry it covers, at its level and the finer ones,
+// points at the tile itself or at the nearest loaded ancestor.
+//
+void STVirtualTexture::UpdatePageTable(unsigned long long tile)
+{
+    int tileLevel = GetTileLevel(tile);
+    int numLevels = GetNumLevels();
+
+    STGLState::BindTexture(GL_TEXTURE_2D, mPageTableTexture);
+    for (int level = tileLevel; level >= 0; --level) {
+        int size = mPageTableSize >> level;
+        int span = 1 << (tileLevel - level);
+        int x0 = GetTileX(tile) * span;
+        int y0 = GetTileY(tile) * span;
+        std::vector<STColor4ub>& entries = mPageTable[level];
+
+        for (int y = y0; y < y0 + span; ++y) {
+            for (int x = x0; x < x0 + span; ++x) {
+                STColor4ub& entry = entries[y * size + x];
+
+                // Entries point at their own level only when their
+                // tile is loaded; below the tile that has not changed.
+                if (level < tileLevel && entry.a != 0 && entry.b == level)
+                    continue;
+
+                if (level == tileLevel && mResident.count(tile)) {
+                    int slot = mResident[tile];
+                    entry = STColor4ub((unsigned char) (slot % mPoolTiles),
+                                       (unsigned char) (slot / mPoolTiles),
+                                       (unsigned char) level, 255);
+                }
+                else if (level + 1 < numLevels) {
+                    entry = mPageTable[level + 1][(y / 2) * (size / 2) + x / 2];
+                }
+                else {
+                    entry = STColor4ub(0, 0, 0, 0);
+                }
+            }
+        }
+
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, size);
+        glTexSubImage2D(GL_TEXTURE_2D, level, x0, y0, span, span,
+                        GL_RGBA, GL_UNSIGNED_BYTE, &entries[y0 * size + x0]);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    STGLState::BindTexture(GL_TEXTURE_2D, 0);
+}
+
+//
+// Bind the page table and pool textures.
+//
+void STVirtualTexture::Bind(int firstUnit)
+{
+    STGLState::ActiveTexture(firstUnit);
+    STGLState::BindTexture(GL_TEXTURE_2D, mPageTableTexture);
+    STGLState::ActiveTexture(firstUnit + 1);
+    STGLState::BindTexture(GL_TEXTURE_2D, mPoolTexture);
+    STGLState::ActiveTexture(0);
+}
+
+void STVirtualTexture::UnBind(int firstUnit)
+{
+    STGLState::ActiveTexture(firstUnit);
+    STGLState::BindTexture(GL_TEXTURE_2D, 0);
+    STGLState::ActiveTexture(firstUnit + 1);
+    STGLState::BindTexture(GL_TEXTURE_2D, 0);
+    STGLState::ActiveTexture(0);
+}
+
+//
+// Set the uniforms used by kernels/virtualtexture.frag.
+//
+void STVirtualTexture::SetUniforms(STShaderProgram* shader) const
+{
+    // Texture coordinates cover the image, which covers the
+    // bottom-left of the square page table.
+    float virtualSize = (float) mPageTableSize * kTilePayload;
+    shader->SetUniform("vtScale", mWidth / virtualSize, mHeight / virtualSize);
+    shader->SetUniform("vtParams", (float) mPageTableSize,
+                       log2f((float) kTilePayload), (float) mPoolTiles,
+                       (float) (GetNumLevels() - 1));
+    shader->SetUniform("vtTile", (float) kTilePayload, (float) kTileBorder);
+    shader->SetUniform("vtFeedbackBias", -log2f((float) kFeedbackScale));
+
+    // Each feedback pixel stands for a block of window pixels, so
+    // sample a different spot of the block each frame, to find tiles
+    // that are only visible in part of a block.
+    static const int kJitter[4][4] = {
+        {  0,  8,  2, 10 },
+        { 12,  4, 14,  6 },
+        {  3, 11,  1,  9 },
+        { 15,  7, 13,  5 }
+    };
+    int step = kJitter[(mFrame / 4) % 4][mFrame % 4];
+    shader->SetUniform("vtFeedbackJitter",
+                       (step % 4 + 0.5f) / 4.0f - 0.5f,
+                       (step / 4 + 0.5f) / 4.0f - 0.5f);
+}
@@ -0,0 +1,106 @@
+// STBlockCompression.h
+#ifndef __STBLOCKCOMPRESSION_H__
+#define __STBLOCKCOMPRESSION_H__
+
+#include "STColor4ub.h"
+
+#include <stddef.h>
+
+class STThreadPool;
+
+/**
+* The STBlockCompression class encodes RGBA pixels into the block
+* compressed texture formats understood by graphics hardware, which
+* store each 4x4 block of pixels in 8 or 16 bytes:
+*
+*   kBC1 (DXT1)  RGB color, 0.5 bytes per pixel. Alpha is dropped.
+*   kBC3 (DXT5)  RGBA color, 1 byte per pixel.
+*   kBC4 (RGTC1) A single channel (red), 0.5 bytes per pixel. Use it
+*                for height and displacement maps.
+*   kBC5 (RGTC2) Two channels (red and green), 1 byte per pixel. Use
+*                it for normal maps, rebuilding z in the shader.
+*
+* Most programs should not call the encoder directly, but ask
+* STImageCache for a compressed mipmap chain, so that each image is
+* only compressed once:
+*
+*   STImageCache* cache = new STImageCache("./rocks_height.png",
+*       STImage::LoadOptions(), STBlockCompression::kBC4);
+*   STTexture* texture = new STTexture(cache);
+*
+* To measure the quality of the encoder, decompress the blocks again and
+* compare them with the original pixels:
+*
+*   std::vector<unsigned char> blocks(
+*       STBlockCompression::GetCompressedSize(kBC1, width, height));
+*   STBlockCompression::Compress(kBC1, pixels, width, height, &blocks[0]);
+*   STBlockCompression::Decompress(kBC1, &blocks[0], width, height, decoded);
+*   double psnr = STBlockCompression::ComputePSNR(kBC1, pixels, decoded,
+*                                                 width, height);
+*
+* Builds with assertions enabled do the same with a small sample image
+* in every format the first time Compress() is called, and assert that
+* its PSNR is at least 28 dB.
+*
+* Blocks are stored in the same row order as the pixels, so an STImage
+* (stored bottom row first) compresses directly into an OpenGL texture.
+* Images whose sides are not multiples of 4 are padded by repeating the
+* edge pixels. Large images are compressed in parallel on the thread
+* pool, and the inner loops use SSE2 when the compiler targets it.
+*/
+class STBlockCompression
+{
+public:
+    //
+    // Formats that pixel data can be stored in.
+    //
+    enum Format {
+        kUncompressed = 0,  // 8-bit RGBA pixels
+        kBC1,
+        kBC3,
+        kBC4,
+        kBC5,
+    };
+
+    //
+    // Get the number of bytes in each 4x4 block of a compressed
+    // format, or the size of one pixel for kUncompressed.
+    //
+    static int GetBlockSize(Format format);
+
+    //
+    // Get the number of bytes needed to store an image of the given
+    // size in a format.
+    //
+    static size_t GetCompressedSize(Format format, int width, int height);
+
+    //
+    // Compress an image into blocks of a compressed format. The output
+    // must hold GetCompressedSize(format, width, height) bytes.
+    //
+    static void Compress(Format format,
+                         const STColor4ub* pixels, int width, int height,
+                         unsigned char* blocks,
+                         STThreadPool* pool = 0);
+
+    //
+    // Decompress blocks of a compressed format back into pixels.
+    // Channels the format does not store are filled in the same way
+    // as OpenGL does: 0 for green and blue, and 255 for alpha.
+    //
+    static void Decompress(Format format,
+                           const unsigned char* blocks, int width, int height,
+                           STColor4ub* pixels);
+
+    //
+    // Compute the peak signal-to-noise ratio, in decibels, between an
+    // image and its compressed version, over just the channels the
+    // format stores. Returns infinity if they are identical.
+    //
+    static double ComputePSNR(Format format,
+                              const STColor4ub* original,
+                              const STColor4ub* decoded,
+                              int width, int height);
+};
+
+#endif // __STBLOCKCOMPRESSION_H__
@@ -0,0 +1,131 @@
+// STCoreRenderer.h
+#ifndef __STCORERENDERER_H__
+#define __STCORERENDERER_H__
+
+#include "stgl.h"
+#include "STMatrix4.h"
+#include "STTriangleMesh.h"
+#include <map>
+
+class STShaderProgram;
+
+/**
+* The STCoreRenderer class draws meshes without the fixed-function
+* state of OpenGL, so that it works in OpenGL 3.3 core profile contexts,
+* where that state does not exist. The matrices, light and materials
+* are kept on the CPU and given to the program in uniform buffers: one
+* for the frame, uploaded when the camera or light changed, and one for
+* each material, uploaded the first time the material is drawn. Each
+* mesh is copied to buffers the first time it is drawn, with its vertex
+* arrays recorded in vertex array objects.
+*
+*   STCoreRenderer renderer(program);
+*   renderer.SetProjection(projection);
+*   renderer.SetLight(position, ambient, diffuse, specular);
+*   ...
+*   renderer.SetView(view);
+*   renderer.BeginFrame();
+*   for (size_t i = 0; i < meshes.size(); ++i)
+*       renderer.Draw(meshes[i], model, smooth);
+*   renderer.EndFrame();
+*
+* The program must declare the STFrame and STMaterial uniform blocks,
+* the modelViewMatrix and normalMatrix uniforms, the colorTex sampler,
+* and the vertex position, normal and texture coordinate inputs at
+* locations 0, 1 and 2, as mainsrc/kernels/core.vert and core.frag do.
+*
+* The axes of meshes are not drawn. Call Forget() when a mesh drawn
+* before has changed, or is about to be deleted.
+*/
+class STCoreRenderer
+{
+public:
+    STCoreRenderer(STShaderProgram* program);
+    ~STCoreRenderer();
+
+    //
+    // Can this renderer be used with the current context? It needs
+    // OpenGL 3.3. Call only after initializing OpenGL (and GLEW).
+    //
+    static bool IsSupported();
+
+    //
+    // Set the projection and view matrices, as gluPerspective and
+    // gluLookAt would (see STMatrix4::EncodePerspective).
+    //
+    void SetProjection(const STMatrix4& projection);
+    void SetView(const STMatrix4& view);
+
+    //
+    // Set the light, as glLightfv would: the position in world space,
+    // and the colors, as four floats each.
+    //
+    void SetLight(const float* position, const float* ambient,
+                  const float* diffuse, const float* specular);
+
+    //
+    // Start drawing a frame: bind the program, and upload the frame's
+    // uniforms if they changed.
+    //
+    void BeginFrame();
+
+    //
+    // Draw a mesh, placed in the world by the model matrix, with
+    // its color map and material.
+    //
+    void Draw(const STTriangleMesh* mesh, const STMatrix4& model, bool smooth);
+
+    //
+    // Finish drawing a frame, un-binding what the renderer bound.
+    //
+    void EndFrame();
+
+    //
+    // Free the buffers of a mesh, or of all of them, so that they
+    // are copied again the next time the mesh is drawn.
+    //
+    void Forget(const STTriangleMesh* mesh);
+    void ForgetAll();
+
+private:
+    // The buffers of a mesh, and a vertex array object for each of
+    // smooth and flat shading.
+    struct MeshArrays {
+        GLuint vertexBuffer;
+        GLuint indexBuffer;
+        GLuint smoothArray;
+        GLuint flatArray;
+        GLsizei numIndices;
+    };
+
+    //
+    // Helper routines - get the buffers of a mesh, and the uniform
+    // buffer of its material, making them the first time.
+    //
+    const MeshArrays& GetMeshArrays(const STTriangleMesh* mesh);
+    GLuint GetMaterialBuffer(const STTriangleMesh* mesh);
+
+    STShaderProgram* mProgram;
+
+    // The frame's matrices and light, and whether they changed
+    // since they were uploaded.
+    STMatrix4 mProjection;
+    STMatrix4 mView;
+    float mLightPosition[4];
+    float mLightAmbient[4];
+    float mLightDiffuse[4];
+    float mLightSpecular[4];
+    bool mFrameChanged;
+    GLuint mFrameBuffer;
+
+    std::map<const STTriangleMesh*, MeshArrays> mMeshes;
+
+    // The uniform buffer of each material, by its values.
+    std::map<STMaterialKey, GLuint> mMaterials;
+
+    // What is bound during a frame.
+    GLuint mBoundMaterial;
+    GLuint mBoundArray;
+};
+
+#endif // __STCORERENDERER_H__
@@ -0,0 +1,169 @@
+// STFrameGrabber.h
+#ifndef __STFRAMEGRABBER_H__
+#define __STFRAMEGRABBER_H__
+
+#include "stgl.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class STImage;
+
+/**
+* The STFrameGrabber class saves the contents of the OpenGL framebuffer
+* to image files without stalling the program. Reading pixels back with
+* STImage::Read() waits for the GPU to finish drawing, and encoding a
+* JPEG or PNG file takes longer still; STFrameGrabber does neither on
+* the OpenGL thread.
+*
+* Capture() starts copying a region of the framebuffer into a pixel
+* buffer object, which the GPU does in the background. Update(), called
+* once per frame, maps the buffers of the captures started in earlier
+* frames and queues them for a worker thread, which encodes and writes
+* the files straight from the mapped memory (through an STImage view).
+* The buffers are unmapped and reused once their files are written:
+*
+*   STFrameGrabber* grabber = new STFrameGrabber();
+*
+*   void DisplayCallback()
+*   {
+*       grabber->Update();
+*       // ... draw the scene ...
+*       if (screenshotRequested)
+*           grabber->Capture("./screenshot.jpg", 0, 0, width, height);
+*       glutSwapBuffers();
+*   }
+*
+* The queue of images waiting to be encoded holds at most maxQueued
+* images, including the captures still being read back. When it is
+* full, a kWait capture makes Update() wait for the workers to catch
+* up, while a kDrop capture is skipped (and counted) so that rendering
+* never stalls; STFrameRecorder records frame sequences this way.
+* Give the grabber several workers to encode frames in parallel. Call
+* Finish() (or delete the grabber) to write out every capture that is
+* still in flight.
+*
+* When the driver lacks pixel buffer objects (OpenGL 2.1 or
+* ARB_pixel_buffer_object), Capture() reads the pixels back directly,
+* and only the encoding happens in the background.
+*/
+class STFrameGrabber
+{
+public:
+    //
+    // What Capture() does when the encoding queue is full.
+    //
+    enum FullQueuePolicy {
+        kWait,      // Keep the capture, and wait in Update().
+        kDrop,      // Skip the capture, and count it as dropped.
+    };
+
+    //
+    // Create a grabber whose encoding queue holds at most maxQueued
+    // images, encoded by numWorkers threads. Zero workers means one
+    // per hardware thread, less one for the OpenGL thread. Create it
+    // after initializing OpenGL.
+    //
+    STFrameGrabber(int maxQueued = 4, int numWorkers = 1);
+
+    //
+    // Write out all captures in flight and stop the workers.
+    //
+    ~STFrameGrabber();
+
+    //
+    // Start capturing the region of the framebuffer that begins
+    // at pixel (x, y) and save it to a file (PPM, JPEG and PNG
+    // formats are supported). Call it after drawing a frame
+    // and before swapping buffers. Returns false if the capture
+    // was dropped because the queue was full.
+    //
+    bool Capture(const std::string& filename,
+                 int x, int y, int width, int height,
+                 FullQueuePolicy policy = kWait);
+
+    //
+    // Hand the captures started in earlier frames to the workers.
+    // Call it once per frame, before any new Capture().
+    //
+    void Update();
+
+    //
+    // Wait until every capture has been written to its file.
+    //
+    void Finish();
+
+    //
+    // Are there no captures in flight? While there are, the
+    // program should keep drawing frames (and calling Update())
+    // so that they get written.
+    //
+    bool IsIdle() const;
+
+    //
+    // Get the number of kDrop captures skipped so far.
+    //
+    int GetNumDropped() const { return mNumDropped; }
+
+private:
+    // A capture being copied into a pixel buffer object.
+    struct Readback {
+        GLuint buffer;
+        std::string filename;
+        int width;
+        int height;
+    };
+
+    // A captured image waiting to be written to a file, and the
+    // mapped buffer object holding its pixels (or 0 if it owns them).
+    struct Job {
+        STImage* image;
+        std::string filename;
+        GLuint buffer;
+    };
+
+    STFrameGrabber(const STFrameGrabber&);
+    STFrameGrabber& operator=(const STFrameGrabber&);
+
+    // Queue an image for the workers, waiting while the queue is full.
+    void Enqueue(STImage* image, const std::string& filename,
+                 GLuint buffer);
+
+    // Unmap the buffer objects whose files have been written.
+    void ReleaseBuffers();
+
+    // Encode and write queued images until stopped.
+    void WorkerLoop();
+
+    // Can pixels be read back into buffer objects?
+    bool mUseBuffers;
+
+    // Captures started since the last Update().
+    std::vector<Readback> mReadbacks;
+
+    // Buffer objects not used by any capture.
+    std::vector<GLuint> mFreeBuffers;
+
+    // Mapped buffer objects whose files have been written.
+    std::vector<GLuint> mWrittenBuffers;
+
+    // Images waiting for the workers, and the number being written.
+    std::deque<Job> mJobs;
+    int mNumWriting;
+    size_t mMaxQueued;
+    bool mStopping;
+
+    // Number of captures dropped because the queue was full.
+    int mNumDropped;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mJobAvailable;
+    std::condition_variable mJobDone;
+    std::vector<std::thread> mWorkers;
+};
+
+#endif // __STFRAMEGRABBER_H__
@@ -0,0 +1,89 @@
+// STFrameRecorder.h
+#ifndef __STFRAMERECORDER_H__
+#define __STFRAMERECORDER_H__
+
+#include <string>
+
+class STFrameGrabber;
+
+/**
+* The STFrameRecorder class records a sequence of frames drawn with
+* OpenGL to numbered image files, for example to make a turntable
+* movie of a mesh. Frames are captured with an STFrameGrabber, so they
+* are read back and encoded in the background:
+*
+*   STFrameGrabber* grabber = new STFrameGrabber(8, 0);
+*   STFrameRecorder* recorder = new STFrameRecorder(grabber);
+*   recorder->Start("./frames/frame%05d.jpg");
+*
+*   void DisplayCallback()
+*   {
+*       grabber->Update();
+*       // ... draw the scene ...
+*       recorder->RecordFrame(0, 0, width, height);
+*       glutSwapBuffers();
+*   }
+*
+* The file name pattern must contain a single printf-style integer
+* conversion, which is replaced by the number of the frame, starting
+* from zero. Any image format supported by STImage::Save() works; PPM
+* files are the quickest to write, and JPEG files the smallest.
+*
+* When the workers cannot encode frames as fast as they are drawn,
+* frames are dropped rather than slowing down rendering, and counted
+* by GetNumDropped(). The frames that are kept are numbered without
+* gaps. Recording every Nth frame, or adding workers to the grabber,
+* reduces the number of drops.
+*/
+class STFrameRecorder
+{
+public:
+    //
+    // Create a recorder that captures frames with the given grabber.
+    //
+    STFrameRecorder(STFrameGrabber* grabber);
+
+    //
+    // Start recording every Nth frame to files named by the pattern.
+    //
+    void Start(const std::string& pattern, int everyNthFrame = 1);
+
+    //
+    // Stop recording. Frames already captured are still written.
+    //
+    void Stop();
+
+    //
+    // Is the recorder recording?
+    //
+    bool IsRecording() const { return mRecording; }
+
+    //
+    // Record the region of the framebuffer that begins at pixel
+    // (x, y) if this frame is due. Call it once per frame, after
+    // drawing and before swapping buffers.
+    //
+    void RecordFrame(int x, int y, int width, int height);
+
+    //
+    // Get the number of frames recorded and dropped since
+    // recording last started.
+    //
+    int GetNumRecorded() const { return mNumRecorded; }
+    int GetNumDropped() const { return mNumDropped; }
+
+private:
+    STFrameGrabber* mGrabber;
+
+    // File name pattern, with an integer conversion for the number.
+    std::string mPattern;
+
+    int mEveryNthFrame;
+    int mFrame;
+    bool mRecording;
+
+    int mNumRecorded;
+    int mNumDropped;
+};
+
+#endif // __STFRAMERECORDER_H__
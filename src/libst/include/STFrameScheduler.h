@@ -0,0 +1,122 @@
+// STFrameScheduler.h
+#ifndef __STFRAMESCHEDULER_H__
+#define __STFRAMESCHEDULER_H__
+
+#include "STTimer.h"
+
+/**
+* The STFrameScheduler class decides when a program should draw its
+* next frame, so that it draws only when something on screen changed,
+* instead of as often as it can from the GLUT idle callback. Mark the
+* scene dirty when input, loading or animation changes it, and ask the
+* scheduler how long to wait before drawing:
+*
+*   STFrameScheduler scheduler(60.0f);
+*
+*   void ScheduleFrame()
+*   {
+*       int wait = scheduler.GetMillisUntilNextFrame();
+*       if (wait == 0)
+*           glutPostRedisplay();
+*       else if (wait > 0)
+*           glutTimerFunc(wait, FrameTimerCallback, 0);
+*   }
+*
+*   void KeyCallback(unsigned char key, int x, int y)
+*   {
+*       // ... change the scene ...
+*       scheduler.Invalidate();
+*       ScheduleFrame();
+*   }
+*
+*   void DisplayCallback()
+*   {
+*       scheduler.BeginFrame();
+*       // ... draw the scene ...
+*       glutSwapBuffers();
+*       scheduler.EndFrame();
+*       ScheduleFrame();
+*   }
+*
+* where FrameTimerCallback calls glutPostRedisplay(). While animating,
+* or while the scene is invalidated faster than the target frame rate,
+* frames are paced to that rate, catching up when one starts late.
+* With no target rate, a dirty frame is drawn right away.
+*
+* The scheduler also counts the time spent drawing frames, so that the
+* program can report how much of the time it sat idle.
+*/
+class STFrameScheduler
+{
+public:
+    //
+    // Create a scheduler that draws at most the given number of
+    // frames per second, or as soon as the scene is dirty if the
+    // rate is zero. The first frame is always due.
+    //
+    STFrameScheduler(float targetFrameRate = 0.0f);
+
+    //
+    // Set or get the target frame rate, in frames per second.
+    //
+    void SetTargetFrameRate(float targetFrameRate);
+    float GetTargetFrameRate() const { return mTargetFrameRate; }
+
+    //
+    // Mark the scene dirty, so that a frame is drawn once it is due.
+    //
+    void Invalidate() { mDirty = true; }
+
+    //
+    // Keep drawing frames at the target rate while animating, for
+    // example while frames are being recorded.
+    //
+    void SetAnimating(bool animating) { mAnimating = animating; }
+    bool IsAnimating() const { return mAnimating; }
+
+    //
+    // Does the program need to draw a frame?
+    //
+    bool IsDirty() const { return mDirty || mAnimating; }
+
+    //
+    // Get the number of milliseconds to wait before drawing the next
+    // frame: zero if it is due now, or -1 if no frame is needed.
+    //
+    int GetMillisUntilNextFrame();
+
+    //
+    // Call at the start and end of drawing each frame. Beginning a
+    // frame makes the scene clean again.
+    //
+    void BeginFrame();
+    void EndFrame();
+
+    //
+    // Get the number of frames drawn, the milliseconds spent drawing
+    // them, and the milliseconds that have passed, since construction
+    // or the last ResetStatistics(). The program sat idle for the
+    // time that passed and was not spent drawing.
+    //
+    int GetNumFrames() const { return mNumFrames; }
+    float GetBusyMillis() const { return mBusyMillis; }
+    float GetElapsedMillis();
+    void ResetStatistics();
+
+private:
+    float mTargetFrameRate;
+    bool mDirty;
+    bool mAnimating;
+
+    // Time since the last frame began, and how long after it the
+    // next one is due.
+    STTimer mFrameTimer;
+    bool mFrameStarted;
+    float mNextFrameDelay;
+
+    STTimer mStatisticsTimer;
+    int mNumFrames;
+    float mBusyMillis;
+};
+
+#endif // __STFRAMESCHEDULER_H__
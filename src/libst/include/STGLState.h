@@ -0,0 +1,89 @@
+// STGLState.h
+#ifndef __STGLSTATE_H__
+#define __STGLSTATE_H__
+
+#include "stgl.h"
+
+/**
+* The STGLState class remembers the OpenGL state that libst changes most
+* often, and skips calls that would set it to the value it already has.
+* The tracked state is the active texture unit, the 2D texture bound to
+* each unit, enabled capabilities, the current program and the front
+* material. Every libst class sets that state through STGLState:
+*
+*   STGLState::ActiveTexture(2);
+*   STGLState::BindTexture(GL_TEXTURE_2D, texId);
+*   STGLState::Material(GL_DIFFUSE, diffuse);
+*
+* Nothing is known about the state at first, so the first call for each
+* piece of state always goes to OpenGL. Code that changes tracked state
+* directly should call Invalidate() afterwards, with one exception:
+* state changed between glPushAttrib() and glPopAttrib() can be set
+* directly, since popping puts back what STGLState expects.
+*
+* STGLState counts the calls it passes on and skips. Call EndFrame()
+* once per frame to read the counts for the frame just drawn:
+*
+*   STGLState::EndFrame();
+*   printf("%d calls, %d skipped\n", STGLState::GetNumIssued(),
+*          STGLState::GetNumSkipped());
+*
+* It must only be used from the OpenGL thread.
+*/
+class STGLState
+{
+public:
+    //
+    // Make a texture unit (0 for GL_TEXTURE0, and so on) active.
+    //
+    static void ActiveTexture(int unit);
+
+    //
+    // Bind a texture to the active unit. Only GL_TEXTURE_2D
+    // bindings are tracked; other targets are always bound.
+    //
+    static void BindTexture(GLenum target, GLuint texture);
+
+    //
+    // Delete a texture, forgetting it on the units it was bound to.
+    //
+    static void DeleteTexture(GLuint texture);
+
+    //
+    // Enable or disable a capability. Texture targets, such as
+    // GL_TEXTURE_2D, are tracked for each texture unit.
+    //
+    static void Enable(GLenum cap);
+    static void Disable(GLenum cap);
+
+    //
+    // Use a GLSL program, or 0 for fixed-function drawing.
+    //
+    static void UseProgram(GLuint program);
+
+    //
+    // Set a front-face material parameter: GL_AMBIENT, GL_DIFFUSE,
+    // GL_SPECULAR or GL_EMISSION (four values) or GL_SHININESS (one).
+    //
+    static void Material(GLenum pname, const float* params);
+
+    //
+    // Forget all of the tracked state, after it was changed
+    // without going through STGLState.
+    //
+    static void Invalidate();
+
+    //
+    // Finish counting calls for a frame.
+    //
+    static void EndFrame();
+
+    //
+    // Get the number of calls passed on to OpenGL, and skipped,
+    // during the frame before the last EndFrame().
+    //
+    static int GetNumIssued();
+    static int GetNumSkipped();
+};
+
+#endif // __STGLSTATE_H__
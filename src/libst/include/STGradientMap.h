@@ -0,0 +1,57 @@
+// STGradientMap.h
+#ifndef __STGRADIENTMAP_H__
+#define __STGRADIENTMAP_H__
+
+#include "STImage.h"
+
+class STThreadPool;
+
+/**
+* The STGradientMap class precomputes the slopes of a height (or
+* displacement) map, so that a vertex shader can displace a vertex and
+* bend its normal with a single texture fetch, instead of fetching the
+* height at the vertex and at four neighbors to take finite differences.
+*
+* Bake() returns a new kRGBA16 image of the same size as the height map,
+* with 16 bits per channel so that the gentle slopes of a smooth surface
+* are not rounded away:
+*
+*   r  The height, from 0 to 1.
+*   g  The central difference h(u + delta) - h(u - delta), encoded as
+*      described below.
+*   b  The central difference h(v + delta) - h(v - delta).
+*   a  Always 65535.
+*
+* Differences range from -1 to 1, and are stored as 32768 + 32767 * d,
+* so that a flat surface is exactly 32768. A shader decodes them with
+*
+*   vec3 g = texture2D(gradientTex, texPos).xyz;
+*   float du = (g.y * 65535.0 - 32768.0) / 32767.0;
+*
+* The differences are taken the same way a shader would sample the
+* height map with linear filtering, with texture coordinates clamped
+* to [0, 1]. delta is the spacing of the samples in texture coordinates,
+* usually the spacing of the vertices of the displaced mesh:
+*
+*   STImage::LoadOptions options;
+*   options.format = STImage::kR8;
+*   STImage* height = new STImage("./terrain_height.png", options);
+*   STImage* gradients = STGradientMap::Bake(height, 1.0f / 100);
+*   STTexture* texture = new STTexture(gradients);
+*
+* The height map can be in any STImage format; only its first (red)
+* channel is used. Rows are baked in parallel on the thread pool, and
+* the inner loops use SSE2 when the compiler targets it.
+*/
+class STGradientMap
+{
+public:
+    //
+    // Bake the height and central differences of a height map into
+    // a new image, which the caller must delete.
+    //
+    static STImage* Bake(const STImage* heightMap, float delta,
+                         STThreadPool* pool = 0);
+};
+
+#endif // __STGRADIENTMAP_H__
@@ -7,10 +7,12 @@
 
 #include <string>
 
+class STMappedFile;
+
 /**
-* The STImage class encapsulates image pixel data, stored as an array
-* of STColor4ub (8-bit RGBA) values. The image data is stored in a
-* format that is consistent with OpenGL; row-major with the bottom row
+* The STImage class encapsulates image pixel data, stored by default as
+* an array of STColor4ub (8-bit RGBA) values. The image data is stored in
+* a format that is consistent with OpenGL; row-major with the bottom row
 * of the image being first in the array of pixels.
 * This means that the bottom-left pixel in the image is the first pixel
 * in the internal array.
@@ -20,6 +22,15 @@
 *
 *   STImage* frog = new STImage("./frog.png");
 *
+* Large images that will only be displayed at a reduced size can be
+* loaded at a fraction of their full resolution, which is much faster
+* for JPEG files since libjpeg can decode directly at 1/2, 1/4 or 1/8
+* scale:
+*
+*   STImage::LoadOptions options;
+*   options.maxDimension = 512;
+*   STImage* preview = new STImage("./satellite.jpg", options);
+*
 * Alternatively, you can construct a new image filled with a solid
 * color of your choosing:
 *
@@ -31,6 +42,38 @@
 *   STColor4ub p = frog->GetPixel(10, 25);
 *   red->SetPixel(10, 25, p);
 *
+* Images that do not need four channels, such as height maps and
+* normal maps, can use a more compact pixel format. Either ask for it
+* when loading, or convert an existing image:
+*
+*   STImage::LoadOptions options;
+*   options.format = STImage::kR16;
+*   STImage* height = new STImage("./terrain_height.png", options);
+*
+*   frog->ConvertTo(STImage::kRG8);
+*
+* The raw data of any format is available through GetData().
+*
+* An STImage can also be a view of pixel data that it does not own,
+* such as a memory-mapped file or a pixel buffer, so that the data
+* does not have to be copied. Such data may have padding at the end
+* of each row, and may store its rows top row first (as most image
+* files and libraries do) rather than bottom row first:
+*
+*   STImage view(width, height, STImage::kRGBA8, pixels,
+*                rowBytes, STImage::kTopDown);
+*   view.Save("./output.png");
+*
+* Loading an image with the kTopDown row order decodes it in file
+* order, without flipping any rows. GetRow() returns the rows of any
+* image counting from the bottom, whatever order they are stored in.
+*
+* Binary PPM (P6) and PAM (P7) files are the quickest to load and
+* save, and suit frame dumps and batch processing: they are read
+* through a memory mapping, and an 8-bit RGBA PAM file loaded with the
+* kTopDown row order uses the mapped file as its pixels, without
+* copying them at all.
+*
 * Any image can be written to a file by using Save():
 *
 *   red->Save("./output.ppm");
@@ -45,11 +88,79 @@ public:
     typedef STColor4ub Pixel;
 
     //
-    // Load a new image from an image file (PPM, JPEG
+    // Formats the pixels of an STImage can be stored in.
+    //
+    //   kRGBA8  STColor4ub pixels.
+    //   kR8     A single 8-bit channel.
+    //   kRG8    Two 8-bit channels.
+    //   kR16    A single 16-bit channel, in native byte order.
+    //   kRGBA16 Four 16-bit channels, in native byte order, for data
+    //           that needs more than 8 bits (see STGradientMap).
+    //
+    // Converting a color image to kR8, kRG8 or kR16 keeps its red
+    // (and green) channels, the ones a shader reads as .x (and .y).
+    // Converting back gives gray (or red and green) RGBA pixels.
+    //
+    enum Format {
+        kRGBA8,
+        kR8,
+        kRG8,
+        kR16,
+        kRGBA16,
+    };
+
+    //
+    // Orders the rows of an image can be stored in. OpenGL expects
+    // kBottomUp, while image files store their rows kTopDown.
+    //
+    enum RowOrder {
+        kBottomUp,
+        kTopDown,
+    };
+
+    //
+    // Options that control how an image file is loaded.
+    //
+    struct LoadOptions
+    {
+        LoadOptions()
+            : maxDimension(0), sRGB(false), format(kRGBA8), rowOrder(kBottomUp) {}
+
+        //
+        // If positive, the image is reduced by powers of two
+        // until neither its width nor its height is larger
+        // than maxDimension.
+        //
+        int maxDimension;
+
+        //
+        // Set if the image holds sRGB-encoded colors (as photos
+        // and painted textures do), rather than data such as
+        // normals or heights. Mipmaps built for the image by
+        // STImageCache then average its pixels in linear light.
+        //
+        bool sRGB;
+
+        //
+        // Format to store the pixels in. Greyscale PNG files are
+        // decoded straight into kR8 or kR16 (keeping 16 bits of
+        // precision); other images are converted after loading.
+        //
+        Format format;
+
+        //
+        // Order to store the rows in.
+        //
+        RowOrder rowOrder;
+    };
+
+    //
+    // Load a new image from an image file (PPM, PAM, JPEG
     // and PNG formats are supported).
     // Returns NULL on failure.
     //
-    STImage(const std::string& filename);
+    STImage(const std::string& filename,
+            const LoadOptions& options = LoadOptions());
 
     //
     // Construct a new image of the specified width and height,
@@ -57,13 +168,28 @@ public:
     //
     STImage(int width, int height, Pixel color = Pixel(0,0,0,0));
 
+    //
+    // Construct a new image of the specified width, height
+    // and pixel format, with all channels set to zero.
+    //
+    STImage(int width, int height, Format format);
+
+    //
+    // Construct a view of existing pixel data in the given format,
+    // without copying it. Rows are stride bytes apart (zero means
+    // tightly packed) and stored in the given order. The view does
+    // not own the data, which must stay valid while it is used.
+    //
+    STImage(int width, int height, Format format, void* data,
+            int stride = 0, RowOrder rowOrder = kBottomUp);
+
     //
     // Delete and clean up an existing image.
     //
     ~STImage();
 
     //
-    // Save the image to a file (PPM, JPEG and PNG
+    // Save the image to a file (PPM, PAM, JPEG and PNG
     // formats are supported).
     // Returns a non-zero value on error.
     //
@@ -96,28 +222,124 @@ public:
     int GetHeight() const { return mHeight; }
 
     //
-    // Read a pixel value given its (x,y) location.
+    // Get the format the pixels are stored in.
+    //
+    Format GetFormat() const { return mFormat; }
+
+    //
+    // Convert the pixels to another format. A view gets a
+    // tightly packed copy of its data that it owns.
+    //
+    void ConvertTo(Format format);
+
+    //
+    // Get the order the rows are stored in.
+    //
+    RowOrder GetRowOrder() const { return mRowOrder; }
+
+    //
+    // Reverse the order of the rows in memory, in place.
+    //
+    void SetRowOrder(RowOrder rowOrder);
+
+    //
+    // Get the number of bytes from the start of one row in
+    // memory to the start of the next.
+    //
+    int GetStride() const { return mStride; }
+
+    //
+    // Is this image a view of data that it does not own?
+    //
+    bool IsView() const { return !mOwnsData && !mMappedFile; }
+
+    //
+    // Get row y of the image, counting from the bottom row
+    // as GetPixel() does, whatever order the rows are in.
+    //
+    const unsigned char* GetRow(int y) const;
+    unsigned char* GetRow(int y);
+
+    //
+    // Copy the pixels of another image of the same size into
+    // this one, converting their format, stride and row order.
+    //
+    void CopyPixels(const STImage& image);
+
+    //
+    // Read a pixel value given its (x,y) location,
+    // converting it to RGBA if needed.
     //
     Pixel GetPixel(int x, int y) const;
 
     //
-    // Write a pixel value given its (x,y) location.
+    // Write a pixel value given its (x,y) location,
+    // converting it from RGBA if needed.
     //
     void SetPixel(int x, int y, Pixel value);
 
     //
-    // Get read-only access to the "raw" array of pixel data.
-    // The STImage object owns this data, and it is not valid
-    // to use it after the image is deleted.
+    // Get read-only access to the "raw" array of RGBA pixels,
+    // which is only valid for kRGBA8 images. The STImage object
+    // owns this data, and it is not valid to use it after the
+    // image is deleted. Loaded and newly constructed images are
+    // tightly packed, bottom row first; views have the stride
+    // and row order they were given.
+    //
+    const Pixel* GetPixels() const;
+
+    //
+    // Get read-write access to the "raw" array of RGBA pixels,
+    // which is only valid for kRGBA8 images. The STImage object
+    // owns this data, and it is not valid to use it after the
+    // image is deleted.
+    //
+    Pixel* GetPixels();
+
+    //
+    // Get read-only access to the "raw" pixel data in any format,
+    // starting with the first row in memory.
+    //
+    const unsigned char* GetData() const { return mData; }
+
+    //
+    // Get read-write access to the "raw" pixel data in any format,
+    // starting with the first row in memory.
+    //
+    unsigned char* GetData() { return mData; }
+
+    //
+    // Get the size in bytes of one pixel of a format.
+    //
+    static int GetBytesPerPixel(Format format);
+
+    //
+    // Get the size in bytes of one channel of a format.
+    //
+    static int GetBytesPerChannel(Format format);
+
+    //
+    // Convert an array of pixels from one format to another.
+    //
+    static void ConvertPixels(Format srcFormat, const void* src,
+                              Format dstFormat, void* dst,
+                              int numPixels);
+
+    //
+    // Fill in a half-resolution copy of an array of pixels by
+    // averaging 2x2 blocks. The destination array must hold
+    // max(width/2,1) by max(height/2,1) pixels. Odd rows and
+    // columns are clamped at the edge of the image.
     //
-    const Pixel* GetPixels() const { return mPixels; }
+    static void Downsample(const Pixel* src, int width, int height,
+                           Pixel* dst);
 
     //
-    // Get read-write access to the "raw" array of pixel data.
-    // The STImage object owns this data, and it is not valid
-    // to use it after the image is deleted.
+    // Resample the image to a new width and height with a
+    // Lanczos filter. See STResample for other filters.
+    // Images in other formats are resampled as kRGBA8.
     //
-    Pixel* GetPixels() { return mPixels; }
+    void Resize(int width, int height);
 
 private:
     // Image height, in pixels.
@@ -126,24 +348,55 @@ private:
     // Image width, in pixels.
     int mWidth;
 
-    // An array of mWidth*mHeight pixels, stored in row-major
-    // left-to-right, bottom-to-top order.
-    Pixel* mPixels;
+    // An array of mWidth*mHeight pixels in mFormat, stored in
+    // row-major left-to-right order, with rows mStride bytes
+    // apart in mRowOrder.
+    unsigned char* mData;
+    Format mFormat;
+    int mStride;
+    RowOrder mRowOrder;
 
+    // Is mData deleted with the image?
+    bool mOwnsData;
+
+    // The file mapping that mData points into, if any, which is
+    // closed with the image.
+    STMappedFile* mMappedFile;
+
+    //
+    void Initialize(int width, int height, Format format = kRGBA8,
+                    RowOrder rowOrder = kBottomUp);
+
+    //
+    // Replace the data with a tightly packed copy, if the rows
+    // have padding or the image is a view.
+    //
+    void Pack();
+
+    //
+    // Free the data, or close the file mapping, that the image owns.
+    //
+    void FreeData();
+
+    //
+    // Halve the resolution of the image until it fits
+    // within maxDimension pixels in both directions.
     //
-    void Initialize(int width, int height);
+    void ReduceToFit(int maxDimension);
 
     //
     // Format-specific routines for loading/saving
     // particular image file formats.
     //
-    void LoadPPM(const std::string& filename);
+    void LoadPPM(const std::string& filename, const LoadOptions& options);
+    void LoadPPMText(const std::string& filename, const LoadOptions& options);
     STStatus  SavePPM(const std::string& filename) const;
+    STStatus  SavePAM(const std::string& filename) const;
 
-    void LoadPNG(const std::string& filename);
+    void LoadPNG(const std::string& filename, const LoadOptions& options);
     STStatus  SavePNG(const std::string& filename) const;
 
-    void LoadJPG(const std::string& filename);
+    void LoadJPG(const std::string& filename, const LoadOptions& options);
     STStatus  SaveJPG(const std::string& filename) const;
 };
 
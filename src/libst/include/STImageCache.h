@@ -0,0 +1,182 @@
+// STImageCache.h
+#ifndef __STIMAGECACHE_H__
+#define __STIMAGECACHE_H__
+
+#include "STBlockCompression.h"
+#include "STImage.h"
+#include "STMappedFile.h"
+#include "STUtil.h" // for STStatus
+
+#include <string>
+#include <vector>
+
+/**
+* The STImageCache class gives access to the fully decoded pixels of an
+* image file, together with its complete chain of mipmap levels. The
+* decoded levels are stored in a cache file next to the source image
+* (or in the directory given to SetCacheDirectory()), so that only the
+* first run pays for decoding the image and building the mipmaps:
+*
+*   STImageCache* cache = new STImageCache("./world_map.jpeg");
+*   STTexture* texture = new STTexture(cache);
+*
+* A cache file remembers the size, modification time and a hash of the
+* source file it was built from. It is rebuilt automatically whenever the
+* source changes. Cached levels are memory-mapped, so uploading them to
+* OpenGL does not copy the pixels again.
+*
+* Levels are stored in the same bottom-to-top row order as STImage, in
+* the STImage format given by the load options (8-bit RGBA by default).
+* Level 0 is the full-size image, and each subsequent level halves the
+* dimensions (rounding down) until reaching 1x1. Compact formats keep
+* the cache file, and the texture made from it, smaller:
+*
+*   STImage::LoadOptions options;
+*   options.format = STImage::kRG8;
+*   STImageCache* normals = new STImageCache("./normals.png", options);
+*
+* The levels can instead be stored block compressed (see
+* STBlockCompression), which makes them 4 to 8 times smaller both on
+* disk and in video memory. Compressing is slow, so it is worth caching:
+*
+*   STImageCache* height = new STImageCache("./height.png",
+*       STImage::LoadOptions(), STBlockCompression::kBC4);
+*
+* Compressed levels are always encoded from RGBA pixels, so the format
+* in the load options is ignored for them. The data of compressed levels,
+* and of levels in formats other than kRGBA8, is read with GetData()
+* rather than GetPixels().
+*/
+class STImageCache
+{
+public:
+    //
+    // Type of pixels stored in the cache.
+    //
+    typedef STImage::Pixel Pixel;
+
+    //
+    // Open the cache for an image file (PPM, JPEG and PNG formats are
+    // supported), decoding the image with the given options and writing
+    // a new cache file if there is no valid one. Throws on failure to
+    // load the image. The levels are stored in the given format.
+    //
+    STImageCache(const std::string& filename,
+                 const STImage::LoadOptions& options = STImage::LoadOptions(),
+                 STBlockCompression::Format format = STBlockCompression::kUncompressed);
+
+    //
+    // Release the cached pixel data.
+    //
+    ~STImageCache();
+
+    //
+    // Get the number of mipmap levels, including the full-size image.
+    //
+    int GetNumLevels() const { return (int) mLevels.size(); }
+
+    //
+    // Get the width (in pixels) of a mipmap level.
+    //
+    int GetWidth(int level = 0) const { return mLevels[level].width; }
+
+    //
+    // Get the height (in pixels) of a mipmap level.
+    //
+    int GetHeight(int level = 0) const { return mLevels[level].height; }
+
+    //
+    // Get the format the levels are stored in.
+    //
+    STBlockCompression::Format GetFormat() const { return mFormat; }
+
+    //
+    // Get the STImage format of the pixels of uncompressed levels.
+    //
+    STImage::Format GetPixelFormat() const { return mPixelFormat; }
+
+    //
+    // Get read-only access to the pixels of a mipmap level, which
+    // must be uncompressed kRGBA8 pixels. The STImageCache owns this
+    // data, and it is not valid to use it after the cache is deleted.
+    //
+    const Pixel* GetPixels(int level = 0) const;
+
+    //
+    // Get read-only access to the data of a mipmap level in any
+    // format, and its size in bytes.
+    //
+    const unsigned char* GetData(int level = 0) const { return mData + mLevels[level].offset; }
+    size_t GetDataSize(int level = 0) const { return mLevels[level].size; }
+
+    //
+    // Was a valid cache file found, or did the image need to be
+    // decoded?
+    //
+    bool WasCacheHit() const { return mCacheHit; }
+
+    //
+    // Store all cache files in the given directory instead of next
+    // to their source images. Pass an empty string to restore the
+    // default.
+    //
+    static void SetCacheDirectory(const std::string& directory);
+
+    //
+    // Get the path of the cache file used for an image file
+    // loaded with the given options and stored in a format.
+    //
+    static std::string GetCachePath(const std::string& filename,
+                                    const STImage::LoadOptions& options = STImage::LoadOptions(),
+                                    STBlockCompression::Format format = STBlockCompression::kUncompressed);
+
+private:
+    // Location and size of a mipmap level within the cache data.
+    struct Level {
+        int width;
+        int height;
+        size_t offset;
+        size_t size;
+    };
+
+    // Not copyable: the pixel data may be a file mapping.
+    STImageCache(const STImageCache&);
+    STImageCache& operator=(const STImageCache&);
+
+    //
+    // Try to use an existing cache file. Returns true if the
+    // cache file is valid for the source image.
+    //
+    bool OpenCacheFile(const std::string& filename,
+                       const STImage::LoadOptions& options,
+                       const std::string& cachePath);
+
+    //
+    // Decode the source image, build its mipmaps and
+    // write them to a new cache file.
+    //
+    void BuildCacheFile(const std::string& filename,
+                        const STImage::LoadOptions& options,
+                        const std::string& cachePath);
+
+    STBlockCompression::Format mFormat;
+    STImage::Format mPixelFormat;
+    std::vector<Level> mLevels;
+
+    // Pointer to the start of the cache data, which is either
+    // the mapped cache file or mBuffer.
+    const unsigned char* mData;
+
+    // The mapped cache file, when the cache was valid.
+    STMappedFile mFile;
+
+    // Freshly built cache data, when the cache was rebuilt.
+    std::vector<unsigned char> mBuffer;
+
+    bool mCacheHit;
+
+    // Directory for cache files; empty means next to the source.
+    static std::string sCacheDirectory;
+};
+
+#endif // __STIMAGECACHE_H__
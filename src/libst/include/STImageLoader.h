@@ -0,0 +1,105 @@
+// STImageLoader.h
+#ifndef __STIMAGELOADER_H__
+#define __STIMAGELOADER_H__
+
+#include "STImage.h"
+
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
+class STThreadPool;
+
+/**
+* The STImageLoader class decodes a batch of image files concurrently
+* on a thread pool, so that loading several large images takes about
+* as long as the slowest one instead of the sum of all of them.
+*
+* Add the files to load, then either call Finish() to wait for all of
+* them, or call Poll() once per frame to collect the images that are
+* ready so far:
+*
+*   STImageLoader loader;
+*   loader.Add("./body.png");
+*   loader.Add("./plate.jpg");
+*   loader.Finish([&](int index, STImage* image) {
+*       textures[index] = new STTexture(image);
+*   });
+*
+* The callback always runs on the thread that called Poll() or
+* Finish(), so it is safe to create OpenGL textures from it. The
+* callback takes ownership of each image it receives. If an image
+* fails to load, an error is printed and the callback receives NULL.
+*/
+class STImageLoader
+{
+public:
+    //
+    // Function that receives each loaded image, together with
+    // the index returned by Add().
+    //
+    typedef std::function<void(int index, STImage* image)> Callback;
+
+    //
+    // Create a loader that decodes images on the given thread pool,
+    // or on the shared libst pool if none is given.
+    //
+    STImageLoader(STThreadPool* pool = NULL);
+
+    //
+    // Wait for any images still being decoded, and delete
+    // the images that were never handed to a callback.
+    //
+    ~STImageLoader();
+
+    //
+    // Start decoding an image file (PPM, JPEG and PNG formats are
+    // supported). Returns the index the image will be reported with.
+    //
+    int Add(const std::string& filename,
+            const STImage::LoadOptions& options = STImage::LoadOptions());
+
+    //
+    // Get the number of images added to the loader.
+    //
+    int GetCount() const { return (int) mJobs.size(); }
+
+    //
+    // Get the file name of an image added to the loader.
+    //
+    const std::string& GetFilename(int index) const { return mJobs[index].filename; }
+
+    //
+    // Hand every image that has finished decoding since the last
+    // call to the callback, without waiting for the others.
+    // Returns the number of images still being decoded.
+    //
+    int Poll(const Callback& callback);
+
+    //
+    // Wait for all images to finish decoding, handing each
+    // one to the callback.
+    //
+    void Finish(const Callback& callback);
+
+private:
+    // Not copyable: the loader owns its pending images.
+    STImageLoader(const STImageLoader&);
+    STImageLoader& operator=(const STImageLoader&);
+
+    struct Job {
+        std::string filename;
+        std::shared_future<STImage*> result;
+        bool delivered;
+    };
+
+    // Take a finished image out of a job, reporting any load error.
+    STImage* Collect(Job& job);
+
+    STThreadPool* mPool;
+    std::vector<Job> mJobs;
+    int mNumPending;
+};
+
+#endif // __STIMAGELOADER_H__
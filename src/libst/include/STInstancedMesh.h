@@ -0,0 +1,135 @@
+// STInstancedMesh.h
+#ifndef __STINSTANCEDMESH_H__
+#define __STINSTANCEDMESH_H__
+
+#include "stgl.h"
+#include "STTriangleMesh.h"
+#include <vector>
+
+// Forward-declare libst types.
+#include "stForward.h"
+class STShaderProgram;
+
+/**
+* The STInstancedMesh class draws many copies of one mesh, each with
+* its own transform and diffuse color, in a single draw call:
+*
+*   STInstancedMesh bolts(boltMesh);
+*   for (int i = 0; i < 100; ++i) {
+*       STMatrix4 transform;
+*       transform.EncodeT(i * 0.1f, 0, 0);
+*       bolts.AddInstance(transform, STColor4f(1, 0, 0, 1));
+*   }
+*   ...
+*   STShaderProgram* program = shader->GetVariant(instancingFeature);
+*   program->Bind();
+*   bolts.Draw(smooth, program);
+*
+* The transforms and colors are kept in one buffer. With OpenGL 3.3
+* (or ARB_instanced_arrays and ARB_draw_instanced), they are read by
+* a program with these vertex attributes:
+*
+*   attribute mat4 instanceTransform;
+*   attribute vec4 instanceDiffuse;
+*
+* as in the INSTANCING variant of default.vert. Otherwise, or when
+* Draw() is not given such a program, the instances are transformed on
+* the CPU into one buffer, which is kept until they change, and drawn
+* with one call for each diffuse color, with any program bound. Use
+* HasInstancing() to choose the variant to bind.
+*
+* That buffer holds a copy of the mesh for every instance: 44 bytes per
+* corner and 4 per index, times the number of instances, so 100 copies
+* of a mesh with 100k corners take over 400 MB of video memory. Draw
+* large meshes instanced on the CPU only a few times, or as separate
+* meshes.
+*
+* The transforms apply before the current modelview matrix. They may
+* rotate, translate and scale the mesh, but should not scale it by a
+* different amount along each axis, or the normals will be wrong.
+* The mesh must outlive this object, and its axes are not drawn.
+*/
+class STInstancedMesh
+{
+public:
+    STInstancedMesh(const STTriangleMesh* mesh);
+    ~STInstancedMesh();
+
+    //
+    // Add an instance, returning its index. Without a color, the
+    // instance has the diffuse color of the mesh.
+    //
+    int AddInstance(const STMatrix4& transform);
+    int AddInstance(const STMatrix4& transform, const STColor4f& diffuse);
+
+    //
+    // Change an instance that was added.
+    //
+    void SetInstance(int instance, const STMatrix4& transform, const STColor4f& diffuse);
+
+    //
+    // Remove all the instances.
+    //
+    void ClearInstances();
+
+    int GetNumInstances() const { return (int) mInstances.size(); }
+
+    //
+    // Draw all the instances, with the bound program, which should
+    // be given if it reads the instance attributes.
+    //
+    void Draw(bool smooth, STShaderProgram* program = NULL);
+
+    //
+    // Can instances be drawn by the GPU with a single call?
+    //
+    static bool HasInstancing();
+
+private:
+    // An instance, as the shader reads it: the transform as four
+    // columns, and the diffuse color.
+    struct Instance {
+        float transform[16];
+        float diffuse[4];
+    };
+
+    //
+    // Helper routines - upload the mesh and instances for the GPU
+    // to draw, or transform the instances on the CPU and upload
+    // them grouped by color.
+    //
+    void UploadInstances();
+    void UploadTransformed();
+
+    //
+    // Helper routine - set the vertex arrays to read from a buffer
+    // of vertices.
+    //
+    static void SetVertexArrays(GLuint buffer, bool smooth);
+
+    const STTriangleMesh* mMesh;
+
+    // The corners of the mesh, and the triangles as indices.
+    std::vector<STBufferVertex> mVertices;
+    std::vector<unsigned int> mIndices;
+
+    std::vector<Instance> mInstances;
+
+    // OpenGL buffer ids of the mesh and of the instances, and whether
+    // the instances changed since they were uploaded.
+    GLuint mVertexBuffer;
+    GLuint mIndexBuffer;
+    GLuint mInstanceBuffer;
+    bool mInstancesChanged;
+
+    // The instances transformed on the CPU, and the runs of indices
+    // to draw with each diffuse color.
+    GLuint mTransformedVertexBuffer;
+    GLuint mTransformedIndexBuffer;
+    bool mTransformedChanged;
+    std::vector<GLsizei> mRunCounts;
+    std::vector<const GLvoid*> mRunOffsets;
+    std::vector<int> mRunInstances;
+};
+
+#endif // __STINSTANCEDMESH_H__
@@ -0,0 +1,91 @@
+// STMappedFile.h
+#ifndef __STMAPPEDFILE_H__
+#define __STMAPPEDFILE_H__
+
+#include "STUtil.h" // for STStatus
+
+#include <string>
+
+/**
+* The STMappedFile class provides read-only access to the contents
+* of a file by mapping it into memory. The data stays valid until the
+* file is closed or the STMappedFile is deleted:
+*
+*   STMappedFile file;
+*   if (file.Open("./frog.ppm") == ST_OK) {
+*       const unsigned char* bytes = file.GetData();
+*       size_t size = file.GetSize();
+*   }
+*
+* Mapping avoids the read() copy into a user buffer, so pixel data stored
+* in a mapped file can be handed straight to OpenGL.
+*
+* A file opened copy-on-write can also be modified in memory through
+* GetPrivateData(). Modified pages are copied privately for this
+* process, and the file itself never changes.
+*/
+class STMappedFile
+{
+public:
+    //
+    // Construct an STMappedFile that has not been opened yet.
+    //
+    STMappedFile();
+
+    //
+    // Unmap the file, if it is open.
+    //
+    ~STMappedFile();
+
+    //
+    // Map the entire contents of a file into memory, optionally
+    // copy-on-write. Returns a non-zero value on error.
+    //
+    STStatus Open(const std::string& filename, bool copyOnWrite = false);
+
+    //
+    // Unmap the file. Pointers returned by GetData()
+    // are no longer valid after this call.
+    //
+    void Close();
+
+    //
+    // Is a file currently mapped?
+    //
+    bool IsOpen() const { return mData != NULL; }
+
+    //
+    // Get read-only access to the mapped bytes.
+    //
+    const unsigned char* GetData() const { return mData; }
+
+    //
+    // Get writable access to the mapped bytes of a file opened
+    // copy-on-write. Changes are never written to the file.
+    //
+    unsigned char* GetPrivateData()
+    {
+        return mCopyOnWrite ? (unsigned char*) mData : NULL;
+    }
+
+    //
+    // Get the size (in bytes) of the mapped file.
+    //
+    size_t GetSize() const { return mSize; }
+
+private:
+    // Not copyable: the mapping is owned by exactly one object.
+    STMappedFile(const STMappedFile&);
+    STMappedFile& operator=(const STMappedFile&);
+
+    const unsigned char* mData;
+    size_t mSize;
+    bool mCopyOnWrite;
+
+#ifdef _WIN32
+    void* mFileHandle;
+    void* mMappingHandle;
+#endif
+};
+
+#endif // __STMAPPEDFILE_H__
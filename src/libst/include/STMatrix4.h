@@ -17,7 +17,12 @@ struct STMatrix4
     inline void EncodeS(float sx,float sy,float sz);
     inline void EncodeR(float degrees,const STVector3& axis);
 
+    // The matrices gluPerspective and gluLookAt would multiply by.
+    inline void EncodePerspective(float fovy,float aspect,float zNear,float zFar);
+    inline void EncodeLookAt(const STVector3& eye,const STVector3& center,const STVector3& up);
+
     inline STVector3 operator*(const STVector3& v);
+    inline STMatrix4 operator*(const STMatrix4& m) const;
     //
     // Local members
     //
@@ -62,6 +62,35 @@ inline void STMatrix4::EncodeR(float degrees,const STVector3& axis)
     table[2][2] = cos_t + z*z*(1-cos_t);
 }
 
+inline void STMatrix4::EncodePerspective(float fovy,float aspect,float zNear,float zFar)
+{
+    EncodeI();
+    float f=1.f/tan(fovy * 3.1415926536f / 360.f);
+    table[0][0]=f/aspect;
+    table[1][1]=f;
+    table[2][2]=(zFar+zNear)/(zNear-zFar);
+    table[2][3]=2.f*zFar*zNear/(zNear-zFar);
+    table[3][2]=-1.f;
+    table[3][3]=0.f;
+}
+
+inline void STMatrix4::EncodeLookAt(const STVector3& eye,const STVector3& center,const STVector3& up)
+{
+    STVector3 f=center-eye;
+    f.Normalize();
+    STVector3 s=STVector3::Cross(f,up);
+    s.Normalize();
+    STVector3 u=STVector3::Cross(s,f);
+
+    EncodeI();
+    table[0][0]=s.x;  table[0][1]=s.y;  table[0][2]=s.z;
+    table[1][0]=u.x;  table[1][1]=u.y;  table[1][2]=u.z;
+    table[2][0]=-f.x; table[2][1]=-f.y; table[2][2]=-f.z;
+    table[0][3]=-STVector3::Dot(s,eye);
+    table[1][3]=-STVector3::Dot(u,eye);
+    table[2][3]=STVector3::Dot(f,eye);
+}
+
 inline STVector3 STMatrix4::operator*(const STVector3& v)
 {
     STVector3 result;
@@ -71,4 +100,16 @@ inline STVector3 STMatrix4::operator*(const STVector3& v)
     return result;
 }
 
+inline STMatrix4 STMatrix4::operator*(const STMatrix4& m) const
+{
+    STMatrix4 result;
+    for(int i=0;i<4;i++)for(int j=0;j<4;j++){
+        float sum=0.f;
+        for(int k=0;k<4;k++)
+            sum+=table[i][k]*m.table[k][j];
+        result.table[i][j]=sum;
+    }
+    return result;
+}
+
 #endif  // __STMATRIX4_INL__
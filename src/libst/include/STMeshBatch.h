@@ -0,0 +1,100 @@
+// STMeshBatch.h
+#ifndef __STMESHBATCH_H__
+#define __STMESHBATCH_H__
+
+#include "stgl.h"
+#include <vector>
+
+class STTriangleMesh;
+
+/**
+* The STMeshBatch class draws many meshes that do not change, such as
+* the shapes of an OBJ file, with a few draw calls instead of one per
+* mesh. Build() copies the triangles of all the meshes into one vertex
+* buffer and one index buffer, with the meshes that share a color map
+* and material next to each other, so that each such group is drawn
+* with a single call:
+*
+*   batch.Build(meshes);
+*   ...
+*   batch.Draw(smooth);
+*
+* Meshes can still be hidden and shown one at a time. The buffers are
+* not touched for this; a group's call just skips the hidden meshes.
+*
+* The meshes must outlive the batch. Build() must be called again
+* after their triangles, texture coordinates or materials change.
+*/
+class STMeshBatch
+{
+public:
+    STMeshBatch();
+    ~STMeshBatch();
+
+    //
+    // Copy the meshes into the batch, replacing the meshes it had.
+    // All of them start out visible.
+    //
+    void Build(const std::vector<STTriangleMesh*>& meshes);
+
+    //
+    // Remove all the meshes and free the buffers.
+    //
+    void Clear();
+
+    //
+    // Draw the visible meshes, with their axes if they have
+    // mDrawAxis set.
+    //
+    void Draw(bool smooth);
+
+    //
+    // Show or hide the mesh with the given index in the vector
+    // passed to Build().
+    //
+    void SetVisible(int mesh, bool visible);
+    bool IsVisible(int mesh) const;
+
+    //
+    // Get the number of meshes in the batch, and the number of
+    // draw calls the last Draw() made for them.
+    //
+    int GetNumMeshes() const { return (int) mMeshes.size(); }
+    int GetNumDrawCalls() const { return mNumDrawCalls; }
+
+private:
+    // Where a mesh's triangles are in the index buffer.
+    struct Range {
+        int group;
+        int firstIndex;
+        int numIndices;
+        bool visible;
+    };
+
+    // Meshes sharing a color map and material, and the runs of
+    // indices to draw for the visible ones.
+    struct Group {
+        const STTriangleMesh* material;
+        std::vector<GLsizei> counts;
+        std::vector<const GLvoid*> offsets;
+    };
+
+    //
+    // Helper routine - find the runs of indices to draw for each
+    // group after meshes were hidden or shown.
+    //
+    void UpdateRuns();
+
+    std::vector<const STTriangleMesh*> mMeshes;
+    std::vector<Range> mRanges;
+    std::vector<Group> mGroups;
+    bool mRunsChanged;
+
+    // OpenGL vertex and index buffer ids.
+    GLuint mVertexBuffer;
+    GLuint mIndexBuffer;
+
+    int mNumDrawCalls;
+};
+
+#endif // __STMESHBATCH_H__
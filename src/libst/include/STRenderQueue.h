@@ -0,0 +1,92 @@
+// STRenderQueue.h
+#ifndef __STRENDERQUEUE_H__
+#define __STRENDERQUEUE_H__
+
+#include "STTriangleMesh.h"
+
+#include <map>
+#include <vector>
+
+class STShaderProgram;
+
+/**
+* The STRenderQueue class draws a set of meshes in the order that needs
+* the fewest state changes, rather than the order they are stored in.
+* Each frame, submit the meshes to draw, then draw them:
+*
+*   queue.Clear();
+*   for (size_t i = 0; i < meshes.size(); ++i)
+*       queue.Submit(meshes[i]);
+*   queue.Execute(smooth);
+*
+* Meshes are sorted by a key made of their program, color map and
+* material, so that meshes sharing them are drawn together and the
+* state is set once for each group. The keys are sorted with a radix
+* sort; when the same meshes are submitted in the same order as the
+* frame before, the order found then is used again.
+*/
+class STRenderQueue
+{
+public:
+    STRenderQueue();
+
+    //
+    // Remove the meshes submitted for the last frame.
+    //
+    void Clear();
+
+    //
+    // Add a mesh to draw, with the program to bind for it, or NULL
+    // to draw it with whatever program is bound. The mesh must stay
+    // unchanged until Execute().
+    //
+    void Submit(const STTriangleMesh* mesh, STShaderProgram* program = NULL);
+
+    //
+    // Sort the meshes submitted by their state. Execute() does this
+    // when needed, so it only has to be called to sort ahead of time.
+    //
+    void Sort();
+
+    //
+    // Draw the meshes in sorted order. Programs bound for the
+    // meshes stay bound afterwards.
+    //
+    void Execute(bool smooth);
+
+    //
+    // Get the number of meshes submitted, and the number of times
+    // the last Execute() changed the program, color map or material.
+    //
+    int GetNumItems() const { return (int) mItems.size(); }
+    int GetNumStateChanges() const { return mNumStateChanges; }
+
+private:
+    // A mesh to draw, and its sort key.
+    struct Item {
+        unsigned long long key;
+        const STTriangleMesh* mesh;
+        STShaderProgram* program;
+    };
+
+    // Get a small number standing for a piece of state, numbering
+    // them in the order they are first submitted.
+    template <class Key>
+    static unsigned int GetId(std::map<Key, unsigned int>* ids,
+                              const Key& state);
+
+    std::vector<Item> mItems;
+
+    // The items submitted and the order found for them last time.
+    std::vector<Item> mSortedItems;
+    std::vector<int> mOrder;
+
+    // The programs, color maps and materials of the submitted items.
+    std::map<const void*, unsigned int> mProgramIds;
+    std::map<const void*, unsigned int> mTextureIds;
+    std::map<STMaterialKey, unsigned int> mMaterialIds;
+
+    int mNumStateChanges;
+};
+
+#endif // __STRENDERQUEUE_H__
@@ -0,0 +1,90 @@
+// STResample.h
+#ifndef __STRESAMPLE_H__
+#define __STRESAMPLE_H__
+
+#include "STColor4ub.h"
+
+class STThreadPool;
+
+/**
+* The STResample class resizes arrays of RGBA pixels, as stored in an
+* STImage, and builds the downsampled levels of mipmap chains.
+*
+* Resize() scales an image to any size with a box or Lanczos filter:
+*
+*   STResample::Resize(src->GetPixels(), src->GetWidth(), src->GetHeight(),
+*                      dst->GetPixels(), dst->GetWidth(), dst->GetHeight());
+*
+* Downsample() is the fast path used for mipmaps: it halves an image by
+* averaging 2x2 blocks of pixels.
+*
+* Images holding colors (rather than data such as normals or heights)
+* are normally sRGB-encoded, and should be filtered with the kSRGB color
+* space so that the pixels are averaged in linear light. Otherwise
+* downsampled images come out too dark wherever they have fine detail.
+*
+* The work is split into bands of rows that run in parallel on the given
+* thread pool (the shared libst pool by default), and the inner loops
+* use SSE2 when the compiler targets it.
+*/
+class STResample
+{
+public:
+    //
+    // Filters available for Resize(). kBox averages all the source
+    // pixels covered by each destination pixel. kLanczos3 is sharper,
+    // and is the better choice for enlarging images.
+    //
+    enum Filter {
+        kBox,
+        kLanczos3,
+    };
+
+    //
+    // How the color channels of pixels are encoded. Alpha is
+    // always treated as linear.
+    //
+    enum ColorSpace {
+        kLinear,
+        kSRGB,
+    };
+
+    //
+    // Resample an image of srcWidth by srcHeight pixels into an image
+    // of dstWidth by dstHeight pixels, using the given filter.
+    //
+    static void Resize(const STColor4ub* src, int srcWidth, int srcHeight,
+                       STColor4ub* dst, int dstWidth, int dstHeight,
+                       Filter filter = kLanczos3,
+                       ColorSpace space = kLinear,
+                       STThreadPool* pool = 0);
+
+    //
+    // Fill in a half-resolution copy of an image by averaging 2x2
+    // blocks of pixels. The result is max(width/2, 1) by
+    // max(height/2, 1) pixels.
+    //
+    static void Downsample(const STColor4ub* src, int width, int height,
+                           STColor4ub* dst,
+                           ColorSpace space = kLinear,
+                           STThreadPool* pool = 0);
+
+    //
+    // Fill in a half-resolution copy of an image whose pixels are
+    // made of numChannels 8-bit or 16-bit channels (bytesPerChannel
+    // 1 or 2), such as the compact STImage formats. Channels are
+    // averaged linearly.
+    //
+    static void DownsampleChannels(const void* src, int width, int height,
+                                   int numChannels, int bytesPerChannel,
+                                   void* dst,
+                                   STThreadPool* pool = 0);
+
+    //
+    // Get the number of levels in a full mipmap chain for an image,
+    // including the image itself.
+    //
+    static int GetNumMipLevels(int width, int height);
+};
+
+#endif // __STRESAMPLE_H__
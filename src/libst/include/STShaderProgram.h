@@ -3,6 +3,7 @@
 #define __STSHADERPROGRAM_H__
 
 #include "stgl.h"
+#include <map>
 #include <string>
 #include <vector>
 
@@ -15,6 +16,29 @@
 * Call LoadVertexShader and UploadFragmentShader
 * to add shaders to the program. Call Bind() to begin
 * using the shader and UnBind() to stop using it.
+*
+* The active uniforms are looked up each time the program is linked,
+* so setting one by name does not go back to OpenGL to find it, and a
+* value that has not changed since it was last set is not uploaded
+* again. Setting uniforms the program does not use does nothing.
+*
+* The shaders are compiled and linked once, the first time the program
+* is used after shaders were added (or at Link()). Where the driver can
+* save linked programs (OpenGL 4.1 or ARB_get_program_binary), the
+* result is written to a cache file next to the first shader, and
+* later runs load it instead of compiling, as long as the shader
+* sources and the driver are unchanged.
+*
+* Shaders can be written with optional features that are compiled in
+* or out with the preprocessor, rather than branched on at run time:
+*
+*   unsigned int kFog = shader->AddFeature("FOG");
+*   ...
+*   STShaderProgram* variant = shader->GetVariant(fogEnabled ? kFog : 0);
+*   variant->Bind();
+*
+* where the shaders test "#ifdef FOG". Each combination of features is
+* a separate program, compiled the first time it is bound.
 */
 
 class STShaderProgram {
@@ -29,14 +53,43 @@ public:
     void LoadVertexShader(const std::string& filename);
     void LoadFragmentShader(const std::string& filename);
 
+    //
+    // Declare a feature of the shaders, which a variant enables by
+    // defining the given preprocessor symbol. Returns the feature's
+    // bit in the masks passed to GetVariant().
+    //
+    unsigned int AddFeature(const std::string& define);
+
+    //
+    // Get the variant of the program with the features in the mask
+    // defined. Mask 0 is this program. Other variants are made the
+    // first time they are asked for, with the shaders added so far,
+    // and belong to this program. Texture units set on this program
+    // also apply to its variants.
+    //
+    STShaderProgram* GetVariant(unsigned int features);
+
+    //
+    // Compile and link the shaders added so far, or load them from
+    // the cache. Bind() does this when needed, but linking early
+    // keeps the work out of the first frame.
+    //
+    void Link();
+
     void Bind();
     void UnBind();
 
     //
-    // Set a uniform global parameter of the program by name.
+    // Set the texture unit a sampler reads from. It takes effect
+    // at the next Bind(), and stays set until it is changed, even
+    // if the program is linked again.
     //
     void SetTexture(const std::string& name, int tex_index);
 
+    //
+    // Set a uniform global parameter of the program by name.
+    // The program must be bound.
+    //
     void SetUniform(const std::string& name, float value);
     void SetUniform(const std::string& name, float v0, float v1);
     void SetUniform(const std::string& name, float v0, float v1, float v2);
@@ -46,22 +99,111 @@ public:
     void SetUniform(const std::string& name, const STVector3& value);
     void SetUniform(const std::string& name, const STColor3f& value);
     void SetUniform(const std::string& name, const STColor4f& value);
+    void SetUniform(const std::string& name, const STMatrix4& value);
+
+    //
+    // Set the binding point that a uniform block reads its buffer
+    // from (OpenGL 3.1). Like a texture unit, it takes effect once
+    // the program is linked and stays set if it is linked again.
+    //
+    void SetUniformBlock(const std::string& name, int binding);
+
+    //
+    // Get the location of a vertex attribute, or -1 if the program
+    // does not use it. The program is linked first if needed.
+    //
+    int GetAttribLocation(const std::string& name);
+
+    //
+    // Store all program cache files in the given directory instead
+    // of next to their shaders. Pass an empty string to restore the
+    // default.
+    //
+    static void SetCacheDirectory(const std::string& directory);
 
 private:
+    // A shader added to the program.
+    struct Source {
+        GLenum type;
+        std::string filename;
+        std::string text;
+    };
+    // An active uniform of the linked program.
+    struct Uniform {
+        GLint location;
+
+        // The value last uploaded, as count floats, or count 0 if
+        // none has been since the program was linked.
+        int count;
+        float value[16];
+
+        // The texture unit set for a sampler, or -1, and whether it
+        // has changed since it was last uploaded.
+        int tex_id;
+        bool tex_pending;
+
+        // Record a new value, returning false if it is the value
+        // already uploaded.
+        bool Change(int n, float v0, float v1, float v2, float v3);
+        bool Change(int n, const float* values);
+    };
+
+    //
+    // Helper routines - read a shader file, and compile a shader
+    // and attach it to the program.
+    //
+    void LoadShader(GLenum type, const std::string& filename);
+    bool CompileShader(const Source& source);
+
+    //
+    // Helper routines - load a linked program from its cache file,
+    // or save it to one. The key identifies the sources and driver.
+    //
+    std::string GetCachePath() const;
+    bool LoadProgramBinary(const std::string& cachePath, unsigned long long key);
+    void SaveProgramBinary(const std::string& cachePath, unsigned long long key);
+
+    //
+    // Helper routine - find the active uniforms after linking.
+    //
+    void ReflectUniforms();
+
     //
-    // Helper routine - get the location for a uniform shader parameter.
+    // Helper routine - get the active uniform with a name, or NULL
+    // if the program does not use it.
     //
-    GLint GetUniformLocation(const std::string& name);
+    Uniform* FindUniform(const std::string& name);
 
     // OpenGL program object id.
     unsigned int programid;
 
-    struct UnboundTexture {
-        GLint location;
-        GLint tex_id;
-    };
+    // The shaders added, and whether the program has been linked
+    // with all of them.
+    std::vector<Source> sources;
+    bool linked;
+
+    // The features that variants can define, the variants made so
+    // far by mask, and the definitions a variant was made with.
+    std::vector<std::string> features;
+    std::map<unsigned int, STShaderProgram*> variants;
+    std::string defines;
+
+    // The active uniforms by name, and names looked up that the
+    // program does not use, with location -1.
+    std::map<std::string, Uniform> uniforms;
+
+    // The vertex attribute locations looked up so far.
+    std::map<std::string, int> attributes;
+
+    // The texture unit set for each sampler name, and the
+    // uniforms that have been given one.
+    std::map<std::string, int> textureUnits;
+    std::vector<Uniform*> samplers;
+
+    // The binding point set for each uniform block name.
+    std::map<std::string, int> blockBindings;
 
-    std::vector<UnboundTexture> textures;
+    static std::string sCacheDirectory;
 };
 
 
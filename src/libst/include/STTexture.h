@@ -3,6 +3,7 @@
 #define __STTEXTURE_H__
 
 #include "stgl.h"
+#include "STBlockCompression.h"
 #include "STImage.h"
 
 /**
@@ -16,6 +17,12 @@
 *
 *   texture->LoadImageData(someOtherImage);
 *
+* To avoid decoding an image file and building its mipmaps every time
+* your program runs, create the texture from an STImageCache instead:
+*
+*   STImageCache* cache = new STImageCache("./frog.png");
+*   STTexture* texture = new STTexture(cache);
+*
 * To use an STTexture for OpenGL rendering, you should call Bind()
 * before rendering with the texture, and UnBind() after you are done.
 *
@@ -31,13 +38,15 @@ class STTexture
 public:
     //
     // Options when loading an image to an STTexture. Use the
-    // kGenerateMipmaps option to use OpenGL to generate mipmaps -
-    // downsampled images used to improve the quality of texture
-    // filtering.
+    // kGenerateMipmaps option to generate mipmaps - downsampled
+    // images used to improve the quality of texture filtering.
+    // Add kSRGB for images holding sRGB-encoded colors, so that
+    // the mipmaps are averaged in linear light.
     //
     enum ImageOptions {
         kNone = 0,
         kGenerateMipmaps = 0x1,
+        kSRGB = 0x2,
     };
 
     //
@@ -48,6 +57,14 @@ public:
     STTexture(const STImage* image,
               ImageOptions options = kGenerateMipmaps);
 
+    //
+    // Create a new STTexture using the pixel data and precomputed
+    // mipmaps from the given image cache. Use the options to specify
+    // whether the mipmaps should be used.
+    //
+    STTexture(const STImageCache* cache,
+              ImageOptions options = kGenerateMipmaps);
+
     //
     // Create an "empty" STTexture with no image data. You will need
     // to load an image before you can use this texture for
@@ -63,11 +80,24 @@ public:
     //
     // Load image data into the STTexture. The texture will be
     // resized to match the image as needed. Use the options
-    // to specify whether mipmaps should be generated.
+    // to specify whether mipmaps should be generated. Images in
+    // the kR8, kRG8 and kR16 formats are stored in one and two
+    // channel textures, which shaders read as .x and .xy, and
+    // kRGBA16 images keep their 16 bits per channel.
     //
     void LoadImageData(const STImage* image,
                        ImageOptions options = kGenerateMipmaps);
 
+    //
+    // Load image data into the STTexture from an image cache,
+    // uploading each cached mipmap level directly instead of
+    // generating the mipmaps again. Block compressed levels stay
+    // compressed in video memory if the driver supports it, and
+    // are decompressed while loading otherwise.
+    //
+    void LoadImageData(const STImageCache* cache,
+                       ImageOptions options = kGenerateMipmaps);
+
     //
     // Bind this texture for use in subsequent OpenGL drawing.
     //
@@ -89,12 +119,19 @@ public:
 
     //
     // Set the OpenGL mode to use for texture addressing in
-    // the S and T dimensions respectively.
-    // For example:
+    // the S and T dimensions respectively. The default is
+    // GL_REPEAT. For example:
     //      SetWrap(GL_REPEAT, GL_REPEAT);
     //
     void SetWrap(GLint wrapS, GLint wrapT);
 
+    //
+    // Can the OpenGL driver use textures stored in a block
+    // compressed format directly? Call only after initializing
+    // OpenGL (and GLEW).
+    //
+    static bool SupportsFormat(STBlockCompression::Format format);
+
     //
     // Get the width (in pixels) of the image.
     //
@@ -105,6 +142,13 @@ public:
     //
     int GetHeight() const { return mHeight; }
 
+    //
+    // Get the OpenGL texture id, to bind the texture without
+    // Bind(), which also enables texturing for fixed-function
+    // drawing (and so cannot be used in a core profile context).
+    //
+    GLuint GetId() const { return mTexId; }
+
 private:
     // Common initialization code, used by all constructors.
     void Initialize();
@@ -115,6 +159,22 @@ private:
     // The width and height of the image data.
     int mWidth;
     int mHeight;
+
+    // The filtering and addressing modes last set.
+    GLint mMagFilter;
+    GLint mMinFilter;
+    GLint mWrapS;
+    GLint mWrapT;
 };
 
+//
+// Combine STTexture image options, as in
+// kGenerateMipmaps | kSRGB.
+//
+inline STTexture::ImageOptions operator|(STTexture::ImageOptions a,
+                                         STTexture::ImageOptions b)
+{
+    return STTexture::ImageOptions((int) a | (int) b);
+}
+
 #endif // __STTEXTURE_H__
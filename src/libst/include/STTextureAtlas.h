@@ -0,0 +1,51 @@
+// STTextureAtlas.h
+#ifndef __STTEXTUREATLAS_H__
+#define __STTEXTUREATLAS_H__
+
+#include <vector>
+
+class STTriangleMesh;
+
+/**
+* The STTextureAtlas class packs the color maps of a set of meshes into
+* a few large textures, so that a model made of many shapes with their
+* own textures (like the parts of turbosonic.obj) can be drawn without
+* switching textures between the shapes:
+*
+*   std::vector<STTriangleMesh*> meshes;
+*   STTriangleMesh::LoadObj(meshes, "./turbosonic/turbosonic.obj");
+*   STTextureAtlas::Build(meshes);
+*
+* Build() copies the color maps into atlas textures, points each mesh's
+* mSurfaceColorTex at its atlas, and rewrites the mesh's texture
+* coordinates to address its map's place in the atlas. The atlases are
+* added to STTextureCache, so the meshes release them as they would
+* any other cached texture. A mesh whose texture coordinates are later
+* rewritten, by STTriangleMesh::CalculateTextureCoordinatesViaSphericalProxy(),
+* goes back to its own map, loaded again from mColorMapFile.
+*
+* Maps are placed with a skyline packer, tallest first. Each map is
+* surrounded by padding that repeats its edge pixels, so that filtering
+* does not blend neighboring maps together, and placed at a multiple of
+* the padding, which keeps them apart in mipmap levels down to 1/padding
+* scale. The atlases have no mipmaps, like the maps loaded by LoadObj().
+* Maps that do not fit in a maxSize square start a new atlas.
+*
+* Only maps that came from STTextureCache, uncompressed, can be packed.
+* Meshes whose texture coordinates leave [0, 1] rely on the texture
+* repeating, which an atlas cannot do, so they keep their own texture.
+* Build() must be called from the OpenGL thread.
+*/
+class STTextureAtlas
+{
+public:
+    //
+    // Pack the color maps of the meshes into atlas textures of at
+    // most maxSize pixels square, with the given padding around each
+    // map. Returns the number of atlas textures created.
+    //
+    static int Build(const std::vector<STTriangleMesh*>& meshes,
+                     int maxSize = 4096, int padding = 8);
+};
+
+#endif // __STTEXTUREATLAS_H__
@@ -0,0 +1,118 @@
+// STTextureCache.h
+#ifndef __STTEXTURECACHE_H__
+#define __STTEXTURECACHE_H__
+
+#include "STImage.h"
+#include "STTexture.h"
+
+#include <future>
+#include <map>
+#include <string>
+
+/**
+* The STTextureCache class shares textures loaded from image files, so
+* that an image used by many meshes is decoded and uploaded to OpenGL
+* only once. Textures are identified by the canonical path of the image
+* file together with the options used to load it, and are reference
+* counted: every Acquire() must be matched by a Release().
+*
+*   STTexture* body = STTextureCache::Acquire("./turbosonic/Body.png");
+*   // ... draw with the texture ...
+*   STTextureCache::Release(body);
+*
+* When several textures are needed at once, call Request() for each of
+* them first. This starts decoding them in parallel on the shared
+* STThreadPool, and the later Acquire() calls only wait for the decoding
+* to finish and upload the result:
+*
+*   STTextureCache::Request(normalMap);
+*   STTextureCache::Request(displacementMap);
+*   // ... other loading work ...
+*   STTexture* normalTex = STTextureCache::Acquire(normalMap);
+*
+* Images loaded with a compact STImage format in their options, such as
+* kRG8 for normal maps, keep that format in the texture. Textures can
+* also be block compressed (see STBlockCompression), in which case the
+* compressed mipmaps are cached on disk too:
+*
+*   STTexture* heightTex = STTextureCache::Acquire(heightMap,
+*       STImage::LoadOptions(), STTexture::kGenerateMipmaps,
+*       STBlockCompression::kBC4);
+*
+* Images are decoded through STImageCache, so their decoded pixels and
+* mipmaps are also cached on disk between runs. Acquire() and Release()
+* create and delete OpenGL textures, so they must be called from the
+* OpenGL thread.
+*/
+class STTextureCache
+{
+public:
+    //
+    // Start decoding an image file on a worker thread, unless its
+    // texture is already cached or being decoded.
+    //
+    static void Request(const std::string& filename,
+                        const STImage::LoadOptions& options = STImage::LoadOptions(),
+                        STTexture::ImageOptions textureOptions = STTexture::kGenerateMipmaps,
+                        STBlockCompression::Format format = STBlockCompression::kUncompressed);
+
+    //
+    // Get the texture for an image file, loading it if it is not
+    // cached yet, and add a reference to it. Throws on failure to
+    // load the image.
+    //
+    static STTexture* Acquire(const std::string& filename,
+                              const STImage::LoadOptions& options = STImage::LoadOptions(),
+                              STTexture::ImageOptions textureOptions = STTexture::kGenerateMipmaps,
+                              STBlockCompression::Format format = STBlockCompression::kUncompressed);
+
+    //
+    // Add a texture made by the program, such as a texture atlas,
+    // to the cache under a unique name, with one reference held by
+    // the caller. The cache takes ownership of the texture.
+    //
+    static void Insert(const std::string& name, STTexture* texture);
+
+    //
+    // Add a reference to a texture that came from the cache.
+    //
+    static void AddRef(STTexture* texture);
+
+    //
+    // Drop a reference to a texture from Acquire(). The texture is
+    // deleted once its last reference is released.
+    //
+    static void Release(STTexture* texture);
+
+    //
+    // Get the decoded pixels of a cached texture, or NULL if the
+    // texture was not loaded from an image file by the cache.
+    //
+    static const STImageCache* GetImage(const STTexture* texture);
+
+    //
+    // Get the number of distinct textures currently cached.
+    //
+    static int GetNumTextures() { return (int) sEntries.size(); }
+
+private:
+    struct Entry {
+        STImageCache* image;
+        STTexture* texture;
+        int refCount;
+    };
+
+    // Build the key identifying an image file loaded with given options.
+    static std::string MakeKey(const std::string& filename,
+                               const STImage::LoadOptions& options,
+                               STTexture::ImageOptions textureOptions,
+                               STBlockCompression::Format format);
+
+    // Cached textures, by key.
+    static std::map<std::string, Entry> sEntries;
+
+    // Images being decoded on worker threads, by key.
+    static std::map<std::string, std::shared_future<STImageCache*> > sPending;
+};
+
+#endif // __STTEXTURECACHE_H__
@@ -0,0 +1,105 @@
+// STThreadPool.h
+#ifndef __STTHREADPOOL_H__
+#define __STTHREADPOOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* The STThreadPool class runs jobs on a fixed set of worker threads.
+* Submit() queues any function taking no arguments, and returns a
+* std::future that receives its result (or the exception it threw):
+*
+*   std::future<STImage*> job = STThreadPool::GetShared()->Submit(
+*       []() { return new STImage("./frog.png"); });
+*   // ... do other work ...
+*   STImage* frog = job.get();
+*
+* Most code should use the pool returned by GetShared(), so that all
+* of libst shares one set of threads sized to the machine.
+*
+* To split one large task (such as processing the rows of an image)
+* across all threads, use ParallelFor(). The calling thread takes part
+* in the work, so ParallelFor() may also be used from inside a job:
+*
+*   pool->ParallelFor(numBands, [&](int band) {
+*       ProcessRows(band * 64, STMin(band * 64 + 64, height));
+*   });
+*
+* Jobs run on worker threads, so they must not make OpenGL calls.
+* A job must also never wait on the result of another job in the
+* same pool, since all workers may be busy waiting.
+*/
+class STThreadPool
+{
+public:
+    //
+    // Start a pool with the given number of worker threads.
+    // Zero means one thread per hardware thread.
+    //
+    STThreadPool(int numThreads = 0);
+
+    //
+    // Finish all queued jobs and stop the worker threads.
+    //
+    ~STThreadPool();
+
+    //
+    // Get the number of worker threads.
+    //
+    int GetNumThreads() const { return (int) mThreads.size(); }
+
+    //
+    // Queue a function to run on a worker thread. The returned
+    // future receives the function's result.
+    //
+    template<typename Function>
+    std::future<typename std::result_of<Function()>::type>
+    Submit(Function function)
+    {
+        typedef typename std::result_of<Function()>::type Result;
+
+        std::shared_ptr<std::packaged_task<Result()> > task(
+            new std::packaged_task<Result()>(function));
+        std::future<Result> result = task->get_future();
+        Enqueue([task]() { (*task)(); });
+        return result;
+    }
+
+    //
+    // Call body(i) for every i from 0 to count-1, spreading the calls
+    // over the worker threads and the calling thread, and return once
+    // all of them are done. The body must not throw.
+    //
+    void ParallelFor(int count, const std::function<void(int)>& body);
+
+    //
+    // Get the pool shared by all of libst, creating it on first use.
+    //
+    static STThreadPool* GetShared();
+
+private:
+    // Not copyable: the pool owns its threads.
+    STThreadPool(const STThreadPool&);
+    STThreadPool& operator=(const STThreadPool&);
+
+    // Add a job to the queue and wake a worker.
+    void Enqueue(const std::function<void()>& job);
+
+    // Main loop of each worker thread.
+    void WorkerLoop();
+
+    std::vector<std::thread> mThreads;
+    std::deque<std::function<void()> > mJobs;
+    std::mutex mMutex;
+    std::condition_variable mJobAvailable;
+    bool mStopping;
+};
+
+#endif // __STTHREADPOOL_H__
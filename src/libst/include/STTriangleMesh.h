@@ -5,6 +5,7 @@
 #include "STPoint2.h"
 #include "STPoint3.h"
 
+#include <string.h>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -56,6 +57,34 @@ struct STFace{
 };
 inline std::ostream& operator <<(std::ostream& stream, const STFace& f);
 
+//
+// A corner of a triangle as it is stored in vertex buffers, with both
+// its smooth and face normals, so that smooth and flat shading can
+// draw from the same buffer.
+//
+struct STBufferVertex{
+    float position[3];
+    float normal[3];
+    float faceNormal[3];
+    float texPos[2];
+};
+
+//
+// The material values of a mesh, as a key for maps of state that
+// meshes with equal materials share, even if they are separate copies.
+// Keys are compared bytewise.
+//
+struct STMaterialKey{
+    float ambient[4];
+    float diffuse[4];
+    float specular[4];
+    float shininess;
+
+    bool operator<(const STMaterialKey& other) const {
+        return memcmp(this, &other, sizeof(STMaterialKey)) < 0;
+    }
+};
+
 /**
 * STTriangleMesh use a simple data structure to represent a triangle mesh.
 */
@@ -80,6 +109,31 @@ public:
     //
     void Draw(bool smooth) const;
 
+    //
+    // The steps of Draw(), for drawing many meshes with fewer state
+    // changes (see STRenderQueue): draw the axes, bind the color map
+    // and set the material, draw the triangles with the state as it
+    // is, and un-bind the color map.
+    //
+    void DrawAxis() const;
+    void BindMaterial() const;
+    void DrawGeometry(bool smooth) const;
+    void UnBindMaterial() const;
+
+    //
+    // Get the values of the material, to tell meshes with different
+    // materials apart.
+    //
+    STMaterialKey GetMaterialKey() const;
+
+    //
+    // Append the corners of the triangles to a vertex buffer, and the
+    // triangles to an index buffer, for drawing with vertex arrays.
+    // Corners that are the same in every way are stored once.
+    //
+    void AppendBuffers(std::vector<STBufferVertex>* vertices,
+                       std::vector<unsigned int>* indices) const;
+
     //
     // Read and Write the triangle mesh from/to files.
     //
@@ -119,9 +173,12 @@ public:
     float mMaterialDiffuse[4];
     float mMaterialSpecular[4];
     float mShininess;  // # between 1 and 128.
-	STImage * mSurfaceColorImg;
 	STTexture * mSurfaceColorTex;
 
+    // The image file the color map was loaded from by LoadObj(),
+    // which still names it after the map is packed into an atlas.
+    std::string mColorMapFile;
+
     static STPoint3 GetMassCenter(const std::vector<STTriangleMesh*>& input_meshes);
     static std::pair<STPoint3,STPoint3> GetBoundingBox(const std::vector<STTriangleMesh*>& input_meshes);
     void Recenter(const STPoint3& center);
@@ -139,6 +196,10 @@ public:
     static int instance_count;
 	static STImage whiteImg;
 	static STTexture* whiteTex;
+
+    // The display list the coordinate axes are drawn from, made
+    // the first time they are drawn.
+    static unsigned int axisList;
 };
 
 #endif  // __STTRIANGLEMESH_H__
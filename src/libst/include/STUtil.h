@@ -7,6 +7,7 @@
  */
 
 #include <string>
+#include <stddef.h>
 
 //
 // not defined in math.h on windows
@@ -67,6 +68,25 @@ STGetExtension(const std::string& filename)
     return extension;
 }
 
+/**
+* Compute a 64-bit FNV-1a hash of a block of memory. Pass the result
+* of a previous call as the seed to hash data that arrives in pieces.
+* This is not a cryptographic hash; it is meant for detecting changed
+* files and building cache keys.
+*/
+inline unsigned long long
+STHashBytes(const void* data, size_t size,
+            unsigned long long seed = 14695981039346656037ULL)
+{
+    const unsigned char* bytes = (const unsigned char*) data;
+    unsigned long long hash = seed;
+    for (size_t i=0; i<size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
 /**
 * Return the minimum of two values. This is more or less the same function
 * as the C++ std::min(), but avoids the name clash with the min() macro
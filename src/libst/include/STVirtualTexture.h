@@ -0,0 +1,222 @@
+// STVirtualTexture.h
+#ifndef __STVIRTUALTEXTURE_H__
+#define __STVIRTUALTEXTURE_H__
+
+#include "stgl.h"
+#include "STColor4ub.h"
+#include "STMappedFile.h"
+
+#include <future>
+#include <map>
+#include <string>
+#include <vector>
+
+class STShaderProgram;
+
+/**
+* The STVirtualTexture class draws with images far larger than any
+* single OpenGL texture (or than video memory), such as planetary
+* imagery. The image is split into tiles at every mipmap level, and only
+* the tiles needed for the current view are kept in video memory, so
+* memory use grows with the size of the window rather than the image.
+*
+* The first time an image is opened, its tiles are written to a cache
+* file next to it (or in the STImageCache cache directory). Building the
+* cache loads the whole image once; after that, tiles are read from the
+* memory-mapped cache file on the shared STThreadPool as they are needed.
+*
+* Resident tiles live in a pool texture of fixed size. A page table
+* texture, with one texel per tile at each mipmap level, tells the
+* shaders where in the pool each tile is, or where its closest loaded
+* ancestor is while it is still loading. The pool is managed least
+* recently used first.
+*
+* Which tiles are needed is found by drawing the scene into a small
+* feedback buffer, with a shader that writes the tile each pixel would
+* sample. Each frame looks something like:
+*
+*   STVirtualTexture* earth = new STVirtualTexture("./earth.jpeg");
+*
+*   void DisplayCallback()
+*   {
+*       earth->BeginFeedback(windowWidth, windowHeight);
+*       feedbackShader->Bind();
+*       earth->SetUniforms(feedbackShader);
+*       // ... draw the scene ...
+*       feedbackShader->UnBind();
+*       earth->EndFeedback();
+*
+*       earth->Update();
+*
+*       earth->Bind(3);   // texture units 3 and 4
+*       shader->SetTexture("vtPageTable", 3);
+*       shader->SetTexture("vtPool", 4);
+*       shader->Bind();
+*       earth->SetUniforms(shader);
+*       // ... draw the scene ...
+*   }
+*
+* Both shaders sample the texture through the functions in
+* kernels/virtualtexture.frag, which is loaded into each program as a
+* second fragment shader:
+*
+*   vec4 VirtualTexture(vec2 texPos);           // the color
+*   vec4 VirtualTextureFeedback(vec2 texPos);   // the feedback
+*
+* The feedback pass needs framebuffer objects (OpenGL 3.0 or
+* EXT_framebuffer_object); without them only the coarsest tile is
+* ever loaded.
+*/
+class STVirtualTexture
+{
+public:
+    //
+    // Open the tile cache of an image file (PPM, PAM, JPEG and PNG
+    // formats are supported), building it if there is no valid one,
+    // with a pool of poolTiles x poolTiles tiles. Throws on failure
+    // to load the image. Create it after initializing OpenGL.
+    //
+    STVirtualTexture(const std::string& filename, int poolTiles = 16);
+
+    //
+    // Delete the textures, after waiting for loads in flight.
+    //
+    ~STVirtualTexture();
+
+    //
+    // Start drawing the feedback pass, into a buffer a fraction of
+    // the size of the window. Draw the scene with a shader that
+    // writes VirtualTextureFeedback(), then call EndFeedback().
+    //
+    void BeginFeedback(int windowWidth, int windowHeight);
+
+    //
+    // Finish the feedback pass, and find the tiles it asked for.
+    // The feedback is read back a frame late to avoid waiting for
+    // the GPU, when pixel buffer objects are available.
+    //
+    void EndFeedback();
+
+    //
+    // Start loading the tiles that the last feedback asked for, and
+    // upload the tiles that have finished loading. Call it once per
+    // frame, after EndFeedback().
+    //
+    void Update();
+
+    //
+    // Bind the page table and pool textures to the given texture
+    // unit and the one after it.
+    //
+    void Bind(int firstUnit);
+    void UnBind(int firstUnit);
+
+    //
+    // Set the uniforms used by kernels/virtualtexture.frag. The
+    // shader must be bound.
+    //
+    void SetUniforms(STShaderProgram* shader) const;
+
+    //
+    // Get the size of the image, in pixels.
+    //
+    int GetWidth() const { return mWidth; }
+    int GetHeight() const { return mHeight; }
+
+    //
+    // Get the number of mipmap levels, and the number of
+    // tiles loaded into the pool.
+    //
+    int GetNumLevels() const { return (int) mLevels.size(); }
+    int GetNumResidentTiles() const { return (int) mResident.size(); }
+
+private:
+    // A mipmap level of the image, as stored in the cache file.
+    struct Level {
+        int width;
+        int height;
+        int tilesX;
+        int tilesY;
+        size_t firstTile;
+    };
+
+    // A place in the pool for one tile.
+    struct Slot {
+        unsigned long long tile;    // The tile held, or kNoTile.
+        int lastUsed;               // Frame the tile was last needed.
+    };
+
+    STVirtualTexture(const STVirtualTexture&);
+    STVirtualTexture& operator=(const STVirtualTexture&);
+
+    // Try to use an existing cache file, or build a new one.
+    bool OpenCacheFile(const std::string& filename, const std::string& cachePath);
+    void BuildCacheFile(const std::string& filename, const std::string& cachePath);
+
+    // Create the pool and page table textures.
+    void CreateTextures();
+
+    // Get the data of a tile in the cache file.
+    const unsigned char* GetTileData(unsigned long long tile) const;
+
+    // Collect the tiles asked for by a feedback buffer.
+    void ReadFeedback(const unsigned char* pixels, int numPixels);
+
+    // Find a slot for a new tile, evicting the least recently used
+    // tile if needed. Returns -1 if every tile is still needed.
+    int AllocateSlot();
+
+    // Copy a tile into a slot of the pool.
+    void UploadTile(unsigned long long tile, int slot, const unsigned char* data);
+
+    // Update the page table under a tile after it was loaded or evicted.
+    void UpdatePageTable(unsigned long long tile);
+
+    // The image and its levels.
+    int mWidth;
+    int mHeight;
+    std::vector<Level> mLevels;
+
+    // The mapped cache file, and the offset of the first tile.
+    STMappedFile mFile;
+    size_t mTileOffset;
+
+    // Number of tiles along each side of level 0 of the page table.
+    int mPageTableSize;
+
+    // Pool of resident tiles, and the slot of each resident tile.
+    int mPoolTiles;
+    std::vector<Slot> mSlots;
+    std::map<unsigned long long, int> mResident;
+
+    // Page table entries at each level: the pool slot and level
+    // of the tile to sample.
+    std::vector<std::vector<STColor4ub> > mPageTable;
+
+    // Tiles asked for by the last feedback, most urgent first,
+    // and the tiles being read from the cache file.
+    std::vector<unsigned long long> mRequests;
+    std::map<unsigned long long, std::future<std::vector<unsigned char> > > mLoading;
+
+    // Frame counter for the least recently used policy.
+    int mFrame;
+
+    GLuint mPoolTexture;
+    GLuint mPageTableTexture;
+
+    // The feedback buffer, and its size.
+    bool mUseFeedback;
+    GLuint mFeedbackFramebuffer;
+    GLuint mFeedbackColor;
+    GLuint mFeedbackDepth;
+    int mFeedbackWidth;
+    int mFeedbackHeight;
+
+    // Pixel buffer objects the feedback is read back through,
+    // alternating each frame, and the size of their contents.
+    bool mUseBuffers;
+    GLuint mFeedbackBuffers[2];
+    int mFeedbackPixels[2];
+};
+
+#endif // __STVIRTUALTEXTURE_H__
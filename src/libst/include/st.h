@@ -13,22 +13,40 @@
 //
 // Include all ST headers.
 //
+#include "STBlockCompression.h"
 #include "STColor3f.h"
 #include "STColor4f.h"
 #include "STColor4ub.h"
+#include "STCoreRenderer.h"
 #include "STFont.h"
+#include "STFrameGrabber.h"
+#include "STFrameRecorder.h"
+#include "STFrameScheduler.h"
+#include "STGLState.h"
+#include "STGradientMap.h"
 #include "STImage.h"
+#include "STImageCache.h"
+#include "STImageLoader.h"
+#include "STInstancedMesh.h"
 #include "STJoystick.h"
+#include "STMappedFile.h"
 #include "STMatrix4.h"
+#include "STMeshBatch.h"
 #include "STPoint2.h"
 #include "STPoint3.h"
+#include "STRenderQueue.h"
+#include "STResample.h"
 #include "STShaderProgram.h"
 #include "STShape.h"
 #include "STTexture.h"
+#include "STTextureAtlas.h"
+#include "STTextureCache.h"
+#include "STThreadPool.h"
 #include "STTimer.h"
 #include "STUtil.h"
 #include "STVector2.h"
 #include "STVector3.h"
+#include "STVirtualTexture.h"
 #include "STTriangleMesh.h"
 
 #endif  // __ST_H__
@@ -10,19 +10,37 @@
 *  a class to a struct or vice versa).
 */
 
+class STBlockCompression;
 struct STColor3f;
 struct STColor4f;
 struct STColor4ub;
+class STCoreRenderer;
 class STFont;
+class STFrameGrabber;
+class STFrameRecorder;
+class STFrameScheduler;
+class STGLState;
+class STGradientMap;
 class STImage;
+class STImageCache;
+class STImageLoader;
+class STInstancedMesh;
 class STJoystick;
+class STMappedFile;
 struct STMatrix4;
+class STMeshBatch;
 struct STPoint2;
 struct STPoint3;
+class STRenderQueue;
+class STResample;
 class STShape;
 class STTexture;
+class STTextureAtlas;
+class STTextureCache;
+class STThreadPool;
 class STTimer;
 struct STVector2;
 struct STVector3;
+class STVirtualTexture;
 
 #endif  // __STFORWARD_H__
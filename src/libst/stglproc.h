@@ -0,0 +1,31 @@
+// stglproc.h
+#ifndef __STGLPROC_H__
+#define __STGLPROC_H__
+
+// OpenGL entry points newer than the GLEW in ext/ have to be looked
+// up at run time.  This internal header holds the few definitions
+// that takes, for the library's .cpp files only.  Include it after
+// GLEW (or gl.h), as it uses the GL types.
+//
+//   typedef void (STAPIENTRY *STFooProc)(GLuint bar);
+//   STFooProc foo = (STFooProc) STGetProcAddress("glFoo");
+//
+// There is nothing to look up on Mac OS X, whose gl.h declares every
+// entry point the system supports, so STGetProcAddress is not defined
+// there.
+
+// glew.h undefines APIENTRY when it is done with it.
+#ifdef _WIN32
+#define STAPIENTRY __stdcall
+#else
+#define STAPIENTRY
+#endif
+
+#if defined(_WIN32)
+#define STGetProcAddress(name) wglGetProcAddress(name)
+#elif !defined(__APPLE__)
+extern "C" void (*glXGetProcAddressARB(const GLubyte* name))(void);
+#define STGetProcAddress(name) glXGetProcAddressARB((const GLubyte*) name)
+#endif
+
+#endif // __STGLPROC_H__
@@ -0,0 +1,52 @@
+// stparallel.h
+#ifndef __STPARALLEL_H__
+#define __STPARALLEL_H__
+
+// What the library's image-processing .cpp files share for running
+// over the pixels of an image quickly: whether SSE2 may be used, and
+// splitting the rows into bands for an STThreadPool. For the
+// library's .cpp files only.
+
+#include "STThreadPool.h"
+#include "STUtil.h"
+
+#include <functional>
+
+// Use SSE2 whenever the compiler targets it (always true on x86-64).
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ST_SSE2
+#include <emmintrin.h>
+#endif
+
+// Number of rows processed together by each parallel job.
+static const int kBandRows = 32;
+
+// Images with fewer pixels than this are processed on the calling
+// thread only, as handing them out costs more than it saves.
+static const int kMinParallelPixels = 64 * 1024;
+
+//
+// Split rows 0 to numRows-1 of an image into bands of bandRows and
+// call rows(first, end) for each, in parallel when there are at least
+// minPixels pixels. A NULL pool means the shared one.
+//
+inline void
+STForEachBand(STThreadPool* pool, int numRows, int rowPixels,
+              const std::function<void(int, int)>& rows,
+              int bandRows = kBandRows, int minPixels = kMinParallelPixels)
+{
+    int numBands = (numRows + bandRows - 1) / bandRows;
+    if (numBands <= 1 || (long long) numRows * rowPixels < minPixels) {
+        rows(0, numRows);
+        return;
+    }
+
+    if (!pool)
+        pool = STThreadPool::GetShared();
+    pool->ParallelFor(numBands, [&](int band) {
+        int first = band * bandRows;
+        rows(first, STMin(first + bandRows, numRows));
+    });
+}
+
+#endif // __STPARALLEL_H__
@@ -0,0 +1,55 @@
+// core.frag
+
+#version 330 core
+
+/*
+  The fragment shader of STCoreRenderer: the Phong reflection model of
+  phong.frag with a color map, taking the light and material from
+  uniform blocks instead of the fixed-function state.
+*/
+
+// Set by the renderer once per frame.
+layout(std140) uniform STFrame {
+    mat4 projectionMatrix;
+    vec4 lightPosition;     // in eye space
+    vec4 lightAmbient;
+    vec4 lightDiffuse;
+    vec4 lightSpecular;
+};
+
+// Set by the renderer for each material.
+layout(std140) uniform STMaterial {
+    vec4 materialAmbient;
+    vec4 materialDiffuse;
+    vec4 materialSpecular;
+    float materialShininess;
+};
+
+uniform sampler2D colorTex;
+
+in vec3 modelPos;    // fragment position in eye space
+in vec3 normal;      // fragment normal in eye space
+in vec2 texPos;      // fragment position in texture space
+
+out vec4 fragColor;
+
+void main()
+{
+    vec3 N = normalize(normal);
+
+    vec3 textureColor = texture(colorTex, texPos).xyz;
+    vec3 ambient  = materialAmbient.xyz*textureColor;
+    vec3 diffuse  = materialDiffuse.xyz*textureColor;
+    vec3 specular = materialSpecular.xyz*textureColor;
+
+    vec3 Lm = normalize(lightPosition.xyz-modelPos);
+    vec3 Rm = normalize(reflect(-Lm,N));
+    vec3 V = normalize(-modelPos);
+
+    vec3 colorAmbient = ambient*lightAmbient.xyz;
+    vec3 colorDiffuse = clamp(max(dot(Lm,N),0.0)*diffuse*lightDiffuse.xyz,0.0,1.0);
+    vec3 colorSpecular = clamp(pow(max(dot(Rm,V),0.0),materialShininess)*specular*lightSpecular.xyz,0.0,1.0);
+
+    vec3 color = colorAmbient + colorDiffuse + colorSpecular;
+    fragColor = vec4(clamp(color, 0.0, 1.0), 1.0);
+}
@@ -0,0 +1,41 @@
+// core.vert
+
+#version 330 core
+
+/*
+  The vertex shader of STCoreRenderer, for OpenGL 3.3 core profile
+  contexts. It does what default.vert does without displacement,
+  taking the matrices from the renderer instead of the fixed-function
+  state, and the vertices from generic attributes.
+*/
+
+// Set by the renderer once per frame.
+layout(std140) uniform STFrame {
+    mat4 projectionMatrix;
+    vec4 lightPosition;     // in eye space
+    vec4 lightAmbient;
+    vec4 lightDiffuse;
+    vec4 lightSpecular;
+};
+
+// Set by the renderer for each mesh.
+uniform mat4 modelViewMatrix;
+uniform mat4 normalMatrix;
+
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 1) in vec3 vertexNormal;
+layout(location = 2) in vec2 vertexTexPos;
+
+out vec3 modelPos;    // position in eye space
+out vec3 normal;      // normal in eye space
+out vec2 texPos;
+
+void main()
+{
+    vec4 position = modelViewMatrix * vec4(vertexPosition, 1.0);
+    gl_Position = projectionMatrix * position;
+
+    modelPos = position.xyz;
+    normal = normalize((normalMatrix * vec4(vertexNormal, 0.0)).xyz);
+    texPos = vertexTexPos;
+}
@@ -6,20 +6,35 @@
   using the default OpenGL transformation. It also passes
   through the texture coordinate, normal coordinate, and some
   other good stuff so we can use them in the fragment shader.
+
+  Features, defined by the program variant in use:
+    DISPLACEMENT_MAPPING    displace the surface by displacementTex
+    DISPLACEMENT_GRADIENTS  displacementTex holds the height and its
+                            slopes, baked by STGradientMap
+    INSTANCING              place each instance drawn by STInstancedMesh
+                            with its own transform and diffuse color
 */
 
 // The input image we will be filtering in this kernel.
 uniform sampler2D displacementTex;
 
-uniform float displacementMapping;
 uniform float TesselationDepth;
 
+#ifdef INSTANCING
+// The transform and diffuse color of the instance being drawn.
+attribute mat4 instanceTransform;
+attribute vec4 instanceDiffuse;
+#endif
+
 // This 'varying' vertex output can be read as an input
 // by a fragment shader that makes the same declaration.
 varying vec3 modelPos;
 varying vec3 lightSourcePos;
 varying vec3 normal;
 varying vec2 texPos;
+#ifdef INSTANCING
+varying vec4 diffuseColor;
+#endif
 
 void main()
 {
@@ -31,20 +46,36 @@ void main()
     
     normal = gl_Normal.xyz;
 	modelPos = gl_Vertex.xyz;
+#ifdef INSTANCING
+    // Move the instance into place in the model.
+    modelPos = (instanceTransform * vec4(modelPos,1)).xyz;
+    normal = (instanceTransform * vec4(normal,0)).xyz;
+    diffuseColor = instanceDiffuse;
+#endif
     vec3 S=vec3(1,0,0);
     vec3 T=cross(S,normal);
-    if(displacementMapping > 0.0){
-        normal = normalize(normal);
-        float delta_uv=1.0/TesselationDepth;
-        float scale=0.5;
-        float center=texture2D(displacementTex, texPos).x*scale;
-        float hu_plus=texture2D(displacementTex, clamp(texPos+vec2(delta_uv,0),0.0,1.0)).x*scale;
-        float hu_minus=texture2D(displacementTex, clamp(texPos+vec2(-delta_uv,0),0.0,1.0)).x*scale;
-        float hv_plus=texture2D(displacementTex, clamp(texPos+vec2(0,delta_uv),0.0,1.0)).x*scale;
-        float hv_minus=texture2D(displacementTex, clamp(texPos+vec2(0,-delta_uv),0.0,1.0)).x*scale;
-        modelPos = modelPos + center*normal;
-        normal=normal-S*(hu_plus-hu_minus)/(2.0*delta_uv)-T*(hv_plus-hv_minus)/(2.0*delta_uv);
-    }//
+#ifdef DISPLACEMENT_MAPPING
+    normal = normalize(normal);
+    float delta_uv=1.0/TesselationDepth;
+    float scale=0.5;
+#ifdef DISPLACEMENT_GRADIENTS
+    // The texture holds the height and its central differences,
+    // baked on the CPU by STGradientMap, so one fetch is enough.
+    vec3 baked=texture2D(displacementTex, texPos).xyz;
+    float center=baked.x*scale;
+    vec2 diff=(baked.yz*65535.0-32768.0)/32767.0*scale;
+    modelPos = modelPos + center*normal;
+    normal=normal-S*diff.x/(2.0*delta_uv)-T*diff.y/(2.0*delta_uv);
+#else
+    float center=texture2D(displacementTex, texPos).x*scale;
+    float hu_plus=texture2D(displacementTex, clamp(texPos+vec2(delta_uv,0),0.0,1.0)).x*scale;
+    float hu_minus=texture2D(displacementTex, clamp(texPos+vec2(-delta_uv,0),0.0,1.0)).x*scale;
+    float hv_plus=texture2D(displacementTex, clamp(texPos+vec2(0,delta_uv),0.0,1.0)).x*scale;
+    float hv_minus=texture2D(displacementTex, clamp(texPos+vec2(0,-delta_uv),0.0,1.0)).x*scale;
+    modelPos = modelPos + center*normal;
+    normal=normal-S*(hu_plus-hu_minus)/(2.0*delta_uv)-T*(hv_plus-hv_minus)/(2.0*delta_uv);
+#endif
+#endif
     
     // Render the shape using modified position.
     gl_Position = gl_ProjectionMatrix * gl_ModelViewMatrix *  vec4(modelPos,1);
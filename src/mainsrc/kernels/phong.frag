@@ -2,34 +2,41 @@
 
 /*
   This fragment implements the Phong Reflection model.
+
+  Features, defined by the program variant in use:
+    NORMAL_MAPPING  take the normal from normalTex
+    COLOR_MAPPING   scale the material colors by colorTex
+    INSTANCING      take the diffuse color from the instance
 */
 
 // The input image we will be filtering in this kernel.
 uniform sampler2D normalTex;
 uniform sampler2D colorTex;
 
-uniform float normalMapping;
-uniform float colorMapping;
-
 varying vec3 modelPos;    // fragment position in model space
 varying vec2 texPos;      // fragment position in texture space
 varying vec3 lightSourcePos; // light source position in model space
 varying vec3 normal;	  // fragment normal in model space
+#ifdef INSTANCING
+varying vec4 diffuseColor; // diffuse color of the instance
+#endif
 
 void main()
 {
     // Sample from the normal map, if we're not doing displacement mapping
     vec3 N;
-	if (normalMapping > 0.0){
-        // convert a normal map to fit our plane
-        vec3 temp=(2.*texture2D(normalTex, texPos).xyz - 1.);
-        N = gl_NormalMatrix * vec3(temp.y,temp.z,temp.x);
+#ifdef NORMAL_MAPPING
+    // convert a normal map to fit our plane. The map holds x and y
+    // only, and z is rebuilt from the normal being unit length.
+    vec2 xy=2.*texture2D(normalTex, texPos).xy - 1.;
+    vec3 temp=vec3(xy, sqrt(max(1. - dot(xy, xy), 0.)));
+    N = gl_NormalMatrix * vec3(temp.y,temp.z,temp.x);
 
-        // use this code for regular normal mapping
-        //N = gl_NormalMatrix * (2.*texture2D(normalTex, texPos).xyz - 1.);
-    }
-	else
-		N = normal;
+    // use this code for regular normal mapping
+    //N = gl_NormalMatrix * (2.*texture2D(normalTex, texPos).xyz - 1.);
+#else
+    N = normal;
+#endif
     
     N=normalize(N);
     
@@ -42,16 +49,21 @@ void main()
 	vec3 materialAmbient;
 	vec3 materialDiffuse;
 	vec3 materialSpecular;
-	if(colorMapping < 0.0){
-		materialAmbient = gl_FrontMaterial.ambient.xyz;
-		materialDiffuse = gl_FrontMaterial.diffuse.xyz;
-		materialSpecular  = gl_FrontMaterial.specular.xyz;
-	}
-	else{
-		materialAmbient = gl_FrontMaterial.ambient.xyz*texture2D(colorTex, texPos).xyz;
-		materialDiffuse = gl_FrontMaterial.diffuse.xyz*texture2D(colorTex, texPos).xyz;
-		materialSpecular  = gl_FrontMaterial.specular.xyz*texture2D(colorTex, texPos).xyz;
-	}
+#ifdef INSTANCING
+	vec3 diffuse = diffuseColor.xyz;
+#else
+	vec3 diffuse = gl_FrontMaterial.diffuse.xyz;
+#endif
+#ifdef COLOR_MAPPING
+	vec3 textureColor = texture2D(colorTex, texPos).xyz;
+	materialAmbient = gl_FrontMaterial.ambient.xyz*textureColor;
+	materialDiffuse = diffuse*textureColor;
+	materialSpecular  = gl_FrontMaterial.specular.xyz*textureColor;
+#else
+	materialAmbient = gl_FrontMaterial.ambient.xyz;
+	materialDiffuse = diffuse;
+	materialSpecular  = gl_FrontMaterial.specular.xyz;
+#endif
     float shininess    = gl_FrontMaterial.shininess;
 
 	/* CS 148 TODO: Implement the Phong reflectance model here */
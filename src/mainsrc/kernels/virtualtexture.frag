@@ -0,0 +1,65 @@
+// virtualtexture.frag
+
+/*
+  Functions for sampling an STVirtualTexture. Load this file into a
+  program as a second fragment shader, and declare the functions in
+  the shader that calls them:
+
+    vec4 VirtualTexture(vec2 texPos);
+    vec4 VirtualTextureFeedback(vec2 texPos);
+
+  STVirtualTexture::SetUniforms() sets all of the uniforms below
+  except the two textures.
+*/
+
+uniform sampler2D vtPageTable;  // one texel per tile, at every level
+uniform sampler2D vtPool;       // the loaded tiles
+
+uniform vec2 vtScale;           // texture coordinates to page table coordinates
+uniform vec4 vtParams;          // page table size in tiles, log2(tile size),
+                                // pool size in tiles, coarsest level
+uniform vec2 vtTile;            // tile size and border, in pixels
+uniform float vtFeedbackBias;   // level bias for the small feedback buffer
+uniform vec2 vtFeedbackJitter;  // offset within a feedback pixel, this frame
+
+// Sample the color of the virtual texture.
+vec4 VirtualTexture(vec2 texPos)
+{
+    vec2 pos = texPos * vtScale;
+
+    // The page table has one texel per tile, so biasing it by the
+    // size of a tile makes the hardware pick the level that the
+    // image itself would use. Each entry holds the pool position
+    // and level of the tile to sample there.
+    vec3 entry = floor(texture2D(vtPageTable, pos, vtParams.y).xyz * 255.0 + 0.5);
+
+    // Find the position within that tile, then within the pool.
+    float tiles = vtParams.x / exp2(entry.z);
+    vec2 within = fract(pos * tiles);
+    float paddedTile = vtTile.x + 2.0 * vtTile.y;
+    vec2 poolPos = entry.xy * paddedTile + vtTile.y + within * vtTile.x;
+    return texture2D(vtPool, poolPos / (vtParams.z * paddedTile));
+}
+
+// Get the feedback color naming the tile this fragment needs: the
+// low 8 bits of its x and y in red and green, the high 4 bits of
+// each in blue, and its level plus one in alpha.
+vec4 VirtualTextureFeedback(vec2 texPos)
+{
+    vec2 pos = texPos * vtScale;
+    vec2 pixels = pos * vtParams.x * vtTile.x;
+    vec2 dx = dFdx(pixels);
+    vec2 dy = dFdy(pixels);
+
+    // Move to another spot of the window pixels this one covers.
+    pos += (dFdx(pos) * vtFeedbackJitter.x + dFdy(pos) * vtFeedbackJitter.y);
+
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0e-8)) + vtFeedbackBias;
+    float level = clamp(floor(lod), 0.0, vtParams.w);
+
+    float tiles = vtParams.x / exp2(level);
+    vec2 tile = clamp(floor(pos * tiles), 0.0, tiles - 1.0);
+    vec2 high = floor(tile / 256.0);
+    vec2 low = tile - high * 256.0;
+    return vec4(low, high.x + high.y * 16.0, level + 1.0) / 255.0;
+}
@@ -11,10 +11,14 @@
 //-------------------------------------------------------
 #include "stglew.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <map>
 #include <queue>
 #include "MySphere.h"
+#ifdef FREEGLUT
+#include <GL/freeglut_ext.h>
+#endif
 
 //--------------------------------------------------
 // Globals used by this application.
@@ -27,6 +31,19 @@
 static int gWindowSizeX = 0;
 static int gWindowSizeY = 0;
 
+// Screenshots are read back and written in the background,
+// from the next frame drawn after the 's' key is pressed.
+static STFrameGrabber* gFrameGrabber = NULL;
+static bool gScreenshotRequested = false;
+
+// The 'R' key records frames to data/images/frame00000.jpg, ...
+static STFrameRecorder* gFrameRecorder = NULL;
+
+// Frames are drawn only when the scene changed, at most 60 times
+// a second (or the rate given with --fps, where 0 means no limit).
+static STFrameScheduler gFrameScheduler(60.0f);
+static bool gFrameTimerPending = false;
+
 // File locations
 std::string vertexShader;
 std::string fragmentShader;
@@ -41,15 +58,39 @@ static float specularLight[] = {0.2, 0.2, 0.2, 1.0};
 float lightPosition[] = {-10.0f, -15.0f, 0.0f, 1.0f};
 
 
-// textures
-STImage   *surfaceNormImg;
-STTexture *surfaceNormTex;
-STImage   *surfaceDisplaceImg;
-STTexture *surfaceDisplaceTex;
+// textures (decoded images and mipmaps are cached on disk)
+STTexture    *surfaceNormTex;
+STTexture    *surfaceDisplaceTex;
+
+// The displacement map's heights and slopes, being baked on a
+// worker thread for the single-fetch path in default.vert.
+std::future<STImage*> displacementBake;
 
 // shaders
 STShaderProgram *shader;
 
+// The meshes to draw this frame, sorted to change state less often.
+STRenderQueue gRenderQueue;
+
+// The meshes of the model, merged to draw with a few calls.
+STMeshBatch gMeshBatch;
+
+// Copies of the model laid out on a grid, drawn with instancing.
+std::vector<STInstancedMesh*> gInstancedMeshes;
+const int kInstanceGridSize = 10;
+
+// Features of the shaders, compiled into variants for each texture mode.
+unsigned int gNormalMapping;
+unsigned int gColorMapping;
+unsigned int gDisplacementMapping;
+unsigned int gDisplacementGradients;
+unsigned int gInstancing;
+
+// With the --core option, the window has an OpenGL 3.3 core profile
+// context, and the meshes are drawn without the fixed-function state.
+bool gCoreProfile = false;
+STCoreRenderer* gCoreRenderer = NULL;
+
 
 // camera params
 STVector3 mPosition;
@@ -76,7 +117,8 @@ typedef enum {
 // mesh types
 typedef enum {
     Mesh                = 0,
-    Axis                = 1
+    Axis                = 1,
+    Instances           = 2
 }MeshType;
 
 // meshes and mesh states
@@ -101,12 +143,51 @@ std::queue<MeshType> meshQueue;
 void ClearGlobalMesh()
 {
     // remove the mesh
+    gMeshBatch.Clear();
+    if(gCoreRenderer)
+        gCoreRenderer->ForgetAll();
+    for(int id=0; id < (int)gInstancedMeshes.size();id++)
+        delete gInstancedMeshes[id];
     for(int id=0; id < (int)gTriangleMeshes.size();id++)
         delete gTriangleMeshes[id];
     if(gCoordAxisTriangleMesh != NULL)
         delete gCoordAxisTriangleMesh;
 }
 
+//
+// Copy the meshes into the buffers they are drawn from,
+// after they are loaded or changed.
+//
+void UpdateMeshBuffers()
+{
+    gMeshBatch.Build(gTriangleMeshes);
+    if(gCoreRenderer)
+        gCoreRenderer->ForgetAll();
+
+    for(int id=0; id < (int)gInstancedMeshes.size();id++)
+        delete gInstancedMeshes[id];
+    gInstancedMeshes.clear();
+
+    // a grid of copies of the model, tinted across the grid
+    STVector3 size_vector=gBoundingBox.second-gBoundingBox.first;
+    float spacing=1.2f*(std::max)((std::max)(size_vector.x,size_vector.y),size_vector.z);
+    float center=(kInstanceGridSize-1)*0.5f;
+    for(int id=0; id < (int)gTriangleMeshes.size(); id++) {
+        STInstancedMesh* instances = new STInstancedMesh(gTriangleMeshes[id]);
+        const float* diffuse = gTriangleMeshes[id]->mMaterialDiffuse;
+        for(int i=0; i < kInstanceGridSize; i++) {
+            for(int j=0; j < kInstanceGridSize; j++) {
+                STMatrix4 transform;
+                transform.EncodeT((i-center)*spacing, 0.0f, (j-center)*spacing);
+                float s=0.5f+0.5f*i/(kInstanceGridSize-1);
+                float t=0.5f+0.5f*j/(kInstanceGridSize-1);
+                instances->AddInstance(transform, STColor4f(diffuse[0]*s, diffuse[1], diffuse[2]*t, diffuse[3]));
+            }
+        }
+        gInstancedMeshes.push_back(instances);
+    }
+}
+
 
 
 void SetUpAndRight()
@@ -192,22 +273,68 @@ void Setup()
     // Set up lighting variables in OpenGL
     // Once we do this, we will be able to access them as built-in
     // attributes in the shader (see examples of this in normalmap.frag)
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
-    glLightfv(GL_LIGHT0, GL_SPECULAR,  specularLight);
-    glLightfv(GL_LIGHT0, GL_AMBIENT,   ambientLight);
-    glLightfv(GL_LIGHT0, GL_DIFFUSE,   diffuseLight);
-
-    surfaceNormImg = new STImage(normalMap);
-    surfaceNormTex = new STTexture(surfaceNormImg);
+    // The core profile has no such state, so the light is given to
+    // the core renderer instead, below.
+    if(!gCoreProfile) {
+        glEnable(GL_LIGHTING);
+        glEnable(GL_LIGHT0);
+        glLightfv(GL_LIGHT0, GL_SPECULAR,  specularLight);
+        glLightfv(GL_LIGHT0, GL_AMBIENT,   ambientLight);
+        glLightfv(GL_LIGHT0, GL_DIFFUSE,   diffuseLight);
+    }
 
-    surfaceDisplaceImg = new STImage(displacementMap);
-    surfaceDisplaceTex = new STTexture(surfaceDisplaceImg);
+    // Load the normal and displacement maps from their image caches
+    // on worker threads while the shaders and the mesh are loaded, so
+    // that the image files are only decoded when they change. The grid
+    // of vertices never changes, so the slopes of the displacement
+    // map are baked once, instead of taking finite differences of
+    // five texture fetches per vertex every frame. Normals only
+    // need two channels; phong.frag rebuilds the third.
+    STImage::LoadOptions normalOptions;
+    normalOptions.format = STImage::kRG8;
+    STTextureCache::Request(normalMap, normalOptions);
+    displacementBake = STThreadPool::GetShared()->Submit([]() {
+        STImage::LoadOptions options;
+        options.format = STImage::kR8;
+        STImageCache heights(displacementMap, options);
+        STImage heightMap(heights.GetWidth(), heights.GetHeight(), STImage::kR8,
+                          (void*) heights.GetData());
+        return STGradientMap::Bake(&heightMap, 1.0f / TesselationDepth);
+    });
+
+    // Frames are encoded on all but one of the hardware threads.
+    gFrameGrabber = new STFrameGrabber(8, 0);
+    gFrameRecorder = new STFrameRecorder(gFrameGrabber);
 
     shader = new STShaderProgram();
     shader->LoadVertexShader(vertexShader);
     shader->LoadFragmentShader(fragmentShader);
 
+    // Each texture mode runs its own variant of the shaders, with the
+    // code for the other modes compiled out. The texture units are the
+    // same for all of them.
+    gNormalMapping = shader->AddFeature("NORMAL_MAPPING");
+    gColorMapping = shader->AddFeature("COLOR_MAPPING");
+    gDisplacementMapping = shader->AddFeature("DISPLACEMENT_MAPPING");
+    gDisplacementGradients = shader->AddFeature("DISPLACEMENT_GRADIENTS");
+    gInstancing = shader->AddFeature("INSTANCING");
+    shader->SetTexture("normalTex", 0);
+    shader->SetTexture("displacementTex", 1);
+    shader->SetTexture("colorTex", 2);
+
+    // The core profile path draws with the color map only.
+    if(gCoreProfile) {
+        if(!STCoreRenderer::IsSupported()) {
+            printf("The core profile renderer needs OpenGL 3.3.\n");
+            exit(1);
+        }
+        STShaderProgram* coreShader = new STShaderProgram();
+        coreShader->LoadVertexShader("kernels/core.vert");
+        coreShader->LoadFragmentShader("kernels/core.frag");
+        gCoreRenderer = new STCoreRenderer(coreShader);
+        gCoreRenderer->SetLight(lightPosition, ambientLight, diffuseLight, specularLight);
+    }
+
     resetCamera();
 
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
@@ -222,15 +349,21 @@ void Setup()
     // load the mesh
     STTriangleMesh::LoadObj(gTriangleMeshes,meshOBJ);
 
+    // pack the color maps of the shapes into atlases, so that
+    // drawing the model switches textures as little as possible
+    STTextureAtlas::Build(gTriangleMeshes);
+
     // set bounding box
     if(gTriangleMeshes.size()) {
         meshType = MeshType::Mesh;
         meshQueue.push(MeshType::Axis);
+        meshQueue.push(MeshType::Instances);
         meshQueue.push(MeshType::Mesh);
         gMassCenter=STTriangleMesh::GetMassCenter(gTriangleMeshes);
         std::cout<<"Mass Center: "<<gMassCenter<<std::endl;
         gBoundingBox=STTriangleMesh::GetBoundingBox(gTriangleMeshes);
         std::cout<<"Bounding Box: "<<gBoundingBox.first<<" - "<<gBoundingBox.second<<std::endl;
+        UpdateMeshBuffers();
     }
     else {
         meshType = MeshType::Axis; // no mesh to draw in this case
@@ -238,6 +371,12 @@ void Setup()
         meshQueue.push(MeshType::Axis);
     }
     CreateYourOwnMesh();
+
+    // The textures must be created here, on the OpenGL thread.
+    surfaceNormTex = STTextureCache::Acquire(normalMap, normalOptions);
+    STImage* displacementGradients = displacementBake.get();
+    surfaceDisplaceTex = new STTexture(displacementGradients);
+    delete displacementGradients;
 }
 
 
@@ -287,17 +426,13 @@ void StrafeCamera(float delta_x, float delta_y)
 
 
 //----------------------------------------------------------------
-// Display the output image from our vertex and fragment shaders
+// Draw the scene with the fixed-function matrices and lights
 //-----------------------------------------------------------------
-void DisplayCallback()
+void DrawScene()
 {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 
-    SetUpAndRight();
-
     gluLookAt(mPosition.x,mPosition.y,mPosition.z,
               mLookAt.x,mLookAt.y,mLookAt.z,
               mUp.x,mUp.y,mUp.z);
@@ -305,86 +440,201 @@ void DisplayCallback()
     glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
 
     // Texture 0: surface normal map
-    glActiveTexture(GL_TEXTURE0);
+    STGLState::ActiveTexture(0);
     surfaceNormTex->Bind();
 
     // Texture 1: surface normal map
-    glActiveTexture(GL_TEXTURE1);
+    STGLState::ActiveTexture(1);
     surfaceDisplaceTex->Bind();
 
-    // Bind the textures we've loaded into openGl to
-    // the variable names we specify in the fragment
-    // shader.
-    shader->SetTexture("normalTex", 0);
-    shader->SetTexture("displacementTex", 1);
-      shader->SetTexture("colorTex", 2);
+    // Pick the variant of the shaders for what we're drawing.
+    unsigned int features = gColorMapping;
+    if(meshType == MeshType::Axis) {
+        if(textureType == TextureType::NormalMapping)
+            features = gNormalMapping;
+        else if(textureType == TextureType::DisplacementMapping)
+            features = gDisplacementMapping | gDisplacementGradients;
+    }
+    else if(meshType == MeshType::Instances && STInstancedMesh::HasInstancing()) {
+        features = gColorMapping | gInstancing;
+    }
+    STShaderProgram* program = shader->GetVariant(features);
 
     // Invoke the shader.  Now OpenGL will call our
     // shader programs on anything we draw.
-    shader->Bind();
+    program->Bind();
 
     if(meshType == MeshType::Mesh)
     {
-        shader->SetUniform("normalMapping", -1.0);
-        shader->SetUniform("displacementMapping", -1.0);
-        shader->SetUniform("colorMapping", 1.0);
-
         glPushMatrix();
         // Pay attention to scale
         STVector3 size_vector=gBoundingBox.second-gBoundingBox.first;
         float maxSize=(std::max)((std::max)(size_vector.x,size_vector.y),size_vector.z);
         glScalef(3.0f/maxSize,3.0f/maxSize,3.0f/maxSize);
         glTranslatef(-gMassCenter.x,-gMassCenter.y,-gMassCenter.z);
-        for(int id=0; id < (int)gTriangleMeshes.size(); id++) {
-                   gTriangleMeshes[id]->Draw(smooth);
+        gMeshBatch.Draw(smooth);
+        glPopMatrix();
+    }
+    else if(meshType == MeshType::Instances)
+    {
+        glPushMatrix();
+        // fit the whole grid in the view
+        STVector3 size_vector=gBoundingBox.second-gBoundingBox.first;
+        float maxSize=1.2f*kInstanceGridSize*(std::max)((std::max)(size_vector.x,size_vector.y),size_vector.z);
+        glScalef(3.0f/maxSize,3.0f/maxSize,3.0f/maxSize);
+        glTranslatef(-gMassCenter.x,-gMassCenter.y,-gMassCenter.z);
+        for(int id=0; id < (int)gInstancedMeshes.size(); id++) {
+            gInstancedMeshes[id]->Draw(smooth, program);
         }
         glPopMatrix();
     }
     else if(meshType == MeshType::Axis)
     {
-        // set up shader textures
-        if(textureType == TextureType::Color) {
-            shader->SetUniform("displacementMapping", -1.0);
-            shader->SetUniform("normalMapping", -1.0);
-            shader->SetUniform("colorMapping", 1.0);
-        }
-        else if(textureType == TextureType::NormalMapping){
-            shader->SetUniform("displacementMapping", -1.0);
-            shader->SetUniform("normalMapping", 1.0);
-            shader->SetUniform("colorMapping", -1.0);
-        }
-        else if(textureType == TextureType::DisplacementMapping){
-            shader->SetUniform("displacementMapping", 1.0);
-            shader->SetUniform("normalMapping", -1.0);
-            shader->SetUniform("colorMapping", -1.0);
-            shader->SetUniform("TesselationDepth", TesselationDepth);
-        }
+        // the displacement samples the map at the grid spacing
+        if(textureType == TextureType::DisplacementMapping)
+            program->SetUniform("TesselationDepth", TesselationDepth);
 
         // draw the geometry here
+        gRenderQueue.Clear();
         if(gCoordAxisTriangleMesh)
-            gCoordAxisTriangleMesh->Draw(smooth);
-        if(gTriangleMeshes.size()) {
-            for(unsigned int id=0;id<gTriangleMeshes.size();id++) {
-                gTriangleMeshes[id]->Draw(smooth);
-            }
+            gRenderQueue.Submit(gCoordAxisTriangleMesh);
+        for(unsigned int id=0;id<gTriangleMeshes.size();id++) {
+            gRenderQueue.Submit(gTriangleMeshes[id]);
         }
+        gRenderQueue.Execute(smooth);
     }
 
 
 
     // must bind the shader
-    shader->UnBind();
+    program->UnBind();
 
     // set textures
-    glActiveTexture(GL_TEXTURE0);
+    STGLState::ActiveTexture(0);
     surfaceNormTex->UnBind();
 
     // set textures
-    glActiveTexture(GL_TEXTURE1);
+    STGLState::ActiveTexture(1);
     surfaceDisplaceTex->UnBind();
+}
+
+
+
+//----------------------------------------------------------------
+// Draw the scene in a core profile context, with the matrices
+// kept here instead of in OpenGL. The meshes are drawn with their
+// color maps, and the instances view shows the model itself.
+//-----------------------------------------------------------------
+void DrawCoreScene()
+{
+    STMatrix4 view;
+    view.EncodeLookAt(mPosition, mLookAt, mUp);
+    gCoreRenderer->SetView(view);
+    gCoreRenderer->BeginFrame();
+
+    if(meshType == MeshType::Axis)
+    {
+        STMatrix4 identity;
+        identity.EncodeI();
+        if(gCoordAxisTriangleMesh)
+            gCoreRenderer->Draw(gCoordAxisTriangleMesh, identity, smooth);
+        for(unsigned int id=0;id<gTriangleMeshes.size();id++) {
+            gCoreRenderer->Draw(gTriangleMeshes[id], identity, smooth);
+        }
+    }
+    else
+    {
+        // Pay attention to scale
+        STVector3 size_vector=gBoundingBox.second-gBoundingBox.first;
+        float maxSize=(std::max)((std::max)(size_vector.x,size_vector.y),size_vector.z);
+        STMatrix4 scale, translate;
+        scale.EncodeS(3.0f/maxSize,3.0f/maxSize,3.0f/maxSize);
+        translate.EncodeT(-gMassCenter.x,-gMassCenter.y,-gMassCenter.z);
+        STMatrix4 model = scale * translate;
+        for(unsigned int id=0;id<gTriangleMeshes.size();id++) {
+            gCoreRenderer->Draw(gTriangleMeshes[id], model, smooth);
+        }
+    }
+
+    gCoreRenderer->EndFrame();
+}
+
+
+
+//----------------------------------------------------------------
+// Frame scheduling: redraw when the scene changed, instead of
+// from the idle callback, which keeps a core busy all the time.
+//-----------------------------------------------------------------
+void FrameTimerCallback(int value)
+{
+    gFrameTimerPending = false;
+    glutPostRedisplay();
+}
+
+// Ask GLUT for the next frame, once it is due.
+void ScheduleFrame()
+{
+    if (gFrameTimerPending)
+        return;
+
+    int wait = gFrameScheduler.GetMillisUntilNextFrame();
+    if (wait == 0) {
+        glutPostRedisplay();
+    }
+    else if (wait > 0) {
+        gFrameTimerPending = true;
+        glutTimerFunc(wait, FrameTimerCallback, 0);
+    }
+}
+
+// The scene changed and must be drawn again.
+void RequestRedraw()
+{
+    gFrameScheduler.Invalidate();
+    ScheduleFrame();
+}
+
+
+
+//----------------------------------------------------------------
+// Display the output image from our vertex and fragment shaders
+//-----------------------------------------------------------------
+void DisplayCallback()
+{
+    gFrameScheduler.BeginFrame();
+
+    // collect the screenshots taken in earlier frames
+    gFrameGrabber->Update();
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    SetUpAndRight();
+
+    if(gCoreProfile)
+        DrawCoreScene();
+    else
+        DrawScene();
+
+    // start reading back a screenshot before the frame is shown
+    if (gScreenshotRequested) {
+        gFrameGrabber->Capture("../../data/images/screenshot.jpg",
+                               0, 0, gWindowSizeX, gWindowSizeY);
+        gScreenshotRequested = false;
+    }
+    gFrameRecorder->RecordFrame(0, 0, gWindowSizeX, gWindowSizeY);
+
+    // count the state changes made and skipped this frame
+    STGLState::EndFrame();
 
     // swap buffers
     glutSwapBuffers();
+    gFrameScheduler.EndFrame();
+
+    // keep drawing while frames are recorded, or screenshots are
+    // still being read back
+    gFrameScheduler.SetAnimating(gFrameRecorder->IsRecording() ||
+                                 !gFrameGrabber->IsIdle());
+    ScheduleFrame();
 }
 
 
@@ -400,10 +650,17 @@ void ReshapeCallback(int w, int h)
 
     glViewport(0, 0, gWindowSizeX, gWindowSizeY);
 
-    glMatrixMode( GL_PROJECTION );
-    glLoadIdentity();
     // Set up a perspective projection
     float aspectRatio = (float) gWindowSizeX / (float) gWindowSizeY;
+    if(gCoreProfile) {
+        STMatrix4 projection;
+        projection.EncodePerspective(30.0f, aspectRatio, .1f, 10000.0f);
+        gCoreRenderer->SetProjection(projection);
+        return;
+    }
+
+    glMatrixMode( GL_PROJECTION );
+    glLoadIdentity();
     gluPerspective(30.0f, aspectRatio, .1f, 10000.0f);
 
     glMatrixMode(GL_MODELVIEW);
@@ -433,7 +690,7 @@ void SpecialKeyCallback(int key, int x, int y)
         default:
             break;
     }
-    glutPostRedisplay();
+    RequestRedraw();
 }
 
 
@@ -489,6 +746,7 @@ void MouseMotionCallback(int x, int y)
             ZoomCamera(deltaY);
         }
 
+        RequestRedraw();
     } else
     {
         gPreviousMouseX = x;
@@ -528,13 +786,41 @@ void KeyCallback(unsigned char key, int x, int y)
 
 
         // save a screen shot as data/images/screenshot.jpg
-        case 's': {
-            STImage* screenshot = new STImage(gWindowSizeX, gWindowSizeY);
-            screenshot->Read(0, 0);
-            screenshot->Save("../../data/images/screenshot.jpg");
-            delete screenshot;
+        case 's':
+            gScreenshotRequested = true;
+            break;
+
+        // start or stop recording frames as data/images/frame#####.jpg
+        case 'R':
+            if (gFrameRecorder->IsRecording()) {
+                gFrameRecorder->Stop();
+                std::cout << "Recorded " << gFrameRecorder->GetNumRecorded()
+                          << " frames (" << gFrameRecorder->GetNumDropped()
+                          << " dropped)" << std::endl;
+            }
+            else {
+                gFrameRecorder->Start("../../data/images/frame%05d.jpg");
+                std::cout << "Recording..." << std::endl;
+            }
+            break;
+
+        // report the OpenGL state changes made for the last frame
+        case 'g':
+            std::cout << "State changes: " << STGLState::GetNumIssued()
+                      << " made, " << STGLState::GetNumSkipped()
+                      << " skipped as redundant" << std::endl;
+            std::cout << "Draw calls: " << gMeshBatch.GetNumDrawCalls()
+                      << " for " << gMeshBatch.GetNumMeshes()
+                      << " meshes" << std::endl;
+            if (gFrameScheduler.GetElapsedMillis() > 0.0f) {
+                float elapsed = gFrameScheduler.GetElapsedMillis();
+                std::cout << "Frames: " << gFrameScheduler.GetNumFrames()
+                          << " in " << elapsed / 1000.0f << " s, idle "
+                          << 100.0f * (1.0f - gFrameScheduler.GetBusyMillis() / elapsed)
+                          << "% of the time" << std::endl;
+            }
+            gFrameScheduler.ResetStatistics();
             break;
-        }
 
         // reset the camera
         case 'r':
@@ -555,6 +841,7 @@ void KeyCallback(unsigned char key, int x, int y)
                 gTriangleMeshes = tempMesh;
                 gMassCenter=STTriangleMesh::GetMassCenter(gTriangleMeshes);
                 gBoundingBox=STTriangleMesh::GetBoundingBox(gTriangleMeshes);
+                UpdateMeshBuffers();
            }
 			meshType = MeshType::Mesh;
             break;
@@ -572,12 +859,14 @@ void KeyCallback(unsigned char key, int x, int y)
         case 'l':
             if(meshType == MeshType::Mesh) {
                 gTriangleMeshes[0]->LoopSubdivide();
+                UpdateMeshBuffers();
             }
             break;
 
         // texturemapping using a spherical proxy
          case 't':
             gTriangleMeshes[0]->CalculateTextureCoordinatesViaSphericalProxy();
+            UpdateMeshBuffers();
             break;
 
         // switch between smooth shading and flat shading
@@ -606,8 +895,10 @@ void KeyCallback(unsigned char key, int x, int y)
                 gCoordAxisTriangleMesh->mDrawAxis = !gCoordAxisTriangleMesh->mDrawAxis;
             break;
 
-        // quit
+        // quit, once any screenshots have been written
         case 'q':
+            delete gFrameRecorder;
+            delete gFrameGrabber;
             exit(0);
 
         default:
@@ -615,7 +906,7 @@ void KeyCallback(unsigned char key, int x, int y)
     }
 
     // redraw scene
-    glutPostRedisplay();
+    RequestRedraw();
 }
 
 
@@ -647,12 +938,35 @@ int main(int argc, char** argv)
     glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
     glutInitWindowPosition(20, 20);
     glutInitWindowSize(640, 480);
+
+    // --core asks for an OpenGL 3.3 core profile context, and
+    // --fps sets the most frames to draw per second
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--core") == 0)
+            gCoreProfile = true;
+        else if(strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+            gFrameScheduler.SetTargetFrameRate((float) atof(argv[++i]));
+    }
+    if(gCoreProfile) {
+#ifdef FREEGLUT
+        glutInitContextVersion(3, 3);
+        glutInitContextProfile(GLUT_CORE_PROFILE);
+#else
+        printf("This GLUT cannot create core profile contexts.\n");
+        gCoreProfile = false;
+#endif
+    }
     glutCreateWindow("proj1_mesh");
 
 
     // initialize GLEW.
 #ifndef __APPLE__
+    // GLEW looks up extensions in a way core profiles do not allow,
+    // so it must be told to load the entry points anyway.
+    if(gCoreProfile)
+        glewExperimental = GL_TRUE;
     glewInit();
+    glGetError();
     if(!GLEW_VERSION_2_0) {
         printf("Your graphics card or graphics driver does\n"
                "\tnot support OpenGL 2.0, trying ARB extensions\n");
@@ -677,7 +991,6 @@ int main(int argc, char** argv)
     glutKeyboardFunc(KeyCallback);
     glutMouseFunc(MouseCallback);
     glutMotionFunc(MouseMotionCallback);
-    glutIdleFunc(DisplayCallback);
 
     // run OpenGL mainloop
     glutMainLoop();